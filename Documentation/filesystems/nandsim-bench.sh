@@ -0,0 +1,234 @@
+#! /bin/sh
+# nandsim-bench.sh - compare yaffs2 and ubifs on a simulated NAND chip
+#
+# Each workload is run on a freshly loaded nandsim (drivers/mtd/nand),
+# formatted and mounted with the filesystem given, and the number of
+# pages nandsim read and programmed and blocks it erased meanwhile is
+# printed after the workload's own results:
+#
+#	mount	fill with <files> files, then time <passes> mounts; for ubifs
+#		the attach of the UBI device is timed apart from the mount,
+#		for yaffs2 a mount with no-checkpoint-read is timed as well
+#	seq	sequential write and read of a big file
+#	rand	random 4 kB overwrites with fdatasync(), as SQLite does
+#	meta	file creates, stats, renames and unlinks
+#	gc	rewrites of files on a filesystem 90% full
+#
+# The workloads other than mount are run by nandsim-load, which prints
+# their latency percentiles; build it from nandsim-load.c and put it in
+# $PATH or next to this script.  flash_eraseall (or flash_erase) and, for
+# ubifs, ubiattach, ubimkvol and ubidetach come from mtd-utils.
+#
+# The chip is one of these, or any four ID bytes given with -i:
+#
+#	64M-512		64 MB, 512 byte pages, 16 kB blocks
+#	128M		128 MB, 2 kB pages, 128 kB blocks
+#	256M		256 MB, 2 kB pages, 128 kB blocks (the default)
+#	512M		512 MB, 2 kB pages, 128 kB blocks
+#
+# -l sets the page read (access) and program times in microseconds and the
+# block erase time in milliseconds, which nandsim busy-waits for; the
+# default 25,200,2 is typical of SLC NAND, and -l 0 turns them off.
+#
+# Everything on the nandsim device is lost, and nandsim must not be loaded
+# already.  Run as root, for example:
+#
+#	nandsim-bench.sh -f yaffs2 /mnt
+#	nandsim-bench.sh -f ubifs /mnt
+#
+# Usage:
+#	nandsim-bench.sh [-f yaffs2|ubifs] [-g chip] [-i id,id,id,id]
+#			 [-l access,program,erase] [-w workload,...]
+#			 [-m MB] [-n ops] [-p passes] [-F files] dir
+
+set -e
+me=`basename $0`
+params=/sys/module/nandsim/parameters
+
+fs=yaffs2
+geometry=256M
+ids=
+latency=25,200,2
+workloads=mount,seq,rand,meta,gc
+mb=16
+ops=1000
+passes=3
+files=2000
+
+usage() {
+	echo "usage: $me [-f yaffs2|ubifs] [-g chip] [-i id,id,id,id]" 1>&2
+	echo "	[-l access,program,erase] [-w workload,...]" 1>&2
+	echo "	[-m MB] [-n ops] [-p passes] [-F files] dir" 1>&2
+	exit 1
+}
+
+while getopts f:g:i:l:w:m:n:p:F: opt; do
+	case $opt in
+	f) fs=$OPTARG ;;
+	g) geometry=$OPTARG ;;
+	i) ids=$OPTARG ;;
+	l) latency=$OPTARG ;;
+	w) workloads=$OPTARG ;;
+	m) mb=$OPTARG ;;
+	n) ops=$OPTARG ;;
+	p) passes=$OPTARG ;;
+	F) files=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift `expr $OPTIND - 1`
+test $# = 1 || usage
+dir=$1
+
+case $fs in
+yaffs2|ubifs) ;;
+*) usage ;;
+esac
+
+if test -z "$ids"; then
+	case $geometry in
+	64M-512)	ids=0xec,0x76,0x00,0x00 ;;
+	128M)		ids=0x20,0xf1,0x00,0x15 ;;
+	256M)		ids=0x20,0xda,0x00,0x15 ;;
+	512M)		ids=0x20,0xdc,0x00,0x15 ;;
+	*)		echo "$me: unknown chip $geometry" 1>&2; exit 1 ;;
+	esac
+fi
+set -- `echo $ids | tr , ' '`
+test $# = 4 || usage
+nandsim_opts="first_id_byte=$1 second_id_byte=$2 third_id_byte=$3"
+nandsim_opts="$nandsim_opts fourth_id_byte=$4"
+
+if test "$latency" = 0; then
+	nandsim_opts="$nandsim_opts do_delays=0"
+else
+	set -- `echo $latency | tr , ' '`
+	test $# = 3 || usage
+	nandsim_opts="$nandsim_opts do_delays=1 access_delay=$1"
+	nandsim_opts="$nandsim_opts programm_delay=$2 erase_delay=$3"
+fi
+
+load=`which nandsim-load 2>/dev/null || true`
+test -z "$load" && load=`dirname $0`/nandsim-load
+test -x "$load" || {
+	echo "$me: nandsim-load not found; build it from nandsim-load.c" 1>&2
+	exit 1
+}
+
+test -d $params && {
+	echo "$me: nandsim is already loaded" 1>&2
+	exit 1
+}
+
+now_ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+reset_counts() {
+	for c in read program erase; do
+		echo 0 > $params/${c}_count
+	done
+}
+
+print_counts() {
+	echo "nand: `cat $params/read_count` page reads," \
+	     "`cat $params/program_count` page programs," \
+	     "`cat $params/erase_count` block erases"
+}
+
+attach() {
+	test $fs = ubifs || return 0
+	ubiattach /dev/ubi_ctrl -m $mtd > /dev/null
+}
+
+detach() {
+	test $fs = ubifs || return 0
+	ubidetach /dev/ubi_ctrl -m $mtd > /dev/null
+}
+
+do_mount() {
+	if test $fs = ubifs; then
+		mount -t ubifs ubi0:bench $dir
+	else
+		mount -t yaffs2 ${1:+-o $1} /dev/mtdblock$mtd $dir
+	fi
+}
+
+# Load nandsim, and format and mount the filesystem on it
+setup() {
+	modprobe nandsim $nandsim_opts
+	mtd=`sed -n 's/^mtd\([0-9]*\): .*"NAND simulator.*/\1/p' /proc/mtd |
+		head -1`
+	test -n "$mtd" || {
+		echo "$me: no nandsim device in /proc/mtd" 1>&2
+		exit 1
+	}
+	flash_eraseall -q /dev/mtd$mtd 2>/dev/null ||
+		flash_erase -q /dev/mtd$mtd 0 0
+	if test $fs = ubifs; then
+		modprobe ubi 2>/dev/null || true
+		modprobe ubifs 2>/dev/null || true
+		attach
+		ubimkvol /dev/ubi0 -N bench -m > /dev/null
+	fi
+	do_mount
+}
+
+teardown() {
+	umount $dir
+	detach
+	rmmod nandsim
+}
+
+# Time <passes> mounts, each of them after an attach for ubifs
+time_mounts() {
+	local i t attach_ms=0 mount_ms=0
+
+	reset_counts
+	for i in `seq $passes`; do
+		t=`now_ms`
+		attach
+		attach_ms=$((attach_ms + `now_ms` - t))
+		t=`now_ms`
+		do_mount $1
+		mount_ms=$((mount_ms + `now_ms` - t))
+		umount $dir
+		detach
+	done
+	if test $fs = ubifs; then
+		echo "attach ${1:-$fs}: mean $((attach_ms / passes)) ms"
+	fi
+	echo "mount ${1:-$fs}: mean $((mount_ms / passes)) ms"
+	print_counts
+}
+
+mount_workload() {
+	$load -n $files files $dir
+	umount $dir
+	detach
+	time_mounts
+	test $fs = yaffs2 && time_mounts no-checkpoint-read
+	attach
+	do_mount
+}
+
+echo "$fs on nandsim $nandsim_opts"
+for w in `echo $workloads | tr , ' '`; do
+	echo
+	echo "== $w"
+	setup
+	case $w in
+	mount)
+		mount_workload
+		;;
+	seq|rand|meta|gc)
+		reset_counts
+		$load -m $mb -n $ops $w $dir
+		print_counts
+		;;
+	*)
+		echo "$me: unknown workload $w" 1>&2
+		;;
+	esac
+	teardown
+done
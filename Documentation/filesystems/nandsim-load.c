@@ -0,0 +1,400 @@
+/*
+ * nandsim-load.c - filesystem workloads with latency percentiles
+ *
+ * Runs one workload in <dir> and prints its throughput and the 50th,
+ * 90th, 99th and 99.9th percentile and maximum latency of its operations.
+ * It is meant to be run by nandsim-bench.sh on yaffs2 or ubifs on a
+ * simulated NAND chip, but works on any filesystem:
+ *
+ *	seq	write a <MB> MB file in 64 kB writes and fsync() it, then
+ *		drop it from the page cache and read it back
+ *	rand	<ops> random <KB> kB overwrites of a <MB> MB file, each
+ *		followed by fdatasync(), as a database does
+ *	meta	create <ops> small files in one directory, then stat,
+ *		rename and unlink each of them
+ *	gc	fill the filesystem to <fill> percent with 64 kB files,
+ *		then rewrite <ops> of them chosen at random, each with
+ *		fsync(), so that the writes wait for garbage collection
+ *	files	create <ops> files of <KB> kB in directories of 500 and
+ *		leave them, for mount time tests
+ *
+ * The latency of an operation is the time of the system calls that make
+ * it up: one write() or read() for seq, the pwrite() and fdatasync() for
+ * rand and gc, and the one call of each phase of meta.
+ *
+ * Usage:
+ *	nandsim-load [-m MB] [-n ops] [-s KB] [-f fill] workload dir
+ *
+ * Compile with: gcc -O2 -o nandsim-load nandsim-load.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#define SEQ_IO		(64 * 1024)
+#define GC_FILE		(64 * 1024)
+#define FILES_PER_DIR	500
+
+static long mb = 16, ops = 1000, kb = 4, fill = 90;
+static const char *dir;
+static char *buf;
+
+static long long *lat;
+static long nlat;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void lat_reset(long n)
+{
+	free(lat);
+	lat = malloc(n * sizeof(*lat));
+	if (!lat)
+		die("malloc");
+	nlat = 0;
+}
+
+static void lat_add(long long ns)
+{
+	lat[nlat++] = ns;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double pct(double p)
+{
+	long i = (long)(p / 100 * nlat);
+
+	if (i >= nlat)
+		i = nlat - 1;
+	return lat[i] / 1e3;
+}
+
+/* Print the percentiles of the latencies collected, in microseconds */
+static void lat_report(const char *name)
+{
+	if (!nlat)
+		return;
+	qsort(lat, nlat, sizeof(*lat), cmp_ll);
+	printf("%-8s %7ld ops  p50 %9.1f  p90 %9.1f  p99 %9.1f  "
+	       "p99.9 %9.1f  max %9.1f us\n", name, nlat,
+	       pct(50), pct(90), pct(99), pct(99.9), lat[nlat - 1] / 1e3);
+}
+
+static void path_of(char *path, const char *name, long i)
+{
+	snprintf(path, 256, "%s/%s%ld", dir, name, i);
+}
+
+static void seq(void)
+{
+	char path[256];
+	long long start, t, total;
+	long i, n = mb * 1024 * 1024 / SEQ_IO;
+	ssize_t r;
+	int fd;
+
+	path_of(path, "seq", 0);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die(path);
+	lat_reset(n);
+	start = now_ns();
+	for (i = 0; i < n; i++) {
+		t = now_ns();
+		if (write(fd, buf, SEQ_IO) != SEQ_IO)
+			die("write");
+		lat_add(now_ns() - t);
+	}
+	if (fsync(fd))
+		die("fsync");
+	total = now_ns() - start;
+	close(fd);
+	printf("seq write %8.2f MB/s\n", mb / (total / 1e9));
+	lat_report("write");
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die(path);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	lat_reset(n);
+	start = now_ns();
+	for (;;) {
+		t = now_ns();
+		r = read(fd, buf, SEQ_IO);
+		if (r < 0)
+			die("read");
+		if (r == 0)
+			break;
+		/* lat[] has room for n, one per 64 kB written */
+		if (nlat < n)
+			lat_add(now_ns() - t);
+	}
+	total = now_ns() - start;
+	close(fd);
+	unlink(path);
+	printf("seq read  %8.2f MB/s\n", mb / (total / 1e9));
+	lat_report("read");
+}
+
+static void rand_write(void)
+{
+	char path[256];
+	long long start, t;
+	long i, n = mb * 1024 * 1024 / SEQ_IO;
+	long size = kb * 1024, slots = mb * 1024 / kb;
+	int fd;
+
+	path_of(path, "rand", 0);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		die(path);
+	for (i = 0; i < n; i++)
+		if (write(fd, buf, SEQ_IO) != SEQ_IO)
+			die("write");
+	if (fsync(fd))
+		die("fsync");
+
+	lat_reset(ops);
+	start = now_ns();
+	for (i = 0; i < ops; i++) {
+		off_t off = (off_t)(random() % slots) * size;
+
+		t = now_ns();
+		if (pwrite(fd, buf, size, off) != size)
+			die("pwrite");
+		if (fdatasync(fd))
+			die("fdatasync");
+		lat_add(now_ns() - t);
+	}
+	t = now_ns() - start;
+	close(fd);
+	unlink(path);
+	printf("rand %ld kB  %8.1f ops/s\n", kb, ops / (t / 1e9));
+	lat_report("write");
+}
+
+static void meta(void)
+{
+	char path[256], path2[256];
+	struct stat st;
+	long long start, t;
+	long i;
+	int fd;
+
+	start = now_ns();
+
+	lat_reset(ops);
+	for (i = 0; i < ops; i++) {
+		path_of(path, "m", i);
+		t = now_ns();
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			die(path);
+		if (write(fd, buf, 100) != 100)
+			die("write");
+		close(fd);
+		lat_add(now_ns() - t);
+	}
+	lat_report("create");
+
+	lat_reset(ops);
+	for (i = 0; i < ops; i++) {
+		path_of(path, "m", random() % ops);
+		t = now_ns();
+		if (stat(path, &st))
+			die(path);
+		lat_add(now_ns() - t);
+	}
+	lat_report("stat");
+
+	lat_reset(ops);
+	for (i = 0; i < ops; i++) {
+		path_of(path, "m", i);
+		path_of(path2, "renamed", i);
+		t = now_ns();
+		if (rename(path, path2))
+			die(path);
+		lat_add(now_ns() - t);
+	}
+	lat_report("rename");
+
+	lat_reset(ops);
+	for (i = 0; i < ops; i++) {
+		path_of(path, "renamed", i);
+		t = now_ns();
+		if (unlink(path))
+			die(path);
+		lat_add(now_ns() - t);
+	}
+	lat_report("unlink");
+
+	sync();
+	t = now_ns() - start;
+	printf("meta %8.1f files/s\n", ops / (t / 1e9));
+}
+
+static void write_file(const char *path, long size, int do_fsync)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	long done, n;
+
+	if (fd < 0)
+		die(path);
+	for (done = 0; done < size; done += n) {
+		n = size - done < SEQ_IO ? size - done : SEQ_IO;
+		if (write(fd, buf, n) != n)
+			die(path);
+	}
+	if (do_fsync && fsync(fd))
+		die("fsync");
+	close(fd);
+}
+
+static void gc(void)
+{
+	char path[256];
+	struct statvfs sv;
+	long long start, t;
+	long i, nfiles;
+
+	if (statvfs(dir, &sv))
+		die(dir);
+	nfiles = (long)((double)sv.f_blocks * sv.f_frsize * fill / 100 -
+			(double)(sv.f_blocks - sv.f_bfree) * sv.f_frsize) /
+		 GC_FILE;
+	if (nfiles < 1) {
+		fprintf(stderr, "already more than %ld%% full\n", fill);
+		exit(1);
+	}
+	for (i = 0; i < nfiles; i++) {
+		path_of(path, "gc", i);
+		write_file(path, GC_FILE, 0);
+	}
+	sync();
+	printf("gc: %ld files of %d kB fill to %ld%%\n",
+	       nfiles, GC_FILE / 1024, fill);
+
+	lat_reset(ops);
+	start = now_ns();
+	for (i = 0; i < ops; i++) {
+		path_of(path, "gc", random() % nfiles);
+		t = now_ns();
+		write_file(path, GC_FILE, 1);
+		lat_add(now_ns() - t);
+	}
+	t = now_ns() - start;
+	printf("gc rewrite %8.2f MB/s\n",
+	       (double)ops * GC_FILE / (1 << 20) / (t / 1e9));
+	lat_report("rewrite");
+
+	for (i = 0; i < nfiles; i++) {
+		path_of(path, "gc", i);
+		unlink(path);
+	}
+	sync();
+}
+
+static void files(void)
+{
+	char path[256];
+	long i;
+
+	for (i = 0; i < ops; i++) {
+		if (i % FILES_PER_DIR == 0) {
+			snprintf(path, sizeof(path), "%s/d%ld", dir,
+				 i / FILES_PER_DIR);
+			mkdir(path, 0755);
+		}
+		snprintf(path, sizeof(path), "%s/d%ld/f%ld", dir,
+			 i / FILES_PER_DIR, i);
+		write_file(path, kb * 1024, 0);
+	}
+	sync();
+	printf("files: %ld of %ld kB\n", ops, kb);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-m MB] [-n ops] [-s KB] [-f fill] "
+		"seq|rand|meta|gc|files dir\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *workload;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:n:s:f:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mb = atol(optarg);
+			break;
+		case 'n':
+			ops = atol(optarg);
+			break;
+		case 's':
+			kb = atol(optarg);
+			break;
+		case 'f':
+			fill = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 2 != argc || mb < 1 || ops < 1 || kb < 1 ||
+	    kb * 1024 > SEQ_IO || fill < 1 || fill > 99)
+		usage(argv[0]);
+	workload = argv[optind];
+	dir = argv[optind + 1];
+
+	buf = malloc(SEQ_IO);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0x5a, SEQ_IO);
+	srandom(1);
+
+	if (!strcmp(workload, "seq"))
+		seq();
+	else if (!strcmp(workload, "rand"))
+		rand_write();
+	else if (!strcmp(workload, "meta"))
+		meta();
+	else if (!strcmp(workload, "gc"))
+		gc();
+	else if (!strcmp(workload, "files"))
+		files();
+	else
+		usage(argv[0]);
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * smaps-rollup-bench.c - time three ways of getting the PSS of all processes
+ *
+ *	smaps		read /proc/<pid>/smaps of every process and add up
+ *			the Pss lines, which is what is done without rollups
+ *	smaps_rollup	read /proc/<pid>/smaps_rollup of every process
+ *	rollup_all	read /proc/smaps_rollup_all in one call
+ *
+ * Each is run <passes> times and the CPU time (user and system) and wall
+ * time per pass are printed, with the total PSS that was seen as a check
+ * that the three agree, give or take processes that came and went.  Run
+ * as root to see all processes; /proc/smaps_rollup_all is only readable
+ * by root.
+ *
+ * Usage:
+ *	smaps-rollup-bench [passes]
+ *
+ * Compile with: gcc -O2 -o smaps-rollup-bench smaps-rollup-bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+/* see Documentation/filesystems/proc.txt */
+struct smaps_rollup_record {
+	uint32_t pid;
+	uint32_t reserved;
+	uint64_t rss;
+	uint64_t pss;
+	uint64_t shared_clean;
+	uint64_t shared_dirty;
+	uint64_t private_clean;
+	uint64_t private_dirty;
+	uint64_t referenced;
+	uint64_t swap;
+};
+
+#define MAX_PIDS	32768
+
+static int pids[MAX_PIDS];
+static int nr_pids;
+static char buf[1 << 16];
+
+static void list_pids(void)
+{
+	struct dirent *de;
+	DIR *dir = opendir("/proc");
+
+	if (!dir) {
+		perror("/proc");
+		exit(1);
+	}
+	nr_pids = 0;
+	while ((de = readdir(dir)) && nr_pids < MAX_PIDS)
+		if (isdigit(de->d_name[0]))
+			pids[nr_pids++] = atoi(de->d_name);
+	closedir(dir);
+}
+
+/* Sum the "Pss:" lines of a smaps style file, in kB */
+static long long sum_pss(const char *path)
+{
+	long long pss = 0;
+	char line[256];
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return 0;
+	setvbuf(f, buf, _IOFBF, sizeof(buf));
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, "Pss:", 4))
+			pss += atoll(line + 4);
+	fclose(f);
+	return pss;
+}
+
+static long long by_file(const char *name)
+{
+	char path[64];
+	long long pss = 0;
+	int i;
+
+	list_pids();
+	for (i = 0; i < nr_pids; i++) {
+		snprintf(path, sizeof(path), "/proc/%d/%s", pids[i], name);
+		pss += sum_pss(path);
+	}
+	return pss;
+}
+
+static long long by_smaps(void)
+{
+	return by_file("smaps");
+}
+
+static long long by_rollup(void)
+{
+	return by_file("smaps_rollup");
+}
+
+static long long by_rollup_all(void)
+{
+	static struct smaps_rollup_record rec[MAX_PIDS];
+	long long pss = 0;
+	ssize_t n;
+	int fd, i;
+
+	fd = open("/proc/smaps_rollup_all", O_RDONLY);
+	if (fd < 0)
+		return -1;
+	while ((n = read(fd, rec, sizeof(rec))) > 0)
+		for (i = 0; i < n / (ssize_t)sizeof(rec[0]); i++)
+			pss += rec[i].pss >> 10;
+	close(fd);
+	return pss;
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static double wall_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(const char *name, long long (*fn)(void), int passes)
+{
+	double cpu, wall;
+	long long pss = 0;
+	int i;
+
+	cpu = cpu_seconds();
+	wall = wall_seconds();
+	for (i = 0; i < passes; i++)
+		pss = fn();
+	cpu = (cpu_seconds() - cpu) / passes;
+	wall = (wall_seconds() - wall) / passes;
+
+	if (pss < 0) {
+		printf("%-14s not available\n", name);
+		return 0;
+	}
+	printf("%-14s cpu %9.3f ms  wall %9.3f ms  total pss %10lld kB\n",
+	       name, cpu * 1000, wall * 1000, pss);
+	return cpu;
+}
+
+int main(int argc, char *argv[])
+{
+	int passes = argc > 1 ? atoi(argv[1]) : 10;
+	double smaps, rollup, all;
+
+	if (passes < 1)
+		passes = 1;
+
+	list_pids();
+	printf("%d processes, %d passes\n", nr_pids, passes);
+
+	smaps = run("smaps", by_smaps, passes);
+	rollup = run("smaps_rollup", by_rollup, passes);
+	all = run("rollup_all", by_rollup_all, passes);
+
+	if (rollup > 0)
+		printf("smaps_rollup is %.1fx cheaper than smaps\n",
+		       smaps / rollup);
+	if (all > 0)
+		printf("rollup_all is %.1fx cheaper than smaps\n",
+		       smaps / all);
+	return 0;
+}
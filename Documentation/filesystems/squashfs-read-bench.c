@@ -0,0 +1,259 @@
+/*
+ * squashfs-read-bench.c - throughput of concurrent reads from squashfs
+ *
+ * The files given are cut into chunks of <KB> kB, and <threads> threads
+ * take the chunks in turn and read them, by faulting in each page of a
+ * mapping of the file as a starting application does, or with pread()
+ * if -r is given.  Before each pass the page cache is dropped through
+ * /proc/sys/vm/drop_caches, so every chunk is read from the device and
+ * decompressed.  This is done <passes> times for each number of threads
+ * given with -t, and the best throughput of each is printed with its
+ * speedup over the first.
+ *
+ * With one decompression stream per CPU, readers decompress different
+ * blocks at the same time, so on an SMP machine the throughput should
+ * grow with the threads up to the number of CPUs, where with a single
+ * stream it stays flat.  The chunks should be at least the block size of
+ * the filesystem, 128 kB by default, so that threads do not share blocks.
+ *
+ * Dropping the page cache needs root; if it cannot be done, the reads
+ * after the first pass come from the page cache.  For example:
+ *
+ *	mount -t squashfs -o loop system.img /mnt
+ *	squashfs-read-bench -t 1,2,4 `find /mnt/app /mnt/lib -type f`
+ *
+ * Usage:
+ *	squashfs-read-bench [-t threads,...] [-n passes] [-c KB] [-r] file...
+ *
+ * Compile with: gcc -O2 -pthread -o squashfs-read-bench squashfs-read-bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DROP_CACHES	"/proc/sys/vm/drop_caches"
+#define MAX_THREADS	64
+
+struct chunk {
+	int		file;
+	off_t		offset;
+	size_t		len;
+};
+
+static int nr_files;
+static int *fds;
+static char **maps;
+static struct chunk *chunks;
+static long nr_chunks, next_chunk;
+static long chunk_size = 128 * 1024;
+static long long total_bytes;
+static int use_read;
+static long page_size;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int drop_caches(void)
+{
+	int fd, ok;
+
+	sync();
+	fd = open(DROP_CACHES, O_WRONLY);
+	if (fd < 0)
+		return 0;
+	ok = write(fd, "3", 1) == 1;
+	close(fd);
+	return ok;
+}
+
+/* Cut the files into chunks, taken by the threads in this order */
+static void make_chunks(char **names)
+{
+	struct stat st;
+	off_t off;
+	int i;
+
+	fds = calloc(nr_files, sizeof(*fds));
+	maps = calloc(nr_files, sizeof(*maps));
+	if (!fds || !maps) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (i = 0; i < nr_files; i++) {
+		fds[i] = open(names[i], O_RDONLY);
+		if (fds[i] < 0 || fstat(fds[i], &st)) {
+			perror(names[i]);
+			exit(1);
+		}
+		if (st.st_size == 0)
+			continue;
+		maps[i] = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+			       fds[i], 0);
+		if (maps[i] == MAP_FAILED) {
+			perror(names[i]);
+			exit(1);
+		}
+		for (off = 0; off < st.st_size; off += chunk_size) {
+			chunks = realloc(chunks,
+					 (nr_chunks + 1) * sizeof(*chunks));
+			if (!chunks) {
+				perror("realloc");
+				exit(1);
+			}
+			chunks[nr_chunks].file = i;
+			chunks[nr_chunks].offset = off;
+			chunks[nr_chunks].len = st.st_size - off < chunk_size ?
+						st.st_size - off : chunk_size;
+			nr_chunks++;
+		}
+		total_bytes += st.st_size;
+	}
+}
+
+static void *reader(void *arg)
+{
+	char *buf = arg;
+	volatile char sink;
+	struct chunk *c;
+	size_t done;
+	long i;
+
+	while ((i = __sync_fetch_and_add(&next_chunk, 1)) < nr_chunks) {
+		c = &chunks[i];
+		if (use_read) {
+			if (pread(fds[c->file], buf, c->len, c->offset) < 0) {
+				perror("pread");
+				exit(1);
+			}
+			continue;
+		}
+		for (done = 0; done < c->len; done += page_size)
+			sink = maps[c->file][c->offset + done];
+	}
+	(void)sink;
+	return NULL;
+}
+
+static double run(int threads)
+{
+	pthread_t tid[MAX_THREADS];
+	char *bufs[MAX_THREADS];
+	long long start;
+	int i;
+
+	for (i = 0; i < threads; i++) {
+		bufs[i] = malloc(chunk_size);
+		if (!bufs[i]) {
+			perror("malloc");
+			exit(1);
+		}
+	}
+
+	next_chunk = 0;
+	start = now_ns();
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tid[i], NULL, reader, bufs[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	for (i = 0; i < threads; i++)
+		pthread_join(tid[i], NULL);
+	start = now_ns() - start;
+
+	for (i = 0; i < threads; i++)
+		free(bufs[i]);
+
+	return total_bytes / (1024.0 * 1024.0) / (start / 1e9);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t threads,...] [-n passes] [-c KB] "
+		"[-r] file...\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int threads[MAX_THREADS] = { 1, 2, 4 };
+	int nr_threads = 3, passes = 3, dropped = 1, opt, i, j;
+	double mbs, best, first = 0;
+	char *p;
+
+	while ((opt = getopt(argc, argv, "t:n:c:r")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = 0;
+			for (p = strtok(optarg, ","); p && nr_threads < MAX_THREADS;
+			     p = strtok(NULL, ","))
+				threads[nr_threads++] = atoi(p);
+			break;
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'c':
+			chunk_size = atol(optarg) * 1024;
+			break;
+		case 'r':
+			use_read = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || passes < 1 || chunk_size < 1 || !nr_threads)
+		usage(argv[0]);
+	for (i = 0; i < nr_threads; i++)
+		if (threads[i] < 1 || threads[i] > MAX_THREADS)
+			usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_files = argc - optind;
+	make_chunks(argv + optind);
+	if (!total_bytes) {
+		fprintf(stderr, "nothing to read\n");
+		return 1;
+	}
+
+	printf("%d files, %lld kB in %ld chunks of %ld kB, %s, "
+	       "best of %d\n", nr_files, total_bytes / 1024, nr_chunks,
+	       chunk_size / 1024, use_read ? "pread" : "page faults",
+	       passes);
+
+	for (i = 0; i < nr_threads; i++) {
+		best = 0;
+		for (j = 0; j < passes; j++) {
+			if (!drop_caches())
+				dropped = 0;
+			mbs = run(threads[i]);
+			if (mbs > best)
+				best = mbs;
+		}
+		if (!first)
+			first = best;
+		printf("threads %2d  %8.2f MB/s  x%.2f\n",
+		       threads[i], best, best / first);
+	}
+	if (!dropped)
+		printf("cannot write %s, reads were cached\n", DROP_CACHES);
+
+	return 0;
+}
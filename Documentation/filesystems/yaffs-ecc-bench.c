@@ -0,0 +1,319 @@
+/*
+ * yaffs-ecc-bench.c - check and time the yaffs software ECC
+ *
+ * fs/yaffs2/yaffs_ecc.c and drivers/mtd/nand/nand_ecc.c are built into
+ * this program as they are in the tree, next to a copy of the byte at a
+ * time yaffs_ECCCalculate() that the word at a time one replaced. First
+ * the three are checked against each other:
+ *
+ *	every value of every byte of a 256-byte block, on a zero block and
+ *	on a random one, and <blocks> random blocks, each also given at an
+ *	odd address; nand_calculate_ecc() gives the same bytes with the two
+ *	line parity bytes the other way round
+ *
+ *	on <blocks> / 100 random blocks, every single bit error in the data
+ *	and in the ECC is corrected by yaffs_ECCCorrect()
+ *
+ * Then each one is timed over <MB> megabytes of random data and its
+ * throughput printed.  Any mismatch is printed and the program exits
+ * with status 1 before timing anything.
+ *
+ * Usage:
+ *	yaffs-ecc-bench [-b blocks] [-m MB]
+ *
+ * Compile with, from this directory:
+ *	gcc -O2 -o yaffs-ecc-bench yaffs-ecc-bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+
+/* What yaffs_ecc.c needs from the kernel's yportenv.h, which is kept out */
+#define __YPORTENV_H__
+#define Y_INLINE inline
+typedef uint32_t __u32;
+
+#include "../../fs/yaffs2/yaffs_ecc.c"
+
+/* What nand_ecc.c needs from the MTD headers */
+#define STANDALONE
+#define uninitialized_var(x) x = x
+struct mtd_info {
+	void *priv;
+};
+struct nand_chip {
+	struct {
+		int size;
+	} ecc;
+};
+/* The kernel only defines __BIG_ENDIAN on big endian machines */
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+#undef __BIG_ENDIAN
+#endif
+
+#include "../../drivers/mtd/nand/nand_ecc.c"
+
+/* yaffs_ECCCalculate() as it was, a byte at a time */
+static void old_ecc_calculate(const unsigned char *data, unsigned char *ecc)
+{
+	unsigned int i;
+	unsigned char col_parity = 0;
+	unsigned char line_parity = 0;
+	unsigned char line_parity_prime = 0;
+	unsigned char t;
+	unsigned char b;
+
+	for (i = 0; i < 256; i++) {
+		b = column_parity_table[*data++];
+		col_parity ^= b;
+
+		if (b & 0x01) {
+			line_parity ^= i;
+			line_parity_prime ^= ~i;
+		}
+	}
+
+	ecc[2] = (~col_parity) | 0x03;
+
+	t = 0;
+	if (line_parity & 0x80)
+		t |= 0x80;
+	if (line_parity_prime & 0x80)
+		t |= 0x40;
+	if (line_parity & 0x40)
+		t |= 0x20;
+	if (line_parity_prime & 0x40)
+		t |= 0x10;
+	if (line_parity & 0x20)
+		t |= 0x08;
+	if (line_parity_prime & 0x20)
+		t |= 0x04;
+	if (line_parity & 0x10)
+		t |= 0x02;
+	if (line_parity_prime & 0x10)
+		t |= 0x01;
+	ecc[1] = ~t;
+
+	t = 0;
+	if (line_parity & 0x08)
+		t |= 0x80;
+	if (line_parity_prime & 0x08)
+		t |= 0x40;
+	if (line_parity & 0x04)
+		t |= 0x20;
+	if (line_parity_prime & 0x04)
+		t |= 0x10;
+	if (line_parity & 0x02)
+		t |= 0x08;
+	if (line_parity_prime & 0x02)
+		t |= 0x04;
+	if (line_parity & 0x01)
+		t |= 0x02;
+	if (line_parity_prime & 0x01)
+		t |= 0x01;
+	ecc[0] = ~t;
+}
+
+static struct nand_chip chip = { .ecc = { .size = 256 } };
+static struct mtd_info mtd = { .priv = &chip };
+
+static void nand_ecc_calculate(const unsigned char *data, unsigned char *ecc)
+{
+	unsigned char code[3];
+
+	nand_calculate_ecc(&mtd, data, code);
+	ecc[0] = code[1];
+	ecc[1] = code[0];
+	ecc[2] = code[2];
+}
+
+static int failures;
+
+static void check(const unsigned char *block, const char *what, int n)
+{
+	/* room to put the block at an odd address */
+	static uint32_t copy[65];
+	unsigned char *odd = (unsigned char *)copy + 1;
+	unsigned char old[3], new[3], nand[3], unaligned[3];
+
+	memcpy(odd, block, 256);
+	old_ecc_calculate(block, old);
+	yaffs_ECCCalculate(block, new);
+	yaffs_ECCCalculate(odd, unaligned);
+	nand_ecc_calculate(block, nand);
+
+	if (memcmp(old, new, 3) || memcmp(old, unaligned, 3) ||
+	    memcmp(old, nand, 3)) {
+		if (failures++ < 10)
+			printf("%s %d: old %02x%02x%02x new %02x%02x%02x "
+			       "unaligned %02x%02x%02x nand %02x%02x%02x\n",
+			       what, n, old[0], old[1], old[2],
+			       new[0], new[1], new[2],
+			       unaligned[0], unaligned[1], unaligned[2],
+			       nand[0], nand[1], nand[2]);
+	}
+}
+
+static void random_block(unsigned char *block)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		block[i] = random();
+}
+
+static void check_correction(const unsigned char *block, int n)
+{
+	unsigned char data[256], ecc[3], bad[3];
+	int bit;
+
+	yaffs_ECCCalculate(block, ecc);
+
+	for (bit = 0; bit < 256 * 8; bit++) {
+		memcpy(data, block, 256);
+		data[bit / 8] ^= 1 << (bit % 8);
+		yaffs_ECCCalculate(data, bad);
+		if (yaffs_ECCCorrect(data, ecc, bad) != 1 ||
+		    memcmp(data, block, 256)) {
+			if (failures++ < 10)
+				printf("block %d: data bit %d not corrected\n",
+				       n, bit);
+		}
+	}
+
+	for (bit = 0; bit < 3 * 8; bit++) {
+		/* the two low bits of ecc[2] are not used */
+		if (bit == 16 || bit == 17)
+			continue;
+		memcpy(data, block, 256);
+		memcpy(bad, ecc, 3);
+		bad[bit / 8] ^= 1 << (bit % 8);
+		if (yaffs_ECCCorrect(data, bad, ecc) != 1 ||
+		    memcmp(data, block, 256)) {
+			if (failures++ < 10)
+				printf("block %d: ecc bit %d not corrected\n",
+				       n, bit);
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name,
+		  void (*fn)(const unsigned char *, unsigned char *),
+		  const unsigned char *buf, long bytes, int passes)
+{
+	unsigned char ecc[3];
+	unsigned sum = 0;
+	double t;
+	long off;
+	int i;
+
+	t = now();
+	for (i = 0; i < passes; i++)
+		for (off = 0; off < bytes; off += 256) {
+			fn(buf + off, ecc);
+			sum += ecc[0] + ecc[1] + ecc[2];
+		}
+	t = now() - t;
+
+	printf("%-24s %8.1f MB/s  (%08x)\n", name,
+	       (double)bytes * passes / t / (1 << 20), sum);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char block[256];
+	long blocks = 100000, mb = 64, bytes, i;
+	int opt, pos, val;
+	unsigned char *buf;
+
+	while ((opt = getopt(argc, argv, "b:m:")) != -1) {
+		switch (opt) {
+		case 'b':
+			blocks = atol(optarg);
+			break;
+		case 'm':
+			mb = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b blocks] [-m MB]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || blocks < 1 || mb < 1) {
+		fprintf(stderr, "usage: %s [-b blocks] [-m MB]\n", argv[0]);
+		return 1;
+	}
+
+	srandom(1);
+
+	memset(block, 0, sizeof(block));
+	for (pos = 0; pos < 256; pos++) {
+		for (val = 0; val < 256; val++) {
+			block[pos] = val;
+			check(block, "zero block, offset", pos);
+		}
+		block[pos] = 0;
+	}
+
+	random_block(block);
+	for (pos = 0; pos < 256; pos++) {
+		unsigned char keep = block[pos];
+
+		for (val = 0; val < 256; val++) {
+			block[pos] = val;
+			check(block, "random block, offset", pos);
+		}
+		block[pos] = keep;
+	}
+
+	for (i = 0; i < blocks; i++) {
+		random_block(block);
+		check(block, "random block", i);
+	}
+
+	for (i = 0; i < blocks / 100 + 1; i++) {
+		random_block(block);
+		check_correction(block, i);
+	}
+
+	if (failures) {
+		printf("%d mismatches\n", failures);
+		return 1;
+	}
+	printf("%ld random blocks and all single bytes agree, "
+	       "single bit errors corrected\n", blocks);
+
+	/* 1 MB of random data, gone through <MB> times */
+	bytes = 1 << 20;
+	buf = malloc(bytes);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < bytes; i += 256)
+		random_block(buf + i);
+
+	bench("byte at a time (old)", old_ecc_calculate, buf, bytes, mb);
+	bench("yaffs_ECCCalculate", yaffs_ECCCalculate, buf, bytes, mb);
+	bench("nand_calculate_ecc", nand_ecc_calculate, buf, bytes, mb);
+
+	return 0;
+}
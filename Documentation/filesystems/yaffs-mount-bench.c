@@ -0,0 +1,276 @@
+/*
+ * yaffs-mount-bench.c - time yaffs2 mounts with and without a checkpoint
+ *
+ * The partition is first filled with <files> files of <KB> kB each, in
+ * a few directories, and unmounted.  Then it is mounted <passes> times
+ * in each of these ways, and the time the mount(2) call takes is printed:
+ *
+ *	checkpoint	a plain mount, which restores the checkpoint written
+ *			by the last unmount
+ *	scan		mounted with -o no-checkpoint-read, so every block is
+ *			scanned, as after an unclean shutdown, with the tags
+ *			read a block at a time and read ahead during the scan
+ *	scan-chunk	the same with yaffs_scan_ahead set to 0, so the tags
+ *			are read a chunk at a time as before
+ *
+ * Setting yaffs_scan_ahead needs /sys/module/yaffs/parameters, so it is
+ * skipped if that cannot be written.
+ *
+ * With -i, a file is then written on a plain mount and the program waits
+ * <seconds>, then reports whether yaffs has written a checkpoint by
+ * itself, as it does after yaffs_idle_checkpoint seconds without writes.
+ * A mount after a crash at that point would not have to scan.
+ *
+ * Everything on the partition is lost.  Run as root, on a nandsim device
+ * of each size to be compared, for example 128, 256 and 512MB:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xf1 \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	flash_eraseall /dev/mtd0
+ *	yaffs-mount-bench -f 2000 /dev/mtdblock0 /mnt
+ *	rmmod nandsim
+ *
+ * and again with second_id_byte=0xda and 0xdc.
+ *
+ * Usage:
+ *	yaffs-mount-bench [-n passes] [-f files] [-s KB] [-i seconds]
+ *			  device dir
+ *
+ * Compile with: gcc -O2 -o yaffs-mount-bench yaffs-mount-bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#define SCAN_AHEAD	"/sys/module/yaffs/parameters/yaffs_scan_ahead"
+#define FILES_PER_DIR	500
+
+static const char *device, *dir;
+static char mtd_name[64];
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Find the MTD name and size of /dev/mtdblockN in /proc/mtd */
+static long long mtd_info(void)
+{
+	char line[128], name[64];
+	unsigned long long size;
+	const char *p = device + strlen(device);
+	int n, want;
+	FILE *f;
+
+	while (p > device && p[-1] >= '0' && p[-1] <= '9')
+		p--;
+	want = atoi(p);
+
+	f = fopen("/proc/mtd", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "mtd%d: %llx %*x \"%63[^\"]\"",
+			   &n, &size, name) == 3 && n == want) {
+			strcpy(mtd_name, name);
+			fclose(f);
+			return size;
+		}
+	fclose(f);
+	return -1;
+}
+
+/* Read a field of our device's section of /proc/yaffs */
+static long proc_yaffs(const char *field)
+{
+	char line[128], name[80];
+	size_t len = strlen(field);
+	int ours = 0;
+	long val = -1;
+	FILE *f = fopen("/proc/yaffs", "r");
+
+	if (!f)
+		return -1;
+	snprintf(name, sizeof(name), "\"%s\"", mtd_name);
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Device ", 7))
+			ours = strstr(line, name) != NULL;
+		else if (ours && !strncmp(line, field, len) &&
+			 line[len] == '.') {
+			val = atol(line + strcspn(line, " ") + 1);
+			break;
+		}
+	}
+	fclose(f);
+	return val;
+}
+
+static int set_scan_ahead(int on)
+{
+	int fd = open(SCAN_AHEAD, O_WRONLY);
+	int ok;
+
+	if (fd < 0)
+		return 0;
+	ok = write(fd, on ? "1" : "0", 1) == 1;
+	close(fd);
+	return ok;
+}
+
+static long long do_mount(const char *opts)
+{
+	long long start = now_ns();
+
+	if (mount(device, dir, "yaffs2", 0, opts)) {
+		perror("mount");
+		exit(1);
+	}
+	return now_ns() - start;
+}
+
+static void do_umount(void)
+{
+	if (umount(dir)) {
+		perror("umount");
+		exit(1);
+	}
+}
+
+static void write_file(const char *path, const char *buf, long kb)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	long i;
+
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	for (i = 0; i < kb; i++)
+		if (write(fd, buf, 1024) != 1024) {
+			perror(path);
+			exit(1);
+		}
+	close(fd);
+}
+
+static void fill(long files, long kb)
+{
+	char path[256], buf[1024];
+	long i;
+
+	memset(buf, 0x5a, sizeof(buf));
+	do_mount(NULL);
+	for (i = 0; i < files; i++) {
+		if (i % FILES_PER_DIR == 0) {
+			snprintf(path, sizeof(path), "%s/d%ld", dir,
+				 i / FILES_PER_DIR);
+			mkdir(path, 0755);
+		}
+		snprintf(path, sizeof(path), "%s/d%ld/f%ld", dir,
+			 i / FILES_PER_DIR, i);
+		write_file(path, buf, kb);
+	}
+	sync();
+	do_umount();
+}
+
+static void run(const char *name, const char *opts, int passes)
+{
+	long long ns, min = -1, sum = 0;
+	int i;
+
+	for (i = 0; i < passes; i++) {
+		ns = do_mount(opts);
+		do_umount();
+		sum += ns;
+		if (min < 0 || ns < min)
+			min = ns;
+	}
+	printf("%-12s mean %9.1f ms  min %9.1f ms\n",
+	       name, sum / passes / 1e6, min / 1e6);
+}
+
+static void idle_test(int seconds)
+{
+	char path[256], buf[1024];
+
+	memset(buf, 0x5a, sizeof(buf));
+	do_mount(NULL);
+	snprintf(path, sizeof(path), "%s/idle-test", dir);
+	write_file(path, buf, 64);
+	printf("\nwrote a file; checkpointed %ld\n",
+	       proc_yaffs("isCheckpointed"));
+	sleep(seconds);
+	printf("after %d s idle; checkpointed %ld\n", seconds,
+	       proc_yaffs("isCheckpointed"));
+	unlink(path);
+	do_umount();
+}
+
+int main(int argc, char *argv[])
+{
+	long files = 1000, kb = 16;
+	int passes = 5, idle = 0, opt;
+	long long size;
+
+	while ((opt = getopt(argc, argv, "n:f:s:i:")) != -1) {
+		switch (opt) {
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'f':
+			files = atol(optarg);
+			break;
+		case 's':
+			kb = atol(optarg);
+			break;
+		case 'i':
+			idle = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n passes] [-f files] "
+				"[-s KB] [-i seconds] device dir\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind + 2 != argc || passes < 1) {
+		fprintf(stderr, "usage: %s [-n passes] [-f files] "
+			"[-s KB] [-i seconds] device dir\n", argv[0]);
+		return 1;
+	}
+	device = argv[optind];
+	dir = argv[optind + 1];
+
+	size = mtd_info();
+	if (size > 0)
+		printf("%s: \"%s\", %lld MB\n", device, mtd_name, size >> 20);
+
+	printf("writing %ld files of %ld kB\n", files, kb);
+	fill(files, kb);
+	printf("%d mounts each\n", passes);
+
+	run("checkpoint", NULL, passes);
+	run("scan", "no-checkpoint-read", passes);
+	if (set_scan_ahead(0)) {
+		run("scan-chunk", "no-checkpoint-read", passes);
+		set_scan_ahead(1);
+	}
+
+	if (idle)
+		idle_test(idle);
+
+	return 0;
+}
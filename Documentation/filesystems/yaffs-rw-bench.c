@@ -0,0 +1,422 @@
+/*
+ * yaffs-rw-bench.c - latency of readers on a yaffs2 mount while others write
+ *
+ * A set of small files is created in <dir>, then reader threads run
+ * alongside writer threads for a while:
+ *
+ *	readers	pick a file at random, drop its pages from the page cache
+ *		with posix_fadvise(POSIX_FADV_DONTNEED) and read it back, so
+ *		that every read goes to yaffs_readpage(); then stat() another
+ *		file by name
+ *	writers	each rewrite a file of their own, in 64kB writes with an
+ *		fsync() after each MB, so that the partition fills up with
+ *		dirty blocks and garbage collection has to run
+ *
+ * With -D, dentries are dropped every <ms> milliseconds through
+ * /proc/sys/vm/drop_caches so that the stat()s turn into yaffs_lookup()
+ * calls rather than dcache hits; that needs root.
+ *
+ * The latency distribution of reads, lookups and writes and the write
+ * bandwidth are printed, with how much time yaffs spent in foreground and
+ * background garbage collection, from /proc/yaffs, summed over all yaffs
+ * mounts.  Run it once with -w 0 for the readers' baseline, then with
+ * writers, on kernels with and without finer grained yaffs locking, or
+ * with and without background gc:
+ *	echo 0 > /sys/module/yaffs/parameters/yaffs_bg_gc
+ * which takes effect at the next mount.
+ *
+ * A nandsim device is enough, for example:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	mount -t yaffs2 /dev/mtdblock0 /mnt
+ *	yaffs-rw-bench -r 4 -w 1 -D 100 /mnt
+ *
+ * The default write size is a third of the space free when the test
+ * starts, so that the writers keep reusing blocks.
+ *
+ * Usage:
+ *	yaffs-rw-bench [-r readers] [-w writers] [-t seconds] [-n files]
+ *		       [-m MB] [-D ms] dir
+ *
+ * Compile with: gcc -O2 -pthread -o yaffs-rw-bench yaffs-rw-bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#define FILE_SIZE	(16 * 1024)
+#define WRITE_SIZE	(64 * 1024)
+#define MAX_SAMPLES	(1 << 20)
+
+struct samples {
+	long long *ns;
+	long n;
+};
+
+struct reader {
+	pthread_t thread;
+	unsigned int seed;
+	struct samples reads;
+	struct samples lookups;
+};
+
+struct writer {
+	pthread_t thread;
+	int id;
+	long long bytes;
+	struct samples writes;
+};
+
+static const char * const gc_counters[] = {
+	"garbageCollections",
+	"backgroundGCs",
+	"foregroundGCTime",
+	"backgroundGCTime",
+};
+#define NR_GC_COUNTERS	(sizeof(gc_counters) / sizeof(gc_counters[0]))
+
+static const char *dir;
+static int nr_files = 256;
+static long write_mb = -1;
+static volatile int stop;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_sample(struct samples *s, long long ns)
+{
+	if (s->n < MAX_SAMPLES)
+		s->ns[s->n++] = ns;
+}
+
+static void file_name(char *buf, size_t len, int i)
+{
+	snprintf(buf, len, "%s/rwbench-%04d", dir, i);
+}
+
+static void create_files(void)
+{
+	char name[4096], buf[FILE_SIZE];
+	int i, fd;
+
+	memset(buf, 0x5a, sizeof(buf));
+	for (i = 0; i < nr_files; i++) {
+		file_name(name, sizeof(name), i);
+		fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(name);
+			exit(1);
+		}
+		close(fd);
+	}
+	sync();
+}
+
+static void remove_files(void)
+{
+	char name[4096];
+	int i;
+
+	for (i = 0; i < nr_files; i++) {
+		file_name(name, sizeof(name), i);
+		unlink(name);
+	}
+}
+
+static void *reader(void *arg)
+{
+	struct reader *r = arg;
+	char name[4096], buf[FILE_SIZE];
+	struct stat st;
+	long long start;
+	int fd;
+
+	while (!stop) {
+		file_name(name, sizeof(name), rand_r(&r->seed) % nr_files);
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			perror(name);
+			exit(1);
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		start = now_ns();
+		if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+			perror(name);
+			exit(1);
+		}
+		add_sample(&r->reads, now_ns() - start);
+		close(fd);
+
+		file_name(name, sizeof(name), rand_r(&r->seed) % nr_files);
+		start = now_ns();
+		if (stat(name, &st)) {
+			perror(name);
+			exit(1);
+		}
+		add_sample(&r->lookups, now_ns() - start);
+	}
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	struct writer *w = arg;
+	char name[4096];
+	char *buf = malloc(WRITE_SIZE);
+	long long off;
+	int fd;
+
+	snprintf(name, sizeof(name), "%s/rwbench-writer-%d", dir, w->id);
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || !buf) {
+		perror(name);
+		exit(1);
+	}
+	memset(buf, w->id + 1, WRITE_SIZE);
+
+	while (!stop) {
+		for (off = 0; !stop && off < (write_mb << 20); off += WRITE_SIZE) {
+			long long start = now_ns();
+
+			if (pwrite(fd, buf, WRITE_SIZE, off) != WRITE_SIZE) {
+				if (errno == ENOSPC)
+					break;
+				perror("write");
+				exit(1);
+			}
+			add_sample(&w->writes, now_ns() - start);
+			w->bytes += WRITE_SIZE;
+			if (!((off + WRITE_SIZE) & ((1 << 20) - 1)))
+				fsync(fd);
+		}
+		fsync(fd);
+	}
+	close(fd);
+	unlink(name);
+	free(buf);
+	return NULL;
+}
+
+static void drop_dentries(void)
+{
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+
+	if (fd < 0 || write(fd, "2", 1) != 1) {
+		perror("/proc/sys/vm/drop_caches");
+		exit(1);
+	}
+	close(fd);
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sum the yaffs gc counters in /proc/yaffs over all mounts */
+static void read_gc_counters(unsigned long long *val)
+{
+	char line[128];
+	unsigned int i;
+	FILE *f = fopen("/proc/yaffs", "r");
+
+	memset(val, 0, NR_GC_COUNTERS * sizeof(*val));
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		for (i = 0; i < NR_GC_COUNTERS; i++) {
+			size_t len = strlen(gc_counters[i]);
+
+			if (!strncmp(line, gc_counters[i], len) &&
+			    line[len] == '.')
+				val[i] += strtoull(line + len +
+						   strspn(line + len, ". "),
+						   NULL, 10);
+		}
+	fclose(f);
+}
+
+/* Print the distribution of the samples that are nr * stride bytes apart */
+static void report(const char *what, struct samples *first, size_t stride,
+		   int nr, int secs)
+{
+	struct samples all, *s;
+	long long sum = 0;
+	long i;
+	int t;
+
+	all.n = 0;
+	for (t = 0; t < nr; t++) {
+		s = (struct samples *)((char *)first + t * stride);
+		all.n += s->n;
+	}
+	if (!all.n)
+		return;
+	all.ns = malloc(all.n * sizeof(*all.ns));
+	if (!all.ns) {
+		perror("malloc");
+		exit(1);
+	}
+	all.n = 0;
+	for (t = 0; t < nr; t++) {
+		s = (struct samples *)((char *)first + t * stride);
+		memcpy(all.ns + all.n, s->ns, s->n * sizeof(*s->ns));
+		all.n += s->n;
+	}
+
+	qsort(all.ns, all.n, sizeof(*all.ns), cmp_ll);
+	for (i = 0; i < all.n; i++)
+		sum += all.ns[i];
+	printf("%-6s %8ld ops %8.0f/s  mean %8lld us  p50 %7lld  p99 %7lld  "
+	       "max %7lld\n", what, all.n, (double)all.n / secs,
+	       sum / all.n / 1000, all.ns[all.n / 2] / 1000,
+	       all.ns[all.n * 99 / 100] / 1000, all.ns[all.n - 1] / 1000);
+	free(all.ns);
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_readers = 4, nr_writers = 1, secs = 30, drop_ms = 0, opt, i;
+	unsigned long long before[NR_GC_COUNTERS], after[NR_GC_COUNTERS];
+	struct reader *readers;
+	struct writer *writers;
+	long long bytes = 0, end;
+	struct statvfs sv;
+
+	while ((opt = getopt(argc, argv, "r:w:t:n:m:D:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'w':
+			nr_writers = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'n':
+			nr_files = atoi(optarg);
+			break;
+		case 'm':
+			write_mb = atol(optarg);
+			break;
+		case 'D':
+			drop_ms = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || nr_readers < 1 || nr_writers < 0 ||
+	    secs < 1 || nr_files < 1)
+		goto usage;
+	dir = argv[optind];
+
+	create_files();
+
+	if (write_mb < 0) {
+		if (statvfs(dir, &sv)) {
+			perror(dir);
+			return 1;
+		}
+		write_mb = (long long)sv.f_bavail * sv.f_bsize / 3 >> 20;
+		if (nr_writers)
+			write_mb /= nr_writers;
+		if (write_mb < 1)
+			write_mb = 1;
+	}
+
+	printf("%d readers, %d writers of %ld MB each, %d files, %d s",
+	       nr_readers, nr_writers, write_mb, nr_files, secs);
+	if (drop_ms)
+		printf(", dentries dropped every %d ms", drop_ms);
+	printf("\n");
+
+	readers = calloc(nr_readers, sizeof(*readers));
+	writers = calloc(nr_writers ? nr_writers : 1, sizeof(*writers));
+	if (!readers || !writers) {
+		perror("calloc");
+		return 1;
+	}
+	read_gc_counters(before);
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].id = i;
+		writers[i].writes.ns = malloc(MAX_SAMPLES * sizeof(long long));
+		if (!writers[i].writes.ns) {
+			perror("malloc");
+			return 1;
+		}
+		pthread_create(&writers[i].thread, NULL, writer, &writers[i]);
+	}
+	for (i = 0; i < nr_readers; i++) {
+		readers[i].seed = i + 1;
+		readers[i].reads.ns = malloc(MAX_SAMPLES * sizeof(long long));
+		readers[i].lookups.ns = malloc(MAX_SAMPLES * sizeof(long long));
+		if (!readers[i].reads.ns || !readers[i].lookups.ns) {
+			perror("malloc");
+			return 1;
+		}
+		pthread_create(&readers[i].thread, NULL, reader, &readers[i]);
+	}
+
+	end = now_ns() + secs * 1000000000LL;
+	while (now_ns() < end) {
+		if (drop_ms) {
+			usleep(drop_ms * 1000);
+			drop_dentries();
+		} else {
+			sleep(1);
+		}
+	}
+	stop = 1;
+
+	for (i = 0; i < nr_readers; i++)
+		pthread_join(readers[i].thread, NULL);
+	for (i = 0; i < nr_writers; i++) {
+		pthread_join(writers[i].thread, NULL);
+		bytes += writers[i].bytes;
+	}
+
+	read_gc_counters(after);
+
+	report("read", &readers[0].reads, sizeof(*readers), nr_readers, secs);
+	report("lookup", &readers[0].lookups, sizeof(*readers), nr_readers,
+	       secs);
+	if (nr_writers) {
+		report("write", &writers[0].writes, sizeof(*writers),
+		       nr_writers, secs);
+		printf("write  %8.2f MB/s\n",
+		       (double)bytes / secs / (1 << 20));
+	}
+	for (i = 0; i < (int)NR_GC_COUNTERS; i++)
+		printf("%-20s %12llu\n", gc_counters[i], after[i] - before[i]);
+
+	remove_files();
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-r readers] [-w writers] [-t seconds] "
+		"[-n files] [-m MB] [-D ms] dir\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,271 @@
+/*
+ * yaffs-seq-bench.c - sequential read and write throughput of a big file
+ *
+ * A file of <MB> megabytes is written to <dir> in <KB> kB pieces, once
+ * with write(2) and fsync() and once through a shared mapping and
+ * msync().  Its pages are then dropped from the page cache with
+ * posix_fadvise(POSIX_FADV_DONTNEED) and it is read back through
+ * readahead.  This is done <passes> times for each value of
+ * yaffs_batch_pages given with -b, and the best throughput of each is
+ * printed:
+ *
+ *	yaffs_batch_pages 16	readpages and writepages handle up to 16
+ *				pages under one taking of the yaffs locks,
+ *				and read chunks that are next to each other
+ *				on NAND in one MTD call
+ *	yaffs_batch_pages 0	a page at a time through readpage and
+ *				writepage
+ *
+ * yaffs writes data through to NAND as write(2) copies it in, without
+ * leaving dirty pages behind, so only the mmap writes go through
+ * writeback; yaffs_batch_pages makes no difference to the write(2)
+ * figure, which is printed for comparison.
+ *
+ * Setting yaffs_batch_pages needs /sys/module/yaffs/parameters; if it
+ * cannot be written, only the current setting is measured.  The file
+ * should fit in the free space with room to spare, or garbage collection
+ * will be timed as well.  A nandsim device is enough, for example:
+ *
+ *	modprobe nandsim first_id_byte=0x20 second_id_byte=0xaa \
+ *		third_id_byte=0x00 fourth_id_byte=0x15
+ *	mount -t yaffs2 /dev/mtdblock0 /mnt
+ *	yaffs-seq-bench -m 64 /mnt
+ *
+ * Usage:
+ *	yaffs-seq-bench [-n passes] [-m MB] [-s KB] [-b batch,...] dir
+ *
+ * Compile with: gcc -O2 -o yaffs-seq-bench yaffs-seq-bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define BATCH_PAGES	"/sys/module/yaffs/parameters/yaffs_batch_pages"
+#define MAX_BATCHES	8
+
+static char path[256];
+static char *buf;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int get_batch(void)
+{
+	char val[16];
+	int fd = open(BATCH_PAGES, O_RDONLY);
+	int n;
+
+	if (fd < 0)
+		return -1;
+	n = read(fd, val, sizeof(val) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	val[n] = '\0';
+	return atoi(val);
+}
+
+static int set_batch(int batch)
+{
+	char val[16];
+	int fd = open(BATCH_PAGES, O_WRONLY);
+	int n, ok;
+
+	if (fd < 0)
+		return 0;
+	n = snprintf(val, sizeof(val), "%d", batch);
+	ok = write(fd, val, n) == n;
+	close(fd);
+	return ok;
+}
+
+static double write_file(long mb, long kb)
+{
+	long long start;
+	long i, n = mb * 1024 / kb;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	start = now_ns();
+	for (i = 0; i < n; i++)
+		if (write(fd, buf, kb * 1024) != kb * 1024) {
+			perror("write");
+			exit(1);
+		}
+	if (fsync(fd)) {
+		perror("fsync");
+		exit(1);
+	}
+	start = now_ns() - start;
+	close(fd);
+	return mb / (start / 1e9);
+}
+
+static double mmap_write_file(long mb, long kb)
+{
+	long long start;
+	long i, n = mb * 1024 / kb;
+	char *map;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	if (ftruncate(fd, n * kb * 1024)) {
+		perror("ftruncate");
+		exit(1);
+	}
+	map = mmap(NULL, n * kb * 1024, PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	start = now_ns();
+	for (i = 0; i < n; i++)
+		memcpy(map + i * kb * 1024, buf, kb * 1024);
+	if (msync(map, n * kb * 1024, MS_SYNC)) {
+		perror("msync");
+		exit(1);
+	}
+	start = now_ns() - start;
+	munmap(map, n * kb * 1024);
+	close(fd);
+	return mb / (start / 1e9);
+}
+
+static double read_file(long mb, long kb)
+{
+	long long start;
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	start = now_ns();
+	while ((n = read(fd, buf, kb * 1024)) > 0)
+		;
+	if (n < 0) {
+		perror("read");
+		exit(1);
+	}
+	start = now_ns() - start;
+	close(fd);
+	return mb / (start / 1e9);
+}
+
+static void run(int batch, int passes, long mb, long kb)
+{
+	double w, m, r, best_w = 0, best_m = 0, best_r = 0;
+	int i;
+
+	for (i = 0; i < passes; i++) {
+		w = write_file(mb, kb);
+		unlink(path);
+		m = mmap_write_file(mb, kb);
+		r = read_file(mb, kb);
+		if (w > best_w)
+			best_w = w;
+		if (m > best_m)
+			best_m = m;
+		if (r > best_r)
+			best_r = r;
+		unlink(path);
+	}
+	printf("batch %2d  write %7.2f  mmap write %7.2f  read %7.2f MB/s\n",
+	       batch, best_w, best_m, best_r);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n passes] [-m MB] [-s KB] "
+		"[-b batch,...] dir\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int batches[MAX_BATCHES] = { 16, 0 };
+	int nr_batches = 2, passes = 3, saved, opt, i;
+	long mb = 32, kb = 64;
+	char *p;
+
+	while ((opt = getopt(argc, argv, "n:m:s:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'm':
+			mb = atol(optarg);
+			break;
+		case 's':
+			kb = atol(optarg);
+			break;
+		case 'b':
+			nr_batches = 0;
+			for (p = strtok(optarg, ",");
+			     p && nr_batches < MAX_BATCHES;
+			     p = strtok(NULL, ","))
+				batches[nr_batches++] = atoi(p);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc || passes < 1 || mb < 1 || kb < 1)
+		usage(argv[0]);
+
+	snprintf(path, sizeof(path), "%s/yaffs-seq-bench.tmp", argv[optind]);
+	buf = malloc(kb * 1024);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+	memset(buf, 0x5a, kb * 1024);
+
+	printf("%ld MB in %ld kB writes and reads, best of %d\n",
+	       mb, kb, passes);
+
+	saved = get_batch();
+	if (saved < 0) {
+		printf("cannot read %s, measuring as is\n", BATCH_PAGES);
+		run(-1, passes, mb, kb);
+		return 0;
+	}
+	for (i = 0; i < nr_batches; i++) {
+		if (!set_batch(batches[i])) {
+			printf("cannot write %s, measuring as is\n",
+			       BATCH_PAGES);
+			run(saved, passes, mb, kb);
+			break;
+		}
+		run(batches[i], passes, mb, kb);
+	}
+	set_batch(saved);
+
+	return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * pmem-trace.c - replay an allocation trace against a pmem device
+ *
+ * Every allocation is a file descriptor of the device with a region
+ * allocated by the PMEM_ALLOCATE ioctl; closing it frees the region.  The
+ * time each allocate and free takes is measured, and at the end the
+ * latency distribution, the number of failed allocations and the
+ * allocator's fragmentation statistics from debugfs are printed.
+ *
+ * A trace has one operation per line:
+ *	a <slot> <bytes>	allocate <bytes> into <slot>
+ *	f <slot>		free the allocation in <slot>
+ * Lines starting with '#' are ignored.  Without a trace file a synthetic
+ * camera/video workload is run instead: a few large frame buffers that
+ * live long, preview and encoder buffers that are reallocated often, and
+ * many small short-lived buffers in between.
+ *
+ * With -l, a child process keeps dirtying that many MB of anonymous
+ * memory meanwhile.  On a device backed by a contiguous memory area (see
+ * Documentation/vm/cma.txt) those pages end up in the area and have to be
+ * migrated out for allocations, which is the slow case.
+ *
+ * Usage:
+ *	pmem-trace [-l MB] <device> [trace file]
+ *
+ * e.g.
+ *	mount -t debugfs none /sys/kernel/debug
+ *	pmem-trace /dev/pmem_adsp
+ *	pmem-trace -l 64 /dev/pmem_camera
+ *
+ * Compile with: gcc -O2 -o pmem-trace pmem-trace.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* from include/linux/android_pmem.h */
+struct pmem_region {
+	unsigned long offset;
+	unsigned long len;
+};
+
+#define PMEM_IOCTL_MAGIC	'p'
+#define PMEM_GET_SIZE		_IOW(PMEM_IOCTL_MAGIC, 3, unsigned int)
+#define PMEM_ALLOCATE		_IOW(PMEM_IOCTL_MAGIC, 5, unsigned int)
+
+#define MAX_SLOTS	1024
+#define SYNTH_OPS	100000
+
+static const char *device;
+static int slot_fd[MAX_SLOTS];
+static long long *alloc_ns, *free_ns;
+static long nr_allocs, nr_frees, nr_fails;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void do_alloc(int slot, unsigned long len)
+{
+	struct pmem_region region;
+	long long start;
+	int fd;
+
+	if (slot < 0 || slot >= MAX_SLOTS || slot_fd[slot] >= 0)
+		return;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+
+	start = now_ns();
+	ioctl(fd, PMEM_ALLOCATE, len);
+	alloc_ns[nr_allocs++] = now_ns() - start;
+
+	/* a failed allocation is not reported by the ioctl itself */
+	if (ioctl(fd, PMEM_GET_SIZE, &region) || !region.len) {
+		nr_fails++;
+		close(fd);
+		return;
+	}
+	slot_fd[slot] = fd;
+}
+
+static void do_free(int slot)
+{
+	long long start;
+
+	if (slot < 0 || slot >= MAX_SLOTS || slot_fd[slot] < 0)
+		return;
+
+	start = now_ns();
+	close(slot_fd[slot]);
+	free_ns[nr_frees++] = now_ns() - start;
+	slot_fd[slot] = -1;
+}
+
+static void replay(FILE *trace)
+{
+	char line[128];
+	unsigned long len;
+	int slot;
+
+	while (fgets(line, sizeof(line), trace)) {
+		if (sscanf(line, "a %d %lu", &slot, &len) == 2)
+			do_alloc(slot, len);
+		else if (sscanf(line, "f %d", &slot) == 1)
+			do_free(slot);
+	}
+}
+
+static unsigned long synth_size(unsigned int r)
+{
+	switch (r % 16) {
+	case 0:
+		return 3 * 1024 * 1024;		/* 2048x1536 frame */
+	case 1:
+	case 2:
+		return 640 * 480 * 3 / 2;	/* VGA preview, YUV 4:2:0 */
+	case 3:
+	case 4:
+	case 5:
+		return 320 * 240 * 3 / 2;	/* thumbnails, encoder input */
+	default:
+		return 4096 << (r / 16 % 5);	/* bitstream, 4k to 64k */
+	}
+}
+
+static void synthetic(void)
+{
+	unsigned int seed = 1, r;
+	int i, slot, live = 0, nr_slots = 256;
+
+	for (i = 0; i < SYNTH_OPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		r = seed >> 8;
+		slot = r % nr_slots;
+		/* large frames stay around, everything else churns */
+		if (slot_fd[slot] >= 0) {
+			if (slot < 8 && r % 64)
+				continue;
+			do_free(slot);
+			live--;
+		} else if (live < nr_slots * 3 / 4) {
+			do_alloc(slot, synth_size(r >> 8));
+			live += slot_fd[slot] >= 0;
+		}
+	}
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *what, long long *ns, long n)
+{
+	long long sum = 0;
+	long i;
+
+	if (!n)
+		return;
+	qsort(ns, n, sizeof(*ns), cmp_ll);
+	for (i = 0; i < n; i++)
+		sum += ns[i];
+	printf("%-8s %8ld ops  mean %6lld ns  p50 %6lld  p99 %6lld  max %6lld\n",
+	       what, n, sum / n, ns[n / 2], ns[n * 99 / 100], ns[n - 1]);
+}
+
+/* Keep touching mb MB of anonymous memory until killed */
+static pid_t start_load(long mb)
+{
+	long len = mb << 20, i;
+	unsigned char *p;
+	pid_t pid;
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	p = malloc(len);
+	if (!p)
+		exit(1);
+	for (;;)
+		for (i = 0; i < len; i += 4096)
+			p[i]++;
+}
+
+static void cat(const char *dir, const char *name)
+{
+	char path[256], buf[4096];
+	size_t n;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/kernel/debug/%s/%s", dir, name);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	printf("\n%s:\n", path);
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, n, stdout);
+	fclose(f);
+}
+
+static void report_stats(void)
+{
+	char *name = strdup(device);
+
+	cat("pmem_stats", basename(name));
+	cat("cma", basename(name));
+	free(name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct rlimit rl = { MAX_SLOTS + 16, MAX_SLOTS + 16 };
+	FILE *trace;
+	long max_ops, load_mb = 0;
+	pid_t load = 0;
+	int i;
+
+	if (argc > 2 && !strcmp(argv[1], "-l")) {
+		load_mb = atol(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s [-l MB] <device> [trace file]\n",
+			argv[0]);
+		return 1;
+	}
+	device = argv[1];
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	for (i = 0; i < MAX_SLOTS; i++)
+		slot_fd[i] = -1;
+
+	/* each line is at most one operation */
+	max_ops = SYNTH_OPS;
+	if (argc > 2) {
+		trace = fopen(argv[2], "r");
+		if (!trace) {
+			perror(argv[2]);
+			return 1;
+		}
+		max_ops = 0;
+		while ((i = fgetc(trace)) != EOF)
+			max_ops += i == '\n';
+		rewind(trace);
+	}
+	alloc_ns = calloc(max_ops + 1, sizeof(*alloc_ns));
+	free_ns = calloc(max_ops + 1, sizeof(*free_ns));
+	if (!alloc_ns || !free_ns) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (load_mb) {
+		load = start_load(load_mb);
+		/* let it fault its memory in */
+		sleep(2);
+	}
+
+	if (argc > 2) {
+		replay(trace);
+		fclose(trace);
+	} else {
+		synthetic();
+	}
+
+	if (load) {
+		kill(load, SIGKILL);
+		waitpid(load, NULL, 0);
+	}
+
+	printf("%ld of %ld allocations failed\n", nr_fails, nr_allocs);
+	report("alloc", alloc_ns, nr_allocs);
+	report("free", free_ns, nr_frees);
+	report_stats();
+
+	for (i = 0; i < MAX_SLOTS; i++)
+		if (slot_fd[i] >= 0)
+			close(slot_fd[i]);
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * sched-group-latency.c - interactive versus batch benchmark for the
+ * per-group CFS latency targets (cpu.sched_*_ns cgroup attributes).
+ *
+ * A number of CPU-bound batch tasks are placed in one cpu cgroup and a
+ * single interactive task, which sleeps for a fixed period and then does
+ * a little work, is placed in another.  The interactive task records how
+ * late each wakeup actually got to run and prints a latency summary.
+ *
+ * Usage:
+ *	sched-group-latency <fg cgroup dir> <bg cgroup dir> [nr_batch]
+ *			    [period_us] [work_us] [seconds]
+ *
+ * e.g.
+ *	mount -t cgroup -ocpu none /dev/cpuctl
+ *	mkdir /dev/cpuctl/fg /dev/cpuctl/bg
+ *	echo 2000000 > /dev/cpuctl/fg/cpu.sched_latency_ns
+ *	echo 250000 > /dev/cpuctl/fg/cpu.sched_wakeup_granularity_ns
+ *	echo 20000000 > /dev/cpuctl/bg/cpu.sched_latency_ns
+ *	sched-group-latency /dev/cpuctl/fg /dev/cpuctl/bg 8
+ *
+ * Run it once with the group attributes at 0 and once with them set to
+ * compare.
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_SAMPLES	100000
+
+static long long samples[MAX_SAMPLES];
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void join_cgroup(const char *dir)
+{
+	char path[256];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/tasks", dir);
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(f, "%d\n", getpid());
+	fclose(f);
+}
+
+static void spin_ns(long long ns)
+{
+	long long end = now_ns() + ns;
+
+	while (now_ns() < end)
+		;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	int nr_batch = 4, period_us = 10000, work_us = 1000, seconds = 10;
+	long long start, expected, lat, sum = 0;
+	struct timespec ts;
+	pid_t *batch;
+	int i, n = 0;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <fg cgroup> <bg cgroup> [nr_batch] "
+			"[period_us] [work_us] [seconds]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3)
+		nr_batch = atoi(argv[3]);
+	if (argc > 4)
+		period_us = atoi(argv[4]);
+	if (argc > 5)
+		work_us = atoi(argv[5]);
+	if (argc > 6)
+		seconds = atoi(argv[6]);
+
+	batch = calloc(nr_batch, sizeof(*batch));
+	for (i = 0; i < nr_batch; i++) {
+		batch[i] = fork();
+		if (batch[i] < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!batch[i]) {
+			join_cgroup(argv[2]);
+			for (;;)
+				;
+		}
+	}
+
+	join_cgroup(argv[1]);
+	/* let the batch tasks settle into their group first */
+	sleep(1);
+
+	start = now_ns();
+	while (n < MAX_SAMPLES && now_ns() - start < seconds * 1000000000LL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = period_us * 1000L;
+		expected = now_ns() + ts.tv_nsec;
+		nanosleep(&ts, NULL);
+		lat = now_ns() - expected;
+		samples[n++] = lat > 0 ? lat : 0;
+		spin_ns(work_us * 1000LL);
+	}
+
+	for (i = 0; i < nr_batch; i++)
+		kill(batch[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+
+	if (!n)
+		return 1;
+
+	qsort(samples, n, sizeof(samples[0]), cmp_ll);
+	for (i = 0; i < n; i++)
+		sum += samples[i];
+
+	printf("batch tasks:  %d\n", nr_batch);
+	printf("wakeups:      %d\n", n);
+	printf("avg latency:  %lld us\n", sum / n / 1000);
+	printf("50%% latency:  %lld us\n", samples[n / 2] / 1000);
+	printf("90%% latency:  %lld us\n", samples[n * 9 / 10] / 1000);
+	printf("99%% latency:  %lld us\n", samples[n * 99 / 100] / 1000);
+	printf("max latency:  %lld us\n", samples[n - 1] / 1000);
+
+	return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ * compaction-test.c - fragment memory, then make high-order allocations
+ *
+ * First memory is fragmented: two anonymous mappings are faulted in page
+ * by page, alternately, so that their pages end up interleaved in physical
+ * memory, and then one of them is unmapped.  That leaves half of it free,
+ * but in single pages between pages that are in use.  Optionally a file is
+ * written as well so that there is page cache around for reclaim to take.
+ *
+ * Then the kernel is made to allocate high-order pages: every AF_UNIX
+ * datagram that is queued holds a kmalloc()ed buffer of its size, which
+ * is sized here to need an allocation of the requested order.  Datagrams
+ * are sent into and received from a set of socket pairs at random, so
+ * that up to <allocs> such buffers are held at a time.  The time each
+ * send takes is measured, which is the time the allocation took.
+ *
+ * At the end the latency distribution and the number of failed
+ * allocations are printed, with how much the compaction and reclaim
+ * counters in /proc/vmstat moved, how much page cache was lost, and
+ * /proc/extfrag_index before and after.  Compare a kernel with
+ * CONFIG_COMPACTION=n, which uses lumpy reclaim instead, or the same
+ * kernel with compaction kept from running:
+ *	echo 1000 > /proc/sys/vm/extfrag_threshold
+ *
+ * Usage:
+ *	compaction-test [-o order] [-n allocs] [-m MB] [-f MB] [-C]
+ *
+ *	-o	allocation order, default 3
+ *	-n	allocations held at most, default 256
+ *	-m	memory to fragment, default half of MemFree
+ *	-f	page cache to create in the current directory, default 0
+ *	-C	compact all memory through /proc/sys/vm/compact_memory before
+ *		allocating
+ *
+ * Compile with: gcc -O2 -o compaction-test compaction-test.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define OPS_PER_ALLOC	40
+#define TMPFILE		"compaction-test.tmp"
+
+static const char * const counters[] = {
+	"compact_stall",
+	"compact_success",
+	"compact_fail",
+	"compact_pages_moved",
+	"compact_pagemigrate_failed",
+	"compact_daemon_wake",
+	"allocstall",
+	"pgscan_direct_",
+	"pgsteal_",
+};
+#define NR_COUNTERS	(sizeof(counters) / sizeof(counters[0]))
+
+static long page_size;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Read a /proc/meminfo field, in kB */
+static long meminfo(const char *field)
+{
+	char line[128];
+	long val = -1;
+	size_t len = strlen(field);
+	FILE *f = fopen("/proc/meminfo", "r");
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, field, len) && line[len] == ':') {
+			val = atol(line + len + 1);
+			break;
+		}
+	fclose(f);
+	return val;
+}
+
+/* Counters ending in '_' are summed over zones */
+static void read_vmstat(unsigned long long *val)
+{
+	char name[64];
+	unsigned long long v;
+	unsigned int i;
+	FILE *f = fopen("/proc/vmstat", "r");
+
+	memset(val, 0, NR_COUNTERS * sizeof(*val));
+	if (!f)
+		return;
+	while (fscanf(f, "%63s %llu", name, &v) == 2)
+		for (i = 0; i < NR_COUNTERS; i++) {
+			size_t len = strlen(counters[i]);
+
+			if (counters[i][len - 1] == '_' ?
+			    !strncmp(name, counters[i], len) :
+			    !strcmp(name, counters[i]))
+				val[i] += v;
+		}
+	fclose(f);
+}
+
+static void cat(const char *path)
+{
+	char buf[4096];
+	size_t n;
+	FILE *f = fopen(path, "r");
+
+	if (!f) {
+		printf("%s: not available\n", path);
+		return;
+	}
+	printf("%s:\n", path);
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		fwrite(buf, 1, n, stdout);
+	fclose(f);
+}
+
+static void make_cache(long mb)
+{
+	char *buf = malloc(1 << 20);
+	long i;
+	int fd;
+
+	fd = open(TMPFILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || !buf) {
+		perror(TMPFILE);
+		exit(1);
+	}
+	memset(buf, 0x5a, 1 << 20);
+	for (i = 0; i < mb; i++)
+		if (write(fd, buf, 1 << 20) != 1 << 20) {
+			perror("write");
+			exit(1);
+		}
+	fsync(fd);
+	close(fd);
+	free(buf);
+}
+
+/*
+ * Fault in two mappings a page at a time, alternately, and unmap the
+ * second.  Returns the first, which stays in use.
+ */
+static char *fragment(long mb)
+{
+	size_t len = (size_t)mb << 19, i;
+	char *keep, *drop;
+
+	keep = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	drop = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (keep == MAP_FAILED || drop == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	for (i = 0; i < len; i += page_size) {
+		keep[i] = 1;
+		drop[i] = 1;
+	}
+	munmap(drop, len);
+
+	return keep;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(long long *ns, long n)
+{
+	long long sum = 0;
+	long i;
+
+	if (!n)
+		return;
+	qsort(ns, n, sizeof(*ns), cmp_ll);
+	for (i = 0; i < n; i++)
+		sum += ns[i];
+	printf("alloc  %8ld ops  mean %8lld ns  p50 %8lld  p99 %8lld  max %8lld\n",
+	       n, sum / n, ns[n / 2], ns[n * 99 / 100], ns[n - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long before[NR_COUNTERS], after[NR_COUNTERS];
+	long order = 3, nr_allocs = 256, frag_mb = -1, cache_mb = 0;
+	long nr_ops, nr_sent = 0, nr_fails = 0, cached, i;
+	int (*pairs)[2], *held, compact = 0, opt, fd;
+	unsigned int seed = 1, slot;
+	struct rlimit rl;
+	long long *ns, start;
+	size_t len;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "o:n:m:f:C")) != -1) {
+		switch (opt) {
+		case 'o':
+			order = atol(optarg);
+			break;
+		case 'n':
+			nr_allocs = atol(optarg);
+			break;
+		case 'm':
+			frag_mb = atol(optarg);
+			break;
+		case 'f':
+			cache_mb = atol(optarg);
+			break;
+		case 'C':
+			compact = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-o order] [-n allocs] "
+				"[-m MB] [-f MB] [-C]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (order < 1 || order > 5 || nr_allocs < 1) {
+		fprintf(stderr, "order must be 1 to 5, allocs at least 1\n");
+		return 1;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (frag_mb < 0)
+		frag_mb = meminfo("MemFree") / 1024 / 2;
+
+	/* each socket pair takes two descriptors */
+	rl.rlim_cur = rl.rlim_max = 2 * nr_allocs + 16;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	/*
+	 * The skb data holds the payload and struct skb_shared_info; keep
+	 * the kmalloc() within 1 << order pages but above half of that.
+	 */
+	len = (page_size << order) - 1024;
+	buf = calloc(1, len);
+	pairs = calloc(nr_allocs, sizeof(*pairs));
+	held = calloc(nr_allocs, sizeof(*held));
+	nr_ops = nr_allocs * OPS_PER_ALLOC;
+	ns = calloc(nr_ops, sizeof(*ns));
+	if (!buf || !pairs || !held || !ns) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nr_allocs; i++) {
+		int sndbuf = 4 * len;
+
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pairs[i])) {
+			perror("socketpair");
+			return 1;
+		}
+		setsockopt(pairs[i][0], SOL_SOCKET, SO_SNDBUF, &sndbuf,
+			   sizeof(sndbuf));
+	}
+
+	if (cache_mb) {
+		printf("creating %ld MB of page cache\n", cache_mb);
+		make_cache(cache_mb);
+	}
+	printf("fragmenting %ld MB\n", frag_mb);
+	fragment(frag_mb);
+	cat("/proc/extfrag_index");
+
+	if (compact) {
+		fd = open("/proc/sys/vm/compact_memory", O_WRONLY);
+		start = now_ns();
+		if (fd < 0 || write(fd, "1", 1) != 1)
+			perror("/proc/sys/vm/compact_memory");
+		else
+			printf("compact_memory took %lld us\n",
+			       (now_ns() - start) / 1000);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	cached = meminfo("Cached");
+	read_vmstat(before);
+
+	printf("\n%ld order-%ld allocations (%zu byte datagrams), "
+	       "up to %ld held\n", nr_ops, order, len, nr_allocs);
+	for (i = 0; i < nr_ops; i++) {
+		seed = seed * 1103515245 + 12345;
+		slot = (seed >> 8) % nr_allocs;
+
+		if (held[slot]) {
+			recv(pairs[slot][1], buf, len, 0);
+			held[slot] = 0;
+			continue;
+		}
+
+		start = now_ns();
+		if (send(pairs[slot][0], buf, len, MSG_DONTWAIT) < 0) {
+			if (errno != ENOBUFS && errno != ENOMEM &&
+			    errno != EAGAIN) {
+				perror("send");
+				return 1;
+			}
+			nr_fails++;
+		} else {
+			held[slot] = 1;
+		}
+		ns[nr_sent++] = now_ns() - start;
+	}
+
+	read_vmstat(after);
+	printf("%ld of %ld allocations failed\n", nr_fails, nr_sent);
+	report(ns, nr_sent);
+	for (i = 0; i < (long)NR_COUNTERS; i++) {
+		int n = strlen(counters[i]);
+
+		/* the per-zone ones without the trailing '_' */
+		n -= counters[i][n - 1] == '_';
+		printf("%-28.*s %10llu\n", n, counters[i],
+		       after[i] - before[i]);
+	}
+	printf("%-28s %10ld kB\n", "page cache lost",
+	       cached - meminfo("Cached"));
+	printf("\n");
+	cat("/proc/extfrag_index");
+
+	if (cache_mb)
+		unlink(TMPFILE);
+
+	return 0;
+}
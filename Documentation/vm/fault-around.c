@@ -0,0 +1,160 @@
+/*
+ * fault-around.c - fault count and launch time benchmark for file
+ * fault-around (/sys/kernel/mm/fault_around_bytes).
+ *
+ * "touch" mode maps each file given (e.g. the libraries, dex and resource
+ * files of an app) privately, reads one byte of every <stride>th page, and
+ * reports the minor faults and the time this took.  The files are read
+ * once beforehand so that they are in the page cache.
+ *
+ * "launch" mode runs a command <iterations> times and reports the average
+ * wall clock time and minor fault count of the child, as a stand-in for
+ * app startup.
+ *
+ * Usage:
+ *	fault-around touch <stride> <file>...
+ *	fault-around launch <iterations> <command> [args...]
+ *
+ * e.g.
+ *	echo 4096 > /sys/kernel/mm/fault_around_bytes
+ *	fault-around touch 1 /system/lib/libc.so /system/lib/libdvm.so
+ *	echo 65536 > /sys/kernel/mm/fault_around_bytes
+ *	fault-around touch 1 /system/lib/libc.so /system/lib/libdvm.so
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void warm_cache(const char *name)
+{
+	char buf[65536];
+	int fd = open(name, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	close(fd);
+}
+
+static int do_touch(int stride, int nr, char **files)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	long long t, total_ns = 0;
+	long faults = 0, pages = 0;
+	struct rusage ru;
+	struct stat st;
+	volatile char *map;
+	char sum = 0;
+	size_t off;
+	int i, fd;
+
+	if (stride < 1)
+		stride = 1;
+
+	for (i = 0; i < nr; i++)
+		warm_cache(files[i]);
+
+	for (i = 0; i < nr; i++) {
+		fd = open(files[i], O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) < 0 || !st.st_size) {
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) {
+			perror(files[i]);
+			continue;
+		}
+
+		getrusage(RUSAGE_SELF, &ru);
+		faults -= ru.ru_minflt;
+		t = now_ns();
+		for (off = 0; off < st.st_size; off += stride * page) {
+			sum += map[off];
+			pages++;
+		}
+		total_ns += now_ns() - t;
+		getrusage(RUSAGE_SELF, &ru);
+		faults += ru.ru_minflt;
+
+		munmap((void *)map, st.st_size);
+	}
+
+	printf("pages touched: %ld\n", pages);
+	printf("minor faults:  %ld\n", faults);
+	printf("time:          %lld us\n", total_ns / 1000);
+
+	return sum == 1;
+}
+
+static int do_launch(int iterations, char **argv)
+{
+	long long t, total_ns = 0;
+	long faults = 0;
+	struct rusage ru;
+	int i, status;
+	pid_t pid;
+
+	if (iterations < 1)
+		iterations = 1;
+
+	for (i = 0; i < iterations; i++) {
+		t = now_ns();
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid) {
+			execvp(argv[0], argv);
+			perror(argv[0]);
+			_exit(127);
+		}
+		if (wait4(pid, &status, 0, &ru) < 0) {
+			perror("wait4");
+			return 1;
+		}
+		total_ns += now_ns() - t;
+		faults += ru.ru_minflt;
+	}
+
+	printf("launches:      %d\n", iterations);
+	printf("avg time:      %lld us\n", total_ns / iterations / 1000);
+	printf("avg faults:    %ld\n", faults / iterations);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 4 && !strcmp(argv[1], "touch"))
+		return do_touch(atoi(argv[2]), argc - 3, argv + 3);
+	if (argc >= 4 && !strcmp(argv[1], "launch"))
+		return do_launch(atoi(argv[2]), argv + 3);
+
+	fprintf(stderr, "usage: %s touch <stride> <file>...\n"
+		"       %s launch <iterations> <command> [args...]\n",
+		argv[0], argv[0]);
+	return 1;
+}
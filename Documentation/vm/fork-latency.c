@@ -0,0 +1,153 @@
+/*
+ * fork-latency.c - fork latency with a large mapped parent
+ *
+ * The parent maps a file privately (like the zygote maps its libraries,
+ * dex and resource files), reads all of it so that it is fully populated
+ * and dirties every <stride>th page so that the mapping also holds
+ * anonymous pages.  It then forks repeatedly and reports how long fork()
+ * took in the parent, the page table size of the child right after fork
+ * and, optionally, how many page faults the child takes to read the whole
+ * mapping.
+ *
+ * Usage:
+ *	fork-latency <file> [iterations] [stride] [touch]
+ *
+ * Compare runs with /proc/sys/vm/fork_lazy_ptes set to 0 and 1.
+ *
+ * Licensed under the terms of the GNU GPL License version 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+struct child_report {
+	long vm_pte_kb;
+	long minflt;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long vm_pte_kb(void)
+{
+	char line[256];
+	long kb = -1;
+	FILE *f = fopen("/proc/self/status", "r");
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "VmPTE: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 100, stride = 64, touch = 0;
+	long long t, total = 0, min = -1, max = 0;
+	long page = sysconf(_SC_PAGESIZE);
+	struct child_report rep = { 0, 0 };
+	volatile char *map;
+	struct stat st;
+	size_t off;
+	int fd, i, pfd[2];
+	char sum = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <file> [iterations] [stride] "
+			"[touch]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		iterations = atoi(argv[2]);
+	if (argc > 3)
+		stride = atoi(argv[3]);
+	if (argc > 4)
+		touch = atoi(argv[4]);
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	for (off = 0; off < st.st_size; off += page)
+		sum += map[off];
+	if (stride > 0)
+		for (off = 0; off < st.st_size; off += stride * page)
+			map[off] = sum;
+
+	if (pipe(pfd) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	for (i = 0; i < iterations; i++) {
+		pid_t pid;
+
+		t = now_ns();
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid) {
+			struct child_report r;
+			struct rusage ru;
+
+			r.vm_pte_kb = vm_pte_kb();
+			r.minflt = 0;
+			if (touch) {
+				getrusage(RUSAGE_SELF, &ru);
+				r.minflt = -ru.ru_minflt;
+				for (off = 0; off < st.st_size; off += page)
+					sum += map[off];
+				getrusage(RUSAGE_SELF, &ru);
+				r.minflt += ru.ru_minflt;
+			}
+			write(pfd[1], &r, sizeof(r));
+			_exit(sum == 1);
+		}
+		t = now_ns() - t;
+		read(pfd[0], &rep, sizeof(rep));
+		waitpid(pid, NULL, 0);
+
+		total += t;
+		if (min < 0 || t < min)
+			min = t;
+		if (t > max)
+			max = t;
+	}
+
+	printf("mapping:       %lld kB\n", (long long)st.st_size / 1024);
+	printf("parent VmPTE:  %ld kB\n", vm_pte_kb());
+	printf("child VmPTE:   %ld kB\n", rep.vm_pte_kb);
+	printf("fork avg:      %lld us\n", total / iterations / 1000);
+	printf("fork min:      %lld us\n", min / 1000);
+	printf("fork max:      %lld us\n", max / 1000);
+	if (touch)
+		printf("child faults:  %ld\n", rep.minflt);
+
+	return 0;
+}
@@ -77,6 +77,7 @@
 #include <linux/mtd/partitions.h>
 #include <linux/i2c.h>
 #include <linux/android_pmem.h>
+#include <linux/cma.h>
 #include <linux/proc_fs.h>
 #include <mach/memory.h>
 #include <mach/camera.h>
@@ -1691,6 +1692,27 @@ err2:
 	return;
 }
 
+/*
+ * The camera, video and GPU regions are only needed while those are in
+ * use.  With CONFIG_CMA they are contiguous memory areas, lent to the
+ * page allocator for movable pages the rest of the time.
+ */
+static int __init msm_mot_7x27_reserve_cma(
+		struct android_pmem_platform_data *pdata, unsigned long size)
+{
+#ifdef CONFIG_CMA
+	struct cma *cma = cma_reserve(size, 0x100000, pdata->name);
+
+	if (cma) {
+		pdata->cma = cma;
+		pdata->start = cma_get_base(cma);
+		pdata->size = cma_get_size(cma);
+		return 0;
+	}
+#endif
+	return -ENOMEM;
+}
+
 static void __init msm_mot_7x27_allocate_memory_regions(void)
 {
 	void *addr;
@@ -1711,25 +1733,31 @@ static void __init msm_mot_7x27_allocate_memory_regions(void)
 	       "for pmem\n", size, addr, __pa(addr));
 
 	size = MSM_PMEM_CAMERA_SIZE;
-	addr = alloc_bootmem(size);
-	android_pmem_camera_pdata.start = __pa(addr);
-	android_pmem_camera_pdata.size = size;
-	printk(KERN_INFO "allocating %lu bytes at %p (%lx physical)"
-	       "for camera pmem\n", size, addr, __pa(addr));
+	if (msm_mot_7x27_reserve_cma(&android_pmem_camera_pdata, size)) {
+		addr = alloc_bootmem(size);
+		android_pmem_camera_pdata.start = __pa(addr);
+		android_pmem_camera_pdata.size = size;
+		printk(KERN_INFO "allocating %lu bytes at %p (%lx physical)"
+		       "for camera pmem\n", size, addr, __pa(addr));
+	}
 
 	size = MSM_PMEM_ADSP_SIZE;
-	addr = alloc_bootmem(size);
-	android_pmem_adsp_pdata.start = __pa(addr);
-	android_pmem_adsp_pdata.size = size;
-	printk(KERN_INFO "allocating %lu bytes at %p (%lx physical)"
-	       "for adsp pmem\n", size, addr, __pa(addr));
+	if (msm_mot_7x27_reserve_cma(&android_pmem_adsp_pdata, size)) {
+		addr = alloc_bootmem(size);
+		android_pmem_adsp_pdata.start = __pa(addr);
+		android_pmem_adsp_pdata.size = size;
+		printk(KERN_INFO "allocating %lu bytes at %p (%lx physical)"
+		       "for adsp pmem\n", size, addr, __pa(addr));
+	}
 
 	size = MSM_PMEM_GPU1_SIZE;
-	addr = alloc_bootmem_aligned(size, 0x100000);
-	android_pmem_gpu1_pdata.start = __pa(addr);
-	android_pmem_gpu1_pdata.size = size;
-	printk(KERN_INFO "allocating %lu bytes at %p (%lx physical)"
-	       "for gpu1 pmem\n", size, addr, __pa(addr));
+	if (msm_mot_7x27_reserve_cma(&android_pmem_gpu1_pdata, size)) {
+		addr = alloc_bootmem_aligned(size, 0x100000);
+		android_pmem_gpu1_pdata.start = __pa(addr);
+		android_pmem_gpu1_pdata.size = size;
+		printk(KERN_INFO "allocating %lu bytes at %p (%lx physical)"
+		       "for gpu1 pmem\n", size, addr, __pa(addr));
+	}
 
 	size = MSM_FB_SIZE;
 	addr = alloc_bootmem(size);
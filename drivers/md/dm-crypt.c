@@ -1198,13 +1198,13 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		cc->iv_mode = NULL;
 
 #ifndef CONFIG_DM_CRYPT_GLOBAL_WORKQUEUES
-	cc->io_queue = create_singlethread_workqueue("kcryptd_io");
+	cc->io_queue = create_singlethread_mem_reclaim_workqueue("kcryptd_io");
 	if (!cc->io_queue) {
 		ti->error = "Couldn't create kcryptd io queue";
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	cc->crypt_queue = create_singlethread_mem_reclaim_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		destroy_workqueue(cc->io_queue);
@@ -1437,13 +1437,13 @@ static int __init dm_crypt_init(void)
 	int r;
 
 #ifdef CONFIG_DM_CRYPT_GLOBAL_WORKQUEUES
-	_io_queue = create_singlethread_workqueue("kcryptd_io");
+	_io_queue = create_singlethread_mem_reclaim_workqueue("kcryptd_io");
 	if (!_io_queue) {
 		DMERR("couldn't create kcryptd io queue");
 		return -ENOMEM;
 	}
 
-	_crypt_queue = create_singlethread_workqueue("kcryptd");
+	_crypt_queue = create_singlethread_mem_reclaim_workqueue("kcryptd");
 	if (!_crypt_queue) {
 		DMERR("couldn't create kcryptd queue");
 		destroy_workqueue(_io_queue);
@@ -1519,7 +1519,7 @@ static int __init dm_snapshot_init(void)
 		goto bad5;
 	}
 
-	ksnapd = create_singlethread_workqueue("ksnapd");
+	ksnapd = create_singlethread_mem_reclaim_workqueue("ksnapd");
 	if (!ksnapd) {
 		DMERR("Failed to create ksnapd workqueue.");
 		r = -ENOMEM;
@@ -23,12 +23,15 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/cma.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
 
 #define PMEM_MAX_DEVICES 10
-#define PMEM_MAX_ORDER 128
+/* block orders range from 0 to log2(num_entries) */
+#define PMEM_NR_ORDERS BITS_PER_LONG
 #define PMEM_MIN_ALLOC PAGE_SIZE
 
 #define PMEM_DEBUG 1
@@ -82,6 +85,9 @@ struct pmem_data {
 struct pmem_bits {
 	unsigned allocated:1;		/* 1 if allocated, 0 if free */
 	unsigned order:7;		/* size of the region in pmem space */
+	/* for the first entry of a free region, its place in the free list
+	 * of its order */
+	struct list_head free_list;
 };
 
 struct pmem_region_node {
@@ -116,6 +122,17 @@ struct pmem_info {
 	/* the bitmap for the region indicating which entries are allocated
 	 * and which are free */
 	struct pmem_bits *bitmap;
+	/* the free regions of each order, so that allocation and free do not
+	 * have to walk the bitmap, and how many there are */
+	struct list_head free_area[PMEM_NR_ORDERS];
+	unsigned long nr_free[PMEM_NR_ORDERS];
+	/* allocation statistics, see the pmem_stats debugfs files */
+	unsigned long nr_allocs;
+	unsigned long nr_alloc_fails;
+	/* if set, the region is a contiguous memory area: allocations come
+	 * from it rather than from the free lists, and it lends the free
+	 * space to the page allocator */
+	struct cma *cma;
 	/* indicates the region should not be managed with an allocator */
 	unsigned no_allocator;
 	/* indicates maps of this region should be cached, if a mix of
@@ -131,7 +148,7 @@ struct pmem_info {
 	 * needed */
 	struct semaphore data_list_sem;
 	struct list_head data_list;
-	/* pmem_sem protects the bitmap array
+	/* pmem_sem protects the bitmap array and the free lists
 	 * a write lock should be held when modifying entries in bitmap
 	 * a read lock should be held when reading data from bits or
 	 * dereferencing a pointer into bitmap
@@ -232,33 +249,59 @@ static int is_master_owner(struct file *file)
 	return ret;
 }
 
+static void pmem_add_free(int id, int index, int order)
+{
+	PMEM_ORDER(id, index) = order;
+	pmem[id].bitmap[index].allocated = 0;
+	list_add(&pmem[id].bitmap[index].free_list,
+		 &pmem[id].free_area[order]);
+	pmem[id].nr_free[order]++;
+}
+
+static void pmem_del_free(int id, int index)
+{
+	list_del(&pmem[id].bitmap[index].free_list);
+	pmem[id].nr_free[PMEM_ORDER(id, index)]--;
+}
+
 static int pmem_free(int id, int index)
 {
 	/* caller should hold the write lock on pmem_sem! */
 	int buddy, curr = index;
+	int order = PMEM_ORDER(id, index);
 	DLOG("index %d\n", index);
 
 	if (pmem[id].no_allocator) {
+		if (pmem[id].cma && pmem[id].allocated)
+			cma_release(pmem[id].cma,
+				    pfn_to_page(pmem[id].base >> PAGE_SHIFT),
+				    pmem[id].num_entries);
 		pmem[id].allocated = 0;
 		return 0;
 	}
-	/* clean up the bitmap, merging any buddies */
-	pmem[id].bitmap[curr].allocated = 0;
+	if (pmem[id].cma) {
+		cma_release(pmem[id].cma,
+			    pfn_to_page((pmem[id].base >> PAGE_SHIFT) + index),
+			    1 << order);
+		pmem[id].bitmap[index].allocated = 0;
+		return 0;
+	}
 	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
 	 * if the buddy is also free merge them
 	 * repeat until the buddy is not free or end of the bitmap is reached
+	 * a buddy index is always the first entry of a region of at most the
+	 * slot's order, so its bits are current
 	 */
-	do {
-		buddy = PMEM_BUDDY_INDEX(id, curr);
-		if (PMEM_IS_FREE(id, buddy) &&
-				PMEM_ORDER(id, buddy) == PMEM_ORDER(id, curr)) {
-			PMEM_ORDER(id, buddy)++;
-			PMEM_ORDER(id, curr)++;
-			curr = min(buddy, curr);
-		} else {
+	while (order + 1 < PMEM_NR_ORDERS) {
+		buddy = curr ^ (1 << order);
+		if (buddy >= pmem[id].num_entries ||
+		    !PMEM_IS_FREE(id, buddy) || PMEM_ORDER(id, buddy) != order)
 			break;
-		}
-	} while (curr < pmem[id].num_entries);
+		pmem_del_free(id, buddy);
+		curr = min(buddy, curr);
+		order++;
+	}
+	pmem_add_free(id, curr, order);
 
 	return 0;
 }
@@ -376,65 +419,91 @@ static unsigned long pmem_order(unsigned long len)
 	return i;
 }
 
+static struct page *pmem_cma_alloc(int id, unsigned long count,
+				   unsigned int order)
+{
+	struct page *page;
+
+	page = cma_alloc(pmem[id].cma, count, order);
+	if (!page)
+		return NULL;
+
+	/* the pages were in use through the cached kernel mapping, don't let
+	 * dirty lines land on top of what the device writes */
+	dmac_flush_range(page_address(page),
+			 page_address(page) + count * PAGE_SIZE);
+	return page;
+}
+
 static int pmem_allocate(int id, unsigned long len)
 {
 	/* caller should hold the write lock on pmem_sem! */
 	/* return the corresponding pdata[] entry */
-	int curr = 0;
-	int end = pmem[id].num_entries;
-	int best_fit = -1;
+	int best_fit;
+	unsigned long curr;
 	unsigned long order = pmem_order(len);
 
 	if (pmem[id].no_allocator) {
 		DLOG("no allocator");
 		if ((len > pmem[id].size) || pmem[id].allocated)
 			return -1;
+		if (pmem[id].cma &&
+		    !pmem_cma_alloc(id, pmem[id].num_entries, 0)) {
+			pmem[id].nr_alloc_fails++;
+			return -1;
+		}
 		pmem[id].allocated = 1;
 		return len;
 	}
 
-	if (order > PMEM_MAX_ORDER)
-		return -1;
 	DLOG("order %lx\n", order);
 
-	/* look through the bitmap:
-	 * 	if you find a free slot of the correct order use it
-	 * 	otherwise, use the best fit (smallest with size > order) slot
-	 */
-	while (curr < end) {
-		if (PMEM_IS_FREE(id, curr)) {
-			if (PMEM_ORDER(id, curr) == (unsigned char)order) {
-				/* set the not free bit and clear others */
-				best_fit = curr;
-				break;
-			}
-			if (PMEM_ORDER(id, curr) > (unsigned char)order &&
-			    (best_fit < 0 ||
-			     PMEM_ORDER(id, curr) < PMEM_ORDER(id, best_fit)))
-				best_fit = curr;
+	if (pmem[id].cma) {
+		struct page *page = pmem_cma_alloc(id, 1UL << order, order);
+
+		if (!page) {
+			printk("pmem: no space left to allocate!\n");
+			pmem[id].nr_alloc_fails++;
+			return -1;
 		}
-		curr = PMEM_NEXT_INDEX(id, curr);
+		best_fit = page_to_pfn(page) - (pmem[id].base >> PAGE_SHIFT);
+		PMEM_ORDER(id, best_fit) = order;
+		pmem[id].bitmap[best_fit].allocated = 1;
+		pmem[id].nr_allocs++;
+		return best_fit;
 	}
 
-	/* if best_fit < 0, there are no suitable slots,
+	/* take a free slot of the correct order if there is one,
+	 * otherwise the smallest slot with size > order
+	 */
+	for (curr = order; curr < PMEM_NR_ORDERS; curr++)
+		if (!list_empty(&pmem[id].free_area[curr]))
+			break;
+
+	/* if there is none, there are no suitable slots,
 	 * return an error
 	 */
-	if (best_fit < 0) {
+	if (curr >= PMEM_NR_ORDERS) {
 		printk("pmem: no space left to allocate!\n");
+		pmem[id].nr_alloc_fails++;
 		return -1;
 	}
 
+	best_fit = list_entry(pmem[id].free_area[curr].next,
+			      struct pmem_bits, free_list) - pmem[id].bitmap;
+	pmem_del_free(id, best_fit);
+
 	/* now partition the best fit:
-	 * 	split the slot into 2 buddies of order - 1
+	 * 	split the slot into 2 buddies of order - 1, freeing the upper
 	 * 	repeat until the slot is of the correct order
 	 */
-	while (PMEM_ORDER(id, best_fit) > (unsigned char)order) {
-		int buddy;
-		PMEM_ORDER(id, best_fit) -= 1;
-		buddy = PMEM_BUDDY_INDEX(id, best_fit);
-		PMEM_ORDER(id, buddy) = PMEM_ORDER(id, best_fit);
+	while (curr > order) {
+		curr--;
+		pmem_add_free(id, best_fit + (1 << curr), curr);
 	}
+	PMEM_ORDER(id, best_fit) = order;
 	pmem[id].bitmap[best_fit].allocated = 1;
+	pmem[id].nr_allocs++;
 	return best_fit;
 }
 
@@ -1139,7 +1208,9 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			if (has_allocation(file))
 				return -EINVAL;
 			data = (struct pmem_data *)file->private_data;
+			down_write(&pmem[id].bitmap_sem);
 			data->index = pmem_allocate(id, arg);
+			up_write(&pmem[id].bitmap_sem);
 			break;
 		}
 	case PMEM_CONNECT:
@@ -1214,6 +1285,85 @@ static struct file_operations debug_fops = {
 	.read = debug_read,
 	.open = debug_open,
 };
+
+/*
+ * Free space of the allocator by order, like /proc/buddyinfo, and for each
+ * order the unusable free space index: the fraction of free space that is
+ * in blocks too small to satisfy an allocation of that order.
+ */
+static ssize_t debug_stats_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	int id = (int)file->private_data;
+	const int debug_bufmax = 4096;
+	static char buffer[4096];
+	unsigned long nr_free[PMEM_NR_ORDERS];
+	unsigned long free_pages = 0, blocks = 0, suitable, unusable;
+	int i, max_order = -1, nr_orders;
+	int n = 0;
+
+	if (pmem[id].no_allocator)
+		return simple_read_from_buffer(buf, count, ppos, "", 0);
+
+	/* the free lists are unused, the area has its own statistics */
+	if (pmem[id].cma) {
+		n = scnprintf(buffer, debug_bufmax,
+			      "allocations: %lu\nfailed: %lu\n"
+			      "see cma/%s in debugfs\n",
+			      pmem[id].nr_allocs, pmem[id].nr_alloc_fails,
+			      pmem[id].dev.name);
+		return simple_read_from_buffer(buf, count, ppos, buffer, n);
+	}
+
+	down_read(&pmem[id].bitmap_sem);
+	memcpy(nr_free, pmem[id].nr_free, sizeof(nr_free));
+	n = scnprintf(buffer, debug_bufmax,
+		      "allocations: %lu\nfailed: %lu\n",
+		      pmem[id].nr_allocs, pmem[id].nr_alloc_fails);
+	up_read(&pmem[id].bitmap_sem);
+
+	nr_orders = fls(pmem[id].num_entries);
+	for (i = 0; i < nr_orders; i++) {
+		free_pages += nr_free[i] << i;
+		blocks += nr_free[i];
+		if (nr_free[i])
+			max_order = i;
+	}
+	n += scnprintf(buffer + n, debug_bufmax - n,
+		       "free: %lu kB in %lu blocks, largest %lu kB\n",
+		       free_pages * (PMEM_MIN_ALLOC >> 10), blocks,
+		       max_order < 0 ? 0 :
+		       (PMEM_MIN_ALLOC >> 10) << max_order);
+
+	n += scnprintf(buffer + n, debug_bufmax - n, "order   ");
+	for (i = 0; i < nr_orders; i++)
+		n += scnprintf(buffer + n, debug_bufmax - n, " %6d", i);
+	n += scnprintf(buffer + n, debug_bufmax - n, "\nfree    ");
+	for (i = 0; i < nr_orders; i++)
+		n += scnprintf(buffer + n, debug_bufmax - n, " %6lu",
+			       nr_free[i]);
+	n += scnprintf(buffer + n, debug_bufmax - n, "\nunusable");
+	suitable = free_pages;
+	for (i = 0; i < nr_orders; i++) {
+		/* in thousandths, pages in blocks of order i and up are
+		 * usable */
+		unusable = free_pages ?
+			(free_pages - suitable) * 1000 / free_pages : 0;
+		n += scnprintf(buffer + n, debug_bufmax - n, "  %lu.%03lu",
+			       unusable / 1000, unusable % 1000);
+		suitable -= nr_free[i] << i;
+	}
+	n += scnprintf(buffer + n, debug_bufmax - n, "\n");
+
+	return simple_read_from_buffer(buf, count, ppos, buffer, n);
+}
+
+static struct file_operations debug_stats_fops = {
+	.read = debug_stats_read,
+	.open = debug_open,
+};
+
+static struct dentry *pmem_stats_dir;
 #endif
 
 #if 0
@@ -1237,6 +1387,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	pmem[id].buffered = pdata->buffered;
 	pmem[id].base = pdata->start;
 	pmem[id].size = pdata->size;
+	pmem[id].cma = pdata->cma;
 	pmem[id].ioctl = ioctl;
 	pmem[id].release = release;
 	init_rwsem(&pmem[id].bitmap_sem);
@@ -1254,17 +1405,20 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	}
 	pmem[id].num_entries = pmem[id].size / PMEM_MIN_ALLOC;
 
-	pmem[id].bitmap = kmalloc(pmem[id].num_entries *
-				  sizeof(struct pmem_bits), GFP_KERNEL);
+	pmem[id].bitmap = vmalloc(pmem[id].num_entries *
+				  sizeof(struct pmem_bits));
 	if (!pmem[id].bitmap)
 		goto err_no_mem_for_metadata;
 
 	memset(pmem[id].bitmap, 0, sizeof(struct pmem_bits) *
 					  pmem[id].num_entries);
 
-	for (i = sizeof(pmem[id].num_entries) * 8 - 1; i >= 0; i--) {
-		if ((pmem[id].num_entries) &  1<<i) {
-			PMEM_ORDER(id, index) = i;
+	for (i = 0; i < PMEM_NR_ORDERS; i++)
+		INIT_LIST_HEAD(&pmem[id].free_area[i]);
+	/* a contiguous memory area does its own allocation */
+	for (i = PMEM_NR_ORDERS - 1; i >= 0 && !pmem[id].cma; i--) {
+		if ((pmem[id].num_entries) & (1UL << i)) {
+			pmem_add_free(id, index, i);
 			index = PMEM_NEXT_INDEX(id, index);
 		}
 	}
@@ -1290,10 +1444,16 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 #if PMEM_DEBUG
 	debugfs_create_file(pdata->name, S_IFREG | S_IRUGO, NULL, (void *)id,
 			    &debug_fops);
+	if (!pmem_stats_dir)
+		pmem_stats_dir = debugfs_create_dir("pmem_stats", NULL);
+	if (pmem_stats_dir)
+		debugfs_create_file(pdata->name, S_IFREG | S_IRUGO,
+				    pmem_stats_dir, (void *)id,
+				    &debug_stats_fops);
 #endif
 	return 0;
 error_cant_remap:
-	kfree(pmem[id].bitmap);
+	vfree(pmem[id].bitmap);
 err_no_mem_for_metadata:
 	misc_deregister(&pmem[id].dev);
 err_cant_register_device:
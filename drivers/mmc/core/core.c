@@ -1424,7 +1424,7 @@ static int __init mmc_init(void)
 
 	wake_lock_init(&mmc_delayed_work_wake_lock, WAKE_LOCK_SUSPEND, "mmc_delayed_work");
 
-	workqueue = create_singlethread_workqueue("kmmcd");
+	workqueue = create_singlethread_mem_reclaim_workqueue("kmmcd");
 	if (!workqueue)
 		return -ENOMEM;
 
@@ -104,6 +104,9 @@ static char *gravepages = NULL;
 static unsigned int rptwear = 0;
 static unsigned int overridesize = 0;
 static char *cache_file = NULL;
+static unsigned long read_count = 0;
+static unsigned long program_count = 0;
+static unsigned long erase_count = 0;
 
 module_param(first_id_byte,  uint, 0400);
 module_param(second_id_byte, uint, 0400);
@@ -127,6 +130,9 @@ module_param(gravepages,     charp, 0400);
 module_param(rptwear,        uint, 0400);
 module_param(overridesize,   uint, 0400);
 module_param(cache_file,     charp, 0400);
+module_param(read_count,     ulong, 0644);
+module_param(program_count,  ulong, 0644);
+module_param(erase_count,    ulong, 0644);
 
 MODULE_PARM_DESC(first_id_byte,  "The first byte returned by NAND Flash 'read ID' command (manufacturer ID)");
 MODULE_PARM_DESC(second_id_byte, "The second byte returned by NAND Flash 'read ID' command (chip ID)");
@@ -159,6 +165,9 @@ MODULE_PARM_DESC(overridesize,   "Specifies the NAND Flash size overriding the I
 				 "The size is specified in erase blocks and as the exponent of a power of two"
 				 " e.g. 5 means a size of 32 erase blocks");
 MODULE_PARM_DESC(cache_file,     "File to use to cache nand pages instead of memory");
+MODULE_PARM_DESC(read_count,     "Number of page reads done so far (write 0 to reset)");
+MODULE_PARM_DESC(program_count,  "Number of page programs done so far (write 0 to reset)");
+MODULE_PARM_DESC(erase_count,    "Number of sector erases done so far (write 0 to reset)");
 
 /* The largest possible page size */
 #define NS_LARGEST_PAGE_SIZE	2048
@@ -1601,6 +1610,7 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 		}
 		num = ns->geom.pgszoob - ns->regs.off - ns->regs.column;
 		read_page(ns, num);
+		read_count++;
 
 		NS_DBG("do_state_action: (ACTION_CPY:) copy %d bytes to int buf, raw offset %d\n",
 			num, NS_RAW_OFFSET(ns) + ns->regs.off);
@@ -1644,6 +1654,7 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 		NS_LOG("erase sector %u\n", erase_block_no);
 
 		erase_sector(ns);
+		erase_count++;
 
 		NS_MDELAY(erase_delay);
 
@@ -1676,6 +1687,7 @@ static int do_state_action(struct nandsim *ns, uint32_t action)
 
 		if (prog_page(ns, num) == -1)
 			return -1;
+		program_count++;
 
 		page_no = ns->regs.row;
 
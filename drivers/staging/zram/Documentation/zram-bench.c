@@ -0,0 +1,196 @@
+/*
+ * zram-bench.c - multi-threaded zram throughput benchmark
+ *
+ * Each thread writes its own region of the device with page sized
+ * O_DIRECT writes, then reads it back, much like several fio jobs with
+ * bs=4k and direct=1.  Page contents are half random bytes and half a
+ * repeated pattern, so they compress to roughly 50%, like typical anonymous
+ * memory.  Aggregate write and read throughput is printed, followed by
+ * the device's comp_stats: the compression ratio and the throughput of
+ * the compression algorithm alone, without block layer and allocator
+ * overhead.
+ *
+ * Usage:
+ *	zram-bench <device> [threads] [MB per thread]
+ *
+ * e.g.
+ *	echo 4 > /sys/block/zram0/max_comp_streams
+ *	echo lz4 > /sys/block/zram0/comp_algorithm
+ *	echo $((512*1024*1024)) > /sys/block/zram0/disksize
+ *	zram-bench /dev/zram0 4 64
+ *
+ * Compile with: gcc -O2 -o zram-bench zram-bench.c -lpthread
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <pthread.h>
+
+#define PAGE_SZ		4096
+
+static const char *device;
+static int nr_threads = 4;
+static long pages_per_thread;
+static pthread_barrier_t barrier;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fill_page(unsigned char *buf, unsigned int seed)
+{
+	int i;
+
+	for (i = 0; i < PAGE_SZ / 2; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+	for (; i < PAGE_SZ; i++)
+		buf[i] = i & 0x0f;
+}
+
+static void *worker(void *arg)
+{
+	long id = (long)arg;
+	off_t base = (off_t)id * pages_per_thread * PAGE_SZ;
+	unsigned char *buf;
+	long i;
+	int fd;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, PAGE_SZ))
+		exit(1);
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < pages_per_thread; i++) {
+		fill_page(buf, id * pages_per_thread + i);
+		if (pwrite(fd, buf, PAGE_SZ, base + i * PAGE_SZ) != PAGE_SZ) {
+			perror("pwrite");
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&barrier);
+
+	pthread_barrier_wait(&barrier);
+	for (i = 0; i < pages_per_thread; i++) {
+		if (pread(fd, buf, PAGE_SZ, base + i * PAGE_SZ) != PAGE_SZ) {
+			perror("pread");
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&barrier);
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void report(const char *what, long long ns)
+{
+	double mb = (double)nr_threads * pages_per_thread * PAGE_SZ /
+		    (1024 * 1024);
+
+	printf("%-6s %8.1f MB in %8.3f s: %8.1f MB/s\n", what, mb,
+	       ns / 1e9, mb / (ns / 1e9));
+}
+
+static void report_comp_stats(void)
+{
+	unsigned long long num_comp, comp_in, comp_out, comp_ns;
+	unsigned long long num_decomp, decomp_in, decomp_ns;
+	char path[512], dev[256], alg[128] = "?";
+	FILE *f;
+
+	strncpy(dev, device, sizeof(dev) - 1);
+	dev[sizeof(dev) - 1] = '\0';
+
+	snprintf(path, sizeof(path), "/sys/block/%s/comp_algorithm",
+		 basename(dev));
+	f = fopen(path, "r");
+	if (f) {
+		/* the current algorithm is the one in brackets */
+		while (fscanf(f, "%127s", alg) == 1 && alg[0] != '[')
+			;
+		fclose(f);
+	}
+
+	snprintf(path, sizeof(path), "/sys/block/%s/comp_stats",
+		 basename(dev));
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (fscanf(f, "%llu %llu %llu %llu %llu %llu %llu", &num_comp,
+		   &comp_in, &comp_out, &comp_ns, &num_decomp, &decomp_in,
+		   &decomp_ns) != 7) {
+		fclose(f);
+		return;
+	}
+	fclose(f);
+
+	printf("%s: ratio %.2f, compress %.1f MB/s, decompress %.1f MB/s\n",
+	       alg, comp_out ? (double)comp_in / comp_out : 0.0,
+	       comp_ns ? comp_in * 1e9 / comp_ns / (1024 * 1024) : 0.0,
+	       decomp_ns ? num_decomp * PAGE_SZ * 1e9 / decomp_ns /
+			   (1024 * 1024) : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	long mb_per_thread = 64;
+	long long t;
+	pthread_t *threads;
+	long i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <device> [threads] "
+			"[MB per thread]\n", argv[0]);
+		return 1;
+	}
+	device = argv[1];
+	if (argc > 2)
+		nr_threads = atoi(argv[2]);
+	if (argc > 3)
+		mb_per_thread = atol(argv[3]);
+	if (nr_threads < 1)
+		nr_threads = 1;
+	pages_per_thread = mb_per_thread * 1024 * 1024 / PAGE_SZ;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+
+	pthread_barrier_wait(&barrier);
+	t = now_ns();
+	pthread_barrier_wait(&barrier);
+	report("write", now_ns() - t);
+
+	pthread_barrier_wait(&barrier);
+	t = now_ns();
+	pthread_barrier_wait(&barrier);
+	report("read", now_ns() - t);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	report_comp_stats();
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * zram-trace.c - replay a swap trace against a zram device and report
+ * allocator memory overhead and fragmentation.
+ *
+ * The trace is read from stdin, one I/O per line: the first field says
+ * whether it is a read or a write (any field containing 'R' or 'W', so
+ * blkparse RWBS output works) and the second is the starting sector.
+ * Capture one on a device with:
+ *
+ *	blktrace -d /dev/block/zram0 -o - | \
+ *		blkparse -i - -a issue -f "%d %S\n" > swap.trace
+ *
+ * Page contents are taken from <content file> (e.g. a dump of an app's
+ * heap), at an offset derived from the sector, so that a slot gets the
+ * same contents each time it is written and compressibility follows the
+ * dump.  Without a content file, a mix of zero, text-like and random
+ * pages is generated.
+ *
+ * Every <interval> I/Os, and at the end, the device's orig_data_size,
+ * compr_data_size and mem_used_total are printed along with:
+ *	overhead	mem_used_total / compr_data_size
+ *	frag		share of mem_used_total not holding compressed data
+ *
+ * Usage:
+ *	zram-trace <device> [content file] [interval] < swap.trace
+ *
+ * e.g. compare the allocators over the same trace:
+ *	echo 1 > /sys/block/zram0/reset
+ *	echo xvmalloc > /sys/block/zram0/allocator
+ *	echo $((256*1024*1024)) > /sys/block/zram0/disksize
+ *	zram-trace /dev/zram0 heap.dump < swap.trace
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#define PAGE_SZ		4096
+#define SECTORS_PER_PAGE	(PAGE_SZ / 512)
+
+static char sysfs_dir[256];
+static int content_fd = -1;
+static off_t content_pages;
+
+static unsigned long long read_stat(const char *name)
+{
+	char path[512];
+	unsigned long long val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", sysfs_dir, name);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%llu", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+static void report(unsigned long nr_io)
+{
+	unsigned long long orig = read_stat("orig_data_size");
+	unsigned long long compr = read_stat("compr_data_size");
+	unsigned long long used = read_stat("mem_used_total");
+
+	printf("%10lu %12llu %12llu %12llu %8.3f %6.1f%%\n", nr_io,
+	       orig >> 10, compr >> 10, used >> 10,
+	       compr ? (double)used / compr : 0.0,
+	       used ? 100.0 * (used - (compr < used ? compr : used)) / used
+		    : 0.0);
+	fflush(stdout);
+}
+
+static void fill_page(unsigned char *buf, unsigned long long slot)
+{
+	unsigned int seed = slot * 2654435761u;
+	int i, kind;
+
+	if (content_fd >= 0) {
+		off_t off = (off_t)(slot % content_pages) * PAGE_SZ;
+
+		if (pread(content_fd, buf, PAGE_SZ, off) == PAGE_SZ)
+			return;
+	}
+
+	kind = seed % 8;
+	if (kind == 0) {
+		memset(buf, 0, PAGE_SZ);
+		return;
+	}
+	for (i = 0; i < PAGE_SZ; i++) {
+		seed = seed * 1103515245 + 12345;
+		/* mostly compressible, a few pages random */
+		buf[i] = kind == 7 ? seed >> 16 : (seed >> 16) % (kind * 4);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long interval = 100000, nr_io = 0;
+	unsigned long long sector;
+	unsigned char *buf;
+	char line[256], op[64], dev[256];
+	struct stat st;
+	int fd;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <device> [content file] "
+			"[interval] < trace\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2 && strcmp(argv[2], "-")) {
+		content_fd = open(argv[2], O_RDONLY);
+		if (content_fd < 0 || fstat(content_fd, &st) < 0) {
+			perror(argv[2]);
+			return 1;
+		}
+		content_pages = st.st_size / PAGE_SZ;
+		if (!content_pages) {
+			close(content_fd);
+			content_fd = -1;
+		}
+	}
+	if (argc > 3)
+		interval = strtoul(argv[3], NULL, 0);
+
+	strncpy(dev, argv[1], sizeof(dev) - 1);
+	dev[sizeof(dev) - 1] = '\0';
+	snprintf(sysfs_dir, sizeof(sysfs_dir), "/sys/block/%s",
+		 basename(dev));
+
+	fd = open(argv[1], O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (posix_memalign((void **)&buf, PAGE_SZ, PAGE_SZ))
+		return 1;
+
+	printf("%10s %12s %12s %12s %8s %7s\n", "io", "orig_kB",
+	       "compr_kB", "used_kB", "overhead", "frag");
+
+	while (fgets(line, sizeof(line), stdin)) {
+		unsigned long long slot;
+		off_t off;
+
+		if (sscanf(line, "%63s %llu", op, &sector) != 2)
+			continue;
+		slot = sector / SECTORS_PER_PAGE;
+		off = (off_t)slot * PAGE_SZ;
+
+		if (strchr(op, 'W')) {
+			fill_page(buf, slot);
+			if (pwrite(fd, buf, PAGE_SZ, off) != PAGE_SZ) {
+				perror("pwrite");
+				break;
+			}
+		} else if (strchr(op, 'R')) {
+			if (pread(fd, buf, PAGE_SZ, off) != PAGE_SZ) {
+				perror("pread");
+				break;
+			}
+		} else {
+			continue;
+		}
+
+		if (++nr_io % interval == 0)
+			report(nr_io);
+	}
+	report(nr_io);
+
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Compression streams for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/gfp.h>
+
+#include "zcomp.h"
+
+/* Compressors zram can use, if the crypto API provides them */
+static const char * const backends[] = {
+	"lzo",
+	"lz4",
+	"deflate",
+	NULL
+};
+
+/*
+ * Look up an algorithm by name, as written to sysfs. Returns the name as
+ * the one to pass to zcomp_create(), or NULL if it is not available.
+ */
+const char *zcomp_find_algorithm(const char *name)
+{
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (sysfs_streq(name, backends[i]))
+			return crypto_has_comp(backends[i], 0, 0) ?
+				backends[i] : NULL;
+	}
+
+	return NULL;
+}
+
+/* List the available algorithms, with the current one in brackets */
+ssize_t zcomp_available_show(const char *cur, char *buf)
+{
+	int i;
+	ssize_t len = 0;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(cur, backends[i]))
+			len += sprintf(buf + len, "[%s] ", backends[i]);
+		else if (crypto_has_comp(backends[i], 0, 0))
+			len += sprintf(buf + len, "%s ", backends[i]);
+	}
+	if (len)
+		buf[len - 1] = '\n';
+
+	return len;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (zstrm->tfm && !IS_ERR(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(comp->name, 0, 0);
+	/*
+	 * allocate 2 pages. 1 for compressed data, plus 1 extra for the
+	 * case when compressed size is larger than the original one
+	 */
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/* Get an idle stream, or wait for one to be released. */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&comp->strm_lock);
+
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+static void zcomp_stats_add(struct zcomp_stats *dst, struct zcomp_stats *src)
+{
+	dst->num_compress += src->num_compress;
+	dst->compress_in += src->compress_in;
+	dst->compress_out += src->compress_out;
+	dst->compress_ns += src->compress_ns;
+	dst->num_decompress += src->num_decompress;
+	dst->decompress_in += src->decompress_in;
+	dst->decompress_ns += src->decompress_ns;
+}
+
+/*
+ * Stats are counted in the stream while it is in use and only added up
+ * here, under the lock we take anyway, so they cost no extra locking.
+ */
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	zcomp_stats_add(&comp->stats, &zstrm->stats);
+	memset(&zstrm->stats, 0, sizeof(zstrm->stats));
+	list_add(&zstrm->list, &comp->idle_strm);
+	spin_unlock(&comp->strm_lock);
+
+	wake_up(&comp->strm_wait);
+}
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len)
+{
+	unsigned int len = PAGE_SIZE * 2;
+	ktime_t start;
+	int ret;
+
+	start = ktime_get();
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+				zstrm->buffer, &len);
+	zstrm->stats.compress_ns +=
+		ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret)
+		return ret;
+
+	zstrm->stats.num_compress++;
+	zstrm->stats.compress_in += PAGE_SIZE;
+	zstrm->stats.compress_out += len;
+
+	*dst_len = len;
+	return 0;
+}
+
+int zcomp_decompress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t src_len, unsigned char *dst)
+{
+	unsigned int len = PAGE_SIZE;
+	ktime_t start;
+	int ret;
+
+	start = ktime_get();
+	ret = crypto_comp_decompress(zstrm->tfm, src, src_len, dst, &len);
+	zstrm->stats.decompress_ns +=
+		ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ret)
+		return ret;
+	if (len != PAGE_SIZE)
+		return -EINVAL;
+
+	zstrm->stats.num_decompress++;
+	zstrm->stats.decompress_in += src_len;
+
+	return 0;
+}
+
+void zcomp_get_stats(struct zcomp *comp, struct zcomp_stats *stats)
+{
+	spin_lock(&comp->strm_lock);
+	*stats = comp->stats;
+	spin_unlock(&comp->strm_lock);
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	kfree(comp);
+}
+
+/*
+ * All streams are allocated up front: crypto transforms can only be
+ * allocated with GFP_KERNEL, which must not be done from the I/O path of
+ * a swap device.  If memory is short, the device makes do with fewer
+ * streams, but at least one.
+ */
+struct zcomp *zcomp_create(const char *name, int max_strm)
+{
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+	int i;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->name = name;
+
+	for (i = 0; i < max(max_strm, 1); i++) {
+		zstrm = zcomp_strm_alloc(comp);
+		if (!zstrm)
+			break;
+		list_add(&zstrm->list, &comp->idle_strm);
+		comp->avail_strm++;
+	}
+
+	if (!comp->avail_strm) {
+		kfree(comp);
+		return NULL;
+	}
+
+	return comp;
+}
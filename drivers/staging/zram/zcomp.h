@@ -0,0 +1,69 @@
+/*
+ * Compression streams for zram
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/* Compressor statistics, see comp_stats in zram.txt */
+struct zcomp_stats {
+	u64 num_compress;	/* pages compressed */
+	u64 compress_in;	/* bytes passed to the compressor */
+	u64 compress_out;	/* bytes it produced */
+	u64 compress_ns;	/* time spent compressing */
+	u64 num_decompress;	/* pages decompressed */
+	u64 decompress_in;	/* compressed bytes read */
+	u64 decompress_ns;	/* time spent decompressing */
+};
+
+/*
+ * A compression stream is the per-user state needed to compress or
+ * decompress one page: a crypto_comp transform of the device's algorithm,
+ * holding its working memory, and a buffer for compressed output.  Readers
+ * and writers grab an idle stream, so up to max_strm pages are processed
+ * in parallel.
+ */
+struct zcomp_strm {
+	void *buffer;		/* compressed output, two pages */
+	struct crypto_comp *tfm;
+	struct list_head list;
+	struct zcomp_stats stats;	/* folded into zcomp on release */
+};
+
+struct zcomp {
+	spinlock_t strm_lock;	/* protects idle_strm and stats */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;		/* streams allocated */
+	const char *name;	/* crypto algorithm */
+	struct zcomp_stats stats;
+};
+
+const char *zcomp_find_algorithm(const char *name);
+ssize_t zcomp_available_show(const char *cur, char *buf);
+
+struct zcomp *zcomp_create(const char *name, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t src_len, unsigned char *dst);
+
+void zcomp_get_stats(struct zcomp *comp, struct zcomp_stats *stats);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * Compressed RAM block device - same content page deduplication
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Identical pages compress to identical objects, so pages are matched on
+ * their compressed form: a jhash of the compressed data picks candidates
+ * from a hash table, and a memcmp against the stored object verifies the
+ * match.  Slots with the same content then share one object, counted in
+ * its zram_dedup_entry.
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* One hash bucket per this many disk pages */
+#define ZRAM_DEDUP_PAGES_PER_BUCKET	8
+#define ZRAM_DEDUP_MIN_BUCKETS		256
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[checksum & (zram->dedup_hash_size - 1)];
+}
+
+/*
+ * Find a stored object with the same compressed contents and take a
+ * reference on it. Returns NULL if there is none; *checksum is set for a
+ * subsequent zram_dedup_insert() either way.
+ */
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+			const unsigned char *mem, size_t len, u32 *checksum)
+{
+	struct zram_dedup_entry *entry;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+	int match;
+
+	*checksum = jhash(mem, len, 0);
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos,
+			zram_dedup_bucket(zram, *checksum), node) {
+		if (entry->checksum != *checksum || entry->size != len)
+			continue;
+
+		cmem = zram_obj_map(zram, entry->handle, ZS_MM_RO);
+		match = !memcmp(cmem, mem, len);
+		zram_obj_unmap(zram, entry->handle, cmem);
+
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+/*
+ * Make a newly stored object available for sharing. Returns NULL if no
+ * memory is available for the entry, in which case the object is simply
+ * not shared.
+ */
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+			unsigned long handle, size_t len, u32 checksum)
+{
+	struct zram_dedup_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = handle;
+	entry->checksum = checksum;
+	entry->size = len;
+	entry->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Drop a reference to a shared object. When the last one goes away, the
+ * entry is freed and the object's handle is returned for the caller to
+ * free; otherwise 0 is returned.
+ */
+unsigned long zram_dedup_put(struct zram *zram,
+			struct zram_dedup_entry *entry)
+{
+	unsigned long handle = 0;
+
+	spin_lock(&zram->dedup_lock);
+	if (!--entry->refcount) {
+		hlist_del(&entry->node);
+		handle = entry->handle;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	if (handle)
+		kfree(entry);
+
+	return handle;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i, size;
+
+	if (!zram->dedup)
+		return 0;
+
+	size = max_t(size_t, ZRAM_DEDUP_MIN_BUCKETS,
+			num_pages / ZRAM_DEDUP_PAGES_PER_BUCKET);
+	size = rounddown_pow_of_two(size);
+
+	zram->dedup_hash = vmalloc(size * sizeof(*zram->dedup_hash));
+	if (!zram->dedup_hash)
+		return -ENOMEM;
+
+	for (i = 0; i < size; i++)
+		INIT_HLIST_HEAD(&zram->dedup_hash[i]);
+	zram->dedup_hash_size = size;
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+	zram->dedup_hash_size = 0;
+}
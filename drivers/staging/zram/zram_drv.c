@@ -29,7 +29,6 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -133,15 +132,114 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/*
+ * Compressed objects come from xvmalloc or zsmalloc, as chosen for the
+ * device before initialization. xvmalloc objects are identified by page
+ * and offset, which are packed into a handle so that the table does not
+ * need to know the difference.
+ */
+static unsigned long xv_to_handle(struct page *page, u32 offset)
+{
+	/* xvmalloc objects are at least 4 byte aligned */
+	return (page_to_pfn(page) << (PAGE_SHIFT - 2)) | (offset >> 2);
+}
+
+static struct page *handle_to_xv(unsigned long handle, u32 *offset)
+{
+	*offset = (handle << 2) & ~PAGE_MASK;
+	return pfn_to_page(handle >> (PAGE_SHIFT - 2));
+}
+
+static unsigned long zram_obj_malloc(struct zram *zram, size_t size)
+{
+	struct page *page;
+	u32 offset;
+
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		return zs_malloc(zram->zs_pool, size,
+				GFP_NOIO | __GFP_HIGHMEM);
+
+	if (xv_malloc(zram->mem_pool, size, &page, &offset,
+			GFP_NOIO | __GFP_HIGHMEM))
+		return 0;
+	return xv_to_handle(page, offset);
+}
+
+static void zram_obj_free(struct zram *zram, unsigned long handle)
+{
+	struct page *page;
+	u32 offset;
+
+	if (zram->allocator == ZRAM_ZSMALLOC) {
+		zs_free(zram->zs_pool, handle);
+		return;
+	}
+
+	page = handle_to_xv(handle, &offset);
+	xv_free(zram->mem_pool, page, offset);
+}
+
+/* Objects are mapped with KM_USER1 */
+void *zram_obj_map(struct zram *zram, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct page *page;
+	u32 offset;
+
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		return zs_map_object(zram->zs_pool, handle, mm);
+
+	page = handle_to_xv(handle, &offset);
+	return kmap_atomic(page, KM_USER1) + offset;
+}
+
+void zram_obj_unmap(struct zram *zram, unsigned long handle,
+			void *cmem)
+{
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		zs_unmap_object(zram->zs_pool, handle);
+	else
+		kunmap_atomic(cmem, KM_USER1);
+}
+
+u64 zram_get_mem_used(struct zram *zram)
+{
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		return zs_get_total_size_bytes(zram->zs_pool);
+	return xv_get_total_size_bytes(zram->mem_pool);
+}
+
+/*
+ * Give back pages of sparsely used zspages. xvmalloc cannot move
+ * objects, so there is nothing to do for it.
+ */
+unsigned long zram_compact(struct zram *zram)
+{
+	unsigned long freed = 0;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done && zram->allocator == ZRAM_ZSMALLOC) {
+		freed = zs_compact(zram->zs_pool);
+		zram_stat64_add(zram, &zram->stats.pages_compacted, freed);
+	}
+	mutex_unlock(&zram->init_lock);
+
+	return freed;
+}
+
+/*
+ * Free the memory backing a table entry.  Called with table_lock held
+ * for writing.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	unsigned long handle = zram->table[index].handle;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,28 +251,55 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_wb_free_block(zram, handle);
+		zram_stat64_sub(zram, &zram->stats.bd_count, 1);
+		goto out_stored;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		__free_page((struct page *)handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
+	clen = zram->table[index].size;
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		handle = zram_dedup_put(zram,
+				(struct zram_dedup_entry *)handle);
+		if (!handle) {
+			/* Other slots still share the object */
+			zram_stat64_sub(zram, &zram->stats.dup_data_size, clen);
+			goto out_stored;
+		}
+	}
+	zram_obj_free(zram, handle);
+
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
+out_stored:
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+}
+
+/* Allocator handle of the object stored for a compressed table entry */
+static unsigned long zram_obj_handle(struct zram *zram, u32 index)
+{
+	unsigned long handle = zram->table[index].handle;
+
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		handle = ((struct zram_dedup_entry *)handle)->handle;
+
+	return handle;
 }
 
 static void handle_zero_page(struct page *page)
@@ -194,8 +319,7 @@ static void handle_uncompressed_page(struct zram *zram,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic((struct page *)zram->table[index].handle, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -204,78 +328,145 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
+/*
+ * Copy out the contents of a slot kept in memory. Called with table_lock
+ * held.
+ */
+static int zram_read_page(struct zram *zram, struct zcomp_strm *zstrm,
+			struct page *page, u32 index)
+{
+	int ret;
+	unsigned long handle;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		handle_zero_page(page);
+		return 0;
+	}
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].handle)) {
+		pr_debug("Read before write: page=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+
+	handle = zram_obj_handle(zram, index);
+	cmem = zram_obj_map(zram, handle, ZS_MM_RO);
+
+	ret = zcomp_decompress(zram->comp, zstrm, cmem + sizeof(*zheader),
+			zram->table[index].size, user_mem);
+
+	zram_obj_unmap(zram, handle, cmem);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	/* Should NEVER happen. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		return ret;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
 static void zram_read(struct zram *zram, struct bio *bio)
 {
 
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+	struct zcomp_strm *zstrm;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
+	/*
+	 * Decompression needs a stream of the device's algorithm too. Get
+	 * it before taking table_lock, since we may have to wait for one.
+	 */
+	zstrm = zcomp_strm_find(zram->comp);
+
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		size_t clen;
+		unsigned long blk, seq;
 		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
-
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
-
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
-
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
+again:
+		/*
+		 * Keep the entry from being freed or replaced by a
+		 * concurrent write or swap slot free while we copy it out.
+		 * Clearing ZRAM_IDLE is fine under the read lock: readers of
+		 * a slot all store the same value.
+		 */
+		read_lock(&zram->table_lock);
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+			/*
+			 * The block is read without table_lock, so the slot
+			 * may be freed and its block given to another slot
+			 * meanwhile.  Read it again if the slot no longer
+			 * owns the block afterwards, or if any block was
+			 * allocated during the read.
+			 */
+			blk = zram->table[index].handle;
+			seq = atomic_long_read(&zram->wb_alloc_seq);
+			read_unlock(&zram->table_lock);
+
+			/* Do not hold up writers while waiting for the disk */
+			zcomp_strm_release(zram->comp, zstrm);
+			ret = zram_bdev_read_page(zram, page, blk);
+			zstrm = zcomp_strm_find(zram->comp);
+
+			read_lock(&zram->table_lock);
+			if (!zram_test_flag(zram, index, ZRAM_WB) ||
+			    zram->table[index].handle != blk ||
+			    atomic_long_read(&zram->wb_alloc_seq) != seq) {
+				read_unlock(&zram->table_lock);
+				goto again;
+			}
+			read_unlock(&zram->table_lock);
+
+			if (!ret) {
+				zram_stat64_inc(zram, &zram->stats.bd_reads);
+				flush_dcache_page(page);
+			} else {
+				pr_err("Error reading page %u from backing "
+					"device: block %lu\n", index, blk);
+			}
+		} else {
+			ret = zram_read_page(zram, zstrm, page, index);
+			read_unlock(&zram->table_lock);
 		}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
-
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
-
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
+		/* Return bio error if the page could not be read. */
+		if (unlikely(ret)) {
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
 
-		flush_dcache_page(page);
 		index++;
 	}
 
+	zcomp_strm_release(zram->comp, zstrm);
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
 out:
+	zcomp_strm_release(zram->comp, zstrm);
 	bio_io_error(bio);
 }
 
@@ -290,42 +481,49 @@ static void zram_write(struct zram *zram, struct bio *bio)
 
 	bio_for_each_segment(bvec, bio, i) {
 		int ret;
-		u32 offset;
+		u32 checksum;
 		size_t clen;
+		unsigned long handle;
+		struct zram_dedup_entry *dentry = NULL;
+		struct zcomp_strm *zstrm;
 		struct zobj_header *zheader;
 		struct page *page, *page_store;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
 
 		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
+		 * Compression and allocation are done without table_lock,
+		 * on a stream of our own, so that writers on different cpus
+		 * (kswapd and direct reclaimers) do not wait for each other.
+		 * Only the table update at the end is serialized.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
+		zstrm = zcomp_strm_find(zram->comp);
 
 		user_mem = kmap_atomic(page, KM_USER0);
 		if (page_zero_filled(user_mem)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
+			zcomp_strm_release(zram->comp, zstrm);
+
+			write_lock(&zram->table_lock);
+			/*
+			 * System overwrites unused sectors. Free memory
+			 * associated with this sector now.
+			 */
+			zram_free_page(zram, index);
 			zram_set_flag(zram, index, ZRAM_ZERO);
+			zram_stat_inc(&zram->stats.pages_zero);
+			write_unlock(&zram->table_lock);
 			index++;
 			continue;
 		}
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		ret = zcomp_compress(zram->comp, zstrm, user_mem, &clen);
 
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zcomp_strm_release(zram->comp, zstrm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -340,7 +538,7 @@ static void zram_write(struct zram *zram, struct bio *bio)
 			clen = PAGE_SIZE;
 			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
+				zcomp_strm_release(zram->comp, zstrm);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,52 +546,84 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
+			handle = (unsigned long)page_store;
 			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+			cmem = kmap_atomic(page_store, KM_USER1);
+			memcpy(cmem, src, clen);
+			kunmap_atomic(cmem, KM_USER1);
+			kunmap_atomic(src, KM_USER0);
+			zram_stat64_add(zram, &zram->stats.compr_size, clen);
+			goto update;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		/*
+		 * Share the object of a page with the same contents, if
+		 * there is one: no need to allocate and copy.
+		 */
+		if (zram->dedup) {
+			dentry = zram_dedup_find(zram, zstrm->buffer, clen,
+						&checksum);
+			if (dentry) {
+				zram_stat64_inc(zram, &zram->stats.dedup_hits);
+				zram_stat64_add(zram,
+					&zram->stats.dup_data_size, clen);
+				handle = (unsigned long)dentry;
+				goto update;
+			}
+		}
+
+		handle = zram_obj_malloc(zram, clen + sizeof(*zheader));
+		if (!handle) {
+			zcomp_strm_release(zram->comp, zstrm);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zram_obj_map(zram, handle, ZS_MM_WO);
 
 #if 0
 		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
+		zheader = (struct zobj_header *)cmem;
+		zheader->table_idx = index;
+		cmem += sizeof(*zheader);
 #endif
 
-		memcpy(cmem, src, clen);
+		memcpy(cmem, zstrm->buffer, clen);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+		zram_obj_unmap(zram, handle, cmem);
 
-		/* Update stats */
 		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+		if (zram->dedup) {
+			dentry = zram_dedup_insert(zram, handle, clen,
+						checksum);
+			if (dentry)
+				handle = (unsigned long)dentry;
+		}
+
+update:
+		zcomp_strm_release(zram->comp, zstrm);
+
+		write_lock(&zram->table_lock);
+		zram_free_page(zram, index);
+
+		zram->table[index].handle = handle;
+		if (unlikely(clen == PAGE_SIZE)) {
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+			zram_stat_inc(&zram->stats.pages_expand);
+		} else {
+			zram->table[index].size = clen;
+		}
+		if (dentry)
+			zram_set_flag(zram, index, ZRAM_DEDUP);
+
+		/* Update stats */
 		zram_stat_inc(&zram->stats.pages_stored);
 		if (clen <= PAGE_SIZE / 2)
 			zram_stat_inc(&zram->stats.good_compress);
+		write_unlock(&zram->table_lock);
 
-		mutex_unlock(&zram->lock);
 		index++;
 	}
 
@@ -405,6 +635,130 @@ out:
 	bio_io_error(bio);
 }
 
+/*
+ * Mark all stored pages idle. A page stays idle until it is next
+ * accessed, so that a later writeback of idle pages picks those that were
+ * not used in between.
+ */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	for (index = 0; zram->init_done &&
+			index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->table_lock);
+		if (zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->table_lock);
+		cond_resched();
+	}
+	mutex_unlock(&zram->init_lock);
+}
+
+static int zram_wb_candidate(struct zram *zram, size_t index,
+			enum zram_wb_mode mode)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+	    zram_test_flag(zram, index, ZRAM_DEDUP))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
+
+/*
+ * Write pages to the backing device and free their memory. Each page is
+ * copied out under table_lock and marked ZRAM_UNDER_WB; if the slot is
+ * freed or rewritten while the copy is written, that flag is gone and
+ * the block is given up instead. Shared (dedup) pages are left alone.
+ * Returns the number of pages written back, or a negative error if one
+ * stopped the writeback; the pages written before it are then only
+ * logged, and counted in bd_writes.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int ret = 0, nr_written = 0;
+	size_t index;
+	unsigned long blk;
+	struct page *page;
+	struct zcomp_strm *zstrm;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		cond_resched();
+
+		zstrm = zcomp_strm_find(zram->comp);
+		write_lock(&zram->table_lock);
+		if (!zram_wb_candidate(zram, index, mode)) {
+			write_unlock(&zram->table_lock);
+			zcomp_strm_release(zram->comp, zstrm);
+			continue;
+		}
+		ret = zram_read_page(zram, zstrm, page, index);
+		if (!ret)
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->table_lock);
+		zcomp_strm_release(zram->comp, zstrm);
+		if (ret)
+			break;
+
+		blk = zram_wb_alloc_block(zram);
+		if (blk) {
+			ret = zram_bdev_write_page(zram, page, blk);
+			if (ret) {
+				zram_wb_free_block(zram, blk);
+				blk = 0;
+			}
+		}
+
+		write_lock(&zram->table_lock);
+		if (!blk || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->table_lock);
+			if (!blk)
+				break;	/* backing device full or failing */
+			zram_wb_free_block(zram, blk);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram->table[index].handle = blk;
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_stat_inc(&zram->stats.pages_stored);
+		write_unlock(&zram->table_lock);
+
+		zram_stat64_inc(zram, &zram->stats.bd_count);
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		nr_written++;
+	}
+
+	if (ret)
+		pr_info("Writeback stopped at page %zu after %d pages: "
+			"err=%d\n", index, nr_written, ret);
+	else
+		ret = nr_written;
+out:
+	mutex_unlock(&zram->init_lock);
+	__free_page(page);
+
+	return ret;
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -460,35 +814,42 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free the compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		unsigned long handle = zram->table[index].handle;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		if (!handle || zram_test_flag(zram, index, ZRAM_WB))
+			continue;
 
-		if (!page)
+		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+			__free_page((struct page *)handle);
 			continue;
+		}
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+			handle = zram_dedup_put(zram,
+					(struct zram_dedup_entry *)handle);
+			if (!handle)
+				continue;
+		}
+		zram_obj_free(zram, handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	zram_dedup_fini(zram);
+	zram_reset_backing_dev(zram);
 
 	xv_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
+	if (zram->zs_pool)
+		zs_destroy_pool(zram->zs_pool);
+	zram->zs_pool = NULL;
 
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
@@ -511,16 +872,10 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error allocating %s compression streams\n",
+			zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
@@ -536,13 +891,22 @@ int zram_init_device(struct zram *zram)
 	}
 	memset(zram->table, 0, num_pages * sizeof(*zram->table));
 
+	if (zram_dedup_init(zram, num_pages)) {
+		pr_err("Error allocating deduplication hash table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
-	if (!zram->mem_pool) {
+	if (zram->allocator == ZRAM_ZSMALLOC)
+		zram->zs_pool = zs_create_pool();
+	else
+		zram->mem_pool = xv_create_pool();
+	if (!zram->mem_pool && !zram->zs_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
@@ -567,7 +931,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->table_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -580,9 +946,13 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->table_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram->max_comp_streams = num_online_cpus();
+	zram->compressor = default_compressor;
+	zram->allocator = ZRAM_ZSMALLOC;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -665,11 +1035,15 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	ret = zram_wb_init();
+	if (ret)
+		goto out;
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto wb_exit;
 	}
 
 	if (!num_devices) {
@@ -699,6 +1073,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+wb_exit:
+	zram_wb_exit();
 out:
 	return ret;
 }
@@ -714,9 +1090,11 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_reset_backing_dev(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
+	zram_wb_exit();
 
 	kfree(devices);
 	pr_debug("Cleanup done!\n");
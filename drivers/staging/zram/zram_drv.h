@@ -19,6 +19,8 @@
 #include <linux/mutex.h>
 
 #include "xvmalloc.h"
+#include "zsmalloc.h"
+#include "zcomp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -43,6 +45,9 @@ struct zobj_header {
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compressor, see comp_algorithm in zram.txt */
+static const char default_compressor[] = "lzo";
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -52,7 +57,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 /*
  * NOTE: max_zpage_size must be less than or equal to:
  *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE - sizeof(struct zobj_header)
+ * otherwise, xv_malloc() or zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -71,19 +77,58 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Object is shared: handle points to a struct zram_dedup_entry */
+	ZRAM_DEDUP,
+
+	/* Page is on the backing device: handle is its block there */
+	ZRAM_WB,
+
+	/* Page is being written back */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since the last 'idle' mark */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/* Allocators for compressed objects (zram->allocator) */
+enum zram_allocator {
+	ZRAM_XVMALLOC,
+	ZRAM_ZSMALLOC,
+};
+
+/* Slots written back by zram_writeback() */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,		/* not accessed since marked idle */
+	ZRAM_WB_HUGE,		/* stored uncompressed */
+};
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	/*
+	 * zsmalloc handle, or encoded page and offset of an xvmalloc
+	 * object. For ZRAM_UNCOMPRESSED pages, the struct page itself,
+	 * for ZRAM_DEDUP pages the shared zram_dedup_entry and for ZRAM_WB
+	 * pages the block on the backing device.
+	 */
+	unsigned long handle;
+	u16 size;	/* compressed size of the object */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/* A compressed object shared by all slots with the same contents */
+struct zram_dedup_entry {
+	struct hlist_node node;		/* in zram->dedup_hash */
+	unsigned long handle;		/* allocator handle of the object */
+	u32 checksum;			/* jhash of the compressed data */
+	u16 size;			/* compressed size */
+	u32 refcount;			/* slots sharing the object */
+};
+
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
 	u64 num_reads;		/* failed + successful */
@@ -92,6 +137,12 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 pages_compacted;	/* pages freed by compaction */
+	u64 dedup_hits;		/* writes that found an identical object */
+	u64 dup_data_size;	/* compressed bytes saved by sharing */
+	u64 bd_count;		/* pages on the backing device */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
@@ -99,13 +150,14 @@ struct zram_stats {
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	int allocator;		/* enum zram_allocator */
+	struct xv_pool *mem_pool;	/* ZRAM_XVMALLOC */
+	struct zs_pool *zs_pool;	/* ZRAM_ZSMALLOC */
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t table_lock;	/* protect table entries and 32-bit stats;
+				 * compression itself runs unlocked */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +168,21 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	int max_comp_streams;	/* max. pages compressed in parallel */
+	const char *compressor;	/* crypto compression algorithm */
+
+	/* Same content page deduplication, see zram_dedup.c */
+	int dedup;		/* enabled for this device */
+	spinlock_t dedup_lock;	/* protects dedup_hash and refcounts */
+	struct hlist_head *dedup_hash;
+	size_t dedup_hash_size;
+
+	/* Writeback to a backing device, see zram_wb.c */
+	struct block_device *bdev;
+	char *backing_dev;	/* path it was opened by */
+	unsigned long *bitmap;	/* blocks in use */
+	unsigned long nr_blocks;
+	atomic_long_t wb_alloc_seq;	/* bumped by each block allocation */
 
 	struct zram_stats stats;
 };
@@ -128,5 +195,33 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern u64 zram_get_mem_used(struct zram *zram);
+extern unsigned long zram_compact(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+extern void zram_mark_idle(struct zram *zram);
+extern void *zram_obj_map(struct zram *zram, unsigned long handle,
+			enum zs_mapmode mm);
+extern void zram_obj_unmap(struct zram *zram, unsigned long handle,
+			void *cmem);
+
+extern struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+			const unsigned char *mem, size_t len, u32 *checksum);
+extern struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+			unsigned long handle, size_t len, u32 checksum);
+extern unsigned long zram_dedup_put(struct zram *zram,
+			struct zram_dedup_entry *entry);
+extern int zram_dedup_init(struct zram *zram, size_t num_pages);
+extern void zram_dedup_fini(struct zram *zram);
+
+extern int zram_set_backing_dev(struct zram *zram, const char *buf);
+extern void zram_reset_backing_dev(struct zram *zram);
+extern unsigned long zram_wb_alloc_block(struct zram *zram);
+extern void zram_wb_free_block(struct zram *zram, unsigned long blk);
+extern int zram_bdev_write_page(struct zram *zram, struct page *page,
+			unsigned long blk);
+extern int zram_bdev_read_page(struct zram *zram, struct page *page,
+			unsigned long blk);
+extern int zram_wb_init(void);
+extern void zram_wb_exit(void);
 
 #endif
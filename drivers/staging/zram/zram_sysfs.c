@@ -72,6 +72,205 @@ static ssize_t disksize_store(struct device *dev,
 	return len;
 }
 
+static ssize_t max_comp_streams_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->max_comp_streams);
+}
+
+static ssize_t max_comp_streams_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long num;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change max_comp_streams for initialized "
+			"device\n");
+		return -EBUSY;
+	}
+
+	ret = strict_strtoul(buf, 10, &num);
+	if (ret)
+		return ret;
+	if (!num || num > INT_MAX)
+		return -EINVAL;
+
+	zram->max_comp_streams = num;
+
+	return len;
+}
+
+static ssize_t comp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return zcomp_available_show(zram->compressor, buf);
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	const char *compressor;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change comp_algorithm for initialized "
+			"device\n");
+		return -EBUSY;
+	}
+
+	compressor = zcomp_find_algorithm(buf);
+	if (!compressor)
+		return -EINVAL;
+
+	zram->compressor = compressor;
+
+	return len;
+}
+
+static const char *zram_allocator_names[] = {
+	[ZRAM_XVMALLOC] = "xvmalloc",
+	[ZRAM_ZSMALLOC] = "zsmalloc",
+};
+
+static ssize_t allocator_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	int i;
+	ssize_t len = 0;
+	struct zram *zram = dev_to_zram(dev);
+
+	for (i = 0; i < ARRAY_SIZE(zram_allocator_names); i++) {
+		if (i == zram->allocator)
+			len += sprintf(buf + len, "[%s] ",
+					zram_allocator_names[i]);
+		else
+			len += sprintf(buf + len, "%s ",
+					zram_allocator_names[i]);
+	}
+	buf[len - 1] = '\n';
+
+	return len;
+}
+
+static ssize_t allocator_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int i;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change allocator for initialized device\n");
+		return -EBUSY;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(zram_allocator_names); i++) {
+		if (sysfs_streq(buf, zram_allocator_names[i])) {
+			zram->allocator = i;
+			return len;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%d\n", zram->dedup);
+}
+
+static ssize_t dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	unsigned long val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change dedup for initialized device\n");
+		return -EBUSY;
+	}
+
+	ret = strict_strtoul(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	zram->dedup = !!val;
+
+	return len;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%s\n",
+		zram->backing_dev ? zram->backing_dev : "none");
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (zram->init_done) {
+		pr_info("Cannot change backing_dev for initialized device\n");
+		return -EBUSY;
+	}
+
+	ret = zram_set_backing_dev(zram, buf);
+	if (ret)
+		return ret;
+
+	return len;
+}
+
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+	if (!zram->init_done)
+		return -EINVAL;
+
+	zram_mark_idle(zram);
+
+	return len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	enum zram_wb_mode mode;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else
+		return -EINVAL;
+
+	ret = zram_writeback(zram, mode);
+	if (ret < 0)
+		return ret;
+
+	return len;
+}
+
 static ssize_t initstate_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -112,6 +311,89 @@ static ssize_t reset_store(struct device *dev,
 	return len;
 }
 
+static ssize_t compact_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	if (!zram->init_done)
+		return -EINVAL;
+
+	zram_compact(zram);
+
+	return len;
+}
+
+static ssize_t pages_compacted_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.pages_compacted));
+}
+
+static ssize_t dedup_hits_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dedup_hits));
+}
+
+static ssize_t dup_data_size_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.dup_data_size));
+}
+
+static ssize_t comp_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zcomp_stats stats;
+	struct zram *zram = dev_to_zram(dev);
+
+	memset(&stats, 0, sizeof(stats));
+	if (zram->init_done)
+		zcomp_get_stats(zram->comp, &stats);
+
+	return sprintf(buf, "%llu %llu %llu %llu %llu %llu %llu\n",
+		stats.num_compress, stats.compress_in, stats.compress_out,
+		stats.compress_ns, stats.num_decompress,
+		stats.decompress_in, stats.decompress_ns);
+}
+
+static ssize_t bd_count_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_count));
+}
+
+static ssize_t bd_reads_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_reads));
+}
+
+static ssize_t bd_writes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return sprintf(buf, "%llu\n",
+		zram_stat64_read(zram, &zram->stats.bd_writes));
+}
+
 static ssize_t num_reads_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
@@ -181,7 +463,7 @@ static ssize_t mem_used_total_show(struct device *dev,
 	struct zram *zram = dev_to_zram(dev);
 
 	if (zram->init_done) {
-		val = xv_get_total_size_bytes(zram->mem_pool) +
+		val = zram_get_mem_used(zram) +
 			((u64)(zram->stats.pages_expand) << PAGE_SHIFT);
 	}
 
@@ -190,8 +472,27 @@ static ssize_t mem_used_total_show(struct device *dev,
 
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR,
 		disksize_show, disksize_store);
+static DEVICE_ATTR(max_comp_streams, S_IRUGO | S_IWUSR,
+		max_comp_streams_show, max_comp_streams_store);
+static DEVICE_ATTR(comp_algorithm, S_IRUGO | S_IWUSR,
+		comp_algorithm_show, comp_algorithm_store);
+static DEVICE_ATTR(allocator, S_IRUGO | S_IWUSR,
+		allocator_show, allocator_store);
+static DEVICE_ATTR(dedup, S_IRUGO | S_IWUSR, dedup_show, dedup_store);
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
 static DEVICE_ATTR(initstate, S_IRUGO, initstate_show, NULL);
 static DEVICE_ATTR(reset, S_IWUSR, NULL, reset_store);
+static DEVICE_ATTR(compact, S_IWUSR, NULL, compact_store);
+static DEVICE_ATTR(idle, S_IWUSR, NULL, idle_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+static DEVICE_ATTR(pages_compacted, S_IRUGO, pages_compacted_show, NULL);
+static DEVICE_ATTR(dedup_hits, S_IRUGO, dedup_hits_show, NULL);
+static DEVICE_ATTR(dup_data_size, S_IRUGO, dup_data_size_show, NULL);
+static DEVICE_ATTR(bd_count, S_IRUGO, bd_count_show, NULL);
+static DEVICE_ATTR(bd_reads, S_IRUGO, bd_reads_show, NULL);
+static DEVICE_ATTR(bd_writes, S_IRUGO, bd_writes_show, NULL);
+static DEVICE_ATTR(comp_stats, S_IRUGO, comp_stats_show, NULL);
 static DEVICE_ATTR(num_reads, S_IRUGO, num_reads_show, NULL);
 static DEVICE_ATTR(num_writes, S_IRUGO, num_writes_show, NULL);
 static DEVICE_ATTR(invalid_io, S_IRUGO, invalid_io_show, NULL);
@@ -203,8 +504,23 @@ static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
+	&dev_attr_max_comp_streams.attr,
+	&dev_attr_comp_algorithm.attr,
+	&dev_attr_allocator.attr,
+	&dev_attr_dedup.attr,
+	&dev_attr_backing_dev.attr,
 	&dev_attr_initstate.attr,
 	&dev_attr_reset.attr,
+	&dev_attr_compact.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_pages_compacted.attr,
+	&dev_attr_dedup_hits.attr,
+	&dev_attr_dup_data_size.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
+	&dev_attr_comp_stats.attr,
 	&dev_attr_num_reads.attr,
 	&dev_attr_num_writes.attr,
 	&dev_attr_invalid_io.attr,
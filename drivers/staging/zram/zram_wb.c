@@ -0,0 +1,208 @@
+/*
+ * Compressed RAM block device - writeback to a backing device
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Slots that are idle or do not compress can be written, uncompressed,
+ * to a block device and their memory freed.  The backing device is split
+ * into page sized blocks, tracked in a bitmap; a written back slot holds
+ * the index of its block in place of an object handle.  Block 0 is never
+ * used, so that a handle of 0 still means an empty slot.
+ */
+
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "zram_drv.h"
+
+static const fmode_t zram_bdev_mode = FMODE_READ | FMODE_WRITE;
+
+/* Runs reads of written back slots, see zram_bdev_read_page() */
+static struct workqueue_struct *zram_wb_wq;
+
+int zram_set_backing_dev(struct zram *zram, const char *buf)
+{
+	int ret;
+	char *path;
+	unsigned long nr_pages, *bitmap;
+	struct block_device *bdev;
+
+	path = kstrndup(buf, PATH_MAX, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+
+	bdev = open_bdev_exclusive(strstrip(path), zram_bdev_mode, zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out_free;
+	}
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto out_close;
+	}
+
+	bitmap = vmalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_close;
+	}
+	bitmap_zero(bitmap, nr_pages);
+	set_bit(0, bitmap);
+
+	zram_reset_backing_dev(zram);
+	zram->bdev = bdev;
+	zram->backing_dev = path;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_pages;
+
+	return 0;
+
+out_close:
+	close_bdev_exclusive(bdev, zram_bdev_mode);
+out_free:
+	kfree(path);
+	return ret;
+}
+
+void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	close_bdev_exclusive(zram->bdev, zram_bdev_mode);
+	vfree(zram->bitmap);
+	kfree(zram->backing_dev);
+
+	zram->bdev = NULL;
+	zram->backing_dev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+}
+
+/*
+ * Blocks are only allocated by zram_writeback(), which is serialized by
+ * init_lock, but may be freed at any time.  wb_alloc_seq is bumped before
+ * the new owner writes the block, so that zram_read() can tell whether the
+ * block it read may have been reused meanwhile.
+ */
+unsigned long zram_wb_alloc_block(struct zram *zram)
+{
+	unsigned long blk = 1;
+
+	do {
+		blk = find_next_zero_bit(zram->bitmap, zram->nr_blocks, blk);
+		if (blk == zram->nr_blocks)
+			return 0;
+	} while (test_and_set_bit(blk, zram->bitmap));
+
+	atomic_long_inc(&zram->wb_alloc_seq);
+	smp_mb__after_atomic_inc();
+
+	return blk;
+}
+
+void zram_wb_free_block(struct zram *zram, unsigned long blk)
+{
+	WARN_ON(!test_and_clear_bit(blk, zram->bitmap));
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_bdev_rw_page(struct zram *zram, int rw, struct page *page,
+			unsigned long blk)
+{
+	int ret;
+	struct bio *bio;
+	struct completion done;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	init_completion(&done);
+	bio->bi_private = &done;
+	bio->bi_end_io = zram_bdev_end_io;
+	submit_bio(rw == READ ? READ_SYNC : WRITE_SYNC, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+int zram_bdev_write_page(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	return zram_bdev_rw_page(zram, WRITE, page, blk);
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *w =
+		container_of(work, struct zram_bdev_work, work);
+
+	w->ret = zram_bdev_rw_page(w->zram, READ, w->page, w->blk);
+}
+
+/*
+ * Reads come from zram_make_request(), where bios we submit are only
+ * queued until we return, so waiting for one there would never end. The
+ * read is issued and waited for from a worker instead.
+ */
+int zram_bdev_read_page(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bdev_work w;
+
+	w.zram = zram;
+	w.page = page;
+	w.blk = blk;
+	INIT_WORK(&w.work, zram_bdev_read_work);
+
+	queue_work(zram_wb_wq, &w.work);
+	flush_work(&w.work);
+
+	return w.ret;
+}
+
+int zram_wb_init(void)
+{
+	zram_wb_wq = create_mem_reclaim_workqueue("zram_wb");
+
+	return zram_wb_wq ? 0 : -ENOMEM;
+}
+
+void zram_wb_exit(void)
+{
+	destroy_workqueue(zram_wb_wq);
+}
@@ -0,0 +1,704 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * A size class allocator for compressed pages.  Unlike xvmalloc, which
+ * keeps every object within a single page, objects are packed back to
+ * back into groups of pages and may straddle page boundaries, so there is
+ * little internal waste even for sizes just under PAGE_SIZE.  Objects are
+ * referred to by opaque handles, which lets zs_compact() move objects out
+ * of sparsely used zspages and give the pages back.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <asm/atomic.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/*
+ * Objects that span two pages are accessed through a per-cpu bounce
+ * buffer between zs_map_object() and zs_unmap_object().
+ */
+struct mapping_area {
+	char *vm_buf;			/* bounce buffer, ZS_MAX_ALLOC_SIZE */
+	char *vm_addr;			/* kmap address, if not bounced */
+	struct zspage *zspage;		/* object being mapped */
+	unsigned long off;
+	size_t size;
+	enum zs_mapmode vm_mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+/* Caches and bounce buffers shared by all pools */
+static DEFINE_MUTEX(zs_init_lock);
+static int zs_nr_pools;
+static struct kmem_cache *zs_handle_cachep;
+static struct kmem_cache *zs_zspage_cachep;
+
+static int zs_get_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Number of pages per zspage that wastes the least space at the end of
+ * the zspage for objects of the given size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int waste = zspage_size % class_size;
+		int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static unsigned long location_to_obj(struct zspage *zspage,
+				unsigned int idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(zspage->pages[0]) << OBJ_INDEX_BITS;
+	obj |= idx & OBJ_INDEX_MASK;
+
+	return obj << OBJ_TAG_BITS;
+}
+
+static struct zspage *obj_to_location(unsigned long obj, unsigned int *idx)
+{
+	obj >>= OBJ_TAG_BITS;
+	*idx = obj & OBJ_INDEX_MASK;
+
+	return (struct zspage *)page_private(pfn_to_page(obj >> OBJ_INDEX_BITS));
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
+
+/* Only called with the handle pinned: keeps the pin bit set */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(volatile unsigned long *)handle = obj | (1UL << HANDLE_PIN_BIT);
+}
+
+static void pin_handle(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_handle(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_handle(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+/*
+ * Copy between a buffer and the object area [off, off + len) of a
+ * zspage, which may cross page boundaries.
+ */
+static void zs_copy_from(struct zspage *zspage, unsigned long off,
+			void *buf, size_t len, enum km_type km)
+{
+	while (len) {
+		size_t chunk = min_t(size_t, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		char *addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], km);
+
+		memcpy(buf, addr + (off & ~PAGE_MASK), chunk);
+		kunmap_atomic(addr, km);
+		buf += chunk;
+		off += chunk;
+		len -= chunk;
+	}
+}
+
+static void zs_copy_to(struct zspage *zspage, unsigned long off,
+			const void *buf, size_t len, enum km_type km)
+{
+	while (len) {
+		size_t chunk = min_t(size_t, len, PAGE_SIZE - (off & ~PAGE_MASK));
+		char *addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], km);
+
+		memcpy(addr + (off & ~PAGE_MASK), buf, chunk);
+		kunmap_atomic(addr, km);
+		buf += chunk;
+		off += chunk;
+		len -= chunk;
+	}
+}
+
+/* Object headers never cross a page: objects are ZS_SIZE_CLASS_DELTA aligned */
+static unsigned long *get_header_atomic(struct size_class *class,
+			struct zspage *zspage, unsigned int idx, enum km_type km)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+	char *addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], km);
+
+	return (unsigned long *)(addr + (off & ~PAGE_MASK));
+}
+
+static void put_header_atomic(unsigned long *header, enum km_type km)
+{
+	kunmap_atomic(header, km);
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	unsigned int inuse = zspage->inuse;
+	unsigned int max = class->objs_per_zspage;
+
+	if (!inuse)
+		return ZS_EMPTY;
+	if (inuse == max)
+		return ZS_FULL;
+	if (inuse <= max * ZS_ALMOST_FULL_PERC / 100)
+		return ZS_ALMOST_EMPTY;
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move the zspage to the fullness list matching its current usage.
+ * Empty zspages are taken off the lists; the caller frees them.
+ */
+static void fix_fullness_group(struct size_class *class,
+				struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg == zspage->fullness)
+		return;
+
+	if (newfg == ZS_EMPTY)
+		list_del_init(&zspage->list);
+	else
+		list_move(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kmem_cache_free(zs_zspage_cachep, zspage);
+
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/*
+ * Allocate a zspage for the class and link all its objects into a free
+ * list.  Called without the class lock.
+ */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class, gfp_t flags)
+{
+	struct zspage *zspage;
+	unsigned long *header;
+	unsigned int idx;
+	int i;
+
+	zspage = kmem_cache_zalloc(zs_zspage_cachep, flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i])
+			goto fail;
+		set_page_private(zspage->pages[i], (unsigned long)zspage);
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (idx = 0; idx < class->objs_per_zspage; idx++) {
+		header = get_header_atomic(class, zspage, idx, KM_USER0);
+		*header = (unsigned long)(idx + 1) << OBJ_TAG_BITS;
+		put_header_atomic(header, KM_USER0);
+	}
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+
+fail:
+	while (i--) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kmem_cache_free(zs_zspage_cachep, zspage);
+	return NULL;
+}
+
+/* Take a free object off the zspage and tag it with handle */
+static unsigned int obj_malloc(struct size_class *class,
+			struct zspage *zspage, unsigned long handle,
+			enum km_type km)
+{
+	unsigned int idx = zspage->freeidx;
+	unsigned long *header;
+
+	header = get_header_atomic(class, zspage, idx, km);
+	zspage->freeidx = *header >> OBJ_TAG_BITS;
+	*header = handle | OBJ_ALLOCATED_TAG;
+	put_header_atomic(header, km);
+
+	zspage->inuse++;
+	class->obj_used++;
+	fix_fullness_group(class, zspage);
+
+	return idx;
+}
+
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, enum km_type km)
+{
+	unsigned long *header;
+
+	header = get_header_atomic(class, zspage, idx, km);
+	*header = (unsigned long)zspage->freeidx << OBJ_TAG_BITS;
+	put_header_atomic(header, km);
+	zspage->freeidx = idx;
+
+	zspage->inuse--;
+	class->obj_used--;
+	fix_fullness_group(class, zspage);
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+					struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: gfp flags for growing the pool
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned long handle;
+	unsigned int idx;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cachep,
+						flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[zs_get_class_index(size + ZS_HANDLE_SIZE)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, (void *)handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		class->obj_allocated += class->objs_per_zspage;
+	}
+
+	idx = obj_malloc(class, zspage, handle, KM_USER0);
+	*(unsigned long *)handle = location_to_obj(zspage, idx);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (unlikely(!handle))
+		return;
+
+	/* The object cannot be moved while its handle is pinned */
+	pin_handle(handle);
+	zspage = obj_to_location(handle_to_obj(handle), &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, idx, KM_USER0);
+	if (zspage->fullness == ZS_EMPTY) {
+		class->obj_allocated -= class->objs_per_zspage;
+		free_zspage(pool, class, zspage);
+	}
+	spin_unlock(&class->lock);
+	unpin_handle(handle);
+
+	kmem_cache_free(zs_handle_cachep, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * The object is mapped with KM_USER1, so the caller may hold a KM_USER0
+ * mapping of its own.  It must not sleep, nor map another object, before
+ * calling zs_unmap_object().
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct mapping_area *area;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+	unsigned long off;
+
+	BUG_ON(!handle);
+
+	/* Disables preemption until zs_unmap_object() */
+	pin_handle(handle);
+
+	zspage = obj_to_location(handle_to_obj(handle), &idx);
+	class = zspage->class;
+	off = (unsigned long)idx * class->size + ZS_HANDLE_SIZE;
+
+	area = &__get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	area->size = class->size - ZS_HANDLE_SIZE;
+
+	if ((off & ~PAGE_MASK) + area->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->zspage = NULL;
+		area->vm_addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+						KM_USER1);
+		return area->vm_addr + (off & ~PAGE_MASK);
+	}
+
+	/* this object spans two pages */
+	area->zspage = zspage;
+	area->off = off;
+	if (mm != ZS_MM_WO)
+		zs_copy_from(zspage, off, area->vm_buf, area->size, KM_USER1);
+
+	return area->vm_buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct mapping_area *area = &__get_cpu_var(zs_map_area);
+
+	if (!area->zspage)
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else if (area->vm_mm != ZS_MM_RO)
+		zs_copy_to(area->zspage, area->off, area->vm_buf, area->size,
+				KM_USER1);
+
+	unpin_handle(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/*
+ * Pick a zspage, other than src, to move objects of src into: the fullest
+ * one with free objects.
+ */
+static struct zspage *find_dst_zspage(struct size_class *class,
+				struct zspage *src)
+{
+	struct zspage *zspage;
+	int i;
+
+	for (i = ZS_ALMOST_FULL; i <= ZS_ALMOST_EMPTY; i++) {
+		list_for_each_entry(zspage, &class->fullness_list[i], list) {
+			if (zspage != src)
+				return zspage;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Move all objects out of src into other zspages of the class.  Returns
+ * 1 if src got emptied (and freed), 0 if a pinned object or lack of room
+ * stopped us.  Called with the class lock held.
+ */
+static int migrate_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *src)
+{
+	unsigned long *header, handle, off;
+	struct zspage *dst;
+	unsigned int idx, didx;
+	char *buf = __get_cpu_var(zs_map_area).vm_buf;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		header = get_header_atomic(class, src, idx, KM_USER0);
+		handle = *header;
+		put_header_atomic(header, KM_USER0);
+
+		if (!(handle & OBJ_ALLOCATED_TAG))
+			continue;
+		handle &= ~OBJ_ALLOCATED_TAG;
+
+		dst = find_dst_zspage(class, src);
+		if (!dst)
+			return 0;
+
+		/* mapped or being freed: leave this zspage alone */
+		if (!trypin_handle(handle))
+			return 0;
+
+		off = (unsigned long)idx * class->size + ZS_HANDLE_SIZE;
+		zs_copy_from(src, off, buf, class->size - ZS_HANDLE_SIZE,
+				KM_USER1);
+
+		didx = obj_malloc(class, dst, handle, KM_USER0);
+		off = (unsigned long)didx * class->size + ZS_HANDLE_SIZE;
+		zs_copy_to(dst, off, buf, class->size - ZS_HANDLE_SIZE,
+				KM_USER1);
+
+		record_obj(handle, location_to_obj(dst, didx));
+		obj_free(class, src, idx, KM_USER0);
+		unpin_handle(handle);
+	}
+
+	if (src->fullness != ZS_EMPTY)
+		return 0;
+
+	class->obj_allocated -= class->objs_per_zspage;
+	free_zspage(pool, class, src);
+	return 1;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src;
+
+	spin_lock(&class->lock);
+	/*
+	 * Only bother while the free objects of the class add up to at
+	 * least one whole zspage: otherwise nothing can be freed.
+	 */
+	while (class->obj_allocated - class->obj_used >=
+					class->objs_per_zspage &&
+			!list_empty(&class->fullness_list[ZS_ALMOST_EMPTY])) {
+		src = list_entry(class->fullness_list[ZS_ALMOST_EMPTY].prev,
+				struct zspage, list);
+
+		/* preemption is disabled by the class lock */
+		if (!migrate_zspage(pool, class, src))
+			break;
+		freed += class->pages_per_zspage;
+
+		if (need_resched()) {
+			spin_unlock(&class->lock);
+			cond_resched();
+			spin_lock(&class->lock);
+		}
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - move objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Objects that are mapped or being freed at the time are skipped.
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		freed += compact_class(pool, &pool->size_class[i]);
+		cond_resched();
+	}
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static void zs_put_globals(void)
+{
+	int cpu;
+
+	mutex_lock(&zs_init_lock);
+	if (--zs_nr_pools) {
+		mutex_unlock(&zs_init_lock);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zs_map_area, cpu).vm_buf);
+		per_cpu(zs_map_area, cpu).vm_buf = NULL;
+	}
+	if (zs_zspage_cachep)
+		kmem_cache_destroy(zs_zspage_cachep);
+	if (zs_handle_cachep)
+		kmem_cache_destroy(zs_handle_cachep);
+	zs_zspage_cachep = NULL;
+	zs_handle_cachep = NULL;
+	mutex_unlock(&zs_init_lock);
+}
+
+static int zs_get_globals(void)
+{
+	int cpu;
+
+	mutex_lock(&zs_init_lock);
+	if (zs_nr_pools++) {
+		mutex_unlock(&zs_init_lock);
+		return 0;
+	}
+
+	zs_handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+						0, 0, NULL);
+	zs_zspage_cachep = kmem_cache_create("zs_zspage",
+				sizeof(struct zspage), 0, 0, NULL);
+	if (!zs_handle_cachep || !zs_zspage_cachep)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		per_cpu(zs_map_area, cpu).vm_buf =
+			kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!per_cpu(zs_map_area, cpu).vm_buf)
+			goto fail;
+	}
+	mutex_unlock(&zs_init_lock);
+
+	return 0;
+
+fail:
+	mutex_unlock(&zs_init_lock);
+	zs_put_globals();
+	return -ENOMEM;
+}
+
+struct zs_pool *zs_create_pool(void)
+{
+	struct zs_pool *pool;
+	int i, j;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	if (zs_get_globals()) {
+		kfree(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+	}
+	atomic_long_set(&pool->pages_allocated, 0);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	struct zspage *zspage, *tmp;
+	int i, j;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++) {
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[j], list) {
+				pr_info("zsmalloc: freeing non-empty zspage "
+					"(class size %d)\n", class->size);
+				list_del(&zspage->list);
+				free_zspage(pool, class, zspage);
+			}
+		}
+	}
+
+	kfree(pool);
+	zs_put_globals();
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
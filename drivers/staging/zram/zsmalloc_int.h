@@ -0,0 +1,112 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * Objects are packed into "zspages": groups of up to
+ * ZS_MAX_PAGES_PER_ZSPAGE (not necessarily contiguous) pages, chosen per
+ * size class so that the zspage is used as fully as possible.  Objects
+ * are laid out back to back and may span two pages of a zspage.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * Every object starts with a ZS_HANDLE_SIZE header.  An allocated object
+ * stores its handle there (tagged with OBJ_ALLOCATED_TAG), so that
+ * compaction can find and update the handle when it moves the object.  A
+ * free object stores the index of the next free object in its zspage.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_TAG_BITS		1
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA apart; this is also the alignment
+ * of objects within a zspage.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A handle points to a word holding the location of its object: the pfn
+ * of the first page of the zspage and the index of the object within it,
+ * shifted left by OBJ_TAG_BITS.  Bit 0 of the word is HANDLE_PIN_BIT,
+ * held while the object is mapped, freed or moved.
+ */
+#ifndef MAX_PHYSMEM_BITS
+#ifdef CONFIG_HIGHMEM64G
+#define MAX_PHYSMEM_BITS	36
+#else
+#define MAX_PHYSMEM_BITS	BITS_PER_LONG
+#endif
+#endif
+#define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
+#define OBJ_INDEX_BITS		(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
+#define OBJ_INDEX_MASK		((1UL << OBJ_INDEX_BITS) - 1)
+
+#define HANDLE_PIN_BIT		0
+
+/*
+ * A zspage is on the list of its size class matching how full it is.
+ * Allocation prefers ZS_ALMOST_FULL zspages; compaction moves objects out
+ * of ZS_ALMOST_EMPTY ones.
+ */
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+/* A zspage is almost empty at or below this % of objects in use */
+#define ZS_ALMOST_FULL_PERC	75
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* fullness list of the class */
+	struct size_class *class;
+	unsigned int inuse;		/* objects allocated */
+	unsigned int freeidx;		/* first free object */
+	enum fullness_group fullness;
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size, including header */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	/* stats, protected by lock */
+	unsigned long obj_allocated;	/* object slots in all zspages */
+	unsigned long obj_used;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	atomic_long_t pages_allocated;
+};
+
+#endif
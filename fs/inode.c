@@ -263,6 +263,7 @@ void address_space_init_once(struct address_space *mapping)
 	spin_lock_init(&mapping->tree_lock);
 	spin_lock_init(&mapping->i_mmap_lock);
 	INIT_LIST_HEAD(&mapping->private_list);
+	INIT_LIST_HEAD(&mapping->shadow_list);
 	spin_lock_init(&mapping->private_lock);
 	INIT_RAW_PRIO_TREE_ROOT(&mapping->i_mmap);
 	INIT_LIST_HEAD(&mapping->i_mmap_nonlinear);
@@ -328,6 +329,13 @@ void clear_inode(struct inode *inode)
 	might_sleep();
 	invalidate_inode_buffers(inode);
 
+	/*
+	 * Filesystems need not truncate an inode that has no pages left,
+	 * but reclaim may have left the shadow entries of its pages.
+	 */
+	if (inode->i_data.nrshadows)
+		truncate_inode_pages(&inode->i_data, 0);
+
 	BUG_ON(inode->i_data.nrpages);
 	BUG_ON(!(inode->i_state & I_FREEING));
 	BUG_ON(inode->i_state & I_CLEAR);
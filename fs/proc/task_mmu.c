@@ -9,6 +9,8 @@
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/security.h>
+#include <linux/proc_fs.h>
+#include <linux/pid_namespace.h>
 
 #include <asm/elf.h>
 #include <asm/uaccess.h>
@@ -446,6 +448,196 @@ const struct file_operations proc_smaps_operations = {
 	.release	= seq_release_private,
 };
 
+/*
+ * The totals of smaps over all the mappings of an mm, which the caller
+ * holds mmap_sem of: that takes one walk of the page tables, and none
+ * of the formatting that makes reading smaps itself so expensive.
+ */
+static void smaps_rollup_mm(struct mm_struct *mm, struct mem_size_stats *mss)
+{
+	struct vm_area_struct *vma;
+	struct mm_walk smaps_walk = {
+		.pmd_entry = smaps_pte_range,
+		.mm = mm,
+		.private = mss,
+	};
+
+	memset(mss, 0, sizeof(*mss));
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (is_vm_hugetlb_page(vma))
+			continue;
+		mss->vma = vma;
+		walk_page_range(vma->vm_start, vma->vm_end, &smaps_walk);
+	}
+}
+
+static int show_smaps_rollup(struct seq_file *m, void *v)
+{
+	struct task_struct *task;
+	struct mem_size_stats mss;
+	struct mm_struct *mm;
+
+	task = get_pid_task(m->private, PIDTYPE_PID);
+	if (!task)
+		return -ESRCH;
+	mm = mm_for_maps(task);
+	put_task_struct(task);
+	if (!mm)
+		return 0;
+
+	down_read(&mm->mmap_sem);
+	smaps_rollup_mm(mm, &mss);
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+
+	seq_printf(m,
+		   "Rss:            %8lu kB\n"
+		   "Pss:            %8lu kB\n"
+		   "Shared_Clean:   %8lu kB\n"
+		   "Shared_Dirty:   %8lu kB\n"
+		   "Private_Clean:  %8lu kB\n"
+		   "Private_Dirty:  %8lu kB\n"
+		   "Referenced:     %8lu kB\n"
+		   "Swap:           %8lu kB\n",
+		   mss.resident >> 10,
+		   (unsigned long)(mss.pss >> (10 + PSS_SHIFT)),
+		   mss.shared_clean  >> 10,
+		   mss.shared_dirty  >> 10,
+		   mss.private_clean >> 10,
+		   mss.private_dirty >> 10,
+		   mss.referenced >> 10,
+		   mss.swap >> 10);
+	return 0;
+}
+
+static int smaps_rollup_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, show_smaps_rollup, proc_pid(inode));
+}
+
+const struct file_operations proc_smaps_rollup_operations = {
+	.open		= smaps_rollup_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * /proc/smaps_rollup_all: the smaps_rollup of every process, as an array
+ * of binary records.  The file position is the pid to go on from, so a
+ * read returns as many whole records as fit, for the processes with the
+ * next pids, and a buffer large enough for all of them takes one call.
+ * Processes that the reader may not ptrace, and kernel threads, are left
+ * out.  All sizes are in bytes.
+ */
+struct smaps_rollup_record {
+	u32 pid;
+	u32 reserved;
+	u64 rss;
+	u64 pss;
+	u64 shared_clean;
+	u64 shared_dirty;
+	u64 private_clean;
+	u64 private_dirty;
+	u64 referenced;
+	u64 swap;
+};
+
+static struct task_struct *next_rollup_task(struct pid_namespace *ns,
+					    pid_t *nr)
+{
+	struct task_struct *task = NULL;
+	struct pid *pid;
+
+	rcu_read_lock();
+	while ((pid = find_ge_pid(*nr, ns)) != NULL) {
+		*nr = pid_nr_ns(pid, ns);
+		task = pid_task(pid, PIDTYPE_PID);
+		if (task && has_group_leader_pid(task)) {
+			get_task_struct(task);
+			break;
+		}
+		task = NULL;
+		*nr += 1;
+	}
+	rcu_read_unlock();
+	return task;
+}
+
+static ssize_t smaps_rollup_all_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct pid_namespace *ns = file->f_dentry->d_sb->s_fs_info;
+	struct smaps_rollup_record rec;
+	struct mem_size_stats mss;
+	struct task_struct *task;
+	struct mm_struct *mm;
+	ssize_t ret = 0;
+	pid_t nr;
+
+	if (count < sizeof(rec))
+		return -EINVAL;
+	if (*ppos < 0 || *ppos >= PID_MAX_LIMIT)
+		return 0;
+	nr = *ppos;
+
+	while (count - ret >= sizeof(rec)) {
+		task = next_rollup_task(ns, &nr);
+		if (!task) {
+			nr = PID_MAX_LIMIT;
+			break;
+		}
+		mm = mm_for_maps(task);
+		put_task_struct(task);
+		if (!mm) {
+			nr++;
+			continue;
+		}
+
+		down_read(&mm->mmap_sem);
+		smaps_rollup_mm(mm, &mss);
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+
+		memset(&rec, 0, sizeof(rec));
+		rec.pid = nr;
+		rec.rss = mss.resident;
+		rec.pss = mss.pss >> PSS_SHIFT;
+		rec.shared_clean = mss.shared_clean;
+		rec.shared_dirty = mss.shared_dirty;
+		rec.private_clean = mss.private_clean;
+		rec.private_dirty = mss.private_dirty;
+		rec.referenced = mss.referenced;
+		rec.swap = mss.swap;
+		if (copy_to_user(buf + ret, &rec, sizeof(rec))) {
+			if (!ret)
+				ret = -EFAULT;
+			break;
+		}
+		ret += sizeof(rec);
+		nr++;
+
+		if (fatal_signal_pending(current))
+			break;
+	}
+
+	*ppos = nr;
+	return ret;
+}
+
+static const struct file_operations proc_smaps_rollup_all_operations = {
+	.llseek		= mem_lseek,
+	.read		= smaps_rollup_all_read,
+};
+
+static int __init proc_smaps_rollup_init(void)
+{
+	proc_create("smaps_rollup_all", S_IRUSR, NULL,
+		    &proc_smaps_rollup_all_operations);
+	return 0;
+}
+module_init(proc_smaps_rollup_init);
+
 static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 				unsigned long end, struct mm_walk *walk)
 {
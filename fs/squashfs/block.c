@@ -29,7 +29,8 @@
 #include <linux/fs.h>
 #include <linux/vfs.h>
 #include <linux/slab.h>
-#include <linux/mutex.h>
+#include <linux/cpumask.h>
+#include <linux/wait.h>
 #include <linux/string.h>
 #include <linux/buffer_head.h>
 #include <linux/zlib.h>
@@ -39,6 +40,121 @@
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
 
+/*
+ * Decompression streams.  A filesystem is mounted with one, and more are
+ * allocated as concurrent readers need them, up to one per CPU online at
+ * mount, so that several readers can decompress different blocks at the
+ * same time.  When they are all in use, or another cannot be allocated,
+ * readers sleep until one is released.
+ */
+static struct squashfs_stream *squashfs_stream_alloc(gfp_t gfp)
+{
+	struct squashfs_stream *stream = kmalloc(sizeof(*stream), gfp);
+
+	if (stream == NULL)
+		return NULL;
+
+	stream->stream.workspace = kmalloc(zlib_inflate_workspacesize(), gfp);
+	if (stream->stream.workspace == NULL) {
+		kfree(stream);
+		return NULL;
+	}
+
+	return stream;
+}
+
+
+int squashfs_streams_init(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream;
+
+	spin_lock_init(&msblk->stream_lock);
+	init_waitqueue_head(&msblk->stream_wait);
+	INIT_LIST_HEAD(&msblk->free_streams);
+	msblk->max_streams = num_online_cpus();
+
+	stream = squashfs_stream_alloc(GFP_KERNEL);
+	if (stream == NULL) {
+		ERROR("Failed to allocate zlib workspace\n");
+		return -ENOMEM;
+	}
+
+	list_add(&stream->list, &msblk->free_streams);
+	msblk->streams = 1;
+	return 0;
+}
+
+
+/*
+ * Free the streams, which must all have been released.
+ */
+void squashfs_streams_delete(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream, *next;
+
+	list_for_each_entry_safe(stream, next, &msblk->free_streams, list) {
+		kfree(stream->stream.workspace);
+		kfree(stream);
+	}
+}
+
+
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream;
+
+	spin_lock(&msblk->stream_lock);
+
+	while (list_empty(&msblk->free_streams)) {
+		if (msblk->streams < msblk->max_streams) {
+			msblk->streams++;
+			spin_unlock(&msblk->stream_lock);
+
+			/*
+			 * Only an optimisation, so give up at once under
+			 * memory pressure rather than reclaim hard for it.
+			 */
+			stream = squashfs_stream_alloc(GFP_KERNEL |
+					__GFP_NORETRY | __GFP_NOWARN);
+			if (stream)
+				return stream;
+
+			/*
+			 * Out of memory, make do with the streams there are,
+			 * at least one of which is in use and will be released.
+			 */
+			spin_lock(&msblk->stream_lock);
+			msblk->streams--;
+			if (!list_empty(&msblk->free_streams))
+				break;
+		}
+
+		spin_unlock(&msblk->stream_lock);
+		wait_event(msblk->stream_wait,
+			!list_empty(&msblk->free_streams));
+		spin_lock(&msblk->stream_lock);
+	}
+
+	stream = list_first_entry(&msblk->free_streams, struct squashfs_stream,
+		list);
+	list_del(&stream->list);
+	spin_unlock(&msblk->stream_lock);
+
+	return stream;
+}
+
+
+static void put_stream(struct squashfs_sb_info *msblk,
+	struct squashfs_stream *stream)
+{
+	spin_lock(&msblk->stream_lock);
+	list_add(&stream->list, &msblk->free_streams);
+	spin_unlock(&msblk->stream_lock);
+
+	wake_up(&msblk->stream_wait);
+}
+
+
 /*
  * Read the metadata block length, this is stored in the first two
  * bytes of the metadata block.
@@ -86,7 +202,8 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 	struct buffer_head **bh;
 	int offset = index & ((1 << msblk->devblksize_log2) - 1);
 	u64 cur_index = index >> msblk->devblksize_log2;
-	int bytes, compressed, b = 0, k = 0, page = 0, avail;
+	int bytes, compressed, b = 0, k = 0, page = 0, avail, i;
+	struct squashfs_stream *stream;
 
 
 	bh = kcalloc((msblk->block_size >> msblk->devblksize_log2) + 1,
@@ -153,25 +270,34 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 	}
 
 	if (compressed) {
+		z_stream *strm;
 		int zlib_err = 0, zlib_init = 0;
 
+		/*
+		 * Wait for the reads before taking a stream, so that a stream
+		 * is not kept from other readers while the I/O is done.
+		 */
+		for (i = 0; i < b; i++) {
+			wait_on_buffer(bh[i]);
+			if (!buffer_uptodate(bh[i]))
+				goto block_release;
+		}
+
 		/*
 		 * Uncompress block.
 		 */
 
-		mutex_lock(&msblk->read_data_mutex);
+		stream = get_stream(msblk);
+		strm = &stream->stream;
 
-		msblk->stream.avail_out = 0;
-		msblk->stream.avail_in = 0;
+		strm->avail_out = 0;
+		strm->avail_in = 0;
 
 		bytes = length;
 		do {
-			if (msblk->stream.avail_in == 0 && k < b) {
+			if (strm->avail_in == 0 && k < b) {
 				avail = min(bytes, msblk->devblksize - offset);
 				bytes -= avail;
-				wait_on_buffer(bh[k]);
-				if (!buffer_uptodate(bh[k]))
-					goto release_mutex;
 
 				if (avail == 0) {
 					offset = 0;
@@ -179,51 +305,51 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 					continue;
 				}
 
-				msblk->stream.next_in = bh[k]->b_data + offset;
-				msblk->stream.avail_in = avail;
+				strm->next_in = bh[k]->b_data + offset;
+				strm->avail_in = avail;
 				offset = 0;
 			}
 
-			if (msblk->stream.avail_out == 0 && page < pages) {
-				msblk->stream.next_out = buffer[page++];
-				msblk->stream.avail_out = PAGE_CACHE_SIZE;
+			if (strm->avail_out == 0 && page < pages) {
+				strm->next_out = buffer[page++];
+				strm->avail_out = PAGE_CACHE_SIZE;
 			}
 
 			if (!zlib_init) {
-				zlib_err = zlib_inflateInit(&msblk->stream);
+				zlib_err = zlib_inflateInit(strm);
 				if (zlib_err != Z_OK) {
 					ERROR("zlib_inflateInit returned"
 						" unexpected result 0x%x,"
 						" srclength %d\n", zlib_err,
 						srclength);
-					goto release_mutex;
+					goto release_stream;
 				}
 				zlib_init = 1;
 			}
 
-			zlib_err = zlib_inflate(&msblk->stream, Z_SYNC_FLUSH);
+			zlib_err = zlib_inflate(strm, Z_SYNC_FLUSH);
 
-			if (msblk->stream.avail_in == 0 && k < b)
+			if (strm->avail_in == 0 && k < b)
 				put_bh(bh[k++]);
 		} while (zlib_err == Z_OK);
 
 		if (zlib_err != Z_STREAM_END) {
 			ERROR("zlib_inflate error, data probably corrupt\n");
-			goto release_mutex;
+			goto release_stream;
 		}
 
-		zlib_err = zlib_inflateEnd(&msblk->stream);
+		zlib_err = zlib_inflateEnd(strm);
 		if (zlib_err != Z_OK) {
 			ERROR("zlib_inflate error, data probably corrupt\n");
-			goto release_mutex;
+			goto release_stream;
 		}
-		length = msblk->stream.total_out;
-		mutex_unlock(&msblk->read_data_mutex);
+		length = strm->total_out;
+		put_stream(msblk, stream);
 	} else {
 		/*
 		 * Block is uncompressed.
 		 */
-		int i, in, pg_offset = 0;
+		int in, pg_offset = 0;
 
 		for (i = 0; i < b; i++) {
 			wait_on_buffer(bh[i]);
@@ -255,8 +381,8 @@ int squashfs_read_data(struct super_block *sb, void **buffer, u64 index,
 	kfree(bh);
 	return length;
 
-release_mutex:
-	mutex_unlock(&msblk->read_data_mutex);
+release_stream:
+	put_stream(msblk, stream);
 
 block_release:
 	for (; k < b; k++)
@@ -33,6 +33,8 @@ static inline struct squashfs_inode_info *squashfs_i(struct inode *inode)
 }
 
 /* block.c */
+extern int squashfs_streams_init(struct squashfs_sb_info *);
+extern void squashfs_streams_delete(struct squashfs_sb_info *);
 extern int squashfs_read_data(struct super_block *, void **, u64, int, u64 *,
 				int, int);
 
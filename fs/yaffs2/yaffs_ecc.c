@@ -94,27 +94,110 @@ static int yaffs_CountBits32(unsigned x)
 	return r;
 }
 
-/* Calculate the ECC for a 256-byte block of data */
+/* Parity of the 32 bits of x, 1 if odd */
+static Y_INLINE unsigned yaffs_Parity32(__u32 x)
+{
+	x ^= x >> 16;
+	x ^= x >> 8;
+	return column_parity_table[x & 0xff] & 0x01;
+}
+
+/*
+ * Calculate the ECC for a 256-byte block of data
+ *
+ * Bit n of the line parity is the parity of all the bytes whose offset
+ * has bit n set, and everything else follows from the column parity of
+ * all the bytes XORed together, since the column parities are linear.
+ * So the block is XORed together a 32-bit word at a time, into the whole
+ * block and into one sum per bit of the word offset, and only those
+ * seven words are reduced to parities. Offset bits 0 and 1 pick the byte
+ * within a word, so they come from the bytes of the whole block's sum,
+ * looked at in memory order so that this works on either endian.
+ */
 void yaffs_ECCCalculate(const unsigned char *data, unsigned char *ecc)
 {
 	unsigned int i;
 
-	unsigned char col_parity = 0;
-	unsigned char line_parity = 0;
-	unsigned char line_parity_prime = 0;
+	__u32 aligned[64];
+	const __u32 *p;
+	__u32 cur;
+	__u32 sum8;	/* the current group of 8 words XORed */
+	__u32 sum = 0;
+	__u32 odd0 = 0, odd1 = 0, odd2 = 0, odd3 = 0, odd4 = 0, odd5 = 0;
+	union {
+		__u32 word;
+		unsigned char byte[4];
+	} all;
+
+	unsigned char col_parity;
+	unsigned char line_parity;
+	unsigned char line_parity_prime;
 	unsigned char t;
-	unsigned char b;
 
-	for (i = 0; i < 256; i++) {
-		b = column_parity_table[*data++];
-		col_parity ^= b;
+	if ((unsigned long)data & 3) {
+		memcpy(aligned, data, sizeof(aligned));
+		p = aligned;
+	} else {
+		p = (const __u32 *)data;
+	}
 
-		if (b & 0x01) {		/* odd number of bits in the byte */
-			line_parity ^= i;
-			line_parity_prime ^= ~i;
-		}
+	/* oddN sums the words whose word offset has bit N set */
+	for (i = 0; i < 8; i++) {
+		cur = *p++;
+		sum8 = cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd0 ^= cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd1 ^= cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd0 ^= cur;
+		odd1 ^= cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd2 ^= cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd0 ^= cur;
+		odd2 ^= cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd1 ^= cur;
+		odd2 ^= cur;
+		cur = *p++;
+		sum8 ^= cur;
+		odd0 ^= cur;
+		odd1 ^= cur;
+		odd2 ^= cur;
+
+		sum ^= sum8;
+		if (i & 1)
+			odd3 ^= sum8;
+		if (i & 2)
+			odd4 ^= sum8;
+		if (i & 4)
+			odd5 ^= sum8;
 	}
 
+	all.word = sum;
+	col_parity = column_parity_table[all.byte[0] ^ all.byte[1] ^
+					 all.byte[2] ^ all.byte[3]];
+
+	line_parity =
+	    (yaffs_Parity32(odd5) << 7) |
+	    (yaffs_Parity32(odd4) << 6) |
+	    (yaffs_Parity32(odd3) << 5) |
+	    (yaffs_Parity32(odd2) << 4) |
+	    (yaffs_Parity32(odd1) << 3) |
+	    (yaffs_Parity32(odd0) << 2) |
+	    ((column_parity_table[all.byte[2] ^ all.byte[3]] & 0x01) << 1) |
+	    (column_parity_table[all.byte[1] ^ all.byte[3]] & 0x01);
+
+	/* The bytes with a bit clear are the odd ones less those with it set */
+	line_parity_prime = line_parity ^ ((col_parity & 0x01) ? 0xff : 0x00);
+
 	ecc[2] = (~col_parity) | 0x03;
 
 	t = 0;
@@ -51,6 +51,9 @@ extern const char *yaffs_guts_c_version;
 #include <linux/interrupt.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/writeback.h>
 
 #include "asm/div64.h"
 
@@ -97,6 +100,18 @@ extern const char *yaffs_guts_c_version;
 #define YAFFS_USE_WRITE_BEGIN_END 0
 #endif
 
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 27))
+#define YAFFS_USE_PAGE_BATCHES 1
+#else
+#define YAFFS_USE_PAGE_BATCHES 0
+#endif
+
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 22))
+#define YAFFS_USE_SHRINKER 1
+#else
+#define YAFFS_USE_SHRINKER 0
+#endif
+
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 28))
 static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 {
@@ -121,16 +136,37 @@ static uint32_t YCALCBLOCKS(uint64_t partition_size, uint32_t block_size)
 unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
+unsigned int yaffs_bg_gc = 1;
+unsigned int yaffs_bg_gc_blocks = 4;
+unsigned int yaffs_dir_index_kb = 64;
+unsigned int yaffs_scan_ahead = 1;
+unsigned int yaffs_idle_checkpoint = 30;
+unsigned int yaffs_batch_pages = 16;
+unsigned int yaffs_shrinker = 1;
 
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param(yaffs_bg_gc, uint, 0644);
+module_param(yaffs_bg_gc_blocks, uint, 0644);
+module_param(yaffs_dir_index_kb, uint, 0644);
+module_param(yaffs_scan_ahead, uint, 0644);
+module_param(yaffs_idle_checkpoint, uint, 0644);
+module_param(yaffs_batch_pages, uint, 0644);
+module_param(yaffs_shrinker, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
+MODULE_PARM(yaffs_bg_gc, "i");
+MODULE_PARM(yaffs_bg_gc_blocks, "i");
+MODULE_PARM(yaffs_dir_index_kb, "i");
+MODULE_PARM(yaffs_scan_ahead, "i");
+MODULE_PARM(yaffs_idle_checkpoint, "i");
+MODULE_PARM(yaffs_batch_pages, "i");
+MODULE_PARM(yaffs_shrinker, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -167,6 +203,18 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino);
 			(dir)->i_ctime = (dir)->i_mtime = CURRENT_TIME; \
 		} while (0)
 
+/* The inode yaffs allocates for the VFS. See yaffs_GrossLock() for dataLock. */
+struct yaffs_InodeInfo {
+	struct rw_semaphore dataLock;
+	struct inode vfsInode;
+};
+
+#define yaffs_InodeToInfo(iptr) \
+	container_of(iptr, struct yaffs_InodeInfo, vfsInode)
+#define yaffs_InodeDataLock(iptr) (&yaffs_InodeToInfo(iptr)->dataLock)
+
+static struct kmem_cache *yaffs_inode_cache;
+
 static void yaffs_put_super(struct super_block *sb);
 
 static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
@@ -235,6 +283,8 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf);
 static void yaffs_put_inode(struct inode *inode);
 #endif
 
+static struct inode *yaffs_alloc_inode(struct super_block *sb);
+static void yaffs_destroy_inode(struct inode *inode);
 static void yaffs_delete_inode(struct inode *);
 static void yaffs_clear_inode(struct inode *);
 
@@ -244,6 +294,12 @@ static int yaffs_writepage(struct page *page, struct writeback_control *wbc);
 #else
 static int yaffs_writepage(struct page *page);
 #endif
+#if (YAFFS_USE_PAGE_BATCHES != 0)
+static int yaffs_readpages(struct file *file, struct address_space *mapping,
+				struct list_head *pages, unsigned nr_pages);
+static int yaffs_writepages(struct address_space *mapping,
+				struct writeback_control *wbc);
+#endif
 
 
 #if (YAFFS_USE_WRITE_BEGIN_END != 0)
@@ -272,6 +328,10 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd);
 static struct address_space_operations yaffs_file_address_operations = {
 	.readpage = yaffs_readpage,
 	.writepage = yaffs_writepage,
+#if (YAFFS_USE_PAGE_BATCHES > 0)
+	.readpages = yaffs_readpages,
+	.writepages = yaffs_writepages,
+#endif
 #if (YAFFS_USE_WRITE_BEGIN_END > 0)
 	.write_begin = yaffs_write_begin,
 	.write_end = yaffs_write_end,
@@ -364,12 +424,39 @@ static const struct super_operations yaffs_super_ops = {
 	.put_inode = yaffs_put_inode,
 #endif
 	.put_super = yaffs_put_super,
+	.alloc_inode = yaffs_alloc_inode,
+	.destroy_inode = yaffs_destroy_inode,
 	.delete_inode = yaffs_delete_inode,
 	.clear_inode = yaffs_clear_inode,
 	.sync_fs = yaffs_sync_fs,
 	.write_super = yaffs_write_super,
 };
 
+/*
+ * Locking.
+ *
+ * The yaffs guts are not reentrant, so every call into them is made with
+ * the device's gross lock held, and that is all it is for: it covers the
+ * allocator, garbage collection, the chunk cache and NAND access, and is
+ * taken around the guts calls alone. Garbage collection that a write
+ * needs is done a step at a time with the lock dropped in between (see
+ * yaffs_GrossLockForWrite()). A semaphore is used because up() hands it
+ * straight to a waiter, which is what lets readers in between the steps.
+ *
+ * Two locks sit above it:
+ *
+ * dev->dirLock protects the namespace. Lookup and readdir take it shared,
+ * everything that adds, removes or renames a directory entry takes it
+ * exclusive. While it is held shared no entry can change, so a lookup
+ * whose answer is in the short names held in RAM needs no gross lock.
+ *
+ * The dataLock of each inode orders access to that file's data and size.
+ * readpage takes it shared, writes and truncation take it exclusive. It is
+ * taken with the page lock held, so it must never be held while waiting
+ * for a page lock.
+ *
+ * Lock order: i_mutex, dirLock, page lock, dataLock, gross lock.
+ */
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_OS, ("yaffs locking %p\n", current));
@@ -383,6 +470,181 @@ static void yaffs_GrossUnlock(yaffs_Device *dev)
 	up(&dev->grossLock);
 }
 
+/*
+ * Take the gross lock for a write, first doing any urgent garbage
+ * collection in steps so that readers are not held off for a whole block.
+ * At most about two blocks are collected here, as in
+ * yaffs_CheckGarbageCollection(); anything left is done by the write.
+ */
+static void yaffs_GrossLockForWrite(yaffs_Device *dev)
+{
+	int steps = 2 * (dev->nChunksPerBlock / YAFFS_GC_STEP_COPIES + 1);
+
+	yaffs_GrossLock(dev);
+	while (steps-- > 0 && yaffs_GarbageCollectStep(dev)) {
+		yaffs_GrossUnlock(dev);
+		cond_resched();
+		yaffs_GrossLock(dev);
+	}
+}
+
+
+/*
+ * Background garbage collection.
+ *
+ * Each read-write mount gets a thread that keeps yaffs_bg_gc_blocks
+ * erased blocks in hand above the point where foreground gc would become
+ * aggressive, so that writes seldom have to collect. It works a step at
+ * a time, and only once no write has been seen for YAFFS_BG_GC_IDLE,
+ * unless space is already short. While it runs, the leisurely gc that
+ * yaffs otherwise does inline on every write is left to it. It only
+ * polls, every YAFFS_BG_GC_SLEEP, while collection is wanted but cannot
+ * be done yet. With nothing to do it sleeps until taking an erased block
+ * for allocation leaves fewer than yaffs_bg_gc_blocks in hand, or a write
+ * invalidates the checkpoint. Nothing is collected while the mount is
+ * read-only.
+ *
+ * The checkpoint is only written at sync and unmount, and the first
+ * write after that invalidates it, so after a crash the next mount
+ * nearly always has to scan. Once nothing has been written to NAND for
+ * yaffs_idle_checkpoint seconds, the thread therefore writes a
+ * checkpoint too. Each burst of writes is then followed by at most one
+ * checkpoint, and one failed attempt is not retried until there have
+ * been more writes. Like sync, it is not done with yaffs_auto_checkpoint
+ * set to 0, nor on a read-only mount.
+ */
+#define YAFFS_BG_GC_IDLE	(HZ / 10)
+#define YAFFS_BG_GC_SLEEP	HZ
+
+static int yaffs_BackgroundGC(void *data)
+{
+	yaffs_Device *dev = data;
+	struct super_block *sb = dev->superBlock;
+	unsigned long quietSince = jiffies;
+	int lastPageWrites = -1;
+	int triedPageWrites = -1;
+	int checkpoint;
+	int urgency;
+	int idle;
+	int done;
+	long timeout;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		try_to_freeze();
+
+		yaffs_GrossLock(dev);
+		dev->bgGCSleeping = 0;
+		if (sb->s_flags & MS_RDONLY)
+			urgency = 0;
+		else
+			urgency = yaffs_BackgroundGCUrgency(dev,
+							yaffs_bg_gc_blocks);
+		idle = time_after_eq(jiffies,
+				dev->lastWriteTime + YAFFS_BG_GC_IDLE);
+		done = 0;
+		if (urgency > 1 || (urgency && idle))
+			done = yaffs_BackgroundGarbageCollect(dev, urgency);
+
+		if (dev->nPageWrites != lastPageWrites) {
+			lastPageWrites = dev->nPageWrites;
+			quietSince = jiffies;
+		}
+		checkpoint = yaffs_auto_checkpoint && yaffs_idle_checkpoint &&
+			!(sb->s_flags & MS_RDONLY) && !dev->isCheckpointed &&
+			lastPageWrites != triedPageWrites;
+		if (!done && checkpoint &&
+		    time_after_eq(jiffies,
+				quietSince + yaffs_idle_checkpoint * HZ)) {
+			yaffs_FlushEntireDeviceCache(dev);
+			yaffs_CheckpointSave(dev);
+			lastPageWrites = triedPageWrites = dev->nPageWrites;
+			checkpoint = 0;
+		}
+
+		if (done) {
+			yaffs_GrossUnlock(dev);
+			cond_resched();
+			continue;
+		}
+
+		if (urgency && !idle)
+			timeout = dev->lastWriteTime + YAFFS_BG_GC_IDLE - jiffies;
+		else if (urgency)
+			timeout = YAFFS_BG_GC_SLEEP;
+		else if (checkpoint)
+			timeout = quietSince + yaffs_idle_checkpoint * HZ - jiffies;
+		else
+			timeout = MAX_SCHEDULE_TIMEOUT;
+		if (timeout < 1)
+			timeout = 1;
+
+		/*
+		 * The flag is set and cleared under the gross lock, which
+		 * yaffs_WakeBackgroundGC() is called with, and the task state
+		 * is set before the lock is dropped, so no wakeup can be
+		 * missed.
+		 */
+		if (timeout == MAX_SCHEDULE_TIMEOUT)
+			dev->bgGCSleeping = 1;
+		set_current_state(TASK_INTERRUPTIBLE);
+		yaffs_GrossUnlock(dev);
+		if (!kthread_should_stop())
+			schedule_timeout(timeout);
+		__set_current_state(TASK_RUNNING);
+	}
+
+	return 0;
+}
+
+/* Called from yaffs_guts with the gross lock held */
+static void yaffs_WakeBackgroundGC(yaffs_Device *dev)
+{
+	if (!dev->bgGCSleeping)
+		return;
+
+	if (yaffs_BackgroundGCUrgency(dev, yaffs_bg_gc_blocks) ||
+	    (yaffs_auto_checkpoint && yaffs_idle_checkpoint &&
+	     !dev->isCheckpointed)) {
+		dev->bgGCSleeping = 0;
+		wake_up_process(dev->bgGCThread);
+	}
+}
+
+static void yaffs_StartBackgroundGC(yaffs_Device *dev, struct super_block *sb)
+{
+	struct task_struct *t;
+	char buf[BDEVNAME_SIZE + 1];
+
+	if (!yaffs_bg_gc || (sb->s_flags & MS_RDONLY))
+		return;
+
+	dev->lastWriteTime = jiffies;
+	t = kthread_create(yaffs_BackgroundGC, dev, "yaffs-gc/%s",
+			   yaffs_devname(sb, buf));
+	if (IS_ERR(t)) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: could not start background gc thread\n"));
+		return;
+	}
+
+	dev->bgGCThread = t;
+	dev->backgroundGC = 1;
+	dev->wakeBackgroundGC = yaffs_WakeBackgroundGC;
+	wake_up_process(t);
+}
+
+static void yaffs_StopBackgroundGC(yaffs_Device *dev)
+{
+	if (!dev->bgGCThread)
+		return;
+
+	dev->wakeBackgroundGC = NULL;
+	kthread_stop(dev->bgGCThread);
+	dev->bgGCThread = NULL;
+	dev->backgroundGC = 0;
+}
 
 /*-----------------------------------------------------------------*/
 /* Directory search context allows us to unlock access to yaffs during
@@ -571,19 +833,29 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
-	yaffs_GrossLock(dev);
+	down_read(&dev->dirLock);
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_lookup for %d:%s\n",
 		yaffs_InodeToObject(dir)->objectId, dentry->d_name.name));
 
-	obj = yaffs_FindObjectByName(yaffs_InodeToObject(dir),
+	obj = yaffs_FindObjectByShortName(yaffs_InodeToObject(dir),
 					dentry->d_name.name);
 
-	obj = yaffs_GetEquivalentObject(obj);	/* in case it was a hardlink */
+	if (!obj) {
+		yaffs_GrossLock(dev);
 
-	/* Can't hold gross lock when calling yaffs_get_inode() */
-	yaffs_GrossUnlock(dev);
+		obj = yaffs_FindObjectByName(yaffs_InodeToObject(dir),
+						dentry->d_name.name);
+
+		/* in case it was a hardlink */
+		obj = yaffs_GetEquivalentObject(obj);
+
+		/* Can't hold gross lock when calling yaffs_get_inode() */
+		yaffs_GrossUnlock(dev);
+	}
+
+	up_read(&dev->dirLock);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -591,6 +863,10 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 		inode = yaffs_get_inode(dir->i_sb, obj->yst_mode, 0, obj);
 
+		/* Not a negative dentry: the object is there */
+		if (!inode)
+			return ERR_PTR(-ENOMEM);
+
 		if (inode) {
 			T(YAFFS_TRACE_OS,
 				("yaffs_loookup dentry \n"));
@@ -632,6 +908,29 @@ static void yaffs_put_inode(struct inode *inode)
 }
 #endif
 
+static struct inode *yaffs_alloc_inode(struct super_block *sb)
+{
+	struct yaffs_InodeInfo *info;
+
+	info = kmem_cache_alloc(yaffs_inode_cache, GFP_KERNEL);
+	if (!info)
+		return NULL;
+	return &info->vfsInode;
+}
+
+static void yaffs_destroy_inode(struct inode *inode)
+{
+	kmem_cache_free(yaffs_inode_cache, yaffs_InodeToInfo(inode));
+}
+
+static void yaffs_init_inode_once(void *foo)
+{
+	struct yaffs_InodeInfo *info = foo;
+
+	init_rwsem(&info->dataLock);
+	inode_init_once(&info->vfsInode);
+}
+
 /* clear is called to tell the fs to release any per-inode data it holds */
 static void yaffs_clear_inode(struct inode *inode)
 {
@@ -653,6 +952,7 @@ static void yaffs_clear_inode(struct inode *inode)
 		 * the yaffs_Object.
 		 */
 		obj->myInode = NULL;
+		dev->nObjectInodes--;
 		yaffs_InodeToObjectLV(inode) = NULL;
 
 		/* If the object freeing was deferred, then the real
@@ -725,6 +1025,7 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	unsigned char *pg_buf;
 	int ret;
 
+	struct inode *inode = pg->mapping->host;
 	yaffs_Device *dev;
 
 	T(YAFFS_TRACE_OS, ("yaffs_readpage at %08x, size %08x\n",
@@ -745,6 +1046,7 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
+	down_read(yaffs_InodeDataLock(inode));
 	yaffs_GrossLock(dev);
 
 	ret = yaffs_ReadDataFromFile(obj, pg_buf,
@@ -752,6 +1054,7 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 				PAGE_CACHE_SIZE);
 
 	yaffs_GrossUnlock(dev);
+	up_read(yaffs_InodeDataLock(inode));
 
 	if (ret >= 0)
 		ret = 0;
@@ -783,6 +1086,107 @@ static int yaffs_readpage(struct file *f, struct page *pg)
 	return yaffs_readpage_unlock(f, pg);
 }
 
+#if (YAFFS_USE_PAGE_BATCHES > 0)
+/*
+ * Readahead and writeback in batches.
+ *
+ * Left to readpage and writepage, every page costs a trip through the
+ * locks and a walk of the tnode tree for each of its chunks. readpages and
+ * writepages instead gather up to yaffs_batch_pages consecutive pages and
+ * deal with them under one taking of the locks. Reads also look up the
+ * tnodes once for the batch and hand chunks that lie next to each other on
+ * NAND to the MTD layer together (see yaffs_ReadDataToBuffers()).
+ *
+ * A batch of reads is made of new, locked pages, taken in index order.
+ * Pages for writeback are not kept locked while the batch is gathered,
+ * which would mean waiting for one page lock while holding others; each
+ * is marked for writeback and unlocked instead, as for asynchronous I/O.
+ *
+ * Only pages dirtied through mmap reach writepages: write_end hands the
+ * data of write(2) straight to yaffs_file_write() and leaves the page
+ * clean, so that running out of space is reported to the writer.
+ *
+ * yaffs_batch_pages of 0 or 1 gives the page at a time behaviour.
+ */
+#define YAFFS_MAX_BATCH_PAGES	16
+
+static int yaffs_BatchPages(void)
+{
+	if (yaffs_batch_pages > YAFFS_MAX_BATCH_PAGES)
+		return YAFFS_MAX_BATCH_PAGES;
+	return yaffs_batch_pages;
+}
+
+static void yaffs_ReadPageBatch(struct inode *inode, struct page **pages,
+				int nPages)
+{
+	yaffs_Object *obj = yaffs_InodeToObject(inode);
+	yaffs_Device *dev = obj->myDev;
+	__u8 *buffers[YAFFS_MAX_BATCH_PAGES];
+	int i;
+
+	T(YAFFS_TRACE_OS, ("yaffs_readpages at %08x, %d pages\n",
+			(unsigned)(pages[0]->index << PAGE_CACHE_SHIFT),
+			nPages));
+
+	for (i = 0; i < nPages; i++)
+		buffers[i] = kmap(pages[i]);
+
+	down_read(yaffs_InodeDataLock(inode));
+	yaffs_GrossLock(dev);
+
+	yaffs_ReadDataToBuffers(obj, buffers, nPages, PAGE_CACHE_SIZE,
+			(loff_t)pages[0]->index << PAGE_CACHE_SHIFT);
+
+	yaffs_GrossUnlock(dev);
+	up_read(yaffs_InodeDataLock(inode));
+
+	for (i = 0; i < nPages; i++) {
+		SetPageUptodate(pages[i]);
+		ClearPageError(pages[i]);
+		flush_dcache_page(pages[i]);
+		kunmap(pages[i]);
+		unlock_page(pages[i]);
+	}
+}
+
+static int yaffs_readpages(struct file *file, struct address_space *mapping,
+				struct list_head *pages, unsigned nr_pages)
+{
+	struct page *batch[YAFFS_MAX_BATCH_PAGES];
+	int maxPages = yaffs_BatchPages();
+	int nPages = 0;
+	unsigned i;
+
+	if (maxPages < 2)
+		return read_cache_pages(mapping, pages,
+					(filler_t *)yaffs_readpage, file);
+
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		list_del(&page->lru);
+		if (!add_to_page_cache_lru(page, mapping, page->index,
+					GFP_KERNEL)) {
+			if (nPages > 0 &&
+			    (page->index != batch[nPages - 1]->index + 1 ||
+			     nPages == maxPages)) {
+				yaffs_ReadPageBatch(mapping->host, batch,
+						nPages);
+				nPages = 0;
+			}
+			batch[nPages++] = page;
+		}
+		page_cache_release(page);
+	}
+
+	if (nPages > 0)
+		yaffs_ReadPageBatch(mapping->host, batch, nPages);
+
+	return 0;
+}
+#endif
+
 /* writepage inspired by/stolen from smbfs */
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
@@ -806,6 +1210,9 @@ static int yaffs_writepage(struct page *page)
 	if (!inode)
 		BUG();
 
+	/* Keep the size from changing under us */
+	down_write(yaffs_InodeDataLock(inode));
+
 	if (offset > inode->i_size) {
 		T(YAFFS_TRACE_OS,
 			("yaffs_writepage at %08x, inode size = %08x!!!\n",
@@ -813,6 +1220,7 @@ static int yaffs_writepage(struct page *page)
 			(unsigned)inode->i_size));
 		T(YAFFS_TRACE_OS,
 			("                -> don't care!!\n"));
+		up_write(yaffs_InodeDataLock(inode));
 		unlock_page(page);
 		return 0;
 	}
@@ -830,7 +1238,7 @@ static int yaffs_writepage(struct page *page)
 	buffer = kmap(page);
 
 	obj = yaffs_InodeToObject(inode);
-	yaffs_GrossLock(obj->myDev);
+	yaffs_GrossLockForWrite(obj->myDev);
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_writepage at %08x, size %08x\n",
@@ -841,12 +1249,14 @@ static int yaffs_writepage(struct page *page)
 
 	nWritten = yaffs_WriteDataToFile(obj, buffer,
 			page->index << PAGE_CACHE_SHIFT, nBytes, 0);
+	obj->myDev->lastWriteTime = jiffies;
 
 	T(YAFFS_TRACE_OS,
 		("writepag1: obj = %05x, ino = %05x\n",
 		(int)obj->variant.fileVariant.fileSize, (int)inode->i_size));
 
 	yaffs_GrossUnlock(obj->myDev);
+	up_write(yaffs_InodeDataLock(inode));
 
 	kunmap(page);
 	SetPageUptodate(page);
@@ -856,6 +1266,121 @@ static int yaffs_writepage(struct page *page)
 	return (nWritten == nBytes) ? 0 : -ENOSPC;
 }
 
+#if (YAFFS_USE_PAGE_BATCHES > 0)
+struct yaffs_WriteBatch {
+	struct address_space *mapping;
+	struct page *pages[YAFFS_MAX_BATCH_PAGES];
+	int nPages;
+	int maxPages;
+	int error;
+};
+
+/* Write out the pages gathered, which are all under writeback */
+static void yaffs_WritePageBatch(struct yaffs_WriteBatch *wb)
+{
+	struct inode *inode = wb->mapping->host;
+	yaffs_Object *obj = yaffs_InodeToObject(inode);
+	yaffs_Device *dev = obj->myDev;
+	unsigned long end_index;
+	loff_t offset;
+	unsigned nBytes;
+	int nWritten;
+	char *buffer;
+	int i;
+
+	if (wb->nPages == 0)
+		return;
+
+	T(YAFFS_TRACE_OS, ("yaffs_writepages at %08x, %d pages\n",
+			(unsigned)(wb->pages[0]->index << PAGE_CACHE_SHIFT),
+			wb->nPages));
+
+	/* Keep the size from changing under us */
+	down_write(yaffs_InodeDataLock(inode));
+	yaffs_GrossLockForWrite(dev);
+
+	end_index = inode->i_size >> PAGE_CACHE_SHIFT;
+
+	for (i = 0; i < wb->nPages; i++) {
+		struct page *page = wb->pages[i];
+
+		offset = (loff_t) page->index << PAGE_CACHE_SHIFT;
+
+		/* Past the end of file, so don't care */
+		if (offset > inode->i_size)
+			continue;
+
+		if (page->index < end_index)
+			nBytes = PAGE_CACHE_SIZE;
+		else
+			nBytes = inode->i_size & (PAGE_CACHE_SIZE - 1);
+
+		buffer = kmap(page);
+		nWritten = yaffs_WriteDataToFile(obj, buffer, offset, nBytes,
+						0);
+		kunmap(page);
+
+		if (nWritten != nBytes) {
+			wb->error = -ENOSPC;
+			SetPageError(page);
+		}
+	}
+
+	dev->lastWriteTime = jiffies;
+
+	yaffs_GrossUnlock(dev);
+	up_write(yaffs_InodeDataLock(inode));
+
+	for (i = 0; i < wb->nPages; i++) {
+		SetPageUptodate(wb->pages[i]);
+		end_page_writeback(wb->pages[i]);
+		put_page(wb->pages[i]);
+	}
+	wb->nPages = 0;
+}
+
+static int yaffs_writepages_add(struct page *page,
+				struct writeback_control *wbc, void *data)
+{
+	struct yaffs_WriteBatch *wb = data;
+
+	if (wb->nPages > 0 &&
+	    (page->index != wb->pages[wb->nPages - 1]->index + 1 ||
+	     wb->nPages == wb->maxPages))
+		yaffs_WritePageBatch(wb);
+
+	get_page(page);
+	set_page_writeback(page);
+	unlock_page(page);
+	wb->pages[wb->nPages++] = page;
+
+	return 0;
+}
+
+static int yaffs_writepages(struct address_space *mapping,
+				struct writeback_control *wbc)
+{
+	struct yaffs_WriteBatch wb;
+	int ret;
+
+	wb.maxPages = yaffs_BatchPages();
+	if (wb.maxPages < 2)
+		return generic_writepages(mapping, wbc);
+
+	wb.mapping = mapping;
+	wb.nPages = 0;
+	wb.error = 0;
+
+	ret = write_cache_pages(mapping, wbc, yaffs_writepages_add, &wb);
+	yaffs_WritePageBatch(&wb);
+
+	if (wb.error)
+		mapping_set_error(mapping, wb.error);
+
+	return ret ? ret : wb.error;
+}
+#endif
+
 
 #if (YAFFS_USE_WRITE_BEGIN_END > 0)
 static int yaffs_write_begin(struct file *filp, struct address_space *mapping,
@@ -1010,13 +1535,27 @@ static int yaffs_commit_write(struct file *f, struct page *pg, unsigned offset,
 #endif
 
 
-static void yaffs_FillInodeFromObject(struct inode *inode, yaffs_Object *obj)
+/*
+ * Returns 0, or -ENOMEM if the object's details could not be read in;
+ * the inode is then left unfilled.
+ */
+static int yaffs_FillInodeFromObject(struct inode *inode, yaffs_Object *obj)
 {
+	yaffs_ObjectDetails *details;
+	__u32 mode;
+
 	if (inode && obj) {
 
+		details = yaffs_GetObjectDetails(obj);
+		if (!details) {
+			T(YAFFS_TRACE_OS,
+				("yaffs_FillInode: no memory for the details "
+				"of object %d\n", obj->objectId));
+			return -ENOMEM;
+		}
 
 		/* Check mode against the variant type and attempt to repair if broken. */
-		__u32 mode = obj->yst_mode;
+		mode = obj->yst_mode;
 		switch (obj->variantType) {
 		case YAFFS_OBJECT_TYPE_FILE:
 			if (!S_ISREG(mode)) {
@@ -1051,25 +1590,25 @@ static void yaffs_FillInodeFromObject(struct inode *inode, yaffs_Object *obj)
 
 		inode->i_ino = obj->objectId;
 		inode->i_mode = obj->yst_mode;
-		inode->i_uid = obj->yst_uid;
-		inode->i_gid = obj->yst_gid;
+		inode->i_uid = details->yst_uid;
+		inode->i_gid = details->yst_gid;
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 19))
 		inode->i_blksize = inode->i_sb->s_blocksize;
 #endif
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 
-		inode->i_rdev = old_decode_dev(obj->yst_rdev);
-		inode->i_atime.tv_sec = (time_t) (obj->yst_atime);
+		inode->i_rdev = old_decode_dev(details->yst_rdev);
+		inode->i_atime.tv_sec = (time_t) (details->yst_atime);
 		inode->i_atime.tv_nsec = 0;
-		inode->i_mtime.tv_sec = (time_t) obj->yst_mtime;
+		inode->i_mtime.tv_sec = (time_t) details->yst_mtime;
 		inode->i_mtime.tv_nsec = 0;
-		inode->i_ctime.tv_sec = (time_t) obj->yst_ctime;
+		inode->i_ctime.tv_sec = (time_t) details->yst_ctime;
 		inode->i_ctime.tv_nsec = 0;
 #else
-		inode->i_rdev = obj->yst_rdev;
-		inode->i_atime = obj->yst_atime;
-		inode->i_mtime = obj->yst_mtime;
-		inode->i_ctime = obj->yst_ctime;
+		inode->i_rdev = details->yst_rdev;
+		inode->i_atime = details->yst_atime;
+		inode->i_mtime = details->yst_mtime;
+		inode->i_ctime = details->yst_ctime;
 #endif
 		inode->i_size = yaffs_GetObjectFileLength(obj);
 		inode->i_blocks = (inode->i_size + 511) >> 9;
@@ -1085,10 +1624,10 @@ static void yaffs_FillInodeFromObject(struct inode *inode, yaffs_Object *obj)
 		default:	/* fifo, device or socket */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 			init_special_inode(inode, obj->yst_mode,
-					old_decode_dev(obj->yst_rdev));
+					old_decode_dev(details->yst_rdev));
 #else
 			init_special_inode(inode, obj->yst_mode,
-					(dev_t) (obj->yst_rdev));
+					(dev_t) (details->yst_rdev));
 #endif
 			break;
 		case S_IFREG:	/* file */
@@ -1108,13 +1647,17 @@ static void yaffs_FillInodeFromObject(struct inode *inode, yaffs_Object *obj)
 
 		yaffs_InodeToObjectLV(inode) = obj;
 
+		if (!obj->myInode)
+			obj->myDev->nObjectInodes++;
 		obj->myInode = inode;
 
 	} else {
 		T(YAFFS_TRACE_OS,
 			("yaffs_FileInode invalid parameters\n"));
+		return -EINVAL;
 	}
 
+	return 0;
 }
 
 struct inode *yaffs_get_inode(struct super_block *sb, int mode, int dev,
@@ -1162,10 +1705,11 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
-
 	inode = f->f_dentry->d_inode;
 
+	down_write(yaffs_InodeDataLock(inode));
+	yaffs_GrossLockForWrite(dev);
+
 	if (!S_ISBLK(inode->i_mode) && f->f_flags & O_APPEND)
 		ipos = inode->i_size;
 	else
@@ -1181,6 +1725,9 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 			n, obj->objectId, ipos));
 
 	nWritten = yaffs_WriteDataToFile(obj, buf, ipos, n, 0);
+	dev->lastWriteTime = jiffies;
+
+	yaffs_GrossUnlock(dev);
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_file_write writing %zu bytes, %d written at %d\n",
@@ -1200,7 +1747,7 @@ static ssize_t yaffs_file_write(struct file *f, const char *buf, size_t n,
 		}
 
 	}
-	yaffs_GrossUnlock(dev);
+	up_write(yaffs_InodeDataLock(inode));
 	return (nWritten == 0) && (n > 0) ? -ENOSPC : nWritten;
 }
 
@@ -1231,18 +1778,23 @@ static ssize_t yaffs_hold_space(struct file *f)
 
 static void yaffs_release_space(struct file *f)
 {
-	yaffs_Object *obj;
-	yaffs_Device *dev;
-
-
-	obj = yaffs_DentryToObject(f->f_dentry);
-
-	dev = obj->myDev;
+	/* Nothing is reserved by yaffs_hold_space() yet, so nothing to do */
+}
 
+/*
+ * readdir holds the namespace lock shared as well as the gross lock, and
+ * drops both around filldir(), which may fault.
+ */
+static void yaffs_ReaddirLock(yaffs_Device *dev)
+{
+	down_read(&dev->dirLock);
 	yaffs_GrossLock(dev);
+}
 
-
+static void yaffs_ReaddirUnlock(yaffs_Device *dev)
+{
 	yaffs_GrossUnlock(dev);
+	up_read(&dev->dirLock);
 }
 
 static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
@@ -1260,7 +1812,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	obj = yaffs_DentryToObject(f->f_dentry);
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_ReaddirLock(dev);
 
 	offset = f->f_pos;
 
@@ -1276,10 +1828,10 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			("yaffs_readdir: entry . ino %d \n",
 			(int)inode->i_ino));
-		yaffs_GrossUnlock(dev);
+		yaffs_ReaddirUnlock(dev);
 		if (filldir(dirent, ".", 1, offset, inode->i_ino, DT_DIR) < 0)
-			goto out;
-		yaffs_GrossLock(dev);
+			goto relock_out;
+		yaffs_ReaddirLock(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1287,11 +1839,11 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 		T(YAFFS_TRACE_OS,
 			("yaffs_readdir: entry .. ino %d \n",
 			(int)f->f_dentry->d_parent->d_inode->i_ino));
-		yaffs_GrossUnlock(dev);
+		yaffs_ReaddirUnlock(dev);
 		if (filldir(dirent, "..", 2, offset,
 			f->f_dentry->d_parent->d_inode->i_ino, DT_DIR) < 0)
-			goto out;
-		yaffs_GrossLock(dev);
+			goto relock_out;
+		yaffs_ReaddirLock(dev);
 		offset++;
 		f->f_pos++;
 	}
@@ -1320,7 +1872,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 			  ("yaffs_readdir: %s inode %d\n", name,
 			   yaffs_GetObjectInode(l)));
 
-                        yaffs_GrossUnlock(dev);
+                        yaffs_ReaddirUnlock(dev);
 
 			if (filldir(dirent,
 					name,
@@ -1328,9 +1880,9 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 					offset,
 					this_inode,
 					this_type) < 0)
-				goto out;
+				goto relock_out;
 
-                        yaffs_GrossLock(dev);
+                        yaffs_ReaddirLock(dev);
 
 			offset++;
 			f->f_pos++;
@@ -1339,11 +1891,15 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	}
 
 unlock_out:
-	yaffs_GrossUnlock(dev);
-out:
-        yaffs_EndSearch(sc);
+	yaffs_EndSearch(sc);
+	yaffs_ReaddirUnlock(dev);
 
 	return retVal;
+
+relock_out:
+	/* The search context may only be touched under the lock */
+	yaffs_ReaddirLock(dev);
+	goto unlock_out;
 }
 
 /*
@@ -1394,6 +1950,7 @@ static int yaffs_mknod(struct inode *dir, struct dentry *dentry, int mode,
 
 	dev = parent->myDev;
 
+	down_write(&dev->dirLock);
 	yaffs_GrossLock(dev);
 
 	switch (mode & S_IFMT) {
@@ -1427,9 +1984,12 @@ static int yaffs_mknod(struct inode *dir, struct dentry *dentry, int mode,
 
 	/* Can not call yaffs_get_inode() with gross lock held */
 	yaffs_GrossUnlock(dev);
+	up_write(&dev->dirLock);
 
 	if (obj) {
 		inode = yaffs_get_inode(dir->i_sb, mode, rdev, obj);
+		if (!inode)
+			return -ENOMEM;
 		d_instantiate(dentry, inode);
 		update_dir_time(dir);
 		T(YAFFS_TRACE_OS,
@@ -1476,6 +2036,7 @@ static int yaffs_unlink(struct inode *dir, struct dentry *dentry)
 
 	dev = yaffs_InodeToObject(dir)->myDev;
 
+	down_write(&dev->dirLock);
 	yaffs_GrossLock(dev);
 
 	retVal = yaffs_Unlink(yaffs_InodeToObject(dir), dentry->d_name.name);
@@ -1484,11 +2045,13 @@ static int yaffs_unlink(struct inode *dir, struct dentry *dentry)
 		dentry->d_inode->i_nlink--;
 		dir->i_version++;
 		yaffs_GrossUnlock(dev);
+		up_write(&dev->dirLock);
 		mark_inode_dirty(dentry->d_inode);
 		update_dir_time(dir);
 		return 0;
 	}
 	yaffs_GrossUnlock(dev);
+	up_write(&dev->dirLock);
 	return -ENOTEMPTY;
 }
 
@@ -1505,6 +2068,7 @@ static int yaffs_rmdir(struct inode *dir, struct dentry *dentry)
 
         dev = yaffs_InodeToObject(dir)->myDev;
 
+        down_write(&dev->dirLock);
         yaffs_GrossLock(dev);
 
         /* Check if the target is an existing directory that is not empty. */
@@ -1529,10 +2093,12 @@ static int yaffs_rmdir(struct inode *dir, struct dentry *dentry)
                 dentry->d_inode->i_nlink--;
                 dir->i_version++;
                 yaffs_GrossUnlock(dev);
+                up_write(&dev->dirLock);
                 mark_inode_dirty(dentry->d_inode);
                 return 0;
         }
         yaffs_GrossUnlock(dev);
+        up_write(&dev->dirLock);
         return -ENOTEMPTY;
 }
 
@@ -1553,6 +2119,7 @@ static int yaffs_link(struct dentry *old_dentry, struct inode *dir,
 	obj = yaffs_InodeToObject(inode);
 	dev = obj->myDev;
 
+	down_write(&dev->dirLock);
 	yaffs_GrossLock(dev);
 
 	if (!S_ISDIR(inode->i_mode))		/* Don't link directories */
@@ -1570,6 +2137,7 @@ static int yaffs_link(struct dentry *old_dentry, struct inode *dir,
 	}
 
 	yaffs_GrossUnlock(dev);
+	up_write(&dev->dirLock);
 
 	if (link) {
 		update_dir_time(dir);
@@ -1590,15 +2158,19 @@ static int yaffs_symlink(struct inode *dir, struct dentry *dentry,
 	T(YAFFS_TRACE_OS, ("yaffs_symlink\n"));
 
 	dev = yaffs_InodeToObject(dir)->myDev;
+	down_write(&dev->dirLock);
 	yaffs_GrossLock(dev);
 	obj = yaffs_MknodSymLink(yaffs_InodeToObject(dir), dentry->d_name.name,
 				S_IFLNK | S_IRWXUGO, uid, gid, symname);
 	yaffs_GrossUnlock(dev);
+	up_write(&dev->dirLock);
 
 	if (obj) {
 		struct inode *inode;
 
 		inode = yaffs_get_inode(dir->i_sb, obj->yst_mode, 0, obj);
+		if (!inode)
+			return -ENOMEM;
 		d_instantiate(dentry, inode);
 		update_dir_time(dir);
 		T(YAFFS_TRACE_OS, ("symlink created OK\n"));
@@ -1643,6 +2215,7 @@ static int yaffs_rename(struct inode *old_dir, struct dentry *old_dentry,
 	T(YAFFS_TRACE_OS, ("yaffs_rename\n"));
 	dev = yaffs_InodeToObject(old_dir)->myDev;
 
+	down_write(&dev->dirLock);
 	yaffs_GrossLock(dev);
 
 	/* Check if the target is an existing directory that is not empty. */
@@ -1667,6 +2240,7 @@ static int yaffs_rename(struct inode *old_dir, struct dentry *old_dentry,
 				new_dentry->d_name.name);
 	}
 	yaffs_GrossUnlock(dev);
+	up_write(&dev->dirLock);
 
 	if (retVal == YAFFS_OK) {
 		if (target) {
@@ -1696,6 +2270,7 @@ static int yaffs_setattr(struct dentry *dentry, struct iattr *attr)
 	error = inode_change_ok(inode, attr);
 	if (error == 0) {
 		dev = yaffs_InodeToObject(inode)->myDev;
+		down_write(yaffs_InodeDataLock(inode));
 		yaffs_GrossLock(dev);
 		if (yaffs_SetAttributes(yaffs_InodeToObject(inode), attr) ==
 				YAFFS_OK) {
@@ -1704,6 +2279,7 @@ static int yaffs_setattr(struct dentry *dentry, struct iattr *attr)
 			error = -EPERM;
 		}
 		yaffs_GrossUnlock(dev);
+		up_write(yaffs_InodeDataLock(inode));
 		if (!error)
 			error = inode_setattr(inode, attr);
 	}
@@ -1840,6 +2416,7 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino)
 	struct inode *inode;
 	yaffs_Object *obj;
 	yaffs_Device *dev = yaffs_SuperToDevice(sb);
+	int error;
 
 	T(YAFFS_TRACE_OS,
 		("yaffs_iget for %lu\n", ino));
@@ -1859,10 +2436,15 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino)
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
-	yaffs_FillInodeFromObject(inode, obj);
+	error = yaffs_FillInodeFromObject(inode, obj);
 
 	yaffs_GrossUnlock(dev);
 
+	if (error) {
+		iget_failed(inode);
+		return ERR_PTR(error);
+	}
+
 	unlock_new_inode(inode);
 	return inode;
 }
@@ -1886,7 +2468,8 @@ static void yaffs_read_inode(struct inode *inode)
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
-	yaffs_FillInodeFromObject(inode, obj);
+	if (yaffs_FillInodeFromObject(inode, obj))
+		make_bad_inode(inode);
 
 	yaffs_GrossUnlock(dev);
 }
@@ -1931,6 +2514,8 @@ static void yaffs_put_super(struct super_block *sb)
 
 	T(YAFFS_TRACE_OS, ("yaffs_put_super\n"));
 
+	yaffs_StopBackgroundGC(dev);
+
 	yaffs_GrossLock(dev);
 
 	yaffs_FlushEntireDeviceCache(dev);
@@ -1981,6 +2566,7 @@ typedef struct {
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int cache_chunks;
 	int tags_ecc_on;
 	int tags_ecc_off;
 	int empty_lost_and_found_overridden;
@@ -1988,6 +2574,12 @@ typedef struct {
 } yaffs_options;
 
 #define MAX_OPT_LEN 20
+
+/* Chunks in the short op cache unless the cache= mount option says.
+ * yaffs_GutsInitialise() holds it to YAFFS_MAX_SHORT_OP_CACHES.
+ */
+#define YAFFS_DEFAULT_SHORT_OP_CACHES	32
+
 static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 {
 	char cur_opt[MAX_OPT_LEN + 1];
@@ -2015,6 +2607,12 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 			options->inband_tags = 1;
 		else if (!strcmp(cur_opt, "no-cache"))
 			options->no_cache = 1;
+		else if (!strncmp(cur_opt, "cache=", 6)) {
+			options->cache_chunks =
+				simple_strtoul(cur_opt + 6, NULL, 10);
+			if (options->cache_chunks == 0)
+				options->no_cache = 1;
+		}
 		else if (!strcmp(cur_opt, "no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-write"))
@@ -2243,7 +2841,14 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	if (options.no_cache)
+		dev->nShortOpCaches = 0;
+	else if (options.cache_chunks)
+		dev->nShortOpCaches = options.cache_chunks;
+	else
+		dev->nShortOpCaches = YAFFS_DEFAULT_SHORT_OP_CACHES;
+	/* Read at mount time; 0 turns directory name indexes off */
+	dev->maxDirIndexBytes = yaffs_dir_index_kb * 1024;
 	dev->inbandTags = options.inband_tags;
 #ifdef CONFIG_YAFFS_DOES_TAGS_ECC
 	dev->doesTagsEcc = !options.tags_ecc_off;
@@ -2259,6 +2864,13 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_ReadChunkWithTagsFromNAND;
 		dev->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		dev->queryNANDBlock = nandmtd2_QueryNANDBlock;
+		dev->readChunksFromNAND = nandmtd2_ReadChunksFromNAND;
+		if (yaffs_scan_ahead) {
+			dev->readBlockTagsFromNAND =
+			    nandmtd2_ReadBlockTagsFromNAND;
+			dev->startBlockScan = nandmtd2_StartBlockScan;
+			dev->endBlockScan = nandmtd2_EndBlockScan;
+		}
 		dev->spareBuffer = YMALLOC(mtd->oobsize);
 		dev->isYaffs2 = 1;
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
@@ -2316,6 +2928,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         dev->removeObjectCallback = yaffs_RemoveObjectCallback;
 
 	init_MUTEX(&dev->grossLock);
+	init_rwsem(&dev->dirLock);
 
 	yaffs_GrossLock(dev);
 
@@ -2354,6 +2967,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs_read_super: isCheckpointed %d\n", dev->isCheckpointed));
 
+	yaffs_StartBackgroundGC(dev, sb);
+
 	T(YAFFS_TRACE_OS, ("yaffs_read_super: done\n"));
 	return sb;
 }
@@ -2453,10 +3068,55 @@ static DECLARE_FSTYPE(yaffs2_fs_type, "yaffs2", yaffs2_read_super,
 
 #endif				/* CONFIG_YAFFS_YAFFS2 */
 
+#if YAFFS_USE_SHRINKER
+/*
+ * Under memory pressure, give back the object details and directory
+ * indexes that yaffs can read back or rebuild (see yaffs_ShrinkMetadata()).
+ * A device whose gross lock is held is passed over rather than waited for,
+ * since the allocation that got us here may be its own. Setting
+ * yaffs_shrinker to 0 turns this off.
+ */
+static int yaffs_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct ylist_head *item;
+	yaffs_Device *dev;
+	int left = 0;
+
+	if (!yaffs_shrinker)
+		return 0;
+
+	if (nr_to_scan && !(gfp_mask & __GFP_FS))
+		return -1;
+
+	/* hold lock_kernel while traversing yaffs_dev_list */
+	lock_kernel();
+	ylist_for_each(item, &yaffs_dev_list) {
+		dev = ylist_entry(item, yaffs_Device, devList);
+		if (down_trylock(&dev->grossLock))
+			continue;
+		left += yaffs_ShrinkMetadata(dev, nr_to_scan);
+		yaffs_GrossUnlock(dev);
+	}
+	unlock_kernel();
+
+	return left;
+}
+
+static struct shrinker yaffs_shrinker_info = {
+	.shrink = yaffs_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+#endif
+
 static struct proc_dir_entry *my_proc_entry;
 
 static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 {
+	int tnodeSize = dev->tnodeWidth * YAFFS_NTNODES_LEVEL0 / 8;
+
+	if (tnodeSize < sizeof(yaffs_Tnode))
+		tnodeSize = sizeof(yaffs_Tnode);
+
 	buf += sprintf(buf, "startBlock......... %d\n", dev->startBlock);
 	buf += sprintf(buf, "endBlock........... %d\n", dev->endBlock);
 	buf += sprintf(buf, "totalBytesPerChunk. %d\n", dev->totalBytesPerChunk);
@@ -2465,11 +3125,20 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "chunkGroupSize..... %d\n", dev->chunkGroupSize);
 	buf += sprintf(buf, "nErasedBlocks...... %d\n", dev->nErasedBlocks);
 	buf += sprintf(buf, "nReservedBlocks.... %d\n", dev->nReservedBlocks);
+	buf += sprintf(buf, "isCheckpointed..... %d\n", dev->isCheckpointed);
 	buf += sprintf(buf, "blocksInCheckpoint. %d\n", dev->blocksInCheckpoint);
 	buf += sprintf(buf, "nTnodesCreated..... %d\n", dev->nTnodesCreated);
 	buf += sprintf(buf, "nFreeTnodes........ %d\n", dev->nFreeTnodes);
 	buf += sprintf(buf, "nObjectsCreated.... %d\n", dev->nObjectsCreated);
 	buf += sprintf(buf, "nFreeObjects....... %d\n", dev->nFreeObjects);
+	buf += sprintf(buf, "nObjectDetails..... %d\n", dev->nObjectDetails);
+	buf += sprintf(buf, "nDetailsDropped.... %d\n", dev->nDetailsDropped);
+	buf += sprintf(buf, "objectBytes........ %d\n",
+		    (dev->nObjectsCreated - dev->nFreeObjects) *
+		    (int)sizeof(yaffs_Object) +
+		    dev->nObjectDetails * (int)sizeof(yaffs_ObjectDetails));
+	buf += sprintf(buf, "tnodeBytes......... %d\n",
+		    (dev->nTnodesCreated - dev->nFreeTnodes) * tnodeSize);
 	buf += sprintf(buf, "nFreeChunks........ %d\n", dev->nFreeChunks);
 	buf += sprintf(buf, "nPageWrites........ %d\n", dev->nPageWrites);
 	buf += sprintf(buf, "nPageReads......... %d\n", dev->nPageReads);
@@ -2478,6 +3147,14 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "garbageCollections. %d\n", dev->garbageCollections);
 	buf += sprintf(buf, "passiveGCs......... %d\n",
 		    dev->passiveGarbageCollections);
+	buf += sprintf(buf, "backgroundGCs...... %d\n",
+		    dev->backgroundGarbageCollections);
+	buf += sprintf(buf, "foregroundGCTime... %llu us\n",
+		    dev->foregroundGCTime);
+	buf += sprintf(buf, "backgroundGCTime... %llu us\n",
+		    dev->backgroundGCTime);
+	buf += sprintf(buf, "dirIndexBytes...... %d\n", dev->dirIndexBytes);
+	buf += sprintf(buf, "dirIndexBuilds..... %d\n", dev->nDirIndexBuilds);
 	buf += sprintf(buf, "nRetriedWrites..... %d\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nShortOpCaches..... %d\n", dev->nShortOpCaches);
 	buf += sprintf(buf, "nRetireBlocks...... %d\n", dev->nRetiredBlocks);
@@ -2486,6 +3163,8 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %d\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheWriteBacks.... %d\n", dev->cacheWriteBacks);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
@@ -2693,6 +3372,13 @@ static int __init init_yaffs_fs(void)
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs " __DATE__ " " __TIME__ " Installing. \n"));
 
+	yaffs_inode_cache = kmem_cache_create("yaffs_inode_cache",
+					sizeof(struct yaffs_InodeInfo), 0,
+					SLAB_RECLAIM_ACCOUNT | SLAB_MEM_SPREAD,
+					yaffs_init_inode_once);
+	if (!yaffs_inode_cache)
+		return -ENOMEM;
+
 	/* Install the proc_fs entry */
 	my_proc_entry = create_proc_entry("yaffs",
 					       S_IRUGO | S_IFREG,
@@ -2702,8 +3388,14 @@ static int __init init_yaffs_fs(void)
 		my_proc_entry->write_proc = yaffs_proc_write;
 		my_proc_entry->read_proc = yaffs_proc_read;
 		my_proc_entry->data = NULL;
-	} else
+	} else {
+		kmem_cache_destroy(yaffs_inode_cache);
 		return -ENOMEM;
+	}
+
+#if YAFFS_USE_SHRINKER
+	register_shrinker(&yaffs_shrinker_info);
+#endif
 
 	/* Now add the file system entries */
 
@@ -2727,6 +3419,11 @@ static int __init init_yaffs_fs(void)
 			}
 			fsinst++;
 		}
+#if YAFFS_USE_SHRINKER
+		unregister_shrinker(&yaffs_shrinker_info);
+#endif
+		remove_proc_entry("yaffs", YPROC_ROOT);
+		kmem_cache_destroy(yaffs_inode_cache);
 	}
 
 	return error;
@@ -2740,6 +3437,10 @@ static void __exit exit_yaffs_fs(void)
 	T(YAFFS_TRACE_ALWAYS, ("yaffs " __DATE__ " " __TIME__
 			       " removing. \n"));
 
+#if YAFFS_USE_SHRINKER
+	unregister_shrinker(&yaffs_shrinker_info);
+#endif
+
 	remove_proc_entry("yaffs", YPROC_ROOT);
 
 	fsinst = fs_to_install;
@@ -2751,6 +3452,8 @@ static void __exit exit_yaffs_fs(void)
 		}
 		fsinst++;
 	}
+
+	kmem_cache_destroy(yaffs_inode_cache);
 }
 
 module_init(init_yaffs_fs)
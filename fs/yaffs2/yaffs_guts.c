@@ -69,6 +69,11 @@ static void yaffs_AddObjectToDirectory(yaffs_Object *directory,
 static int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name,
 				int force, int isShrink, int shadows);
 static void yaffs_RemoveObjectFromDirectory(yaffs_Object *obj);
+static void yaffs_DirIndexAdd(yaffs_Object *obj);
+static void yaffs_DirIndexRemove(yaffs_Object *obj);
+static void yaffs_DirIndexFree(yaffs_Object *dir);
+static void yaffs_DirIndexFreeAll(yaffs_Device *dev);
+static void yaffs_DirIndexFreeOldest(yaffs_Device *dev);
 static int yaffs_CheckStructures(void);
 static int yaffs_DoGenericObjectDeletion(yaffs_Object *in);
 
@@ -1078,6 +1083,9 @@ static __u16 yaffs_CalcNameSum(const YCHAR *name)
 
 static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
 {
+	/* The sum is the key in the parent's name index */
+	yaffs_DirIndexRemove(obj);
+
 #ifdef CONFIG_YAFFS_SHORT_NAMES_IN_RAM
 	memset(obj->shortName, 0, sizeof(YCHAR) * (YAFFS_SHORT_NAME_LENGTH+1));
 	if (name && yaffs_strlen(name) <= YAFFS_SHORT_NAME_LENGTH)
@@ -1086,6 +1094,8 @@ static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
 		obj->shortName[0] = _Y('\0');
 #endif
 	obj->sum = yaffs_CalcNameSum(name);
+
+	yaffs_DirIndexAdd(obj);
 }
 
 /*-------------------- TNODES -------------------
@@ -1782,6 +1792,7 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device *dev)
 		if (dev->rootDir) {
 			tn->parent = dev->rootDir;
 			ylist_add(&(tn->siblings), &dev->rootDir->variant.directoryVariant.children);
+			yaffs_DirIndexAdd(tn);
 		}
 
 		/* Add it to the lost and found directory.
@@ -1833,6 +1844,15 @@ static void yaffs_UnhashObject(yaffs_Object *tn)
 	}
 }
 
+static void yaffs_FreeObjectDetails(yaffs_Object *obj)
+{
+	if (obj->details) {
+		YFREE(obj->details);
+		obj->details = NULL;
+		obj->myDev->nObjectDetails--;
+	}
+}
+
 /*  FreeObject frees up a Object and puts it back on the free list */
 static void yaffs_FreeObject(yaffs_Object *tn)
 {
@@ -1847,6 +1867,8 @@ static void yaffs_FreeObject(yaffs_Object *tn)
 	if (!ylist_empty(&tn->siblings))
 		YBUG();
 
+	if (tn->variantType == YAFFS_OBJECT_TYPE_DIRECTORY)
+		yaffs_DirIndexFree(tn);
 
 #ifdef __KERNEL__
 	if (tn->myInode) {
@@ -1858,6 +1880,7 @@ static void yaffs_FreeObject(yaffs_Object *tn)
 	}
 #endif
 
+	yaffs_FreeObjectDetails(tn);
 	yaffs_UnhashObject(tn);
 
 #ifdef VALGRIND_TEST
@@ -1886,6 +1909,16 @@ static void yaffs_DeinitialiseObjects(yaffs_Device *dev)
 	/* Free the list of allocated Objects */
 
 	yaffs_ObjectList *tmp;
+	struct ylist_head *i;
+	int b;
+
+	yaffs_DirIndexFreeAll(dev);
+
+	for (b = 0; b < YAFFS_NOBJECT_BUCKETS; b++) {
+		ylist_for_each(i, &dev->objectBucket[b].list)
+			yaffs_FreeObjectDetails(ylist_entry(i, yaffs_Object,
+							hashLink));
+	}
 
 	while (dev->allocatedObjectList) {
 		tmp = dev->allocatedObjectList->next;
@@ -1907,6 +1940,9 @@ static void yaffs_InitialiseObjects(yaffs_Device *dev)
 	dev->freeObjects = NULL;
 	dev->nFreeObjects = 0;
 
+	YINIT_LIST_HEAD(&dev->dirIndexes);
+	dev->dirIndexBytes = 0;
+
 	for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
 		YINIT_LIST_HEAD(&dev->objectBucket[i].list);
 		dev->objectBucket[i].count = 0;
@@ -2043,18 +2079,8 @@ yaffs_Object *yaffs_CreateNewObject(yaffs_Device *dev, int number,
 		theObject->objectId = number;
 		yaffs_HashObject(theObject);
 		theObject->variantType = type;
-#ifdef CONFIG_YAFFS_WINCE
-		yfsd_WinFileTimeNow(theObject->win_atime);
-		theObject->win_ctime[0] = theObject->win_mtime[0] =
-		    theObject->win_atime[0];
-		theObject->win_ctime[1] = theObject->win_mtime[1] =
-		    theObject->win_atime[1];
-
-#else
 
-		theObject->yst_atime = theObject->yst_mtime =
-		    theObject->yst_ctime = Y_CURRENT_TIME;
-#endif
+		/* The details, with the times, are made on first use */
 		switch (type) {
 		case YAFFS_OBJECT_TYPE_FILE:
 			theObject->variant.fileVariant.fileSize = 0;
@@ -2129,6 +2155,7 @@ static yaffs_Object *yaffs_MknodObject(yaffs_ObjectType type,
 				       const YCHAR *aliasString, __u32 rdev)
 {
 	yaffs_Object *in;
+	yaffs_ObjectDetails *details;
 	YCHAR *str = NULL;
 
 	yaffs_Device *dev = parent->myDev;
@@ -2159,17 +2186,14 @@ static yaffs_Object *yaffs_MknodObject(yaffs_ObjectType type,
 
 		in->yst_mode = mode;
 
-#ifdef CONFIG_YAFFS_WINCE
-		yfsd_WinFileTimeNow(in->win_atime);
-		in->win_ctime[0] = in->win_mtime[0] = in->win_atime[0];
-		in->win_ctime[1] = in->win_mtime[1] = in->win_atime[1];
-
-#else
-		in->yst_atime = in->yst_mtime = in->yst_ctime = Y_CURRENT_TIME;
-
-		in->yst_rdev = rdev;
-		in->yst_uid = uid;
-		in->yst_gid = gid;
+		/* No header yet, so these come with the current time */
+		details = yaffs_GetObjectDetails(in);
+#ifndef CONFIG_YAFFS_WINCE
+		if (details) {
+			details->yst_rdev = rdev;
+			details->yst_uid = uid;
+			details->yst_gid = gid;
+		}
 #endif
 		in->nDataChunks = 0;
 
@@ -2199,7 +2223,8 @@ static yaffs_Object *yaffs_MknodObject(yaffs_ObjectType type,
 			break;
 		}
 
-		if (yaffs_UpdateObjectHeader(in, name, 0, 0, 0) < 0) {
+		if (!details ||
+		    yaffs_UpdateObjectHeader(in, name, 0, 0, 0) < 0) {
 			/* Could not create the object header, fail the creation */
 			yaffs_DeleteObject(in);
 			in = NULL;
@@ -2665,6 +2690,8 @@ static int yaffs_FindBlockForAllocation(yaffs_Device *dev)
 			  (TSTR("Allocated block %d, seq  %d, %d left" TENDSTR),
 			   dev->allocationBlockFinder, dev->sequenceNumber,
 			   dev->nErasedBlocks));
+			if (dev->wakeBackgroundGC)
+				dev->wakeBackgroundGC(dev);
 			return dev->allocationBlockFinder;
 		}
 	}
@@ -2867,7 +2894,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 
 		yaffs_VerifyBlock(dev, bi, block);
 
-		maxCopies = (wholeBlock) ? dev->nChunksPerBlock : 10;
+		maxCopies = (wholeBlock) ? dev->nChunksPerBlock : YAFFS_GC_STEP_COPIES;
 		oldChunk = block * dev->nChunksPerBlock + dev->gcChunk;
 
 		for (/* init already done */;
@@ -3054,6 +3081,26 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	return retVal;
 }
 
+/*
+ * Below this many erased blocks, garbage collection becomes aggressive.
+ */
+static int yaffs_ErasedBlocksWanted(yaffs_Device *dev)
+{
+	int checkpointBlockAdjust;
+
+	checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
+	if (checkpointBlockAdjust < 0)
+		checkpointBlockAdjust = 0;
+
+	return dev->nReservedBlocks + checkpointBlockAdjust + 2;
+}
+
+static int yaffs_GarbageCollectionIsUrgent(yaffs_Device *dev)
+{
+	/* Do we need a block soon? */
+	return dev->nErasedBlocks < yaffs_ErasedBlocksWanted(dev);
+}
+
 /* New garbage collector
  * If we're very low on erased blocks then we do aggressive garbage collection
  * otherwise we do "leasurely" garbage collection.
@@ -3070,13 +3117,15 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	int gcOk = YAFFS_OK;
 	int maxTries = 0;
 
-	int checkpointBlockAdjust;
-
 	if (dev->isDoingGC) {
 		/* Bail out so we don't get recursive gc */
 		return YAFFS_OK;
 	}
 
+	/* Leave leisurely gc to the background collector, if there is one */
+	if (dev->backgroundGC && !yaffs_GarbageCollectionIsUrgent(dev))
+		return YAFFS_OK;
+
 	/* This loop should pass the first time.
 	 * We'll only see looping here if the erase of the collected block fails.
 	 */
@@ -3084,17 +3133,7 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	do {
 		maxTries++;
 
-		checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
-		if (checkpointBlockAdjust < 0)
-			checkpointBlockAdjust = 0;
-
-		if (dev->nErasedBlocks < (dev->nReservedBlocks + checkpointBlockAdjust + 2)) {
-			/* We need a block soon...*/
-			aggressive = 1;
-		} else {
-			/* We're in no hurry */
-			aggressive = 0;
-		}
+		aggressive = yaffs_GarbageCollectionIsUrgent(dev);
 
 		if (dev->gcBlock <= 0) {
 			dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, aggressive);
@@ -3104,6 +3143,8 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 		block = dev->gcBlock;
 
 		if (block > 0) {
+			unsigned long long start = Y_TIME_US();
+
 			dev->garbageCollections++;
 			if (!aggressive)
 				dev->passiveGarbageCollections++;
@@ -3114,6 +3155,8 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 			   dev->nErasedBlocks, aggressive));
 
 			gcOk = yaffs_GarbageCollectBlock(dev, block, aggressive);
+
+			dev->foregroundGCTime += Y_TIME_US() - start;
 		}
 
 		if (dev->nErasedBlocks < (dev->nReservedBlocks) && block > 0) {
@@ -3129,6 +3172,112 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	return aggressive ? gcOk : YAFFS_OK;
 }
 
+/*
+ * Do one bounded step of urgent garbage collection: copy at most
+ * YAFFS_GC_STEP_COPIES chunks out of the block being collected, choosing
+ * that block first if need be. The block is remembered in gcBlock and
+ * gcChunk, so the next step (or yaffs_CheckGarbageCollection()) carries
+ * on where this one stopped.
+ *
+ * This lets an OS layer that holds a lock across yaffs calls make room
+ * before a write a little at a time, dropping the lock between steps,
+ * rather than doing it all inside the write.
+ *
+ * Returns 1 if a step was done and more are needed, else 0.
+ */
+int yaffs_GarbageCollectStep(yaffs_Device *dev)
+{
+	int block;
+	int gcOk;
+	unsigned long long start;
+
+	if (dev->isDoingGC || !yaffs_GarbageCollectionIsUrgent(dev))
+		return 0;
+
+	if (dev->gcBlock <= 0) {
+		dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, 1);
+		dev->gcChunk = 0;
+	}
+
+	block = dev->gcBlock;
+	if (block <= 0)
+		return 0;
+
+	dev->garbageCollections++;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: GC step erasedBlocks %d block %d chunk %d" TENDSTR),
+	   dev->nErasedBlocks, block, dev->gcChunk));
+
+	start = Y_TIME_US();
+	gcOk = yaffs_GarbageCollectBlock(dev, block, 0);
+	dev->foregroundGCTime += Y_TIME_US() - start;
+
+	if (gcOk != YAFFS_OK)
+		return 0;
+
+	return yaffs_GarbageCollectionIsUrgent(dev);
+}
+
+/*
+ * Background garbage collection, for an OS layer that runs a collector
+ * thread and sets dev->backgroundGC.
+ *
+ * yaffs_BackgroundGCUrgency() says how much collection is wanted:
+ *  2: erased blocks are short and foreground gc would be aggressive now.
+ *  1: fewer than extraBlocks erased blocks above that point, or a block
+ *     is part way through collection. Best done while the device is idle.
+ *  0: none.
+ */
+int yaffs_BackgroundGCUrgency(yaffs_Device *dev, int extraBlocks)
+{
+	int wanted = yaffs_ErasedBlocksWanted(dev);
+
+	if (dev->nErasedBlocks < wanted)
+		return 2;
+	if (dev->nErasedBlocks < wanted + extraBlocks || dev->gcBlock > 0)
+		return 1;
+	return 0;
+}
+
+/*
+ * Do one step of background collection at the given urgency, copying at
+ * most YAFFS_GC_STEP_COPIES chunks. The victim is the block with the
+ * fewest chunks in use, so the least is copied for each block freed.
+ * Returns 1 if a step was done.
+ */
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int urgency)
+{
+	int block;
+	int gcOk;
+	unsigned long long start;
+
+	if (dev->isDoingGC || urgency < 1)
+		return 0;
+
+	if (dev->gcBlock <= 0) {
+		dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, 1);
+		dev->gcChunk = 0;
+		if (dev->gcBlock <= 0)
+			return 0;
+	}
+
+	block = dev->gcBlock;
+
+	dev->garbageCollections++;
+	dev->backgroundGarbageCollections++;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: background GC erasedBlocks %d block %d chunk %d" TENDSTR),
+	   dev->nErasedBlocks, block, dev->gcChunk));
+
+	start = Y_TIME_US();
+	gcOk = yaffs_GarbageCollectBlock(dev, block, 0);
+	dev->backgroundGCTime += Y_TIME_US() - start;
+
+	return gcOk == YAFFS_OK;
+}
+
 /*-------------------------  TAGS --------------------------------*/
 
 static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
@@ -3540,6 +3689,7 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
 
 	__u8 *buffer = NULL;
 	YCHAR oldName[YAFFS_MAX_NAME_LENGTH + 1];
+	yaffs_ObjectDetails *details;
 
 	yaffs_ObjectHeader *oh = NULL;
 
@@ -3551,7 +3701,10 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
 		force) {
 
 		yaffs_CheckGarbageCollection(dev);
-		yaffs_CheckObjectDetailsLoaded(in);
+
+		details = yaffs_GetObjectDetails(in);
+		if (!details)
+			return -1;
 
 		buffer = yaffs_GetTempBuffer(in->myDev, __LINE__);
 		oh = (yaffs_ObjectHeader *) buffer;
@@ -3574,19 +3727,19 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
 		oh->shadowsObject = oh->inbandShadowsObject = shadows;
 
 #ifdef CONFIG_YAFFS_WINCE
-		oh->win_atime[0] = in->win_atime[0];
-		oh->win_ctime[0] = in->win_ctime[0];
-		oh->win_mtime[0] = in->win_mtime[0];
-		oh->win_atime[1] = in->win_atime[1];
-		oh->win_ctime[1] = in->win_ctime[1];
-		oh->win_mtime[1] = in->win_mtime[1];
+		oh->win_atime[0] = details->win_atime[0];
+		oh->win_ctime[0] = details->win_ctime[0];
+		oh->win_mtime[0] = details->win_mtime[0];
+		oh->win_atime[1] = details->win_atime[1];
+		oh->win_ctime[1] = details->win_ctime[1];
+		oh->win_mtime[1] = details->win_mtime[1];
 #else
-		oh->yst_uid = in->yst_uid;
-		oh->yst_gid = in->yst_gid;
-		oh->yst_atime = in->yst_atime;
-		oh->yst_mtime = in->yst_mtime;
-		oh->yst_ctime = in->yst_ctime;
-		oh->yst_rdev = in->yst_rdev;
+		oh->yst_uid = details->yst_uid;
+		oh->yst_gid = details->yst_gid;
+		oh->yst_atime = details->yst_atime;
+		oh->yst_mtime = details->yst_mtime;
+		oh->yst_ctime = details->yst_ctime;
+		oh->yst_rdev = details->yst_rdev;
 #endif
 		if (in->parent)
 			oh->parentObjectId = in->parent->objectId;
@@ -3696,10 +3849,51 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The cache can be a few hundred chunks, so cached chunks are found through
+ *   a hash on object and chunk id, and kept on a list in least recently used
+ *   order with unused entries at the old end. Dirty chunks are left in the
+ *   cache, where further short writes to them cost nothing, until about half
+ *   the cache is dirty; then the object owning the oldest dirty chunk is
+ *   written out. Written out chunks stay in the cache, clean.
+ *
+ *   Dirty chunks are written in object and chunk order, so that a file's
+ *   chunks end up next to each other on NAND.
  */
 
+static int yaffs_ChunkCacheHash(yaffs_Device *dev, const yaffs_Object *obj,
+				int chunkId)
+{
+	/* On the address, so that unhashing never has to look at the object */
+	return ((((unsigned long)obj) >> 5) * 31 + chunkId) & dev->srHashMask;
+}
+
+static void yaffs_UnhashChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	yaffs_ChunkCache **p;
+
+	if (!cache->object)
+		return;
+
+	p = &dev->srHash[yaffs_ChunkCacheHash(dev, cache->object,
+						cache->chunkId)];
+	while (*p && *p != cache)
+		p = &(*p)->hashNext;
+	if (*p)
+		*p = cache->hashNext;
+
+	cache->hashNext = NULL;
+	cache->object = NULL;
+}
+
+/* Drop a cache entry, whatever it holds, and make it the first to reuse */
+static void yaffs_FreeChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	yaffs_UnhashChunkCache(dev, cache);
+	cache->dirty = 0;
+	ylist_del(&cache->lru);
+	ylist_add_tail(&cache->lru, &dev->srLRU);
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
@@ -3717,56 +3911,56 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 	return 0;
 }
 
-
-static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
+static int yaffs_ChunkCacheCompare(const void *a, const void *b)
 {
-	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
-	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
-	int nCaches = obj->myDev->nShortOpCaches;
+	const yaffs_ChunkCache *ca = *(yaffs_ChunkCache * const *)a;
+	const yaffs_ChunkCache *cb = *(yaffs_ChunkCache * const *)b;
 
-	if (nCaches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
+	if (ca->object->objectId != cb->object->objectId)
+		return ca->object->objectId - cb->object->objectId;
+	return ca->chunkId - cb->chunkId;
+}
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+/* Write out the dirty chunks of obj, or of every object if obj is NULL */
+static void yaffs_FlushChunkCaches(yaffs_Device *dev, yaffs_Object *obj)
+{
+	yaffs_ChunkCache **list = dev->srFlushList;
+	yaffs_ChunkCache *cache;
+	int chunkWritten;
+	int nDirty = 0;
+	int i;
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+	for (i = 0; i < dev->nShortOpCaches; i++) {
+		cache = &dev->srCache[i];
+		if (cache->object && cache->dirty && !cache->locked &&
+		    (!obj || cache->object == obj))
+			list[nDirty++] = cache;
+	}
 
-		} while (cache && chunkWritten > 0);
+	if (nDirty > 1)
+		yaffs_qsort(list, nDirty, sizeof(list[0]),
+			yaffs_ChunkCacheCompare);
 
-		if (cache) {
+	for (i = 0; i < nDirty; i++) {
+		cache = list[i];
+		chunkWritten = yaffs_WriteChunkDataToObject(cache->object,
+						cache->chunkId, cache->data,
+						cache->nBytes, 1);
+		if (chunkWritten <= 0) {
 			/* Hoosterman, disk full while writing cache out. */
 			T(YAFFS_TRACE_ERROR,
 			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
-
+			break;
 		}
+		cache->dirty = 0;
+		dev->cacheWriteBacks++;
 	}
+}
 
+static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
+{
+	if (obj->myDev->nShortOpCaches > 0)
+		yaffs_FlushChunkCaches(obj->myDev, obj);
 }
 
 /*yaffs_FlushEntireDeviceCache(dev)
@@ -3776,97 +3970,65 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
-	yaffs_Object *obj;
-	int nCaches = dev->nShortOpCaches;
-	int i;
-
-	/* Find a dirty object in the cache and flush it...
-	 * until there are no further dirty objects.
-	 */
-	do {
-		obj = NULL;
-		for (i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
-
-		}
-		if (obj)
-			yaffs_FlushFilesChunkCache(obj);
-
-	} while (obj);
-
+	if (dev->nShortOpCaches > 0)
+		yaffs_FlushChunkCaches(dev, NULL);
 }
 
 
-/* Grab us a cache chunk for use.
- * First look for an empty one.
- * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+/* Grab us a cache chunk for obj's chunkId.
+ * Take the least recently used entry that is unused or clean. If about
+ * half of those looked at on the way are dirty, write out the object of
+ * the oldest dirty one, which leaves that entry clean, and take it.
  */
-static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
-{
-	int i;
-
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
-	}
-
-	return NULL;
-}
-
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Object *obj, int chunkId)
 {
+	yaffs_Device *dev = obj->myDev;
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
-
-	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
+	yaffs_ChunkCache *oldestDirty = NULL;
+	struct ylist_head *i;
+	int nDirty = 0;
+	int h;
 
-		cache = yaffs_GrabChunkCacheWorker(dev);
+	if (dev->nShortOpCaches <= 0)
+		return NULL;
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	cache = NULL;
+	for (i = dev->srLRU.prev; i != &dev->srLRU; i = i->prev) {
+		yaffs_ChunkCache *c = ylist_entry(i, yaffs_ChunkCache, lru);
 
-			/* With locking we can't assume we can use entry zero */
+		if (c->locked)
+			continue;
+		if (!c->object || !c->dirty) {
+			cache = c;
+			break;
+		}
+		if (!oldestDirty)
+			oldestDirty = c;
+		if (++nDirty > dev->nShortOpCaches / 2)
+			break;
+	}
 
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+	if (!cache && oldestDirty) {
+		yaffs_FlushFilesChunkCache(oldestDirty->object);
+		if (!oldestDirty->dirty)
+			cache = oldestDirty;
+	}
 
-			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
+	if (!cache)
+		return NULL;
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+	yaffs_UnhashChunkCache(dev, cache);
 
-		}
-		return cache;
-	} else
-		return NULL;
+	h = yaffs_ChunkCacheHash(dev, obj, chunkId);
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->nBytes = 0;
+	cache->hashNext = dev->srHash[h];
+	dev->srHash[h] = cache;
 
+	return cache;
 }
 
 /* Find a cached chunk */
@@ -3874,18 +4036,17 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	yaffs_ChunkCache *cache;
 
-				return &dev->srCache[i];
-			}
-		}
-	}
-	return NULL;
+	if (dev->nShortOpCaches <= 0)
+		return NULL;
+
+	cache = dev->srHash[yaffs_ChunkCacheHash(dev, obj, chunkId)];
+	while (cache &&
+	       (cache->object != obj || cache->chunkId != chunkId))
+		cache = cache->hashNext;
+
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -3894,18 +4055,8 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 {
 
 	if (dev->nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
-
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
+		ylist_del(&cache->lru);
+		ylist_add(&cache->lru, &dev->srLRU);
 
 		if (isAWrite)
 			cache->dirty = 1;
@@ -3922,7 +4073,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_FreeChunkCache(object->myDev, cache);
 	}
 }
 
@@ -3938,7 +4089,7 @@ static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 		/* Invalidate it. */
 		for (i = 0; i < dev->nShortOpCaches; i++) {
 			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+				yaffs_FreeChunkCache(dev, &dev->srCache[i]);
 		}
 	}
 }
@@ -4468,6 +4619,8 @@ static void yaffs_InvalidateCheckpoint(yaffs_Device *dev)
 		yaffs_CheckpointInvalidateStream(dev);
 		if (dev->superBlock && dev->markSuperBlockDirty)
 			dev->markSuperBlockDirty(dev->superBlock);
+		if (dev->wakeBackgroundGC)
+			dev->wakeBackgroundGC(dev);
 	}
 }
 
@@ -4486,7 +4639,7 @@ int yaffs_CheckpointSave(yaffs_Device *dev)
 		yaffs_WriteCheckpointData(dev);
 	}
 
-	T(YAFFS_TRACE_ALWAYS, (TSTR("save exit: isCheckpointed %d"TENDSTR), dev->isCheckpointed));
+	T(YAFFS_TRACE_CHECKPOINT, (TSTR("save exit: isCheckpointed %d"TENDSTR), dev->isCheckpointed));
 
 	return dev->isCheckpointed;
 }
@@ -4555,22 +4708,20 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		 * else bypass the cache.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->inbandTags) {
-			if (dev->nShortOpCaches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
-
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+			/* If we can't find the data in the cache, then load it up. */
+			if (cache) {
+				dev->cacheHits++;
+			} else if (dev->nShortOpCaches > 0) {
+				cache = yaffs_GrabChunkCache(in, chunk);
+				if (cache) {
+					dev->cacheMisses++;
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
-					cache->nBytes = 0;
 				}
+			}
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -4611,6 +4762,116 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 	return nDone;
 }
 
+/*
+ * Read whole chunks into nBuffers buffers of bufferSize bytes each, from
+ * offset on, as for readahead. The level 0 tnode is looked up once for
+ * each group of chunks it covers rather than once a chunk, and chunks
+ * that follow each other on NAND are read in one go. Chunks in the cache
+ * and unaligned reads go through yaffs_ReadDataFromFile().
+ */
+#define YAFFS_READ_RUN_CHUNKS	8
+
+static void yaffs_ReadChunkRun(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data, yaffs_ExtendedTags *tags)
+{
+	if (nChunks > 0)
+		yaffs_ReadChunksWithTagsFromNAND(dev, chunkInNAND, nChunks,
+						data, tags);
+}
+
+int yaffs_ReadDataToBuffers(yaffs_Object *in, __u8 * const *buffers,
+			int nBuffers, int bufferSize, loff_t offset)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_Tnode *tn = NULL;
+	int tnGroup = -1;
+	yaffs_ExtendedTags localTags;
+	yaffs_ExtendedTags *tags;
+	__u8 *runData[YAFFS_READ_RUN_CHUNKS];
+	int runStart = 0;
+	int runLength = 0;
+	int maxRun;
+	int chunksPerBuffer;
+	int firstChunk;
+	int nChunks;
+	__u32 start;
+	int i;
+
+	yaffs_AddrToChunk(dev, offset, &firstChunk, &start);
+	firstChunk++;
+
+	if (start || bufferSize % dev->nDataBytesPerChunk || dev->inbandTags) {
+		for (i = 0; i < nBuffers; i++)
+			yaffs_ReadDataFromFile(in, buffers[i],
+					offset + (loff_t)i * bufferSize,
+					bufferSize);
+		return nBuffers * bufferSize;
+	}
+
+	/* The tags of a run live in a temp buffer, not on the stack */
+	tags = (yaffs_ExtendedTags *)yaffs_GetTempBuffer(dev, __LINE__);
+	maxRun = dev->nDataBytesPerChunk / sizeof(yaffs_ExtendedTags);
+	if (maxRun > YAFFS_READ_RUN_CHUNKS)
+		maxRun = YAFFS_READ_RUN_CHUNKS;
+
+	chunksPerBuffer = bufferSize / dev->nDataBytesPerChunk;
+	nChunks = nBuffers * chunksPerBuffer;
+
+	for (i = 0; i < nChunks; i++) {
+		int chunkInInode = firstChunk + i;
+		int chunkInNAND = -1;
+		__u8 *data = buffers[i / chunksPerBuffer] +
+			(i % chunksPerBuffer) * dev->nDataBytesPerChunk;
+
+		if (yaffs_FindChunkCache(in, chunkInInode)) {
+			yaffs_ReadChunkRun(dev, runStart, runLength, runData,
+					tags);
+			runLength = 0;
+			yaffs_ReadDataFromFile(in, data,
+				(loff_t)(chunkInInode - 1) *
+					dev->nDataBytesPerChunk,
+				dev->nDataBytesPerChunk);
+			continue;
+		}
+
+		if ((chunkInInode >> YAFFS_TNODES_LEVEL0_BITS) != tnGroup) {
+			tnGroup = chunkInInode >> YAFFS_TNODES_LEVEL0_BITS;
+			tn = yaffs_FindLevel0Tnode(dev,
+					&in->variant.fileVariant,
+					chunkInInode);
+		}
+		if (tn)
+			chunkInNAND = yaffs_FindChunkInGroup(dev,
+				yaffs_GetChunkGroupBase(dev, tn, chunkInInode),
+				&localTags, in->objectId, chunkInInode);
+
+		if (runLength > 0 &&
+		    (chunkInNAND != runStart + runLength ||
+		     chunkInNAND % dev->nChunksPerBlock == 0 ||
+		     runLength == maxRun)) {
+			yaffs_ReadChunkRun(dev, runStart, runLength, runData,
+					tags);
+			runLength = 0;
+		}
+
+		if (chunkInNAND < 0) {
+			/* get sane (zero) data if you read a hole */
+			memset(data, 0, dev->nDataBytesPerChunk);
+			continue;
+		}
+
+		if (runLength == 0)
+			runStart = chunkInNAND;
+		runData[runLength++] = data;
+	}
+
+	yaffs_ReadChunkRun(dev, runStart, runLength, runData, tags);
+
+	yaffs_ReleaseTempBuffer(dev, (__u8 *)tags, __LINE__);
+
+	return nChunks * dev->nDataBytesPerChunk;
+}
+
 int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 			int nBytes, int writeThrough)
 {
@@ -4687,17 +4948,18 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				/* If we can't find the data in the cache, then load the cache */
 				cache = yaffs_FindChunkCache(in, chunk);
 
+				if (cache)
+					dev->cacheHits++;
+
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->
-								      data);
+					cache = yaffs_GrabChunkCache(in, chunk);
+					if (cache) {
+						dev->cacheMisses++;
+						yaffs_ReadChunkDataFromObject(in,
+							chunk, cache->data);
+					}
 				} else if (cache &&
 					!cache->dirty &&
 					!yaffs_CheckSpaceForAllocation(in->myDev)) {
@@ -4920,14 +5182,17 @@ loff_t yaffs_GetFileSize(yaffs_Object *obj)
 int yaffs_FlushFile(yaffs_Object *in, int updateTime)
 {
 	int retVal;
+	yaffs_ObjectDetails *details;
+
 	if (in->dirty) {
 		yaffs_FlushFilesChunkCache(in);
-		if (updateTime) {
+		details = updateTime ? yaffs_GetObjectDetails(in) : NULL;
+		if (details) {
 #ifdef CONFIG_YAFFS_WINCE
-			yfsd_WinFileTimeNow(in->win_mtime);
+			yfsd_WinFileTimeNow(details->win_mtime);
 #else
 
-			in->yst_mtime = Y_CURRENT_TIME;
+			details->yst_mtime = Y_CURRENT_TIME;
 
 #endif
 		}
@@ -5134,6 +5399,7 @@ static int yaffs_UnlinkWorker(yaffs_Object *obj)
 		hl = ylist_entry(obj->hardLinks.next, yaffs_Object, hardLinks);
 
 		ylist_del_init(&hl->hardLinks);
+		yaffs_DirIndexRemove(hl);
 		ylist_del_init(&hl->siblings);
 
 		yaffs_GetObjectName(hl, name, YAFFS_MAX_NAME_LENGTH + 1);
@@ -5223,12 +5489,6 @@ static void yaffs_HandleShadowedObject(yaffs_Device *dev, int objId,
 
 }
 
-typedef struct {
-	int seq;
-	int block;
-} yaffs_BlockIndex;
-
-
 static void yaffs_HardlinkFixup(yaffs_Device *dev, yaffs_Object *hardList)
 {
 	yaffs_Object *hl;
@@ -5671,21 +5931,8 @@ static int yaffs_Scan(yaffs_Device *dev)
 					in->variantType = oh->type;
 
 					in->yst_mode = oh->yst_mode;
-#ifdef CONFIG_YAFFS_WINCE
-					in->win_atime[0] = oh->win_atime[0];
-					in->win_ctime[0] = oh->win_ctime[0];
-					in->win_mtime[0] = oh->win_mtime[0];
-					in->win_atime[1] = oh->win_atime[1];
-					in->win_ctime[1] = oh->win_ctime[1];
-					in->win_mtime[1] = oh->win_mtime[1];
-#else
-					in->yst_uid = oh->yst_uid;
-					in->yst_gid = oh->yst_gid;
-					in->yst_atime = oh->yst_atime;
-					in->yst_mtime = oh->yst_mtime;
-					in->yst_ctime = oh->yst_ctime;
-					in->yst_rdev = oh->yst_rdev;
-#endif
+					/* The other details are read from the header when wanted */
+					yaffs_FreeObjectDetails(in);
 					in->hdrChunk = chunk;
 					in->serial = tags.serialNumber;
 
@@ -5696,21 +5943,8 @@ static int yaffs_Scan(yaffs_Device *dev)
 					in->variantType = oh->type;
 
 					in->yst_mode = oh->yst_mode;
-#ifdef CONFIG_YAFFS_WINCE
-					in->win_atime[0] = oh->win_atime[0];
-					in->win_ctime[0] = oh->win_ctime[0];
-					in->win_mtime[0] = oh->win_mtime[0];
-					in->win_atime[1] = oh->win_atime[1];
-					in->win_ctime[1] = oh->win_ctime[1];
-					in->win_mtime[1] = oh->win_mtime[1];
-#else
-					in->yst_uid = oh->yst_uid;
-					in->yst_gid = oh->yst_gid;
-					in->yst_atime = oh->yst_atime;
-					in->yst_mtime = oh->yst_mtime;
-					in->yst_ctime = oh->yst_ctime;
-					in->yst_rdev = oh->yst_rdev;
-#endif
+					/* The other details are read from the header when wanted */
+					yaffs_FreeObjectDetails(in);
 					in->hdrChunk = chunk;
 					in->serial = tags.serialNumber;
 
@@ -5867,6 +6101,147 @@ static int yaffs_Scan(yaffs_Device *dev)
 	return YAFFS_OK;
 }
 
+/*
+ * Object details.
+ *
+ * The attributes that only stat() and the object header need (owner,
+ * times, rdev) live in a yaffs_ObjectDetails apart from the object. An
+ * object is given them the first time they are asked for, through
+ * yaffs_GetObjectDetails(), so the objects of files nobody has looked at
+ * since the mount never carry them. Once an object is clean, so that its
+ * header on NAND holds the same values, and the OS has no inode for it,
+ * yaffs_ShrinkMetadata() may drop them again; they are then read back from
+ * the header when next wanted. The mode, name sum and short name stay in
+ * the object, since lookups go through them without the gross lock.
+ * Only yaffs_GetObjectDetails() allocates them; loading a lazy-loaded
+ * object, as a directory index build does for every child, fills them
+ * only if the object already has them.
+ */
+
+/* Copy the mode, and the attributes if the object has its details, from an object header */
+static void yaffs_LoadDetailsFromHeader(yaffs_Object *in,
+				const yaffs_ObjectHeader *oh)
+{
+	yaffs_ObjectDetails *details = in->details;
+
+	in->yst_mode = oh->yst_mode;
+
+	if (!details)
+		return;
+
+#ifdef CONFIG_YAFFS_WINCE
+	details->win_atime[0] = oh->win_atime[0];
+	details->win_ctime[0] = oh->win_ctime[0];
+	details->win_mtime[0] = oh->win_mtime[0];
+	details->win_atime[1] = oh->win_atime[1];
+	details->win_ctime[1] = oh->win_ctime[1];
+	details->win_mtime[1] = oh->win_mtime[1];
+#else
+	details->yst_uid = oh->yst_uid;
+	details->yst_gid = oh->yst_gid;
+	details->yst_atime = oh->yst_atime;
+	details->yst_mtime = oh->yst_mtime;
+	details->yst_ctime = oh->yst_ctime;
+	details->yst_rdev = oh->yst_rdev;
+#endif
+}
+
+/*
+ * Get an object's details, reading them from its header if they are not
+ * in RAM. An object with no header yet gets them with the current time.
+ * Returns NULL only if there was no memory for them.
+ */
+yaffs_ObjectDetails *yaffs_GetObjectDetails(yaffs_Object *in)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_ObjectDetails *details;
+	yaffs_ExtendedTags tags;
+	__u8 *chunkData;
+
+	if (in->details) {
+		yaffs_CheckObjectDetailsLoaded(in);
+		return in->details;
+	}
+
+	details = YMALLOC(sizeof(yaffs_ObjectDetails));
+	if (!details)
+		return NULL;
+	memset(details, 0, sizeof(yaffs_ObjectDetails));
+	in->details = details;
+	dev->nObjectDetails++;
+
+	if (in->lazyLoaded && in->hdrChunk > 0) {
+		/* Reads the header once, for the name as well */
+		yaffs_CheckObjectDetailsLoaded(in);
+	} else if (in->hdrChunk > 0) {
+		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
+		yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk,
+						chunkData, &tags);
+		yaffs_LoadDetailsFromHeader(in,
+					(yaffs_ObjectHeader *) chunkData);
+		yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+	} else {
+#ifdef CONFIG_YAFFS_WINCE
+		yfsd_WinFileTimeNow(details->win_atime);
+		details->win_ctime[0] = details->win_mtime[0] =
+		    details->win_atime[0];
+		details->win_ctime[1] = details->win_mtime[1] =
+		    details->win_atime[1];
+#else
+		details->yst_atime = details->yst_mtime = details->yst_ctime =
+		    Y_CURRENT_TIME;
+#endif
+	}
+
+	return details;
+}
+
+/*
+ * Give back RAM that can be had again from NAND: the least recently used
+ * directory name index, and the details of objects that are clean and
+ * have no inode. About nToScan objects are looked at, carrying on round
+ * the hash buckets from where the last call stopped. Returns the number
+ * of objects with details that could still be dropped, not counting
+ * those the OS holds inodes for.
+ */
+int yaffs_ShrinkMetadata(yaffs_Device *dev, int nToScan)
+{
+	struct ylist_head *i;
+	yaffs_Object *obj;
+	int nBuckets;
+	int nLeft;
+
+	if (!dev->isMounted)
+		return 0;
+
+	if (nToScan > 0)
+		yaffs_DirIndexFreeOldest(dev);
+
+	for (nBuckets = 0; nToScan > 0 && nBuckets < YAFFS_NOBJECT_BUCKETS;
+	     nBuckets++) {
+		ylist_for_each(i, &dev->objectBucket[dev->shrinkBucket].list) {
+			obj = ylist_entry(i, yaffs_Object, hashLink);
+			nToScan--;
+
+			if (!obj->details || obj->dirty || obj->lazyLoaded ||
+			    obj->hdrChunk <= 0 || obj->beingCreated)
+				continue;
+#ifdef __KERNEL__
+			if (obj->myInode)
+				continue;
+#endif
+			yaffs_FreeObjectDetails(obj);
+			dev->nDetailsDropped++;
+		}
+
+		dev->shrinkBucket = (dev->shrinkBucket + 1) %
+					YAFFS_NOBJECT_BUCKETS;
+	}
+
+	nLeft = dev->nObjectDetails - dev->nObjectInodes;
+	return nLeft > 0 ? nLeft : 0;
+}
+
 static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 {
 	__u8 *chunkData;
@@ -5888,29 +6263,12 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 #endif
 
 	if (in->lazyLoaded && in->hdrChunk > 0) {
-		in->lazyLoaded = 0;
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 		result = yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk, chunkData, &tags);
 		oh = (yaffs_ObjectHeader *) chunkData;
 
-		in->yst_mode = oh->yst_mode;
-#ifdef CONFIG_YAFFS_WINCE
-		in->win_atime[0] = oh->win_atime[0];
-		in->win_ctime[0] = oh->win_ctime[0];
-		in->win_mtime[0] = oh->win_mtime[0];
-		in->win_atime[1] = oh->win_atime[1];
-		in->win_ctime[1] = oh->win_ctime[1];
-		in->win_mtime[1] = oh->win_mtime[1];
-#else
-		in->yst_uid = oh->yst_uid;
-		in->yst_gid = oh->yst_gid;
-		in->yst_atime = oh->yst_atime;
-		in->yst_mtime = oh->yst_mtime;
-		in->yst_ctime = oh->yst_ctime;
-		in->yst_rdev = oh->yst_rdev;
-
-#endif
+		yaffs_LoadDetailsFromHeader(in, oh);
 		yaffs_SetObjectName(in, oh->name);
 
 		if (in->variantType == YAFFS_OBJECT_TYPE_SYMLINK) {
@@ -5921,6 +6279,12 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		}
 
 		yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+
+		/* yaffs_FindObjectByShortName() trusts the name once
+		 * lazyLoaded is clear, so clear it last.
+		 */
+		YWMB();
+		in->lazyLoaded = 0;
 	}
 }
 
@@ -5957,6 +6321,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	yaffs_BlockIndex *blockIndex = NULL;
 	int altBlockIndex = 0;
+	yaffs_ExtendedTags *blockTags;
 
 	if (!dev->isYaffs2) {
 		T(YAFFS_TRACE_SCAN,
@@ -6087,6 +6452,14 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	T(YAFFS_TRACE_SCAN_DEBUG,
 	  (TSTR("%d blocks to be scanned" TENDSTR), nBlocksToScan));
 
+	/* Read the tags a block at a time, and let the NAND layer read
+	 * ahead while we work through them. Without the buffer we just
+	 * read chunk by chunk.
+	 */
+	blockTags = YMALLOC(dev->nChunksPerBlock * sizeof(yaffs_ExtendedTags));
+	if (blockTags && dev->startBlockScan)
+		dev->startBlockScan(dev, blockIndex, nBlocksToScan);
+
 	/* For each block.... backwards */
 	for (blockIterator = endIterator; !alloc_failed && blockIterator >= startIterator;
 			blockIterator--) {
@@ -6104,6 +6477,9 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		if (blockTags)
+			yaffs_ReadBlockTagsFromNAND(dev, blk, blockTags);
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->nChunksPerBlock - 1;
@@ -6116,8 +6492,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (blockTags)
+				tags = blockTags[c];
+			else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6370,22 +6749,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 						in->variantType = oh->type;
 
 						in->yst_mode = oh->yst_mode;
-#ifdef CONFIG_YAFFS_WINCE
-						in->win_atime[0] = oh->win_atime[0];
-						in->win_ctime[0] = oh->win_ctime[0];
-						in->win_mtime[0] = oh->win_mtime[0];
-						in->win_atime[1] = oh->win_atime[1];
-						in->win_ctime[1] = oh->win_ctime[1];
-						in->win_mtime[1] = oh->win_mtime[1];
-#else
-						in->yst_uid = oh->yst_uid;
-						in->yst_gid = oh->yst_gid;
-						in->yst_atime = oh->yst_atime;
-						in->yst_mtime = oh->yst_mtime;
-						in->yst_ctime = oh->yst_ctime;
-						in->yst_rdev = oh->yst_rdev;
-
-#endif
+						/* The other details are read from the header when wanted */
+						yaffs_FreeObjectDetails(in);
 					} else {
 						in->variantType = tags.extraObjectType;
 						in->lazyLoaded = 1;
@@ -6403,21 +6768,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 						in->variantType = oh->type;
 
 						in->yst_mode = oh->yst_mode;
-#ifdef CONFIG_YAFFS_WINCE
-						in->win_atime[0] = oh->win_atime[0];
-						in->win_ctime[0] = oh->win_ctime[0];
-						in->win_mtime[0] = oh->win_mtime[0];
-						in->win_atime[1] = oh->win_atime[1];
-						in->win_ctime[1] = oh->win_ctime[1];
-						in->win_mtime[1] = oh->win_mtime[1];
-#else
-						in->yst_uid = oh->yst_uid;
-						in->yst_gid = oh->yst_gid;
-						in->yst_atime = oh->yst_atime;
-						in->yst_mtime = oh->yst_mtime;
-						in->yst_ctime = oh->yst_ctime;
-						in->yst_rdev = oh->yst_rdev;
-#endif
+						/* The other details are read from the header when wanted */
+						yaffs_FreeObjectDetails(in);
 
 						if (oh->shadowsObject > 0)
 							yaffs_HandleShadowedObject(dev,
@@ -6566,6 +6918,12 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 	}
 
+	if (blockTags) {
+		if (dev->endBlockScan)
+			dev->endBlockScan(dev);
+		YFREE(blockTags);
+	}
+
 	if (altBlockIndex)
 		YFREE_ALT(blockIndex);
 	else
@@ -6678,15 +7036,292 @@ static void yaffs_VerifyDirectory(yaffs_Object *directory)
  */
 static void yaffs_UpdateParent(yaffs_Object *obj)
 {
+	yaffs_ObjectDetails *details;
+
 	if (!obj)
 		return;
 
 	obj->dirty = 1;
-	obj->yst_mtime = obj->yst_ctime = Y_CURRENT_TIME;
+	details = yaffs_GetObjectDetails(obj);
+	if (details)
+		details->yst_mtime = details->yst_ctime = Y_CURRENT_TIME;
 
 	yaffs_UpdateObjectHeader(obj, NULL, 0, 0, 0);
 }
 
+/*
+ * Directory name index.
+ *
+ * Looking a name up walks the directory's children, so it slows down as
+ * a directory grows to thousands of entries. Big directories therefore get
+ * a hash table of their children, keyed by name sum. It is built on the
+ * first lookup and from then on every child is in it under its current
+ * sum: yaffs_AddObjectToDirectory(), yaffs_RemoveObjectFromDirectory() and
+ * yaffs_SetObjectName() keep it that way. The table holds just object
+ * pointers, using linear probing, and is kept at most 3/4 full.
+ *
+ * All the indexes of a device share dev->maxDirIndexBytes of RAM. They are
+ * kept on dev->dirIndexes in LRU order and the least recently used ones
+ * are dropped to make room for a new one. Dropping an index, here or when
+ * it would have to grow past the cap, only means the directory is walked
+ * until its next lookup builds it again.
+ *
+ * The unlinked and deleted directories are never indexed, since they may
+ * hold several objects with one name.
+ */
+
+#define YAFFS_DIR_INDEX_MIN_CHILDREN	32
+#define YAFFS_DIR_INDEX_MIN_SLOTS	64
+
+#define yaffs_DirIndexBytes(nSlots) \
+	(sizeof(yaffs_DirIndex) + (nSlots) * sizeof(yaffs_Object *))
+
+struct yaffs_DirIndexStruct {
+	struct ylist_head list;		/* on dev->dirIndexes */
+	yaffs_Object *dir;
+	int nEntries;
+	unsigned mask;			/* number of slots - 1 */
+	yaffs_Object **slot;
+};
+
+static __u16 yaffs_DirIndexKey(yaffs_Object *obj)
+{
+	if (obj->objectId == YAFFS_OBJECTID_LOSTNFOUND)
+		return yaffs_CalcNameSum(YAFFS_LOSTNFOUND_NAME);
+	return obj->sum;
+}
+
+static unsigned yaffs_DirIndexHome(yaffs_DirIndex *index, __u16 key)
+{
+	/* Sums of similar names are close together, so spread them out */
+	return (((__u32)key * 0x9E3779B1U) >> 16) & index->mask;
+}
+
+static void yaffs_DirIndexInsert(yaffs_DirIndex *index, yaffs_Object *obj)
+{
+	unsigned i = yaffs_DirIndexHome(index, yaffs_DirIndexKey(obj));
+
+	while (index->slot[i])
+		i = (i + 1) & index->mask;
+
+	index->slot[i] = obj;
+	index->nEntries++;
+}
+
+static void yaffs_DirIndexFree(yaffs_Object *dir)
+{
+	yaffs_DirIndex *index = dir->variant.directoryVariant.index;
+
+	if (!index)
+		return;
+
+	dir->variant.directoryVariant.index = NULL;
+	ylist_del(&index->list);
+	dir->myDev->dirIndexBytes -= yaffs_DirIndexBytes(index->mask + 1);
+
+	YFREE(index->slot);
+	YFREE(index);
+}
+
+static void yaffs_DirIndexFreeAll(yaffs_Device *dev)
+{
+	yaffs_DirIndex *index;
+
+	while (!ylist_empty(&dev->dirIndexes)) {
+		index = ylist_entry(dev->dirIndexes.next, yaffs_DirIndex, list);
+		yaffs_DirIndexFree(index->dir);
+	}
+}
+
+/* Drop the least recently used index, if there is one */
+static void yaffs_DirIndexFreeOldest(yaffs_Device *dev)
+{
+	yaffs_DirIndex *index;
+
+	if (ylist_empty(&dev->dirIndexes))
+		return;
+
+	index = ylist_entry(dev->dirIndexes.prev, yaffs_DirIndex, list);
+	yaffs_DirIndexFree(index->dir);
+}
+
+static yaffs_DirIndex *yaffs_DirIndexBuild(yaffs_Object *dir)
+{
+	yaffs_Device *dev = dir->myDev;
+	yaffs_DirIndex *index;
+	yaffs_Object **slot;
+	struct ylist_head *i;
+	int nChildren = 0;
+	int nSlots = YAFFS_DIR_INDEX_MIN_SLOTS;
+	int bytes;
+
+	if (dev->maxDirIndexBytes <= 0 ||
+	    dir == dev->unlinkedDir || dir == dev->deletedDir)
+		return NULL;
+
+	ylist_for_each(i, &dir->variant.directoryVariant.children)
+		nChildren++;
+
+	if (nChildren < YAFFS_DIR_INDEX_MIN_CHILDREN)
+		return NULL;
+
+	while (nSlots < 2 * nChildren)
+		nSlots <<= 1;
+
+	bytes = yaffs_DirIndexBytes(nSlots);
+	if (bytes > dev->maxDirIndexBytes)
+		return NULL;
+
+	while (dev->dirIndexBytes + bytes > dev->maxDirIndexBytes &&
+	       !ylist_empty(&dev->dirIndexes))
+		yaffs_DirIndexFreeOldest(dev);
+
+	index = YMALLOC(sizeof(yaffs_DirIndex));
+	slot = YMALLOC(nSlots * sizeof(yaffs_Object *));
+	if (!index || !slot) {
+		if (index)
+			YFREE(index);
+		if (slot)
+			YFREE(slot);
+		return NULL;
+	}
+
+	memset(slot, 0, nSlots * sizeof(yaffs_Object *));
+	index->dir = dir;
+	index->nEntries = 0;
+	index->mask = nSlots - 1;
+	index->slot = slot;
+
+	/* The sums of objects that are not loaded yet are not valid */
+	ylist_for_each(i, &dir->variant.directoryVariant.children) {
+		yaffs_Object *l = ylist_entry(i, yaffs_Object, siblings);
+
+		yaffs_CheckObjectDetailsLoaded(l);
+		yaffs_DirIndexInsert(index, l);
+	}
+
+	dir->variant.directoryVariant.index = index;
+	ylist_add(&index->list, &dev->dirIndexes);
+	dev->dirIndexBytes += bytes;
+	dev->nDirIndexBuilds++;
+
+	return index;
+}
+
+/* Put an object that was just linked to obj->parent in its index */
+static void yaffs_DirIndexAdd(yaffs_Object *obj)
+{
+	yaffs_Object *dir = obj->parent;
+	yaffs_DirIndex *index;
+
+	if (!dir)
+		return;
+
+	index = dir->variant.directoryVariant.index;
+	if (!index)
+		return;
+
+	if (obj->lazyLoaded) {
+		/* No sum to file it under */
+		yaffs_DirIndexFree(dir);
+	} else if ((index->nEntries + 1) * 4 > (int)(index->mask + 1) * 3) {
+		/* Too full: build one twice the size, if that fits */
+		yaffs_DirIndexFree(dir);
+		yaffs_DirIndexBuild(dir);
+	} else {
+		yaffs_DirIndexInsert(index, obj);
+	}
+}
+
+/* Take an object out of its parent's index, if it is in one */
+static void yaffs_DirIndexRemove(yaffs_Object *obj)
+{
+	yaffs_DirIndex *index;
+	unsigned i;
+	unsigned j;
+	unsigned home;
+
+	if (!obj->parent)
+		return;
+
+	index = obj->parent->variant.directoryVariant.index;
+	if (!index)
+		return;
+
+	i = yaffs_DirIndexHome(index, yaffs_DirIndexKey(obj));
+	while (index->slot[i] != obj) {
+		if (!index->slot[i])
+			return;
+		i = (i + 1) & index->mask;
+	}
+
+	index->nEntries--;
+	if (index->nEntries < YAFFS_DIR_INDEX_MIN_CHILDREN / 2 ||
+	    index->nEntries * 8 < (int)(index->mask + 1)) {
+		/* Much too big now. Build a smaller one when needed. */
+		yaffs_DirIndexFree(obj->parent);
+		return;
+	}
+
+	/*
+	 * Slot i is now a hole. Move back into it any later entry of the
+	 * run that could not be found past it, then do the same for the
+	 * hole that leaves.
+	 */
+	for (j = (i + 1) & index->mask; index->slot[j];
+	     j = (j + 1) & index->mask) {
+		home = yaffs_DirIndexHome(index,
+					yaffs_DirIndexKey(index->slot[j]));
+		if (((j - home) & index->mask) >= ((j - i) & index->mask)) {
+			index->slot[i] = index->slot[j];
+			i = j;
+		}
+	}
+	index->slot[i] = NULL;
+}
+
+/* Does the name look like one yaffs_GetObjectName() makes up? */
+static int yaffs_IsMadeUpName(const YCHAR *name)
+{
+	int len = yaffs_strlen(YAFFS_LOSTNFOUND_PREFIX);
+
+	if (yaffs_strncmp(name, YAFFS_LOSTNFOUND_PREFIX, len) != 0 ||
+	    !name[len])
+		return 0;
+
+	for (name += len; *name; name++) {
+		if (*name < '0' || *name > '9')
+			return 0;
+	}
+
+	return 1;
+}
+
+static yaffs_Object *yaffs_DirIndexFind(yaffs_DirIndex *index,
+					const YCHAR *name, int sum,
+					YCHAR *buffer)
+{
+	yaffs_Device *dev = index->dir->myDev;
+	unsigned i = yaffs_DirIndexHome(index, sum);
+	yaffs_Object *l;
+
+	if (dev->dirIndexes.next != &index->list) {
+		ylist_del(&index->list);
+		ylist_add(&index->list, &dev->dirIndexes);
+	}
+
+	for (; (l = index->slot[i]) != NULL; i = (i + 1) & index->mask) {
+		if (!yaffs_SumCompare(yaffs_DirIndexKey(l), sum))
+			continue;
+
+		yaffs_GetObjectName(l, buffer, YAFFS_MAX_NAME_LENGTH + 1);
+		if (yaffs_strncmp(name, buffer, YAFFS_MAX_NAME_LENGTH) == 0)
+			return l;
+	}
+
+	return NULL;
+}
+
 static void yaffs_RemoveObjectFromDirectory(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
@@ -6700,6 +7335,7 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object *obj)
 	if (dev && dev->removeObjectCallback)
 		dev->removeObjectCallback(obj);
 
+	yaffs_DirIndexRemove(obj);
 
 	ylist_del_init(&obj->siblings);
 	obj->parent = NULL;
@@ -6740,6 +7376,7 @@ static void yaffs_AddObjectToDirectory(yaffs_Object *directory,
 	/* Now add it */
 	ylist_add(&obj->siblings, &directory->variant.directoryVariant.children);
 	obj->parent = directory;
+	yaffs_DirIndexAdd(obj);
 
 	if (directory == obj->myDev->unlinkedDir
 			|| directory == obj->myDev->deletedDir) {
@@ -6761,6 +7398,7 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object *directory,
 	YCHAR buffer[YAFFS_MAX_NAME_LENGTH + 1];
 
 	yaffs_Object *l;
+	yaffs_DirIndex *index;
 
 	if (!name)
 		return NULL;
@@ -6782,6 +7420,17 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object *directory,
 
 	sum = yaffs_CalcNameSum(name);
 
+	/* Objects without a header match their made up names whatever
+	 * their sum, so only a walk can find those.
+	 */
+	if (!yaffs_IsMadeUpName(name)) {
+		index = directory->variant.directoryVariant.index;
+		if (!index)
+			index = yaffs_DirIndexBuild(directory);
+		if (index)
+			return yaffs_DirIndexFind(index, name, sum, buffer);
+	}
+
 	ylist_for_each(i, &directory->variant.directoryVariant.children) {
 		if (i) {
 			l = ylist_entry(i, yaffs_Object, siblings);
@@ -6813,6 +7462,53 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object *directory,
 	return NULL;
 }
 
+/*
+ * Look a name up using only the short names held in RAM.
+ *
+ * This may be called without the gross lock, but the caller must keep
+ * the directory from changing (in Linux, the device's dirLock). Only
+ * positive answers are given: NULL means "don't know", and the caller
+ * must fall back to yaffs_FindObjectByName(). Long names, lost+found,
+ * hard links and objects whose details are not loaded yet all take
+ * that path.
+ */
+yaffs_Object *yaffs_FindObjectByShortName(yaffs_Object *directory,
+					const YCHAR *name)
+{
+#ifdef CONFIG_YAFFS_SHORT_NAMES_IN_RAM
+	int sum;
+	struct ylist_head *i;
+	yaffs_Object *l;
+
+	if (!name || !directory ||
+	    directory->variantType != YAFFS_OBJECT_TYPE_DIRECTORY ||
+	    yaffs_strlen(name) > YAFFS_SHORT_NAME_LENGTH)
+		return NULL;
+
+	/* An indexed directory is quicker to search under the lock */
+	if (directory->variant.directoryVariant.index)
+		return NULL;
+
+	sum = yaffs_CalcNameSum(name);
+
+	ylist_for_each(i, &directory->variant.directoryVariant.children) {
+		l = ylist_entry(i, yaffs_Object, siblings);
+
+		if (l->lazyLoaded || l->objectId == YAFFS_OBJECTID_LOSTNFOUND)
+			continue;
+
+		/* Pairs with the YWMB() in yaffs_CheckObjectDetailsLoaded() */
+		YRMB();
+
+		if (yaffs_SumCompare(l->sum, sum) &&
+		    yaffs_strcmp(name, l->shortName) == 0)
+			return l->variantType == YAFFS_OBJECT_TYPE_HARDLINK ?
+				NULL : l;
+	}
+#endif
+	return NULL;
+}
+
 
 #if 0
 int yaffs_ApplyToDirectoryChildren(yaffs_Object *theDir,
@@ -6996,20 +7692,24 @@ YCHAR *yaffs_GetSymlinkAlias(yaffs_Object *obj)
 int yaffs_SetAttributes(yaffs_Object *obj, struct iattr *attr)
 {
 	unsigned int valid = attr->ia_valid;
+	yaffs_ObjectDetails *details = yaffs_GetObjectDetails(obj);
+
+	if (!details)
+		return YAFFS_FAIL;
 
 	if (valid & ATTR_MODE)
 		obj->yst_mode = attr->ia_mode;
 	if (valid & ATTR_UID)
-		obj->yst_uid = attr->ia_uid;
+		details->yst_uid = attr->ia_uid;
 	if (valid & ATTR_GID)
-		obj->yst_gid = attr->ia_gid;
+		details->yst_gid = attr->ia_gid;
 
 	if (valid & ATTR_ATIME)
-		obj->yst_atime = Y_TIME_CONVERT(attr->ia_atime);
+		details->yst_atime = Y_TIME_CONVERT(attr->ia_atime);
 	if (valid & ATTR_CTIME)
-		obj->yst_ctime = Y_TIME_CONVERT(attr->ia_ctime);
+		details->yst_ctime = Y_TIME_CONVERT(attr->ia_ctime);
 	if (valid & ATTR_MTIME)
-		obj->yst_mtime = Y_TIME_CONVERT(attr->ia_mtime);
+		details->yst_mtime = Y_TIME_CONVERT(attr->ia_mtime);
 
 	if (valid & ATTR_SIZE)
 		yaffs_ResizeFile(obj, attr->ia_size);
@@ -7022,19 +7722,23 @@ int yaffs_SetAttributes(yaffs_Object *obj, struct iattr *attr)
 int yaffs_GetAttributes(yaffs_Object *obj, struct iattr *attr)
 {
 	unsigned int valid = 0;
+	yaffs_ObjectDetails *details = yaffs_GetObjectDetails(obj);
+
+	if (!details)
+		return YAFFS_FAIL;
 
 	attr->ia_mode = obj->yst_mode;
 	valid |= ATTR_MODE;
-	attr->ia_uid = obj->yst_uid;
+	attr->ia_uid = details->yst_uid;
 	valid |= ATTR_UID;
-	attr->ia_gid = obj->yst_gid;
+	attr->ia_gid = details->yst_gid;
 	valid |= ATTR_GID;
 
-	Y_TIME_CONVERT(attr->ia_atime) = obj->yst_atime;
+	Y_TIME_CONVERT(attr->ia_atime) = details->yst_atime;
 	valid |= ATTR_ATIME;
-	Y_TIME_CONVERT(attr->ia_ctime) = obj->yst_ctime;
+	Y_TIME_CONVERT(attr->ia_ctime) = details->yst_ctime;
 	valid |= ATTR_CTIME;
-	Y_TIME_CONVERT(attr->ia_mtime) = obj->yst_mtime;
+	Y_TIME_CONVERT(attr->ia_mtime) = details->yst_mtime;
 	valid |= ATTR_MTIME;
 
 	attr->ia_size = yaffs_GetFileSize(obj);
@@ -7279,6 +7983,10 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
+	dev->backgroundGarbageCollections = 0;
+	dev->foregroundGCTime = 0;
+	dev->backgroundGCTime = 0;
+	dev->nDirIndexBuilds = 0;
 	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -7299,38 +8007,56 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srHash = NULL;
+	dev->srFlushList = NULL;
 	dev->gcCleanupList = NULL;
 
+	YINIT_LIST_HEAD(&dev->srLRU);
 
 	if (!init_failed &&
 	    dev->nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
+		int nBuckets = 1;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		while (nBuckets < dev->nShortOpCaches)
+			nBuckets <<= 1;
+		dev->srHashMask = nBuckets - 1;
+
 		dev->srCache =  YMALLOC(srCacheBytes);
+		dev->srHash = YMALLOC(nBuckets * sizeof(yaffs_ChunkCache *));
+		dev->srFlushList = YMALLOC(dev->nShortOpCaches *
+					sizeof(yaffs_ChunkCache *));
 
 		buf = (__u8 *) dev->srCache;
+		if (!dev->srHash || !dev->srFlushList)
+			buf = NULL;
 
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
+		if (dev->srHash)
+			memset(dev->srHash, 0,
+				nBuckets * sizeof(yaffs_ChunkCache *));
 
 		for (i = 0; i < dev->nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
+			dev->srCache[i].hashNext = NULL;
 			dev->srCache[i].dirty = 0;
+			ylist_add_tail(&dev->srCache[i].lru, &dev->srLRU);
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->totalBytesPerChunk);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
+	dev->cacheWriteBacks = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7449,6 +8175,12 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			YFREE(dev->srCache);
 			dev->srCache = NULL;
 		}
+		if (dev->srHash)
+			YFREE(dev->srHash);
+		dev->srHash = NULL;
+		if (dev->srFlushList)
+			YFREE(dev->srFlushList);
+		dev->srFlushList = NULL;
 
 		YFREE(dev->gcCleanupList);
 
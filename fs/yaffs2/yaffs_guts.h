@@ -60,6 +60,9 @@
 
 #define YAFFS_NOBJECT_BUCKETS		256
 
+/* Chunks copied per passive or stepped garbage collection call */
+#define YAFFS_GC_STEP_COPIES		10
+
 
 #define YAFFS_OBJECT_SPACE		0x40000
 
@@ -88,7 +91,7 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	512
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -112,10 +115,11 @@
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
 /* ChunkCache is used for short read/write operations.*/
-typedef struct {
+typedef struct yaffs_ChunkCacheStruct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
+	struct yaffs_ChunkCacheStruct *hashNext;
+	struct ylist_head lru;	/* Most recently used first */
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -294,6 +298,12 @@ typedef struct {
 
 } yaffs_BlockInfo;
 
+/* Blocks to be scanned, sorted by sequence number */
+typedef struct {
+	int seq;
+	int block;
+} yaffs_BlockIndex;
+
 /* -------------------------- Object structure -------------------------------*/
 /* This is the object structure as stored on NAND */
 
@@ -385,8 +395,11 @@ typedef struct {
 	yaffs_Tnode *top;
 } yaffs_FileStructure;
 
+typedef struct yaffs_DirIndexStruct yaffs_DirIndex;
+
 typedef struct {
 	struct ylist_head children;     /* list of child links */
+	yaffs_DirIndex *index;		/* name index of the children, or NULL */
 } yaffs_DirectoryStructure;
 
 typedef struct {
@@ -405,6 +418,28 @@ typedef union {
 	yaffs_HardLinkStructure hardLinkVariant;
 } yaffs_ObjectVariant;
 
+/*
+ * The attributes of an object that only stat() and the object header need.
+ * They are allocated apart from the object, on first use, so that objects
+ * nobody has looked at since the mount do not carry them, and they can be
+ * dropped again once the object is clean and has no inode (see
+ * yaffs_GetObjectDetails()).
+ */
+typedef struct {
+#ifdef CONFIG_YAFFS_WINCE
+	__u32 win_ctime[2];
+	__u32 win_mtime[2];
+	__u32 win_atime[2];
+#else
+	__u32 yst_uid;
+	__u32 yst_gid;
+	__u32 yst_atime;
+	__u32 yst_mtime;
+	__u32 yst_ctime;
+#endif
+	__u32 yst_rdev;
+} yaffs_ObjectDetails;
+
 struct yaffs_ObjectStruct {
 	__u8 deleted:1;		/* This should only apply to unlinked files. */
 	__u8 softDeleted:1;	/* it has also been soft deleted */
@@ -426,6 +461,7 @@ struct yaffs_ObjectStruct {
 	__u8 beingCreated:1;	/* This object is still being created so skip some checks. */
 
 	__u8 serial;		/* serial number of chunk in NAND. Cached here */
+	__u8 variantType;	/* yaffs_ObjectType */
 	__u16 sum;		/* sum of the name to speed searching */
 
 	struct yaffs_DeviceStruct *myDev;       /* The device I'm on */
@@ -456,27 +492,13 @@ struct yaffs_ObjectStruct {
 	__u32 inUse;
 #endif
 
-#ifdef CONFIG_YAFFS_WINCE
-	__u32 win_ctime[2];
-	__u32 win_mtime[2];
-	__u32 win_atime[2];
-#else
-	__u32 yst_uid;
-	__u32 yst_gid;
-	__u32 yst_atime;
-	__u32 yst_mtime;
-	__u32 yst_ctime;
-#endif
-
-	__u32 yst_rdev;
+	yaffs_ObjectDetails *details;	/* NULL until needed, or when dropped */
 
 #ifdef __KERNEL__
 	struct inode *myInode;
 
 #endif
 
-	yaffs_ObjectType variantType;
-
 	yaffs_ObjectVariant variant;
 
 };
@@ -559,6 +581,10 @@ struct yaffs_DeviceStruct {
 
 	int emptyLostAndFound;  /* Flasg to determine if lst+found should be emptied on init */
 
+	int maxDirIndexBytes;	/* RAM that directory name indexes may use.
+				 * If <= 0, then directories are not indexed.
+				 */
+
 	int useNANDECC;		/* Flag to decide whether or not to use NANDECC */
 
 	void *genericDevice;	/* Pointer to device context
@@ -589,6 +615,26 @@ struct yaffs_DeviceStruct {
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct *dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct *dev, int blockNo,
 			       yaffs_BlockState *state, __u32 *sequenceNumber);
+
+	/* Optional. Read the tags of every chunk in a block at once. */
+	int (*readBlockTagsFromNAND) (struct yaffs_DeviceStruct *dev,
+				      int blockNo, yaffs_ExtendedTags *tags);
+
+	/* Optional. Read nChunks consecutive chunks of one block, with their
+	 * tags, at once. The data of chunk chunkInNAND + c goes to data[c].
+	 */
+	int (*readChunksFromNAND) (struct yaffs_DeviceStruct *dev,
+				   int chunkInNAND, int nChunks, __u8 **data,
+				   yaffs_ExtendedTags *tags);
+
+	/* Optional. The scan is about to read the tags of the blocks in
+	 * order[nBlocks - 1] down to order[0], and may be helped by reading
+	 * ahead. The block numbers include blockOffset. endBlockScan is
+	 * called when the scan is over, whether or not it got through.
+	 */
+	void (*startBlockScan) (struct yaffs_DeviceStruct *dev,
+				const yaffs_BlockIndex *order, int nBlocks);
+	void (*endBlockScan) (struct yaffs_DeviceStruct *dev);
 #endif
 
 	int isYaffs2;
@@ -603,6 +649,10 @@ struct yaffs_DeviceStruct {
 	/* Callback to mark the superblock dirsty */
 	void (*markSuperBlockDirty)(void *superblock);
 
+	/* Callback to wake a background collector when an erased block is
+	 * taken or the checkpoint is invalidated */
+	void (*wakeBackgroundGC)(struct yaffs_DeviceStruct *dev);
+
 	int wideTnodesDisabled; /* Set to disable wide tnodes */
 
 	YCHAR *pathDividers;	/* String of legal path dividers */
@@ -638,7 +688,7 @@ struct yaffs_DeviceStruct {
 #ifdef __KERNEL__
 
 	struct semaphore sem;	/* Semaphore for waiting on erasure.*/
-	struct semaphore grossLock;	/* Gross locking semaphore */
+	struct semaphore grossLock;	/* Allocator, GC and NAND access */
 	struct rw_semaphore dirLock; /* Lock the directory structure */
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
@@ -646,6 +696,10 @@ struct yaffs_DeviceStruct {
 				 */
 	void (*putSuperFunc) (struct super_block *sb);
         struct ylist_head searchContexts;
+	struct task_struct *bgGCThread;	/* Background garbage collector */
+	int bgGCSleeping;		/* it waits for wakeBackgroundGC */
+	unsigned long lastWriteTime;	/* jiffies, for the collector */
+	void *scanAhead;		/* Tags read ahead during the scan */
 
 #endif
 
@@ -699,17 +753,25 @@ struct yaffs_DeviceStruct {
 	yaffs_TnodeList *allocatedTnodeList;
 
 	int isDoingGC;
+	int backgroundGC;	/* Set while the OS runs a background collector */
 	int gcBlock;
 	int gcChunk;
 
 	int nObjectsCreated;
 	yaffs_Object *freeObjects;
 	int nFreeObjects;
+	int nObjectDetails;	/* Objects with their details in RAM */
+	int nObjectInodes;	/* Objects the OS holds inodes for, kept by the OS */
+	int nDetailsDropped;
+	int shrinkBucket;	/* Where yaffs_ShrinkMetadata() goes on from */
 
 	int nHardLinks;
 
 	yaffs_ObjectList *allocatedObjectList;
 
+	struct ylist_head dirIndexes;	/* Directory name indexes, most recently used first */
+	int dirIndexBytes;		/* RAM they use */
+
 	yaffs_ObjectBucket objectBucket[YAFFS_NOBJECT_BUCKETS];
 
 	int nFreeChunks;
@@ -727,6 +789,9 @@ struct yaffs_DeviceStruct {
 	int nGCCopies;
 	int garbageCollections;
 	int passiveGarbageCollections;
+	int backgroundGarbageCollections;
+	unsigned long long foregroundGCTime;	/* microseconds */
+	unsigned long long backgroundGCTime;	/* microseconds */
 	int nRetriedWrites;
 	int nRetiredBlocks;
 	int eccFixed;
@@ -735,6 +800,7 @@ struct yaffs_DeviceStruct {
 	int tagsEccUnfixed;
 	int nDeletions;
 	int nUnmarkedDeletions;
+	int nDirIndexBuilds;
 
 	int hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 
@@ -751,9 +817,14 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	yaffs_ChunkCache **srHash;
+	int srHashMask;
+	struct ylist_head srLRU;
+	yaffs_ChunkCache **srFlushList;
 
 	int cacheHits;
+	int cacheMisses;
+	int cacheWriteBacks;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -840,10 +911,14 @@ int yaffs_GetObjectLinkCount(yaffs_Object *obj);
 
 int yaffs_SetAttributes(yaffs_Object *obj, struct iattr *attr);
 int yaffs_GetAttributes(yaffs_Object *obj, struct iattr *attr);
+yaffs_ObjectDetails *yaffs_GetObjectDetails(yaffs_Object *obj);
+int yaffs_ShrinkMetadata(yaffs_Device *dev, int nToScan);
 
 /* File operations */
 int yaffs_ReadDataFromFile(yaffs_Object *obj, __u8 *buffer, loff_t offset,
 				int nBytes);
+int yaffs_ReadDataToBuffers(yaffs_Object *obj, __u8 * const *buffers,
+				int nBuffers, int bufferSize, loff_t offset);
 int yaffs_WriteDataToFile(yaffs_Object *obj, const __u8 *buffer, loff_t offset,
 				int nBytes, int writeThrough);
 int yaffs_ResizeFile(yaffs_Object *obj, loff_t newSize);
@@ -858,10 +933,17 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev);
 int yaffs_CheckpointSave(yaffs_Device *dev);
 int yaffs_CheckpointRestore(yaffs_Device *dev);
 
+/* Garbage collection */
+int yaffs_GarbageCollectStep(yaffs_Device *dev);
+int yaffs_BackgroundGCUrgency(yaffs_Device *dev, int extraBlocks);
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int urgency);
+
 /* Directory operations */
 yaffs_Object *yaffs_MknodDirectory(yaffs_Object *parent, const YCHAR *name,
 				__u32 mode, __u32 uid, __u32 gid);
 yaffs_Object *yaffs_FindObjectByName(yaffs_Object *theDir, const YCHAR *name);
+yaffs_Object *yaffs_FindObjectByShortName(yaffs_Object *theDir,
+					const YCHAR *name);
 int yaffs_ApplyToDirectoryChildren(yaffs_Object *theDir,
 				   int (*fn) (yaffs_Object *));
 
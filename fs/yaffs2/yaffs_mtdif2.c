@@ -24,6 +24,8 @@ const char *yaffs_mtdif2_c_version =
 #include "linux/mtd/mtd.h"
 #include "linux/types.h"
 #include "linux/time.h"
+#include "linux/kthread.h"
+#include "linux/wait.h"
 
 #include "yaffs_packedtags2.h"
 
@@ -258,3 +260,335 @@ int nandmtd2_QueryNANDBlock(struct yaffs_DeviceStruct *dev, int blockNo,
 		return YAFFS_FAIL;
 }
 
+
+/*
+ * Reading the tags of a whole block.
+ *
+ * An OOB-only read of a block costs one MTD call rather than one per
+ * chunk. In MTD_OOB_AUTO mode the free OOB bytes of consecutive pages
+ * land mtd->oobavail bytes apart in the buffer. An ECC problem is only
+ * reported for the call as a whole, so when there is one the block is
+ * read again a chunk at a time to find out which chunks had it.
+ */
+static int nandmtd2_CanReadBlockTags(yaffs_Device *dev)
+{
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	int packed_tags_size = dev->doesTagsEcc ? sizeof(yaffs_PackedTags2) :
+				sizeof(yaffs_PackedTags2TagsPart);
+
+	return !dev->inbandTags && packed_tags_size <= mtd->oobavail;
+#else
+	return 0;
+#endif
+}
+
+static int nandmtd2_BlockOOBSize(yaffs_Device *dev)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+
+	return dev->nChunksPerBlock * mtd->oobavail;
+}
+
+static int nandmtd2_ReadBlockOOB(yaffs_Device *dev, int blockNo, __u8 *oob)
+{
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	struct mtd_oob_ops ops;
+	loff_t addr = ((loff_t) blockNo) * dev->nChunksPerBlock *
+			dev->totalBytesPerChunk;
+
+	memset(&ops, 0, sizeof(ops));
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = nandmtd2_BlockOOBSize(dev);
+	ops.len = ops.ooblen;
+	ops.ooboffs = 0;
+	ops.datbuf = NULL;
+	ops.oobbuf = oob;
+
+	return mtd->read_oob(mtd, addr, &ops);
+#else
+	return -EINVAL;
+#endif
+}
+
+/* oob holds the free OOB bytes of one chunk, as read in MTD_OOB_AUTO mode */
+static void nandmtd2_UnpackChunkTags(yaffs_Device *dev, const __u8 *oob,
+				yaffs_ExtendedTags *tags)
+{
+	yaffs_PackedTags2 pt;
+	int packed_tags_size = dev->doesTagsEcc ? sizeof(pt) : sizeof(pt.t);
+
+	memset(&pt, 0, sizeof(pt));
+	memcpy(&pt, oob, packed_tags_size);
+	yaffs_UnpackTags2(dev, tags, &pt);
+
+	if (tags->eccResult == YAFFS_ECC_RESULT_FIXED)
+		dev->tagsEccFixed++;
+	if (tags->eccResult == YAFFS_ECC_RESULT_UNFIXED)
+		dev->tagsEccUnfixed++;
+}
+
+/* retval is what nandmtd2_ReadBlockOOB() returned for oob */
+static int nandmtd2_UnpackBlockTags(yaffs_Device *dev, int blockNo,
+				const __u8 *oob, int retval,
+				yaffs_ExtendedTags *tags)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	int chunkInNAND = blockNo * dev->nChunksPerBlock;
+	int result = YAFFS_OK;
+	int c;
+
+	for (c = 0; c < dev->nChunksPerBlock; c++) {
+		if (retval) {
+			if (nandmtd2_ReadChunkWithTagsFromNAND(dev,
+					chunkInNAND + c, NULL,
+					&tags[c]) != YAFFS_OK)
+				result = YAFFS_FAIL;
+			continue;
+		}
+
+		nandmtd2_UnpackChunkTags(dev, oob + c * mtd->oobavail,
+					&tags[c]);
+	}
+
+	return result;
+}
+
+/*
+ * Reading ahead during the scan.
+ *
+ * The scan reads the tags of each block in turn and then does the work
+ * of rebuilding the objects from them. While it does that, a thread reads
+ * the next NANDMTD2_SCAN_AHEAD blocks in the order the scan will want
+ * them, so that the NAND is kept busy. The thread only fills buffers; the
+ * tags are unpacked, and any chunk by chunk re-reads are done, by the
+ * scan, which owns the rest of the device.
+ */
+#define NANDMTD2_SCAN_AHEAD	4
+
+struct nandmtd2_ScanAhead {
+	yaffs_Device *dev;
+	const yaffs_BlockIndex *order;
+	int nBlocks;
+	int produced;		/* blocks read by the thread */
+	int consumed;		/* blocks handed to the scan */
+	wait_queue_head_t wait;
+	struct task_struct *thread;
+	int retval[NANDMTD2_SCAN_AHEAD];
+	__u8 *oob;		/* NANDMTD2_SCAN_AHEAD blocks of OOB */
+};
+
+/* Block number, without blockOffset, of the n'th block the scan reads */
+static int nandmtd2_ScanAheadBlock(struct nandmtd2_ScanAhead *sa, int n)
+{
+	return sa->order[sa->nBlocks - 1 - n].block - sa->dev->blockOffset;
+}
+
+static int nandmtd2_ScanAheadThread(void *data)
+{
+	struct nandmtd2_ScanAhead *sa = data;
+	int oobSize = nandmtd2_BlockOOBSize(sa->dev);
+	int n;
+	int slot;
+
+	while (!kthread_should_stop()) {
+		n = sa->produced;
+
+		wait_event_interruptible(sa->wait, kthread_should_stop() ||
+			(n < sa->nBlocks &&
+			 n - sa->consumed < NANDMTD2_SCAN_AHEAD));
+		if (kthread_should_stop())
+			break;
+
+		/* The scan is done with this slot's last block */
+		smp_mb();
+
+		slot = n % NANDMTD2_SCAN_AHEAD;
+		sa->retval[slot] = nandmtd2_ReadBlockOOB(sa->dev,
+					nandmtd2_ScanAheadBlock(sa, n),
+					sa->oob + slot * oobSize);
+
+		smp_wmb();
+		sa->produced = n + 1;
+		wake_up(&sa->wait);
+	}
+
+	return 0;
+}
+
+void nandmtd2_StartBlockScan(yaffs_Device *dev, const yaffs_BlockIndex *order,
+			int nBlocks)
+{
+	struct nandmtd2_ScanAhead *sa;
+	struct task_struct *t;
+
+	if (!nandmtd2_CanReadBlockTags(dev) || nBlocks < 2)
+		return;
+
+	sa = YMALLOC(sizeof(struct nandmtd2_ScanAhead));
+	if (!sa)
+		return;
+
+	memset(sa, 0, sizeof(struct nandmtd2_ScanAhead));
+	sa->oob = YMALLOC(NANDMTD2_SCAN_AHEAD * nandmtd2_BlockOOBSize(dev));
+	if (!sa->oob) {
+		YFREE(sa);
+		return;
+	}
+
+	sa->dev = dev;
+	sa->order = order;
+	sa->nBlocks = nBlocks;
+	init_waitqueue_head(&sa->wait);
+
+	t = kthread_run(nandmtd2_ScanAheadThread, sa, "yaffs-scan");
+	if (IS_ERR(t)) {
+		YFREE(sa->oob);
+		YFREE(sa);
+		return;
+	}
+
+	sa->thread = t;
+	dev->scanAhead = sa;
+}
+
+void nandmtd2_EndBlockScan(yaffs_Device *dev)
+{
+	struct nandmtd2_ScanAhead *sa = dev->scanAhead;
+
+	if (!sa)
+		return;
+
+	kthread_stop(sa->thread);
+	dev->scanAhead = NULL;
+
+	YFREE(sa->oob);
+	YFREE(sa);
+}
+
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockNo,
+				yaffs_ExtendedTags *tags)
+{
+	struct nandmtd2_ScanAhead *sa = dev->scanAhead;
+	int oobSize = nandmtd2_BlockOOBSize(dev);
+	int result;
+	int retval;
+	int slot;
+	int n;
+	__u8 *oob;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadBlockTagsFromNAND block %d" TENDSTR), blockNo));
+
+	if (sa && sa->consumed < sa->nBlocks &&
+	    nandmtd2_ScanAheadBlock(sa, sa->consumed) == blockNo) {
+		n = sa->consumed;
+		slot = n % NANDMTD2_SCAN_AHEAD;
+
+		wait_event(sa->wait, sa->produced > n);
+		smp_rmb();
+
+		result = nandmtd2_UnpackBlockTags(dev, blockNo,
+					sa->oob + slot * oobSize,
+					sa->retval[slot], tags);
+
+		/* Let the thread have the slot back */
+		smp_mb();
+		sa->consumed = n + 1;
+		wake_up(&sa->wait);
+
+		return result;
+	}
+
+	oob = NULL;
+	retval = -EINVAL;
+	if (nandmtd2_CanReadBlockTags(dev))
+		oob = YMALLOC(oobSize);
+	if (oob)
+		retval = nandmtd2_ReadBlockOOB(dev, blockNo, oob);
+
+	result = nandmtd2_UnpackBlockTags(dev, blockNo, oob, retval, tags);
+
+	if (oob)
+		YFREE(oob);
+
+	return result;
+}
+
+/*
+ * Reading a run of chunks.
+ *
+ * File reads want the data of several consecutive chunks, which costs one
+ * MTD call the same way as the tags of a block do. mtd->read_oob() wants
+ * one buffer for the data, so unless the caller's buffers follow each
+ * other the data is read into a bounce buffer and copied out. As for
+ * blocks, an ECC problem makes us read the run again a chunk at a time.
+ */
+int nandmtd2_ReadChunksFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data,
+				yaffs_ExtendedTags *tags)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	int result = YAFFS_OK;
+	int retval = -EINVAL;
+	int contiguous = 1;
+	__u8 *buf = NULL;
+	__u8 *oob = NULL;
+	int c;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadChunksFromNAND chunk %d n %d" TENDSTR),
+	   chunkInNAND, nChunks));
+
+	for (c = 1; c < nChunks; c++) {
+		if (data[c] != data[0] + c * dev->nDataBytesPerChunk)
+			contiguous = 0;
+	}
+
+	if (nandmtd2_CanReadBlockTags(dev)) {
+		oob = YMALLOC(nChunks * mtd->oobavail);
+		buf = contiguous ? data[0] :
+			YMALLOC(nChunks * dev->nDataBytesPerChunk);
+	}
+
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 17))
+	if (oob && buf) {
+		struct mtd_oob_ops ops;
+
+		memset(&ops, 0, sizeof(ops));
+		ops.mode = MTD_OOB_AUTO;
+		ops.len = nChunks * dev->nDataBytesPerChunk;
+		ops.ooblen = nChunks * mtd->oobavail;
+		ops.ooboffs = 0;
+		ops.datbuf = buf;
+		ops.oobbuf = oob;
+		retval = mtd->read_oob(mtd,
+				((loff_t) chunkInNAND) * dev->totalBytesPerChunk,
+				&ops);
+	}
+#endif
+
+	for (c = 0; c < nChunks; c++) {
+		if (retval) {
+			if (nandmtd2_ReadChunkWithTagsFromNAND(dev,
+					chunkInNAND + c, data[c],
+					&tags[c]) != YAFFS_OK)
+				result = YAFFS_FAIL;
+			continue;
+		}
+
+		if (!contiguous)
+			memcpy(data[c], buf + c * dev->nDataBytesPerChunk,
+				dev->nDataBytesPerChunk);
+		nandmtd2_UnpackChunkTags(dev, oob + c * mtd->oobavail,
+					&tags[c]);
+	}
+
+	if (buf && !contiguous)
+		YFREE(buf);
+	if (oob)
+		YFREE(oob);
+
+	return result;
+}
@@ -25,5 +25,13 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo);
 int nandmtd2_QueryNANDBlock(struct yaffs_DeviceStruct *dev, int blockNo,
 			yaffs_BlockState *state, __u32 *sequenceNumber);
+int nandmtd2_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockNo,
+				yaffs_ExtendedTags *tags);
+void nandmtd2_StartBlockScan(yaffs_Device *dev, const yaffs_BlockIndex *order,
+			int nBlocks);
+void nandmtd2_EndBlockScan(yaffs_Device *dev);
+int nandmtd2_ReadChunksFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data,
+				yaffs_ExtendedTags *tags);
 
 #endif
@@ -53,6 +53,70 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 	return result;
 }
 
+/* tags must have room for the tags of every chunk in the block */
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+				yaffs_ExtendedTags *tags)
+{
+	int chunkInNAND = blockInNAND * dev->nChunksPerBlock;
+	int result = YAFFS_OK;
+	int c;
+
+	if (!dev->readBlockTagsFromNAND) {
+		for (c = 0; c < dev->nChunksPerBlock; c++) {
+			if (yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND + c,
+						NULL, &tags[c]) != YAFFS_OK)
+				result = YAFFS_FAIL;
+		}
+		return result;
+	}
+
+	dev->nPageReads += dev->nChunksPerBlock;
+
+	result = dev->readBlockTagsFromNAND(dev,
+					blockInNAND - dev->blockOffset, tags);
+
+	for (c = 0; c < dev->nChunksPerBlock; c++) {
+		if (tags[c].eccResult > YAFFS_ECC_RESULT_NO_ERROR)
+			yaffs_HandleChunkError(dev,
+					yaffs_GetBlockInfo(dev, blockInNAND));
+	}
+
+	return result;
+}
+
+/* The chunks are consecutive and in one block; tags must have room for
+ * nChunks.
+ */
+int yaffs_ReadChunksWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data,
+				yaffs_ExtendedTags *tags)
+{
+	int result = YAFFS_OK;
+	int c;
+
+	if (!dev->readChunksFromNAND || nChunks < 2) {
+		for (c = 0; c < nChunks; c++) {
+			if (yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND + c,
+						data[c], &tags[c]) != YAFFS_OK)
+				result = YAFFS_FAIL;
+		}
+		return result;
+	}
+
+	dev->nPageReads += nChunks;
+
+	result = dev->readChunksFromNAND(dev, chunkInNAND - dev->chunkOffset,
+					nChunks, data, tags);
+
+	for (c = 0; c < nChunks; c++) {
+		if (tags[c].eccResult > YAFFS_ECC_RESULT_NO_ERROR)
+			yaffs_HandleChunkError(dev, yaffs_GetBlockInfo(dev,
+					chunkInNAND / dev->nChunksPerBlock));
+	}
+
+	return result;
+}
+
 int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						   int chunkInNAND,
 						   const __u8 *buffer,
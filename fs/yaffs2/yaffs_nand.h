@@ -23,6 +23,13 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 					__u8 *buffer,
 					yaffs_ExtendedTags *tags);
 
+int yaffs_ReadBlockTagsFromNAND(yaffs_Device *dev, int blockInNAND,
+				yaffs_ExtendedTags *tags);
+
+int yaffs_ReadChunksWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
+				int nChunks, __u8 **data,
+				yaffs_ExtendedTags *tags);
+
 int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						int chunkInNAND,
 						const __u8 *buffer,
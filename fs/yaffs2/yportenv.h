@@ -74,6 +74,13 @@
 /* KR - added for use in scan so processes aren't blocked indefinitely. */
 #define YYIELD() schedule()
 
+/* Order updates of object details that are read without the gross lock */
+#define YWMB() smp_wmb()
+#define YRMB() smp_rmb()
+
+/* For accounting time spent in garbage collection */
+#define Y_TIME_US() ((unsigned long long)ktime_to_us(ktime_get()))
+
 #define YAFFS_ROOT_MODE			0666
 #define YAFFS_LOSTNFOUND_MODE		0666
 
@@ -196,6 +203,15 @@ extern unsigned int yaffs_wr_attempts;
 
 #define T(mask, p) do { if ((mask) & (yaffs_traceMask | YAFFS_TRACE_ALWAYS)) TOUT(p); } while (0)
 
+#ifndef YWMB
+#define YWMB() do {} while (0)
+#define YRMB() do {} while (0)
+#endif
+
+#ifndef Y_TIME_US
+#define Y_TIME_US() 0ULL
+#endif
+
 #ifndef YBUG
 #define YBUG() do {T(YAFFS_TRACE_BUG, (TSTR("==>> yaffs bug: " __FILE__ " %d" TENDSTR), __LINE__)); } while (0)
 #endif
@@ -54,6 +54,8 @@ enum pmem_allocator_type {
 #define PMEM_CLEAN_CACHES	_IOW(PMEM_IOCTL_MAGIC, 12, unsigned int)
 #define PMEM_INV_CACHES		_IOW(PMEM_IOCTL_MAGIC, 13, unsigned int)
 
+struct cma;
+
 struct android_pmem_platform_data
 {
 	const char* name;
@@ -77,6 +79,10 @@ struct android_pmem_platform_data
 	unsigned cached;
 	/* The MSM7k has bits to enable a write buffer in the bus controller*/
 	unsigned buffered;
+	/* set if the region is a contiguous memory area, lent to the page
+	 * allocator while not allocated, see mm/cma.c. start and size must
+	 * be the area's */
+	struct cma *cma;
 };
 
 struct pmem_region {
@@ -0,0 +1,53 @@
+#ifndef _LINUX_CMA_H
+#define _LINUX_CMA_H
+
+/*
+ * Contiguous memory areas
+ *
+ * An area is reserved at boot like a carveout, but its pages are handed
+ * to the page allocator for movable allocations until a driver asks for
+ * a contiguous buffer, when the pages in the way are migrated elsewhere.
+ * See mm/cma.c.
+ */
+
+struct cma;
+struct page;
+
+#ifdef CONFIG_CMA
+
+extern unsigned long totalcma_pages;
+
+extern struct cma *cma_reserve(unsigned long size, unsigned long align,
+			       const char *name);
+extern unsigned long cma_get_base(struct cma *cma);
+extern unsigned long cma_get_size(struct cma *cma);
+
+extern struct page *cma_alloc(struct cma *cma, unsigned long count,
+			      unsigned int order);
+extern void cma_release(struct cma *cma, struct page *pages,
+			unsigned long count);
+
+#else
+
+#define totalcma_pages 0UL
+
+static inline struct cma *cma_reserve(unsigned long size, unsigned long align,
+				      const char *name)
+{
+	return NULL;
+}
+
+static inline struct page *cma_alloc(struct cma *cma, unsigned long count,
+				     unsigned int order)
+{
+	return NULL;
+}
+
+static inline void cma_release(struct cma *cma, struct page *pages,
+			       unsigned long count)
+{
+}
+
+#endif /* CONFIG_CMA */
+
+#endif /* _LINUX_CMA_H */
@@ -342,4 +342,12 @@ static inline void set_gfp_allowed_mask(gfp_t mask)
 	gfp_allowed_mask = mask;
 }
 
+#ifdef CONFIG_CMA
+/* The contiguous memory allocator's interface to the page allocator */
+extern void init_cma_reserved_pageblock(struct page *page);
+extern int alloc_contig_range(unsigned long start, unsigned long end,
+			      int migratetype);
+extern void free_contig_range(unsigned long pfn, unsigned long nr_pages);
+#endif
+
 #endif /* __LINUX_GFP_H */
@@ -0,0 +1,39 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Kernel Interface
+ *
+ *  A compressor for the LZ4 block format: a byte oriented LZ77 with no
+ *  entropy coding, which trades some compression ratio for compression
+ *  and decompression speeds several times those of deflate.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+/* Worst case output size for input of size x */
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * Compress src_len bytes of src into dst.  On entry *dst_len is the size
+ * of dst, on success it is set to the compressed size.  This requires
+ * 'wrkmem' of size LZ4_MEM_COMPRESS.  Returns 0, or -ENOSPC if the
+ * result does not fit in dst.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression with overrun testing: malformed input can neither
+ * read past src + src_len nor write past dst + *dst_len.  On success
+ * *dst_len is set to the decompressed size and 0 is returned, otherwise
+ * -EINVAL.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+#endif
@@ -38,6 +38,16 @@
 #define RADIX_TREE_INDIRECT_PTR	1
 #define RADIX_TREE_RETRY ((void *)-1UL)
 
+/*
+ * A common use of the radix tree is to store pointers to struct pages;
+ * but the page cache also uses it to keep "exceptional" entries in the
+ * slots of evicted pages, which hold small values rather than pointers.
+ * Those are distinguished by bit 1 set, bit 0 (the indirect bit) clear,
+ * so that radix_tree_deref_slot() still tells them from a retry.
+ */
+#define RADIX_TREE_EXCEPTIONAL_ENTRY	2
+#define RADIX_TREE_EXCEPTIONAL_SHIFT	2
+
 static inline void *radix_tree_ptr_to_indirect(void *ptr)
 {
 	return (void *)((unsigned long)ptr | RADIX_TREE_INDIRECT_PTR);
@@ -53,6 +63,18 @@ static inline int radix_tree_is_indirect_ptr(void *ptr)
 	return (int)((unsigned long)ptr & RADIX_TREE_INDIRECT_PTR);
 }
 
+/**
+ * radix_tree_exceptional_entry	- radix_tree_deref_slot gave exceptional entry?
+ * @arg:	value returned by radix_tree_deref_slot
+ * Returns:	0 if well-aligned pointer, non-0 if exceptional entry.
+ *
+ * RADIX_TREE_RETRY has the bit set as well, so test for that first.
+ */
+static inline int radix_tree_exceptional_entry(void *arg)
+{
+	return (unsigned long)arg & RADIX_TREE_EXCEPTIONAL_ENTRY;
+}
+
 /*** radix-tree API starts here ***/
 
 #define RADIX_TREE_MAX_TAGS 2
@@ -164,7 +186,8 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 			unsigned long first_index, unsigned int max_items);
 unsigned int
 radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
-			unsigned long first_index, unsigned int max_items);
+			unsigned long *indices, unsigned long first_index,
+			unsigned int max_items);
 unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 				unsigned long index, unsigned long max_scan);
 unsigned long radix_tree_prev_hole(struct radix_tree_root *root,
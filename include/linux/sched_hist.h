@@ -0,0 +1,54 @@
+/* sched_hist.h - binary export of scheduler run delay histograms
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of version 2.1 of the GNU Lesser General Public License
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#ifndef _LINUX_SCHED_HIST_H
+#define _LINUX_SCHED_HIST_H
+
+#include <linux/types.h>
+
+/*
+ * With CONFIG_SCHEDSTATS every task, and every cpu cgroup, keeps a log2
+ * histogram of the time it spent runnable before it got the cpu.  Delays
+ * are counted in units of 2^SCHED_HIST_SHIFT ns (~1us): bucket 0 holds
+ * delays below one unit, bucket n (n > 0) delays of [2^(n-1), 2^n) units,
+ * and the last bucket everything longer.
+ */
+#define SCHED_HIST_SHIFT	10
+#define SCHED_HIST_BUCKETS	24
+
+/*
+ * Bump this up when changing the layout of the records below, so that
+ * tools can adapt (or abort).
+ */
+#define SCHED_HIST_VERSION	1
+
+/*
+ * /proc/sched_hist is a snapshot of all tasks in the system, taken when
+ * the file is opened.  It consists of one struct sched_hist_header
+ * followed by nr_records records of record_size bytes each.
+ */
+struct sched_hist_header {
+	__u32	version;		/* SCHED_HIST_VERSION */
+	__u32	nr_buckets;		/* SCHED_HIST_BUCKETS */
+	__u32	record_size;		/* sizeof(struct sched_hist_record) */
+	__u32	nr_records;
+	__u64	timestamp;		/* ktime_get() at snapshot, in ns */
+};
+
+struct sched_hist_record {
+	__u32	pid;
+	__u32	tgid;
+	__u64	run_delay;		/* cumulative, in ns */
+	__u64	pcount;			/* number of times run */
+	__u32	hist[SCHED_HIST_BUCKETS];
+};
+
+#endif /* _LINUX_SCHED_HIST_H */
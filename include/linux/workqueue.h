@@ -166,11 +166,11 @@ struct execute_work {
 
 extern struct workqueue_struct *
 __create_workqueue_key(const char *name, int singlethread,
-		       int freezeable, int rt, struct lock_class_key *key,
-		       const char *lock_name);
+		       int freezeable, int rt, int mem_reclaim,
+		       struct lock_class_key *key, const char *lock_name);
 
 #ifdef CONFIG_LOCKDEP
-#define __create_workqueue(name, singlethread, freezeable, rt)	\
+#define __create_workqueue(name, singlethread, freezeable, rt, mem_reclaim) \
 ({								\
 	static struct lock_class_key __key;			\
 	const char *__lock_name;				\
@@ -181,19 +181,27 @@ __create_workqueue_key(const char *name, int singlethread,
 		__lock_name = #name;				\
 								\
 	__create_workqueue_key((name), (singlethread),		\
-			       (freezeable), (rt), &__key,	\
-			       __lock_name);			\
+			       (freezeable), (rt), (mem_reclaim), \
+			       &__key, __lock_name);		\
 })
 #else
-#define __create_workqueue(name, singlethread, freezeable, rt)	\
+#define __create_workqueue(name, singlethread, freezeable, rt, mem_reclaim) \
 	__create_workqueue_key((name), (singlethread), (freezeable), (rt), \
-			       NULL, NULL)
+			       (mem_reclaim), NULL, NULL)
 #endif
 
-#define create_workqueue(name) __create_workqueue((name), 0, 0, 0)
-#define create_rt_workqueue(name) __create_workqueue((name), 0, 0, 1)
-#define create_freezeable_workqueue(name) __create_workqueue((name), 1, 1, 0)
-#define create_singlethread_workqueue(name) __create_workqueue((name), 1, 0, 0)
+#define create_workqueue(name) __create_workqueue((name), 0, 0, 0, 0)
+#define create_rt_workqueue(name) __create_workqueue((name), 0, 0, 1, 0)
+#define create_freezeable_workqueue(name) __create_workqueue((name), 1, 1, 0, 0)
+#define create_singlethread_workqueue(name) __create_workqueue((name), 1, 0, 0, 0)
+/*
+ * For workqueues that memory reclaim may wait on, e.g. to complete I/O:
+ * they keep threads of their own, as a shared pool may need to allocate
+ * a new worker before it can run their work.
+ */
+#define create_mem_reclaim_workqueue(name) __create_workqueue((name), 0, 0, 0, 1)
+#define create_singlethread_mem_reclaim_workqueue(name)		\
+	__create_workqueue((name), 1, 0, 0, 1)
 
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
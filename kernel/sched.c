@@ -76,6 +76,7 @@
 #include <asm/irq_regs.h>
 
 #include "sched_cpupri.h"
+#include "workqueue_sched.h"
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/sched.h>
@@ -251,6 +252,13 @@ struct task_group {
 	/* runqueue "owned" by this group on each cpu */
 	struct cfs_rq **cfs_rq;
 	unsigned long shares;
+	/*
+	 * CFS latency targets for this group's runqueues, in nanoseconds.
+	 * Zero means the corresponding global sysctl applies.
+	 */
+	unsigned int sched_latency;
+	unsigned int min_granularity;
+	unsigned int wakeup_granularity;
 #endif
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -365,6 +373,11 @@ struct cfs_rq {
 
 	unsigned int nr_spread_over;
 
+#ifdef CONFIG_SCHEDSTATS
+	/* run delays of the tasks of this group on this cpu */
+	unsigned int run_delay_hist[SCHED_HIST_BUCKETS];
+#endif
+
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	struct rq *rq;	/* cpu runqueue to which this cfs_rq is attached */
 
@@ -1894,6 +1907,8 @@ static void sched_irq_time_avg_update(struct rq *rq, u64 curr_irq_time) { }
 
 #endif
 
+static const struct sched_class fair_sched_class;
+
 #include "sched_stats.h"
 #include "sched_idletask.c"
 #include "sched_fair.c"
@@ -5643,6 +5658,14 @@ asmlinkage void __sched __schedule(void)
 	switch_count = &prev->nivcsw;
 
 	release_kernel_lock(prev);
+
+	/*
+	 * A shared workqueue worker about to block lets its pool start
+	 * another worker. This has to happen before the rq lock is taken.
+	 */
+	if (unlikely(prev->flags & PF_WQ_WORKER) && prev->state &&
+	    !(preempt_count() & PREEMPT_ACTIVE))
+		wq_worker_sleeping(prev);
 need_resched_nonpreemptible:
 
 	schedule_debug(prev);
@@ -5691,6 +5714,9 @@ need_resched_nonpreemptible:
 
 	post_schedule(rq);
 
+	if (unlikely(current->flags & PF_WQ_WORKER))
+		wq_worker_running(current);
+
 	if (unlikely(reacquire_kernel_lock(current) < 0))
 		goto need_resched_nonpreemptible;
 }
@@ -10681,6 +10707,92 @@ static u64 cpu_shares_read_u64(struct cgroup *cgrp, struct cftype *cft)
 
 	return (u64) tg->shares;
 }
+
+/*
+ * Per-group latency targets. These follow the limits of the matching
+ * sched_*_ns sysctls; writing 0 makes the group fall back to the global
+ * value again.
+ */
+#define MIN_GROUP_GRANULARITY	100000UL	/* 100 usecs */
+#define MAX_GROUP_GRANULARITY	NSEC_PER_SEC	/* 1 second */
+
+enum sched_group_latency_type {
+	SCHED_GROUP_LATENCY,
+	SCHED_GROUP_MIN_GRANULARITY,
+	SCHED_GROUP_WAKEUP_GRANULARITY,
+};
+
+static int sched_group_set_latency(struct task_group *tg, int type, u64 ns)
+{
+	u64 min = MIN_GROUP_GRANULARITY;
+
+	if (type == SCHED_GROUP_WAKEUP_GRANULARITY)
+		min = 0;
+	if (ns && (ns < min || ns > MAX_GROUP_GRANULARITY))
+		return -EINVAL;
+
+	switch (type) {
+	case SCHED_GROUP_LATENCY:
+		tg->sched_latency = ns;
+		break;
+	case SCHED_GROUP_MIN_GRANULARITY:
+		tg->min_granularity = ns;
+		break;
+	case SCHED_GROUP_WAKEUP_GRANULARITY:
+		tg->wakeup_granularity = ns;
+		break;
+	}
+
+	return 0;
+}
+
+static u64 sched_group_latency(struct task_group *tg, int type)
+{
+	switch (type) {
+	case SCHED_GROUP_LATENCY:
+		return tg->sched_latency;
+	case SCHED_GROUP_MIN_GRANULARITY:
+		return tg->min_granularity;
+	case SCHED_GROUP_WAKEUP_GRANULARITY:
+		return tg->wakeup_granularity;
+	}
+	return 0;
+}
+
+static int cpu_latency_write_u64(struct cgroup *cgrp, struct cftype *cft,
+				 u64 ns)
+{
+	return sched_group_set_latency(cgroup_tg(cgrp), cft->private, ns);
+}
+
+static u64 cpu_latency_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return sched_group_latency(cgroup_tg(cgrp), cft->private);
+}
+
+#ifdef CONFIG_SCHEDSTATS
+/*
+ * Run delay histogram of the tasks directly in this group, summed over
+ * all cpus. See <linux/sched_hist.h> for the bucket layout.
+ */
+static int cpu_run_delay_hist_show(struct cgroup *cgrp, struct cftype *cft,
+				   struct seq_file *m)
+{
+	struct task_group *tg = cgroup_tg(cgrp);
+	int cpu, i;
+
+	for (i = 0; i < SCHED_HIST_BUCKETS; i++) {
+		u64 count = 0;
+
+		for_each_possible_cpu(cpu)
+			count += tg->cfs_rq[cpu]->run_delay_hist[i];
+		seq_printf(m, "%s%llu", i ? " " : "", count);
+	}
+	seq_printf(m, "\n");
+
+	return 0;
+}
+#endif
 #endif /* CONFIG_FAIR_GROUP_SCHED */
 
 #ifdef CONFIG_RT_GROUP_SCHED
@@ -10714,6 +10826,30 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_shares_read_u64,
 		.write_u64 = cpu_shares_write_u64,
 	},
+	{
+		.name = "sched_latency_ns",
+		.read_u64 = cpu_latency_read_u64,
+		.write_u64 = cpu_latency_write_u64,
+		.private = SCHED_GROUP_LATENCY,
+	},
+	{
+		.name = "sched_min_granularity_ns",
+		.read_u64 = cpu_latency_read_u64,
+		.write_u64 = cpu_latency_write_u64,
+		.private = SCHED_GROUP_MIN_GRANULARITY,
+	},
+	{
+		.name = "sched_wakeup_granularity_ns",
+		.read_u64 = cpu_latency_read_u64,
+		.write_u64 = cpu_latency_write_u64,
+		.private = SCHED_GROUP_WAKEUP_GRANULARITY,
+	},
+#ifdef CONFIG_SCHEDSTATS
+	{
+		.name = "run_delay_hist",
+		.read_seq_string = cpu_run_delay_hist_show,
+	},
+#endif
 #endif
 #ifdef CONFIG_RT_GROUP_SCHED
 	{
@@ -76,8 +76,6 @@ unsigned int normalized_sysctl_sched_wakeup_granularity = 1000000UL;
 
 const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
 
-static const struct sched_class fair_sched_class;
-
 /**************************************************************
  * CFS operations on generic schedulable entities:
  */
@@ -414,6 +412,75 @@ calc_delta_fair(unsigned long delta, struct sched_entity *se)
 	return delta;
 }
 
+/*
+ * Latency targets of a runqueue. With group scheduling a task group may
+ * override the global sysctls through its cpu.sched_*_ns attributes, so
+ * that e.g. a foreground group keeps a short period and aggressive wakeup
+ * preemption no matter how busy a background group is.
+ */
+#ifdef CONFIG_FAIR_GROUP_SCHED
+static inline unsigned int cfs_rq_latency(struct cfs_rq *cfs_rq)
+{
+	return cfs_rq->tg->sched_latency ?: sysctl_sched_latency;
+}
+
+static inline unsigned int cfs_rq_min_granularity(struct cfs_rq *cfs_rq)
+{
+	return cfs_rq->tg->min_granularity ?: sysctl_sched_min_granularity;
+}
+
+/*
+ * Derived on use rather than stored in the group, so that a group which
+ * overrides only one of the two follows later writes of the other sysctl.
+ */
+static inline unsigned int cfs_rq_nr_latency(struct cfs_rq *cfs_rq)
+{
+	struct task_group *tg = cfs_rq->tg;
+
+	if (unlikely(tg->sched_latency || tg->min_granularity))
+		return DIV_ROUND_UP(cfs_rq_latency(cfs_rq),
+				    cfs_rq_min_granularity(cfs_rq));
+	return sched_nr_latency;
+}
+
+/*
+ * The wakeup granularity is that of the group the preempting entity
+ * stands for: its own runqueue's group for a task, the group it
+ * represents for a group entity.
+ */
+static inline unsigned int entity_wakeup_granularity(struct sched_entity *se)
+{
+	struct task_group *tg;
+
+	if (entity_is_task(se))
+		tg = cfs_rq_of(se)->tg;
+	else
+		tg = group_cfs_rq(se)->tg;
+
+	return tg->wakeup_granularity ?: sysctl_sched_wakeup_granularity;
+}
+#else
+static inline unsigned int cfs_rq_latency(struct cfs_rq *cfs_rq)
+{
+	return sysctl_sched_latency;
+}
+
+static inline unsigned int cfs_rq_min_granularity(struct cfs_rq *cfs_rq)
+{
+	return sysctl_sched_min_granularity;
+}
+
+static inline unsigned int cfs_rq_nr_latency(struct cfs_rq *cfs_rq)
+{
+	return sched_nr_latency;
+}
+
+static inline unsigned int entity_wakeup_granularity(struct sched_entity *se)
+{
+	return sysctl_sched_wakeup_granularity;
+}
+#endif
+
 /*
  * The idea is to set a period in which each task runs once.
  *
@@ -422,13 +489,13 @@ calc_delta_fair(unsigned long delta, struct sched_entity *se)
  *
  * p = (nr <= nl) ? l : l*nr/nl
  */
-static u64 __sched_period(unsigned long nr_running)
+static u64 __sched_period(struct cfs_rq *cfs_rq, unsigned long nr_running)
 {
-	u64 period = sysctl_sched_latency;
-	unsigned long nr_latency = sched_nr_latency;
+	u64 period = cfs_rq_latency(cfs_rq);
+	unsigned long nr_latency = cfs_rq_nr_latency(cfs_rq);
 
 	if (unlikely(nr_running > nr_latency)) {
-		period = sysctl_sched_min_granularity;
+		period = cfs_rq_min_granularity(cfs_rq);
 		period *= nr_running;
 	}
 
@@ -443,7 +510,7 @@ static u64 __sched_period(unsigned long nr_running)
  */
 static u64 sched_slice(struct cfs_rq *cfs_rq, struct sched_entity *se)
 {
-	u64 slice = __sched_period(cfs_rq->nr_running + !se->on_rq);
+	u64 slice = __sched_period(cfs_rq, cfs_rq->nr_running + !se->on_rq);
 
 	for_each_sched_entity(se) {
 		struct load_weight *load;
@@ -716,7 +783,7 @@ place_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int initial)
 
 	/* sleeps up to a single latency don't count. */
 	if (!initial && sched_feat(FAIR_SLEEPERS)) {
-		unsigned long thresh = sysctl_sched_latency;
+		unsigned long thresh = cfs_rq_latency(cfs_rq);
 
 		/*
 		 * Convert the sleeper threshold into virtual time.
@@ -855,7 +922,7 @@ check_preempt_tick(struct cfs_rq *cfs_rq, struct sched_entity *curr)
 	if (!sched_feat(WAKEUP_PREEMPT))
 		return;
 
-	if (delta_exec < sysctl_sched_min_granularity)
+	if (delta_exec < cfs_rq_min_granularity(cfs_rq))
 		return;
 
 	if (cfs_rq->nr_running > 1) {
@@ -1011,11 +1078,13 @@ static void hrtick_start_fair(struct rq *rq, struct task_struct *p)
 static void hrtick_update(struct rq *rq)
 {
 	struct task_struct *curr = rq->curr;
+	struct cfs_rq *cfs_rq;
 
 	if (curr->sched_class != &fair_sched_class)
 		return;
 
-	if (cfs_rq_of(&curr->se)->nr_running < sched_nr_latency)
+	cfs_rq = cfs_rq_of(&curr->se);
+	if (cfs_rq->nr_running < cfs_rq_nr_latency(cfs_rq))
 		hrtick_start_fair(rq, curr);
 }
 #else /* !CONFIG_SCHED_HRTICK */
@@ -1606,7 +1675,8 @@ select_task_rq_fair(struct rq *rq, struct task_struct *p, int sd_flag, int wake_
  *       degrading latency on load.
  */
 static unsigned long
-adaptive_gran(struct sched_entity *curr, struct sched_entity *se)
+adaptive_gran(struct sched_entity *curr, struct sched_entity *se,
+	      unsigned long max_gran)
 {
 	u64 this_run = curr->sum_exec_runtime - curr->prev_sum_exec_runtime;
 	u64 expected_wakeup = 2*se->avg_wakeup * cfs_rq_of(se)->nr_running;
@@ -1615,16 +1685,16 @@ adaptive_gran(struct sched_entity *curr, struct sched_entity *se)
 	if (this_run < expected_wakeup)
 		gran = expected_wakeup - this_run;
 
-	return min_t(s64, gran, sysctl_sched_wakeup_granularity);
+	return min_t(s64, gran, max_gran);
 }
 
 static unsigned long
 wakeup_gran(struct sched_entity *curr, struct sched_entity *se)
 {
-	unsigned long gran = sysctl_sched_wakeup_granularity;
+	unsigned long gran = entity_wakeup_granularity(se);
 
 	if (cfs_rq_of(curr)->curr && sched_feat(ADAPTIVE_GRAN))
-		gran = adaptive_gran(curr, se);
+		gran = adaptive_gran(curr, se, gran);
 
 	/*
 	 * Since its curr running now, convert the gran from real-time
@@ -1705,7 +1775,7 @@ static void check_preempt_wakeup(struct rq *rq, struct task_struct *p, int wake_
 	struct sched_entity *se = &curr->se, *pse = &p->se;
 	struct cfs_rq *cfs_rq = task_cfs_rq(curr);
 	int sync = wake_flags & WF_SYNC;
-	int scale = cfs_rq->nr_running >= sched_nr_latency;
+	int scale = cfs_rq->nr_running >= cfs_rq_nr_latency(cfs_rq);
 
 	update_curr(cfs_rq);
 
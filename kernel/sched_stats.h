@@ -97,13 +97,109 @@ static const struct file_operations proc_schedstat_operations = {
 	.release = single_release,
 };
 
+/*
+ * /proc/sched_hist is a binary snapshot of the run delay histograms of
+ * every task, taken at open time so that a single read(2) returns a
+ * consistent view of the whole system. See <linux/sched_hist.h>.
+ */
+static int sched_hist_open(struct inode *inode, struct file *file)
+{
+	struct sched_hist_header *hdr;
+	struct sched_hist_record *rec;
+	struct task_struct *g, *p;
+	unsigned int max;
+
+	/* leave some room for tasks forked while we allocate */
+	max = nr_threads + 64;
+	hdr = vmalloc(sizeof(*hdr) + max * sizeof(*rec));
+	if (!hdr)
+		return -ENOMEM;
+
+	hdr->version = SCHED_HIST_VERSION;
+	hdr->nr_buckets = SCHED_HIST_BUCKETS;
+	hdr->record_size = sizeof(*rec);
+	hdr->nr_records = 0;
+	hdr->timestamp = ktime_to_ns(ktime_get());
+
+	rec = (struct sched_hist_record *)(hdr + 1);
+	read_lock(&tasklist_lock);
+	do_each_thread(g, p) {
+		if (hdr->nr_records == max)
+			goto out;
+		rec->pid = task_pid_vnr(p);
+		rec->tgid = task_tgid_vnr(p);
+		rec->run_delay = p->sched_info.run_delay;
+		rec->pcount = p->sched_info.pcount;
+		memcpy(rec->hist, p->sched_info.run_delay_hist,
+		       sizeof(rec->hist));
+		hdr->nr_records++;
+		rec++;
+	} while_each_thread(g, p);
+out:
+	read_unlock(&tasklist_lock);
+
+	file->private_data = hdr;
+	return 0;
+}
+
+static ssize_t sched_hist_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct sched_hist_header *hdr = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, hdr, sizeof(*hdr) +
+				       hdr->nr_records * hdr->record_size);
+}
+
+static int sched_hist_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations proc_sched_hist_operations = {
+	.open    = sched_hist_open,
+	.read    = sched_hist_read,
+	.llseek  = generic_file_llseek,
+	.release = sched_hist_release,
+};
+
 static int __init proc_schedstat_init(void)
 {
 	proc_create("schedstat", 0, NULL, &proc_schedstat_operations);
+	proc_create("sched_hist", 0, NULL, &proc_sched_hist_operations);
 	return 0;
 }
 module_init(proc_schedstat_init);
 
+static inline int sched_hist_bucket(unsigned long long delta)
+{
+	if (delta >> (SCHED_HIST_SHIFT + SCHED_HIST_BUCKETS))
+		return SCHED_HIST_BUCKETS - 1;
+
+	return min_t(int, fls(delta >> SCHED_HIST_SHIFT),
+		     SCHED_HIST_BUCKETS - 1);
+}
+
+/*
+ * Account a wait of @delta into the histograms of @t and, for a CFS task,
+ * of its group. Expects runqueue lock to be held for atomicity of update
+ */
+static inline void
+task_sched_info_arrive(struct task_struct *t, unsigned long long delta)
+{
+	int bucket = sched_hist_bucket(delta);
+
+	t->sched_info.run_delay_hist[bucket]++;
+	if (t->sched_class != &fair_sched_class)
+		return;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	t->se.cfs_rq->run_delay_hist[bucket]++;
+#else
+	task_rq(t)->cfs.run_delay_hist[bucket]++;
+#endif
+}
+
 /*
  * Expects runqueue lock to be held for atomicity of update
  */
@@ -140,6 +236,9 @@ static inline void
 rq_sched_info_arrive(struct rq *rq, unsigned long long delta)
 {}
 static inline void
+task_sched_info_arrive(struct task_struct *t, unsigned long long delta)
+{}
+static inline void
 rq_sched_info_dequeued(struct rq *rq, unsigned long long delta)
 {}
 static inline void
@@ -199,6 +298,7 @@ static void sched_info_arrive(struct task_struct *t)
 	t->sched_info.last_arrival = now;
 	t->sched_info.pcount++;
 
+	task_sched_info_arrive(t, delta);
 	rq_sched_info_arrive(task_rq(t), delta);
 }
 
@@ -36,13 +36,18 @@
 #define CREATE_TRACE_POINTS
 #include <trace/events/workqueue.h>
 
+#include "workqueue_sched.h"
+
+struct worker_pool;
+
 /*
  * The per-CPU workqueue (if single thread, we always use the first
  * possible cpu).
  */
 struct cpu_workqueue_struct {
 
-	spinlock_t lock;
+	spinlock_t *lock;	/* &own_lock, or the pool's lock if shared */
+	spinlock_t own_lock;
 
 	struct list_head worklist;
 	wait_queue_head_t more_work;
@@ -50,6 +55,12 @@ struct cpu_workqueue_struct {
 
 	struct workqueue_struct *wq;
 	struct task_struct *thread;
+
+	/* Only used when the workqueue is served by a shared worker pool: */
+	struct worker_pool *pool;
+	struct list_head ready_entry;	/* on pool->ready while work pending */
+	struct list_head busy_list;	/* workers running our work items */
+	int nr_active;			/* number of work items running */
 } ____cacheline_aligned;
 
 /*
@@ -63,6 +74,9 @@ struct workqueue_struct {
 	int singlethread;
 	int freezeable;		/* Freeze threads during suspend */
 	int rt;
+	int mem_reclaim;	/* Memory reclaim may wait on its work */
+	int shared;		/* Served by the shared worker pools */
+	int max_active;		/* Work items run concurrently per cwq */
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map lockdep_map;
 #endif
@@ -83,16 +97,96 @@ static const struct cpumask *cpu_singlethread_map __read_mostly;
  */
 static cpumask_var_t cpu_populated_map __read_mostly;
 
+/*
+ * Shared worker pools.
+ *
+ * Workqueues which are neither freezeable nor realtime don't get threads
+ * of their own.  Their cpu_workqueue_structs are served by a pool of
+ * kworker threads instead: one pool per cpu for multithreaded workqueues
+ * and an unbound pool for singlethreaded ones.  The exception is those
+ * that memory reclaim may wait on (create_mem_reclaim_workqueue()): a pool
+ * that has run out of idle workers needs memory to create another one, so
+ * the work that frees memory must not depend on it.
+ *
+ * The pools are concurrency managed.  A per-cpu pool normally has a
+ * single running worker which processes the pending work of all shared
+ * workqueues on that cpu; another idle worker is only woken when the
+ * running one blocks inside a work function (see wq_worker_sleeping(),
+ * called from the scheduler).  The kworkerd manager thread keeps one idle
+ * worker in reserve per pool so the scheduler hook never has to create
+ * threads, and idle workers beyond that reserve exit after
+ * IDLE_WORKER_TIMEOUT.
+ *
+ * Each cwq still runs at most max_active work items at a time; it is 1
+ * for singlethreaded workqueues, so these keep executing their work
+ * strictly in queueing order.  A work item is never run concurrently
+ * with itself.  A flush_workqueue() barrier at the head of a cwq waits
+ * until all the work items started before it have completed, while the
+ * barrier of flush_work() or cancel_work_sync() only waits for its target:
+ * it is handed to the worker running the target, which completes it when
+ * done, so the rest of the cwq keeps going meanwhile.
+ */
+#define WQ_MAX_ACTIVE		16	/* per cwq of multithreaded wqs */
+#define MAX_POOL_WORKERS	128
+#define IDLE_WORKER_TIMEOUT	(300 * HZ)
+#define CREATE_COOLDOWN		(HZ / 10)
+
+struct worker {
+	struct list_head	entry;		/* idle_list or cwq->busy_list */
+	struct list_head	node;		/* pool->workers */
+	struct task_struct	*task;
+	struct worker_pool	*pool;
+	struct cpu_workqueue_struct *cwq;	/* cwq of current_work */
+	struct work_struct	*current_work;
+	int			id;
+	int			idle;
+	int			sleeping;	/* blocked in a work function */
+	struct list_head	flushers;	/* barriers for current_work */
+};
+
+struct worker_pool {
+	spinlock_t		lock;
+	int			cpu;		/* -1 for the unbound pool */
+	int			max_running;
+	int			active;		/* workers may be created */
+
+	struct list_head	ready;		/* cwqs with pending work */
+	struct list_head	idle_list;
+	struct list_head	workers;
+	int			nr_workers;
+	int			nr_idle;
+	int			next_id;
+	atomic_t		nr_running;	/* busy and not blocked */
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU(struct worker_pool, cpu_worker_pool);
+static struct worker_pool unbound_worker_pool;
+static struct task_struct *pool_manager;
+
+static int wq_shared __read_mostly = 1;
+
+static int __init wq_noshare_setup(char *str)
+{
+	wq_shared = 0;
+	return 1;
+}
+__setup("wq_noshare", wq_noshare_setup);
+
 /* If it's single threaded, it isn't in the list of workqueues. */
 static inline int is_wq_single_threaded(struct workqueue_struct *wq)
 {
 	return wq->singlethread;
 }
 
+/*
+ * Work queued on a shared workqueue for a cpu that went down is still
+ * processed by that cpu's pool, so flushes have to look at all of them.
+ */
 static const struct cpumask *wq_cpu_map(struct workqueue_struct *wq)
 {
-	return is_wq_single_threaded(wq)
-		? cpu_singlethread_map : cpu_populated_map;
+	if (is_wq_single_threaded(wq))
+		return cpu_singlethread_map;
+	return wq->shared ? cpu_possible_mask : cpu_populated_map;
 }
 
 static
@@ -125,10 +219,105 @@ struct cpu_workqueue_struct *get_wq_data(struct work_struct *work)
 	return (void *) (atomic_long_read(&work->data) & WORK_STRUCT_WQ_DATA_MASK);
 }
 
+struct wq_barrier {
+	struct work_struct	work;
+	struct completion	done;
+	struct work_struct	*target;	/* NULL for flush_workqueue() */
+	struct list_head	node;		/* on worker->flushers */
+};
+
+static void wq_barrier_func(struct work_struct *work)
+{
+	struct wq_barrier *barr = container_of(work, struct wq_barrier, work);
+	complete(&barr->done);
+}
+
+static struct worker *first_idle_worker(struct worker_pool *pool)
+{
+	if (list_empty(&pool->idle_list))
+		return NULL;
+	return list_first_entry(&pool->idle_list, struct worker, entry);
+}
+
+static struct worker *
+cwq_find_worker(struct cpu_workqueue_struct *cwq, struct work_struct *work)
+{
+	struct worker *worker;
+
+	list_for_each_entry(worker, &cwq->busy_list, entry)
+		if (worker->current_work == work)
+			return worker;
+	return NULL;
+}
+
+/*
+ * Can the work item at the head of @cwq be started now?
+ * Called with pool->lock held.
+ */
+static int cwq_can_start(struct cpu_workqueue_struct *cwq)
+{
+	struct work_struct *work;
+
+	if (list_empty(&cwq->worklist))
+		return 0;
+
+	work = list_first_entry(&cwq->worklist, struct work_struct, entry);
+	if (work->func == wq_barrier_func) {
+		struct wq_barrier *barr;
+
+		barr = container_of(work, struct wq_barrier, work);
+		return barr->target || !cwq->nr_active;
+	}
+	if (cwq->nr_active >= cwq->wq->max_active)
+		return 0;
+	return !cwq_find_worker(cwq, work);
+}
+
+/*
+ * Return the first cwq on @pool whose head work item can be started,
+ * dropping cwqs that have run out of work from the ready list.
+ * Called with pool->lock held.
+ */
+static struct cpu_workqueue_struct *pool_next_cwq(struct worker_pool *pool)
+{
+	struct cpu_workqueue_struct *cwq, *n;
+
+	list_for_each_entry_safe(cwq, n, &pool->ready, ready_entry) {
+		if (list_empty(&cwq->worklist)) {
+			list_del_init(&cwq->ready_entry);
+			continue;
+		}
+		if (cwq_can_start(cwq))
+			return cwq;
+	}
+	return NULL;
+}
+
+static int pool_need_more_worker(struct worker_pool *pool)
+{
+	return atomic_read(&pool->nr_running) < pool->max_running &&
+		pool_next_cwq(pool);
+}
+
+/*
+ * Get an idle worker going, or have the manager create one if there are
+ * none left.  Called with pool->lock held.
+ */
+static void wake_up_idle_worker(struct worker_pool *pool)
+{
+	struct worker *worker = first_idle_worker(pool);
+
+	if (worker)
+		wake_up_process(worker->task);
+	else if (pool_manager)
+		wake_up_process(pool_manager);
+}
+
 static void insert_work(struct cpu_workqueue_struct *cwq,
 			struct work_struct *work, struct list_head *head)
 {
-	trace_workqueue_insertion(cwq->thread, work);
+	if (cwq->thread)
+		trace_workqueue_insertion(cwq->thread, work);
 
 	set_wq_data(work, cwq);
 	/*
@@ -137,7 +326,16 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 	 */
 	smp_wmb();
 	list_add_tail(&work->entry, head);
-	wake_up(&cwq->more_work);
+
+	if (cwq->pool) {
+		struct worker_pool *pool = cwq->pool;
+
+		if (list_empty(&cwq->ready_entry))
+			list_add_tail(&cwq->ready_entry, &pool->ready);
+		if (atomic_read(&pool->nr_running) < pool->max_running)
+			wake_up_idle_worker(pool);
+	} else
+		wake_up(&cwq->more_work);
 }
 
 static void __queue_work(struct cpu_workqueue_struct *cwq,
@@ -145,9 +343,9 @@ static void __queue_work(struct cpu_workqueue_struct *cwq,
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&cwq->lock, flags);
+	spin_lock_irqsave(cwq->lock, flags);
 	insert_work(cwq, work, &cwq->worklist);
-	spin_unlock_irqrestore(&cwq->lock, flags);
+	spin_unlock_irqrestore(cwq->lock, flags);
 }
 
 /**
@@ -261,9 +459,23 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 }
 EXPORT_SYMBOL_GPL(queue_delayed_work_on);
 
+static void check_work_leak(work_func_t f)
+{
+	if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
+		printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
+				"%s/0x%08x/%d\n",
+				current->comm, preempt_count(),
+			       	task_pid_nr(current));
+		printk(KERN_ERR "    last function: ");
+		print_symbol("%s\n", (unsigned long)f);
+		debug_show_held_locks(current);
+		dump_stack();
+	}
+}
+
 static void run_workqueue(struct cpu_workqueue_struct *cwq)
 {
-	spin_lock_irq(&cwq->lock);
+	spin_lock_irq(cwq->lock);
 	while (!list_empty(&cwq->worklist)) {
 		struct work_struct *work = list_entry(cwq->worklist.next,
 						struct work_struct, entry);
@@ -282,7 +494,7 @@ static void run_workqueue(struct cpu_workqueue_struct *cwq)
 		trace_workqueue_execution(cwq->thread, work);
 		cwq->current_work = work;
 		list_del_init(cwq->worklist.next);
-		spin_unlock_irq(&cwq->lock);
+		spin_unlock_irq(cwq->lock);
 
 		BUG_ON(get_wq_data(work) != cwq);
 		work_clear_pending(work);
@@ -292,21 +504,12 @@ static void run_workqueue(struct cpu_workqueue_struct *cwq)
 		lock_map_release(&lockdep_map);
 		lock_map_release(&cwq->wq->lockdep_map);
 
-		if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
-			printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
-					"%s/0x%08x/%d\n",
-					current->comm, preempt_count(),
-				       	task_pid_nr(current));
-			printk(KERN_ERR "    last function: ");
-			print_symbol("%s\n", (unsigned long)f);
-			debug_show_held_locks(current);
-			dump_stack();
-		}
+		check_work_leak(f);
 
-		spin_lock_irq(&cwq->lock);
+		spin_lock_irq(cwq->lock);
 		cwq->current_work = NULL;
 	}
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(cwq->lock);
 }
 
 static int worker_thread(void *__cwq)
@@ -336,24 +539,386 @@ static int worker_thread(void *__cwq)
 	return 0;
 }
 
-struct wq_barrier {
-	struct work_struct	work;
-	struct completion	done;
-};
+/*
+ * Run the work item at the head of @cwq in @worker.  Called with
+ * pool->lock held, which is dropped while the work function runs.
+ */
+static void process_one_work(struct worker *worker,
+			     struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool = worker->pool;
+	struct work_struct *work = list_first_entry(&cwq->worklist,
+						struct work_struct, entry);
+	work_func_t f = work->func;
+#ifdef CONFIG_LOCKDEP
+	/* see run_workqueue() */
+	struct lockdep_map lockdep_map = work->lockdep_map;
+#endif
 
-static void wq_barrier_func(struct work_struct *work)
+	list_del_init(&work->entry);
+	/* round-robin between the cwqs of the pool */
+	if (list_empty(&cwq->worklist))
+		list_del_init(&cwq->ready_entry);
+	else
+		list_move_tail(&cwq->ready_entry, &pool->ready);
+
+	/*
+	 * The barrier of flush_work() got here after its target had been
+	 * started: pass it on to the worker running the target, if any.
+	 */
+	if (f == wq_barrier_func) {
+		struct wq_barrier *barr;
+		struct worker *running;
+
+		barr = container_of(work, struct wq_barrier, work);
+		if (barr->target) {
+			running = cwq_find_worker(cwq, barr->target);
+			if (running)
+				list_add_tail(&barr->node, &running->flushers);
+			else
+				complete(&barr->done);
+			return;
+		}
+	}
+
+	cwq->nr_active++;
+	worker->cwq = cwq;
+	worker->current_work = work;
+	list_add(&worker->entry, &cwq->busy_list);
+	spin_unlock_irq(&pool->lock);
+
+	trace_workqueue_execution(worker->task, work);
+	BUG_ON(get_wq_data(work) != cwq);
+	work_clear_pending(work);
+	lock_map_acquire(&cwq->wq->lockdep_map);
+	lock_map_acquire(&lockdep_map);
+	f(work);
+	lock_map_release(&lockdep_map);
+	lock_map_release(&cwq->wq->lockdep_map);
+
+	check_work_leak(f);
+
+	spin_lock_irq(&pool->lock);
+	list_del_init(&worker->entry);
+	worker->current_work = NULL;
+	worker->cwq = NULL;
+	while (!list_empty(&worker->flushers)) {
+		struct wq_barrier *barr = list_first_entry(&worker->flushers,
+						struct wq_barrier, node);
+
+		list_del_init(&barr->node);
+		complete(&barr->done);
+	}
+	/* cleanup_shared_cwq() waits for this, see there */
+	if (!--cwq->nr_active)
+		wake_up(&cwq->more_work);
+	if (!list_empty(&cwq->worklist) && list_empty(&cwq->ready_entry))
+		list_add_tail(&cwq->ready_entry, &pool->ready);
+}
+
+/* Called with pool->lock held. */
+static void worker_leave_idle(struct worker *worker)
 {
-	struct wq_barrier *barr = container_of(work, struct wq_barrier, work);
-	complete(&barr->done);
+	struct worker_pool *pool = worker->pool;
+
+	worker->idle = 0;
+	list_del_init(&worker->entry);
+	pool->nr_idle--;
+	atomic_inc(&pool->nr_running);
+
+	/* the unbound pool may want more than one worker running */
+	if (pool_need_more_worker(pool))
+		wake_up_idle_worker(pool);
+	/* keep one idle worker in reserve */
+	if (!pool->nr_idle && pool_manager)
+		wake_up_process(pool_manager);
+}
+
+/* Called with pool->lock held. */
+static void worker_enter_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	atomic_dec(&pool->nr_running);
+	worker->idle = 1;
+	list_add(&worker->entry, &pool->idle_list);
+	pool->nr_idle++;
+}
+
+static int pool_worker_thread(void *__worker)
+{
+	struct worker *worker = __worker;
+	struct worker_pool *pool = worker->pool;
+	long timeout;
+
+	current->flags |= PF_WQ_WORKER;
+
+	spin_lock_irq(&pool->lock);
+	for (;;) {
+		/*
+		 * Workers of a per-cpu pool are moved off their cpu when it
+		 * goes down; get back to it once it is online again.
+		 */
+		if (pool->cpu >= 0 && cpu_online(pool->cpu) &&
+		    !cpumask_equal(&current->cpus_allowed,
+				   cpumask_of(pool->cpu))) {
+			spin_unlock_irq(&pool->lock);
+			set_cpus_allowed_ptr(current, cpumask_of(pool->cpu));
+			spin_lock_irq(&pool->lock);
+			continue;
+		}
+
+		if (pool_need_more_worker(pool)) {
+			struct cpu_workqueue_struct *cwq;
+
+			worker_leave_idle(worker);
+			/*
+			 * Keep going as long as we are the only running
+			 * worker; if others are running again after having
+			 * blocked, leave the rest of the work to them.
+			 */
+			while (atomic_read(&pool->nr_running) <=
+							pool->max_running &&
+			       (cwq = pool_next_cwq(pool)))
+				process_one_work(worker, cwq);
+			worker_enter_idle(worker);
+			continue;
+		}
+
+		__set_current_state(TASK_INTERRUPTIBLE);
+		spin_unlock_irq(&pool->lock);
+		timeout = schedule_timeout(IDLE_WORKER_TIMEOUT);
+		spin_lock_irq(&pool->lock);
+
+		if (!timeout && pool->nr_idle > 1 &&
+		    !pool_need_more_worker(pool))
+			break;
+	}
+
+	list_del(&worker->entry);
+	list_del(&worker->node);
+	pool->nr_idle--;
+	pool->nr_workers--;
+	spin_unlock_irq(&pool->lock);
+
+	trace_workqueue_destruction(current);
+	current->flags &= ~PF_WQ_WORKER;
+	kfree(worker);
+	return 0;
+}
+
+/**
+ * wq_worker_sleeping - a shared pool worker is going to sleep
+ * @task: the worker's task
+ *
+ * Called from the scheduler when @task, a shared workqueue worker, is
+ * about to block.  If it was the last running worker of its pool and
+ * there is more work to do, another idle worker is woken to do it.
+ */
+void wq_worker_sleeping(struct task_struct *task)
+{
+	struct worker *worker = kthread_data(task);
+	struct worker_pool *pool = worker->pool;
+	unsigned long flags;
+
+	if (worker->idle || worker->sleeping)
+		return;
+
+	worker->sleeping = 1;
+	spin_lock_irqsave(&pool->lock, flags);
+	atomic_dec(&pool->nr_running);
+	if (pool_need_more_worker(pool))
+		wake_up_idle_worker(pool);
+	spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+/**
+ * wq_worker_running - a shared pool worker is running again
+ * @task: the worker's task, which must be current
+ *
+ * Undo wq_worker_sleeping() once @task got the cpu back.
+ */
+void wq_worker_running(struct task_struct *task)
+{
+	struct worker *worker = kthread_data(task);
+
+	if (unlikely(worker->sleeping)) {
+		worker->sleeping = 0;
+		atomic_inc(&worker->pool->nr_running);
+	}
+}
+
+static struct worker *current_worker(void)
+{
+	if (!(current->flags & PF_WQ_WORKER))
+		return NULL;
+	return kthread_data(current);
+}
+
+/*
+ * Is @work currently being run from @cwq?
+ * Called with cwq->lock held.
+ */
+static int cwq_executing(struct cpu_workqueue_struct *cwq,
+			 struct work_struct *work)
+{
+	if (cwq->pool)
+		return cwq_find_worker(cwq, work) != NULL;
+	return cwq->current_work == work;
+}
+
+/* Is current running a work item from @cwq? */
+static int cwq_is_current(struct cpu_workqueue_struct *cwq)
+{
+	struct worker *worker;
+
+	if (!cwq->pool)
+		return cwq->thread == current;
+
+	worker = current_worker();
+	return worker && worker->cwq == cwq;
+}
+
+static int create_pool_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+	struct task_struct *p;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return -ENOMEM;
+
+	worker->pool = pool;
+	worker->idle = 1;
+	INIT_LIST_HEAD(&worker->entry);
+	INIT_LIST_HEAD(&worker->flushers);
+
+	spin_lock_irq(&pool->lock);
+	worker->id = pool->next_id++;
+	spin_unlock_irq(&pool->lock);
+
+	if (pool->cpu >= 0)
+		p = kthread_create(pool_worker_thread, worker, "kworker/%d:%d",
+				   pool->cpu, worker->id);
+	else
+		p = kthread_create(pool_worker_thread, worker, "kworker/u:%d",
+				   worker->id);
+	if (IS_ERR(p)) {
+		kfree(worker);
+		return PTR_ERR(p);
+	}
+	worker->task = p;
+	if (pool->cpu >= 0)
+		kthread_bind(p, pool->cpu);
+
+	spin_lock_irq(&pool->lock);
+	list_add(&worker->entry, &pool->idle_list);
+	list_add(&worker->node, &pool->workers);
+	pool->nr_idle++;
+	pool->nr_workers++;
+	spin_unlock_irq(&pool->lock);
+
+	trace_workqueue_creation(p, pool->cpu < 0 ? 0 : pool->cpu);
+	wake_up_process(p);
+	return 0;
+}
+
+static int pool_needs_worker(struct worker_pool *pool)
+{
+	int ret;
+
+	spin_lock_irq(&pool->lock);
+	ret = pool->active && !pool->nr_idle &&
+		pool->nr_workers < MAX_POOL_WORKERS;
+	spin_unlock_irq(&pool->lock);
+
+	return ret;
+}
+
+/* Iterate over the unbound pool and the pools of all possible cpus. */
+#define for_each_worker_pool(pool, cpu)					\
+	for ((cpu) = -1, (pool) = &unbound_worker_pool;			\
+	     (cpu) < nr_cpu_ids;					\
+	     (cpu) = cpumask_next((cpu), cpu_possible_mask),		\
+	     (pool) = (cpu) < nr_cpu_ids ?				\
+			&per_cpu(cpu_worker_pool, (cpu)) : NULL)
+
+/*
+ * kworkerd creates workers whenever a pool has run out of idle ones, so
+ * that waking up another worker never has to wait for a fork.
+ */
+static int pool_manager_thread(void *unused)
+{
+	struct worker_pool *pool;
+	int cpu, needed;
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		needed = 0;
+		for_each_worker_pool(pool, cpu)
+			needed |= pool_needs_worker(pool);
+		if (!needed)
+			schedule();
+		__set_current_state(TASK_RUNNING);
+
+		for_each_worker_pool(pool, cpu) {
+			while (pool_needs_worker(pool)) {
+				if (create_pool_worker(pool)) {
+					/* out of memory, retry in a bit */
+					schedule_timeout_interruptible(
+							CREATE_COOLDOWN);
+					break;
+				}
+			}
+		}
+	}
+
+	return 0;
 }
 
+static void init_worker_pool(struct worker_pool *pool, int cpu)
+{
+	spin_lock_init(&pool->lock);
+	pool->cpu = cpu;
+	pool->max_running = cpu >= 0 ? 1 : nr_cpu_ids;
+	INIT_LIST_HEAD(&pool->ready);
+	INIT_LIST_HEAD(&pool->idle_list);
+	INIT_LIST_HEAD(&pool->workers);
+	atomic_set(&pool->nr_running, 0);
+}
+
+static void activate_worker_pool(struct worker_pool *pool)
+{
+	spin_lock_irq(&pool->lock);
+	pool->active = 1;
+	spin_unlock_irq(&pool->lock);
+	if (pool_manager)
+		wake_up_process(pool_manager);
+}
+
+/*
+ * Queue @barr at @head of @cwq.  If it waits for a @target that a shared
+ * pool worker is running, it is handed to that worker instead.
+ * Called with cwq->lock held.
+ */
 static void insert_wq_barrier(struct cpu_workqueue_struct *cwq,
-			struct wq_barrier *barr, struct list_head *head)
+			struct wq_barrier *barr, struct work_struct *target,
+			struct list_head *head)
 {
 	INIT_WORK(&barr->work, wq_barrier_func);
 	__set_bit(WORK_STRUCT_PENDING, work_data_bits(&barr->work));
 
 	init_completion(&barr->done);
+	barr->target = target;
+
+	if (target && cwq->pool) {
+		struct worker *worker = cwq_find_worker(cwq, target);
+
+		if (worker) {
+			list_add_tail(&barr->node, &worker->flushers);
+			return;
+		}
+	}
 
 	insert_work(cwq, &barr->work, head);
 }
@@ -363,14 +928,15 @@ static int flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
 	int active = 0;
 	struct wq_barrier barr;
 
-	WARN_ON(cwq->thread == current);
+	WARN_ON(cwq_is_current(cwq));
 
-	spin_lock_irq(&cwq->lock);
-	if (!list_empty(&cwq->worklist) || cwq->current_work != NULL) {
-		insert_wq_barrier(cwq, &barr, &cwq->worklist);
+	spin_lock_irq(cwq->lock);
+	if (!list_empty(&cwq->worklist) || cwq->current_work != NULL ||
+	    cwq->nr_active) {
+		insert_wq_barrier(cwq, &barr, NULL, &cwq->worklist);
 		active = 1;
 	}
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(cwq->lock);
 
 	if (active)
 		wait_for_completion(&barr.done);
@@ -429,7 +995,7 @@ int flush_work(struct work_struct *work)
 	lock_map_release(&cwq->wq->lockdep_map);
 
 	prev = NULL;
-	spin_lock_irq(&cwq->lock);
+	spin_lock_irq(cwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * See the comment near try_to_grab_pending()->smp_rmb().
@@ -440,13 +1006,13 @@ int flush_work(struct work_struct *work)
 			goto out;
 		prev = &work->entry;
 	} else {
-		if (cwq->current_work != work)
+		if (!cwq_executing(cwq, work))
 			goto out;
 		prev = &cwq->worklist;
 	}
-	insert_wq_barrier(cwq, &barr, prev->next);
+	insert_wq_barrier(cwq, &barr, work, prev->next);
 out:
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(cwq->lock);
 	if (!prev)
 		return 0;
 
@@ -476,7 +1042,7 @@ static int try_to_grab_pending(struct work_struct *work)
 	if (!cwq)
 		return ret;
 
-	spin_lock_irq(&cwq->lock);
+	spin_lock_irq(cwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
 		 * This work is queued, but perhaps we locked the wrong cwq.
@@ -489,7 +1055,7 @@ static int try_to_grab_pending(struct work_struct *work)
 			ret = 1;
 		}
 	}
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(cwq->lock);
 
 	return ret;
 }
@@ -500,12 +1066,12 @@ static void wait_on_cpu_work(struct cpu_workqueue_struct *cwq,
 	struct wq_barrier barr;
 	int running = 0;
 
-	spin_lock_irq(&cwq->lock);
-	if (unlikely(cwq->current_work == work)) {
-		insert_wq_barrier(cwq, &barr, cwq->worklist.next);
+	spin_lock_irq(cwq->lock);
+	if (unlikely(cwq_executing(cwq, work))) {
+		insert_wq_barrier(cwq, &barr, work, cwq->worklist.next);
 		running = 1;
 	}
-	spin_unlock_irq(&cwq->lock);
+	spin_unlock_irq(cwq->lock);
 
 	if (unlikely(running))
 		wait_for_completion(&barr.done);
@@ -766,7 +1332,7 @@ int current_is_keventd(void)
 	BUG_ON(!keventd_wq);
 
 	cwq = per_cpu_ptr(keventd_wq->cpu_wq, cpu);
-	if (current == cwq->thread)
+	if (cwq_is_current(cwq))
 		ret = 1;
 
 	return ret;
@@ -780,9 +1346,20 @@ init_cpu_workqueue(struct workqueue_struct *wq, int cpu)
 	struct cpu_workqueue_struct *cwq = per_cpu_ptr(wq->cpu_wq, cpu);
 
 	cwq->wq = wq;
-	spin_lock_init(&cwq->lock);
+	spin_lock_init(&cwq->own_lock);
+	cwq->lock = &cwq->own_lock;
 	INIT_LIST_HEAD(&cwq->worklist);
 	init_waitqueue_head(&cwq->more_work);
+	INIT_LIST_HEAD(&cwq->ready_entry);
+	INIT_LIST_HEAD(&cwq->busy_list);
+
+	if (wq->shared) {
+		if (is_wq_single_threaded(wq))
+			cwq->pool = &unbound_worker_pool;
+		else
+			cwq->pool = &per_cpu(cpu_worker_pool, cpu);
+		cwq->lock = &cwq->pool->lock;
+	}
 
 	return cwq;
 }
@@ -829,6 +1406,7 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 						int singlethread,
 						int freezeable,
 						int rt,
+						int mem_reclaim,
 						struct lock_class_key *key,
 						const char *lock_name)
 {
@@ -851,9 +1429,20 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 	wq->singlethread = singlethread;
 	wq->freezeable = freezeable;
 	wq->rt = rt;
+	wq->mem_reclaim = mem_reclaim;
+	wq->shared = wq_shared && !freezeable && !rt && !mem_reclaim;
+	wq->max_active = singlethread ? 1 : WQ_MAX_ACTIVE;
 	INIT_LIST_HEAD(&wq->list);
 
-	if (singlethread) {
+	if (wq->shared) {
+		/*
+		 * No threads to create; the pools start workers as needed.
+		 * Shared wqs are not put on the workqueues list since they
+		 * have nothing to do on cpu hotplug.
+		 */
+		for_each_possible_cpu(cpu)
+			init_cpu_workqueue(wq, cpu);
+	} else if (singlethread) {
 		cwq = init_cpu_workqueue(wq, singlethread_cpu);
 		err = create_workqueue_thread(cwq, singlethread_cpu);
 		start_workqueue_thread(cwq, -1);
@@ -892,6 +1481,24 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 }
 EXPORT_SYMBOL_GPL(__create_workqueue_key);
 
+/*
+ * Flush a shared cwq and make sure no pool worker still refers to it:
+ * the worker running the flush barrier drops its reference only after
+ * having completed it, and wakes us up when it has.  It does so under
+ * pool->lock, so once we hold that lock it is done with the cwq.
+ */
+static void cleanup_shared_cwq(struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool = cwq->pool;
+
+	flush_cpu_workqueue(cwq);
+	wait_event(cwq->more_work, !cwq->nr_active);
+
+	spin_lock_irq(&pool->lock);
+	list_del_init(&cwq->ready_entry);
+	spin_unlock_irq(&pool->lock);
+}
+
 static void cleanup_workqueue_thread(struct cpu_workqueue_struct *cwq)
 {
 	/*
@@ -931,6 +1538,14 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	const struct cpumask *cpu_map = wq_cpu_map(wq);
 	int cpu;
 
+	if (wq->shared) {
+		lock_map_acquire(&wq->lockdep_map);
+		lock_map_release(&wq->lockdep_map);
+		for_each_cpu(cpu, cpu_map)
+			cleanup_shared_cwq(per_cpu_ptr(wq->cpu_wq, cpu));
+		goto free;
+	}
+
 	cpu_maps_update_begin();
 	spin_lock(&workqueue_lock);
 	list_del(&wq->list);
@@ -939,6 +1554,7 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	for_each_cpu(cpu, cpu_map)
 		cleanup_workqueue_thread(per_cpu_ptr(wq->cpu_wq, cpu));
  	cpu_maps_update_done();
+free:
 
 	free_percpu(wq->cpu_wq);
 	kfree(wq);
@@ -959,6 +1575,8 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 	switch (action) {
 	case CPU_UP_PREPARE:
 		cpumask_set_cpu(cpu, cpu_populated_map);
+		if (wq_shared)
+			activate_worker_pool(&per_cpu(cpu_worker_pool, cpu));
 	}
 undo:
 	list_for_each_entry(wq, &workqueues, list) {
@@ -1044,11 +1662,26 @@ EXPORT_SYMBOL_GPL(work_on_cpu);
 
 void __init init_workqueues(void)
 {
+	struct worker_pool *pool;
+	int cpu;
+
 	alloc_cpumask_var(&cpu_populated_map, GFP_KERNEL);
 
 	cpumask_copy(cpu_populated_map, cpu_online_mask);
 	singlethread_cpu = cpumask_first(cpu_possible_mask);
 	cpu_singlethread_map = cpumask_of(singlethread_cpu);
+
+	for_each_worker_pool(pool, cpu)
+		init_worker_pool(pool, cpu);
+	if (wq_shared) {
+		pool_manager = kthread_run(pool_manager_thread, NULL,
+					   "kworkerd");
+		BUG_ON(IS_ERR(pool_manager));
+		for_each_worker_pool(pool, cpu)
+			if (cpu < 0 || cpu_online(cpu))
+				activate_worker_pool(pool);
+	}
+
 	hotcpu_notifier(workqueue_cpu_callback, 0);
 	keventd_wq = create_workqueue("events");
 	BUG_ON(!keventd_wq);
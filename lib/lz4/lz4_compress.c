@@ -0,0 +1,177 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Matches are found through a hash table of the last position each
+ *  4 byte sequence was seen at, with no chains: one candidate is checked
+ *  per position, which is what makes the compressor fast.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/lz4.h>
+#include <asm/byteorder.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U) >>
+		(32 - LZ4_HASH_LOG);
+}
+
+/* Number of leading bytes that are equal in p and ref, up to limit */
+static inline size_t lz4_count(const unsigned char *p,
+			       const unsigned char *ref,
+			       const unsigned char *limit)
+{
+	const unsigned char *start = p;
+	unsigned long diff;
+
+	while (p + sizeof(long) <= limit) {
+		diff = get_unaligned((const unsigned long *)p) ^
+		       get_unaligned((const unsigned long *)ref);
+		if (diff) {
+#ifdef __LITTLE_ENDIAN
+			p += __ffs(diff) >> 3;
+#else
+			p += (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+			return p - start;
+		}
+		p += sizeof(long);
+		ref += sizeof(long);
+	}
+	while (p < limit && *p == *ref) {
+		p++;
+		ref++;
+	}
+
+	return p - start;
+}
+
+/* Number of extra length bytes for len, with mask the nibble's maximum */
+static inline size_t lz4_length_bytes(size_t len, unsigned int mask)
+{
+	return len >= mask ? (len - mask) / 255 + 1 : 0;
+}
+
+/* Extra length bytes for a length that did not fit in its nibble */
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = src, *anchor = src, *ref;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char *mflimit, *matchlimit;
+	unsigned char *op = dst, *token;
+	unsigned char * const oend = dst + *dst_len;
+	unsigned int misses = 1 << SKIP_STRENGTH;
+	size_t lit_len, match_len;
+	u32 h;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	mflimit = iend - MFLIMIT;
+	matchlimit = iend - LASTLITERALS;
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+
+	hash_table[lz4_hash(ip)] = 0;
+	ip++;
+
+	while (ip <= mflimit) {
+		h = lz4_hash(ip);
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+
+		if (ip - ref > MAX_DISTANCE ||
+		    get_unaligned((const u32 *)ref) !=
+		    get_unaligned((const u32 *)ip)) {
+			ip += misses++ >> SKIP_STRENGTH;
+			continue;
+		}
+		misses = 1 << SKIP_STRENGTH;
+
+		/* Extend the match backwards over pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		lit_len = ip - anchor;
+		match_len = lz4_count(ip + MINMATCH, ref + MINMATCH,
+				      matchlimit);
+
+		/* token, literals, offset and both length extensions */
+		if ((size_t)(oend - op) <
+		    1 + lz4_length_bytes(lit_len, RUN_MASK) + lit_len +
+		    2 + lz4_length_bytes(match_len, ML_MASK))
+			return -ENOSPC;
+
+		token = op++;
+		if (lit_len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, lit_len - RUN_MASK);
+		} else {
+			*token = lit_len << ML_BITS;
+		}
+		memcpy(op, anchor, lit_len);
+		op += lit_len;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		if (match_len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, match_len - ML_MASK);
+		} else {
+			*token |= match_len;
+		}
+
+		ip += MINMATCH + match_len;
+		anchor = ip;
+
+		/* Seed the table from inside the match too */
+		if (ip <= mflimit)
+			hash_table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	lit_len = iend - anchor;
+	if ((size_t)(oend - op) <
+	    1 + lz4_length_bytes(lit_len, RUN_MASK) + lit_len)
+		return -ENOSPC;
+
+	if (lit_len >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else {
+		*op++ = lit_len << ML_BITS;
+	}
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
@@ -0,0 +1,96 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/byteorder.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+/*
+ * Add up the extra bytes of a length.  Returns 0 if the input ends
+ * before the length does.
+ */
+static inline int lz4_get_length(const unsigned char **ip,
+				 const unsigned char *iend, size_t *len)
+{
+	unsigned int s;
+
+	do {
+		if (*ip >= iend)
+			return 0;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 1;
+}
+
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dst, *ref;
+	unsigned char * const oend = dst + *dst_len;
+	unsigned int token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && !lz4_get_length(&ip, iend, &len))
+			goto malformed;
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			goto malformed;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence has no match */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			goto malformed;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (!offset || offset > (size_t)(op - dst))
+			goto malformed;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && !lz4_get_length(&ip, iend, &len))
+			goto malformed;
+		len += MINMATCH;
+		if (len > (size_t)(oend - op))
+			goto malformed;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* overlapping copy repeats the last offset bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return 0;
+
+malformed:
+	return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
@@ -0,0 +1,33 @@
+/*
+ *  lz4defs.h -- LZ4 block format definitions
+ *
+ *  A compressed block is a series of sequences.  Each starts with a
+ *  token byte: the high nibble is the number of literals that follow, the
+ *  low nibble the length of the match after them, minus MINMATCH.  A
+ *  nibble of 15 is continued by extra bytes, added up until one is not
+ *  255.  After the literals comes the match offset, 16 bit little endian,
+ *  then the extra match length bytes.  The last sequence has literals
+ *  only, and the format requires that the last LASTLITERALS bytes are
+ *  literals and that no match starts within MFLIMIT bytes of the end.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+#define LASTLITERALS	5
+#define MFLIMIT		12
+#define MAX_DISTANCE	65535
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/*
+ * Every (1 << SKIP_STRENGTH) positions searched without finding a match,
+ * the compressor takes a larger step, so incompressible data is skipped
+ * through quickly.
+ */
+#define SKIP_STRENGTH	6
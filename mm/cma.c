@@ -0,0 +1,384 @@
+/*
+ * Contiguous memory allocator
+ *
+ * Devices such as cameras, video codecs and GPUs without an IOMMU need
+ * large physically contiguous buffers, which the page allocator cannot
+ * provide once memory is fragmented.  Boards have therefore reserved
+ * fixed carveouts for them at boot, memory that is wasted whenever the
+ * device is idle.
+ *
+ * A contiguous memory area is reserved the same way, but its pageblocks
+ * are then freed to the page allocator as MIGRATE_CMA.  Only movable
+ * allocations, user pages and page cache, may use them, so when a driver
+ * needs a buffer the pages in the way are migrated elsewhere and the range
+ * handed to it.  An area is a run of whole pageblocks within one zone.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/bootmem.h>
+#include <linux/cma.h>
+#include <linux/debugfs.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <asm/dma.h>
+#include <asm/div64.h>
+#include "internal.h"
+
+#define MAX_CMA_AREAS	8
+
+struct cma {
+	unsigned long	base_pfn;
+	unsigned long	count;		/* pages in the area */
+	unsigned long	*bitmap;	/* pages allocated by cma_alloc() */
+	const char	*name;
+	int		lent;		/* free pages are in the page allocator */
+	/*
+	 * Protects the bitmap and statistics, and serializes allocations,
+	 * which isolate whole pageblocks of the area
+	 */
+	struct mutex	lock;
+
+	/* statistics, see the cma debugfs files */
+	unsigned long	nr_allocs;
+	unsigned long	nr_fails;
+	unsigned long	nr_busy;	/* ranges that could not be emptied */
+	u64		alloc_ns;	/* time spent in successful allocations */
+	u64		max_alloc_ns;
+};
+
+static struct cma cma_areas[MAX_CMA_AREAS];
+static unsigned int cma_area_count;
+
+unsigned long totalcma_pages;
+
+/**
+ * cma_reserve() -- reserve a contiguous memory area
+ * @size:	size of the area in bytes
+ * @align:	alignment of its base, a power of two, or 0
+ * @name:	name of the area in debugfs
+ *
+ * Called from the board's memory setup, while bootmem is available.  The
+ * size and alignment are rounded up to whole pageblocks.  The area is
+ * lent to the page allocator at core_initcall time.
+ */
+struct cma * __init cma_reserve(unsigned long size, unsigned long align,
+				const char *name)
+{
+	unsigned long min_align = PAGE_SIZE << max(MAX_ORDER - 1,
+						   (int)pageblock_order);
+	struct cma *cma;
+	void *addr;
+
+	if (cma_area_count == ARRAY_SIZE(cma_areas) || !size)
+		return NULL;
+
+	align = max(align, min_align);
+	size = ALIGN(size, min_align);
+
+	addr = __alloc_bootmem_nopanic(size, align, __pa(MAX_DMA_ADDRESS));
+	if (!addr) {
+		printk(KERN_ERR "cma: cannot reserve %lu kB for %s\n",
+		       size >> 10, name);
+		return NULL;
+	}
+
+	cma = &cma_areas[cma_area_count++];
+	cma->base_pfn = __pa(addr) >> PAGE_SHIFT;
+	cma->count = size >> PAGE_SHIFT;
+	cma->name = name;
+	mutex_init(&cma->lock);
+
+	printk(KERN_INFO "cma: reserved %lu kB at %lx for %s\n",
+	       size >> 10, __pa(addr), name);
+
+	return cma;
+}
+
+unsigned long cma_get_base(struct cma *cma)
+{
+	return cma->base_pfn << PAGE_SHIFT;
+}
+
+unsigned long cma_get_size(struct cma *cma)
+{
+	return cma->count << PAGE_SHIFT;
+}
+
+/*
+ * Without a bitmap the area is of no use to its driver, so rather than
+ * keeping it reserved for nothing its pages are given to the page
+ * allocator for good, as ordinary memory.
+ */
+static void __init cma_free_area(struct cma *cma)
+{
+	unsigned long pfn = cma->base_pfn;
+	unsigned long end = pfn + cma->count;
+	struct page *page;
+
+	for (; pfn < end; pfn++) {
+		page = pfn_to_page(pfn);
+		ClearPageReserved(page);
+		init_page_count(page);
+		__free_page(page);
+		totalram_pages++;
+	}
+	cma->count = 0;
+}
+
+static int __init cma_activate_area(struct cma *cma)
+{
+	unsigned long pfn = cma->base_pfn;
+	unsigned long end = pfn + cma->count;
+
+	cma->bitmap = kzalloc(BITS_TO_LONGS(cma->count) * sizeof(long),
+			      GFP_KERNEL);
+	if (!cma->bitmap) {
+		printk(KERN_ERR "cma: no memory for the bitmap of %s, "
+		       "%lu kB freed, allocations from it will fail\n",
+		       cma->name, cma->count << (PAGE_SHIFT - 10));
+		cma_free_area(cma);
+		return -ENOMEM;
+	}
+
+	/*
+	 * The page allocator's free lists are per zone, so an area across
+	 * a zone boundary cannot be lent.  It stays reserved and cma_alloc()
+	 * hands out its pages as a plain carveout.
+	 */
+	if (page_zone(pfn_to_page(pfn)) != page_zone(pfn_to_page(end - 1))) {
+		printk(KERN_WARNING "cma: %s spans zones, kept as a carveout\n",
+		       cma->name);
+		return 0;
+	}
+
+	for (; pfn < end; pfn += pageblock_nr_pages)
+		init_cma_reserved_pageblock(pfn_to_page(pfn));
+	totalcma_pages += cma->count;
+	cma->lent = 1;
+
+	return 0;
+}
+
+static int __init cma_init_reserved_areas(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < cma_area_count; i++)
+		cma_activate_area(&cma_areas[i]);
+
+	return 0;
+}
+core_initcall(cma_init_reserved_areas);
+
+/* The first position from pos whose pfn is aligned to 1 << order */
+static unsigned long cma_align(struct cma *cma, unsigned long pos,
+			       unsigned int order)
+{
+	return ALIGN(cma->base_pfn + pos, 1UL << order) - cma->base_pfn;
+}
+
+/**
+ * cma_alloc() -- allocate pages from a contiguous memory area
+ * @cma:	the area
+ * @count:	number of pages
+ * @order:	the first page's pfn is aligned to 1 << order
+ *
+ * Searches the area for a free range, migrating out the movable pages
+ * that use it.  Ranges with pages that cannot be moved are skipped.  An
+ * area kept as a carveout needs no migration, only a free range.
+ * Returns the first page, or NULL.  May sleep for as long as migration
+ * takes.
+ */
+struct page *cma_alloc(struct cma *cma, unsigned long count,
+		       unsigned int order)
+{
+	unsigned long pos, next, pfn, i;
+	struct page *page = NULL;
+	ktime_t start;
+	u64 ns;
+	int ret;
+
+	if (!cma || !cma->bitmap || !count)
+		return NULL;
+
+	start = ktime_get();
+	mutex_lock(&cma->lock);
+
+	pos = cma_align(cma, 0, order);
+	while (pos + count <= cma->count) {
+		next = find_next_bit(cma->bitmap, pos + count, pos);
+		if (next < pos + count) {
+			pos = cma_align(cma, next + 1, order);
+			continue;
+		}
+
+		pfn = cma->base_pfn + pos;
+		ret = cma->lent ?
+			alloc_contig_range(pfn, pfn + count, MIGRATE_CMA) : 0;
+		if (!ret) {
+			for (i = pos; i < pos + count; i++)
+				__set_bit(i, cma->bitmap);
+			page = pfn_to_page(pfn);
+			break;
+		}
+		if (ret != -EBUSY)
+			break;
+
+		/* some page is pinned, try the next position */
+		cma->nr_busy++;
+		pos = cma_align(cma, pos + 1, order);
+	}
+
+	if (page) {
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		cma->nr_allocs++;
+		cma->alloc_ns += ns;
+		cma->max_alloc_ns = max(cma->max_alloc_ns, ns);
+	} else {
+		cma->nr_fails++;
+	}
+
+	mutex_unlock(&cma->lock);
+
+	return page;
+}
+EXPORT_SYMBOL(cma_alloc);
+
+/**
+ * cma_release() -- free pages allocated by cma_alloc()
+ * @cma:	the area
+ * @pages:	the first page
+ * @count:	number of pages, as passed to cma_alloc()
+ *
+ * The pages go back to the page allocator, for movable allocations,
+ * unless the area is kept as a carveout.
+ */
+void cma_release(struct cma *cma, struct page *pages, unsigned long count)
+{
+	unsigned long pfn, i;
+
+	if (!cma || !pages)
+		return;
+
+	pfn = page_to_pfn(pages);
+	VM_BUG_ON(pfn < cma->base_pfn ||
+		  pfn + count > cma->base_pfn + cma->count);
+
+	if (cma->lent)
+		free_contig_range(pfn, count);
+
+	mutex_lock(&cma->lock);
+	for (i = pfn - cma->base_pfn; i < pfn - cma->base_pfn + count; i++)
+		__clear_bit(i, cma->bitmap);
+	mutex_unlock(&cma->lock);
+}
+EXPORT_SYMBOL(cma_release);
+
+#ifdef CONFIG_DEBUG_FS
+/* Free pages in the area, lent to nobody */
+static unsigned long cma_count_free(struct cma *cma)
+{
+	unsigned long pfn = cma->base_pfn;
+	unsigned long end = pfn + cma->count;
+	unsigned long nr_free = 0, flags;
+	struct zone *zone = page_zone(pfn_to_page(pfn));
+	struct page *page;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	while (pfn < end) {
+		page = pfn_to_page(pfn);
+		if (PageBuddy(page)) {
+			nr_free += 1UL << page_order(page);
+			pfn += 1UL << page_order(page);
+		} else {
+			pfn++;
+		}
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	return nr_free;
+}
+
+#define K(x) ((x) << (PAGE_SHIFT - 10))
+static int cma_debug_show(struct seq_file *m, void *v)
+{
+	struct cma *cma = m->private;
+	unsigned long allocated = 0, nr_free = 0, i;
+	unsigned long nr_allocs;
+	u64 avg_us, max_us;
+
+	if (cma->lent)
+		nr_free = cma_count_free(cma);
+
+	mutex_lock(&cma->lock);
+	if (cma->bitmap)
+		for (i = 0; i < cma->count; i++)
+			allocated += test_bit(i, cma->bitmap);
+	if (cma->bitmap && !cma->lent)
+		nr_free = cma->count - allocated;
+	nr_allocs = cma->nr_allocs;
+	avg_us = cma->alloc_ns;
+	do_div(avg_us, NSEC_PER_USEC);
+	if (nr_allocs)
+		do_div(avg_us, nr_allocs);
+	max_us = cma->max_alloc_ns;
+	do_div(max_us, NSEC_PER_USEC);
+
+	seq_printf(m,
+		   "base:       %#lx\n"
+		   "size:       %8lu kB\n"
+		   "allocated:  %8lu kB\n"
+		   "lent:       %8lu kB\n"
+		   "free:       %8lu kB\n"
+		   "allocs:     %8lu\n"
+		   "failed:     %8lu\n"
+		   "busy:       %8lu\n"
+		   "alloc_us:   avg %llu max %llu\n",
+		   cma_get_base(cma), K(cma->count), K(allocated),
+		   cma->lent ? K(cma->count - allocated - nr_free) : 0,
+		   K(nr_free), nr_allocs, cma->nr_fails, cma->nr_busy,
+		   (unsigned long long)avg_us, (unsigned long long)max_us);
+	mutex_unlock(&cma->lock);
+
+	return 0;
+}
+#undef K
+
+static int cma_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cma_debug_show, inode->i_private);
+}
+
+static const struct file_operations cma_debug_fops = {
+	.open		= cma_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init cma_debugfs_init(void)
+{
+	struct dentry *dir;
+	unsigned int i;
+
+	if (!cma_area_count)
+		return 0;
+
+	dir = debugfs_create_dir("cma", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	for (i = 0; i < cma_area_count; i++)
+		debugfs_create_file(cma_areas[i].name, S_IRUGO, dir,
+				    &cma_areas[i], &cma_debug_fops);
+
+	return 0;
+}
+late_initcall(cma_debugfs_init);
+#endif /* CONFIG_DEBUG_FS */
@@ -110,18 +110,41 @@
  *    ->i_mmap_lock
  */
 
+static void page_cache_tree_delete(struct address_space *mapping,
+				   struct page *page, void *shadow)
+{
+	if (shadow) {
+		void **slot;
+
+		slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+		radix_tree_replace_slot(slot, shadow);
+		workingset_shadow_inc(mapping);
+		/*
+		 * Make sure the nrshadows update is committed before
+		 * the nrpages update so that final truncate racing
+		 * with reclaim does not see both counters 0 at the
+		 * same time and miss a shadow entry.
+		 */
+		smp_wmb();
+	} else
+		radix_tree_delete(&mapping->page_tree, page->index);
+	mapping->nrpages--;
+}
+
 /*
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow is not NULL it is left in the page's slot, for
+ * workingset_refault() to find if the page is faulted back in.
  */
-void __remove_from_page_cache(struct page *page)
+void __remove_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	page_cache_tree_delete(mapping, page, shadow);
 	page->mapping = NULL;
-	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
 	if (PageSwapBacked(page))
 		__dec_zone_page_state(page, NR_SHMEM);
@@ -147,7 +170,7 @@ void remove_from_page_cache(struct page *page)
 	BUG_ON(!PageLocked(page));
 
 	spin_lock_irq(&mapping->tree_lock);
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 }
@@ -404,18 +427,56 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 }
 EXPORT_SYMBOL(filemap_write_and_wait_range);
 
+/*
+ * Insert the page at @index, which may be taken by the shadow entry of a
+ * page evicted from there earlier: that is replaced and handed back in
+ * @shadowp.  nrpages is left to the caller.
+ */
+static int page_cache_tree_insert(struct address_space *mapping,
+				  pgoff_t index, struct page *page,
+				  void **shadowp)
+{
+	void **slot;
+
+	slot = radix_tree_lookup_slot(&mapping->page_tree, index);
+	if (slot) {
+		void *p;
+
+		p = radix_tree_deref_slot(slot);
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		radix_tree_replace_slot(slot, page);
+		workingset_shadow_dec(mapping);
+		if (shadowp)
+			*shadowp = p;
+		return 0;
+	}
+	return radix_tree_insert(&mapping->page_tree, index, page);
+}
+
 /**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
- *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
+ * add_to_page_cache_tree - put a page into a mapping's radix tree
+ * @mapping:	the address_space
+ * @index:	where to put it
+ * @page:	the page
+ *
+ * For filesystems that move pages around the page cache by themselves:
+ * like radix_tree_insert(), but a shadow entry left at @index by reclaim
+ * is replaced rather than failing with -EEXIST.  The caller holds the
+ * mapping's tree_lock, has preloaded the radix tree, and sees to
+ * page->mapping, page->index and nrpages.
  */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+int add_to_page_cache_tree(struct address_space *mapping, pgoff_t index,
+			   struct page *page)
+{
+	return page_cache_tree_insert(mapping, index, page, NULL);
+}
+EXPORT_SYMBOL_GPL(add_to_page_cache_tree);
+
+static int __add_to_page_cache_locked(struct page *page,
+				      struct address_space *mapping,
+				      pgoff_t offset, gfp_t gfp_mask,
+				      void **shadowp)
 {
 	int error;
 
@@ -433,7 +494,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, offset, page, shadowp);
 		if (likely(!error)) {
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -452,11 +513,29 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset,
+					  gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -468,14 +547,27 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
-			lru_cache_add_file(page);
-		else
-			lru_cache_add_anon(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+		return ret;
 	}
-	return ret;
+
+	/*
+	 * A page that was evicted recently enough to have made it onto
+	 * the active list, had there been room, is part of the workingset:
+	 * put it straight back there instead of letting it thrash.
+	 */
+	if (!page_is_file_cache(page))
+		lru_cache_add_anon(page);
+	else if (shadow && workingset_refault(shadow)) {
+		workingset_activation(page);
+		lru_cache_add_lru(page, LRU_ACTIVE_FILE);
+	} else
+		lru_cache_add_file(page);
+	return 0;
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
@@ -626,6 +718,79 @@ void __lock_page_nosync(struct page *page)
 							TASK_UNINTERRUPTIBLE);
 }
 
+/**
+ * page_cache_next_hole - find the next hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Search the set [index, min(index+max_scan-1, MAX_INDEX)] for the
+ * lowest indexed hole.  This is radix_tree_next_hole(), except that the
+ * shadow entries of evicted pages count as holes.
+ *
+ * Returns: the index of the hole if found, otherwise returns an index
+ * outside of the set specified (in which case 'return - index >=
+ * max_scan' will be true). In rare cases of index wrap-around, 0 will
+ * be returned.
+ *
+ * Like radix_tree_next_hole(), it may be called under rcu_read_lock().
+ */
+pgoff_t page_cache_next_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index++;
+		if (index == 0)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_next_hole);
+
+/**
+ * page_cache_prev_hole - find the prev hole (not-present entry)
+ * @mapping: mapping
+ * @index: index
+ * @max_scan: maximum range to search
+ *
+ * Search backwards in the range [max(index-max_scan+1, 0), index] for
+ * the first hole, counting shadow entries as holes.
+ *
+ * Returns: the index of the hole if found, otherwise returns an index
+ * outside of the set specified (in which case 'index - return >=
+ * max_scan' will be true). In rare cases of wrap-around, ULONG_MAX will
+ * be returned.
+ *
+ * Like radix_tree_prev_hole(), it may be called under rcu_read_lock().
+ */
+pgoff_t page_cache_prev_hole(struct address_space *mapping,
+			     pgoff_t index, unsigned long max_scan)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_scan; i++) {
+		struct page *page;
+
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		if (!page || radix_tree_exceptional_entry(page))
+			break;
+		index--;
+		if (index == ULONG_MAX)
+			break;
+	}
+
+	return index;
+}
+EXPORT_SYMBOL(page_cache_prev_hole);
+
 /**
  * find_get_page - find and get a page reference
  * @mapping: the address_space to search
@@ -647,6 +812,11 @@ repeat:
 		page = radix_tree_deref_slot(pagep);
 		if (unlikely(!page || page == RADIX_TREE_RETRY))
 			goto repeat;
+		if (radix_tree_exceptional_entry(page)) {
+			/* the shadow entry of a recently evicted page */
+			page = NULL;
+			goto out;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -661,6 +831,7 @@ repeat:
 			goto repeat;
 		}
 	}
+out:
 	rcu_read_unlock();
 
 	return page;
@@ -758,44 +929,62 @@ EXPORT_SYMBOL(find_or_create_page);
  * The search returns a group of mapping-contiguous pages with ascending
  * indexes.  There may be holes in the indices due to not-present pages.
  *
- * find_get_pages() returns the number of pages which were found.
+ * find_get_pages() returns the number of pages which were found.  Callers
+ * take 0 to mean that there are no more pages, so the slots are looked up
+ * in batches, and the lookup goes on past batches that turned out to hold
+ * nothing but the shadow entries of evicted pages.
  */
 unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 			    unsigned int nr_pages, struct page **pages)
 {
+	unsigned long indices[PAGEVEC_SIZE];
 	unsigned int i;
-	unsigned int ret;
+	unsigned int ret = 0;
 	unsigned int nr_found;
+	void ***slots;
 
 	rcu_read_lock();
+	while (ret < nr_pages) {
+		slots = (void ***)pages + ret;
 restart:
-	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, start, nr_pages);
-	ret = 0;
-	for (i = 0; i < nr_found; i++) {
-		struct page *page;
+		nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				slots, indices, start,
+				min_t(unsigned int, nr_pages - ret, PAGEVEC_SIZE));
+		if (!nr_found)
+			break;
+		for (i = 0; i < nr_found; i++) {
+			struct page *page;
 repeat:
-		page = radix_tree_deref_slot((void **)pages[i]);
-		if (unlikely(!page))
-			continue;
-		/*
-		 * this can only trigger if nr_found == 1, making livelock
-		 * a non issue.
-		 */
-		if (unlikely(page == RADIX_TREE_RETRY))
-			goto restart;
+			page = radix_tree_deref_slot(slots[i]);
+			if (unlikely(!page))
+				continue;
+			/*
+			 * this can only trigger if nr_found == 1, making
+			 * livelock a non issue.
+			 */
+			if (unlikely(page == RADIX_TREE_RETRY))
+				goto restart;
 
-		if (!page_cache_get_speculative(page))
-			goto repeat;
+			/* Skip the shadow entries of evicted pages */
+			if (radix_tree_exceptional_entry(page))
+				continue;
 
-		/* Has the page moved? */
-		if (unlikely(page != *((void **)pages[i]))) {
-			page_cache_release(page);
-			goto repeat;
-		}
+			if (!page_cache_get_speculative(page))
+				goto repeat;
 
-		pages[ret] = page;
-		ret++;
+			/* Has the page moved? */
+			if (unlikely(page != *slots[i])) {
+				page_cache_release(page);
+				goto repeat;
+			}
+
+			/* never ahead of slots[i], which is done with */
+			pages[ret] = page;
+			ret++;
+		}
+		start = indices[nr_found - 1] + 1;
+		if (!start)
+			break;
 	}
 	rcu_read_unlock();
 	return ret;
@@ -823,7 +1012,7 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 	rcu_read_lock();
 restart:
 	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
-				(void ***)pages, index, nr_pages);
+				(void ***)pages, NULL, index, nr_pages);
 	ret = 0;
 	for (i = 0; i < nr_found; i++) {
 		struct page *page;
@@ -838,6 +1027,10 @@ repeat:
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
 
+		/* The shadow entry of an evicted page ends the run */
+		if (radix_tree_exceptional_entry(page))
+			break;
+
 		if (page->mapping == NULL || page->index != index)
 			break;
 
@@ -895,6 +1088,10 @@ repeat:
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
 
+		/* Shadow entries are not tagged, but skip stale tags */
+		if (radix_tree_exceptional_entry(page))
+			continue;
+
 		if (!page_cache_get_speculative(page))
 			goto repeat;
 
@@ -1620,8 +1817,79 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map uptodate page cache pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	range of pages to map, see struct vm_fault
+ *
+ * filemap_map_pages() is invoked via the vma operations vector with the
+ * page table lock held, so it must not sleep: pages that are not in the
+ * page cache, not uptodate, locked or marked for readahead are skipped
+ * and left for filemap_fault() to deal with.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct address_space *mapping = vma->vm_file->f_mapping;
+	unsigned long address = (unsigned long)vmf->virtual_address;
+	pgoff_t pgoff = vmf->pgoff;
+	struct page *page;
+	void **pagep;
+	pgoff_t size;
+	pte_t *pte;
+
+	rcu_read_lock();
+	for (; pgoff <= vmf->max_pgoff; pgoff++, address += PAGE_SIZE) {
+		pte = vmf->pte + (pgoff - vmf->pgoff);
+		if (!pte_none(*pte))
+			continue;
+
+		pagep = radix_tree_lookup_slot(&mapping->page_tree, pgoff);
+		if (!pagep)
+			continue;
+		page = radix_tree_deref_slot(pagep);
+		if (unlikely(!page || page == RADIX_TREE_RETRY))
+			continue;
+		if (radix_tree_exceptional_entry(page))
+			continue;
+		if (!page_cache_get_speculative(page))
+			continue;
+
+		/* Has the page moved? */
+		if (unlikely(page != *pagep))
+			goto skip;
+
+		/* Leave readahead marks to filemap_fault() */
+		if (!PageUptodate(page) || PageReadahead(page))
+			goto skip;
+		if (!trylock_page(page))
+			goto skip;
+
+		if (page->mapping != mapping || !PageUptodate(page))
+			goto unlock;
+		if (unlikely(PageHWPoison(page)))
+			goto unlock;
+
+		size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1)
+							>> PAGE_CACHE_SHIFT;
+		if (page->index >= size)
+			goto unlock;
+
+		/* the mapping keeps our page cache reference */
+		do_set_pte(vma, address, page, pte);
+		unlock_page(page);
+		continue;
+unlock:
+		unlock_page(page);
+skip:
+		page_cache_release(page);
+	}
+	rcu_read_unlock();
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 const struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
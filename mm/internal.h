@@ -256,6 +256,10 @@ int __get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
 		     unsigned long start, int len, unsigned int foll_flags,
 		     struct page **pages, struct vm_area_struct **vmas);
 
+/* mm/truncate.c */
+extern void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end);
+
 #define ZONE_RECLAIM_NOSCAN	-2
 #define ZONE_RECLAIM_FULL	-1
 #define ZONE_RECLAIM_SOME	0
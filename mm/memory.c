@@ -56,6 +56,8 @@
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
+#include <linux/kobject.h>
+#include <linux/log2.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -108,6 +110,12 @@ static int __init disable_randmaps(char *s)
 }
 __setup("norandmaps", disable_randmaps);
 
+/*
+ * On fork, leave the ptes of page cache pages in private file mappings
+ * to be faulted in by the child instead of copying them.
+ */
+int sysctl_fork_lazy_ptes __read_mostly = 1;
+
 unsigned long zero_pfn __read_mostly;
 unsigned long highest_memmap_pfn __read_mostly;
 
@@ -637,6 +645,62 @@ out_set_pte:
 	set_pte_at(dst_mm, addr, dst_pte, pte);
 }
 
+/*
+ * Private file mappings which got an anon_vma are copied pte by pte at
+ * fork, including the ptes of the page cache pages in them that were
+ * never written to: library text and data, mapped dex files and so on.
+ * Those can just as well be faulted in again by the child, so with
+ * sysctl_fork_lazy_ptes only the ptes that carry state (anonymous
+ * pages, swap and migration entries, special mappings) are copied, and
+ * page tables covering nothing but such page cache pages are not
+ * allocated for the child at all.
+ */
+static inline int vma_fork_lazy_ptes(struct vm_area_struct *vma)
+{
+	return sysctl_fork_lazy_ptes && vma->vm_file &&
+		!(vma->vm_flags & (VM_SHARED | VM_LOCKED | VM_NONLINEAR |
+				   VM_PFNMAP | VM_MIXEDMAP | VM_INSERTPAGE |
+				   VM_HUGETLB));
+}
+
+static inline int pte_fork_lazy(struct vm_area_struct *vma,
+				unsigned long addr, pte_t pte)
+{
+	struct page *page;
+
+	if (pte_none(pte))
+		return 1;
+	if (!pte_present(pte))
+		return 0;
+	page = vm_normal_page(vma, addr, pte);
+	return page && !PageAnon(page);
+}
+
+/*
+ * Does the pte page under @src_pmd hold anything that must be copied?
+ * The parent's mmap_sem is held for writing, so no pte can turn from
+ * lazy to non-lazy under us: that would take a fault.
+ */
+static int pte_range_needs_copy(struct mm_struct *src_mm, pmd_t *src_pmd,
+		struct vm_area_struct *vma, unsigned long addr,
+		unsigned long end)
+{
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+	int ret = 0;
+
+	orig_pte = pte = pte_offset_map_lock(src_mm, src_pmd, addr, &ptl);
+	do {
+		if (!pte_fork_lazy(vma, addr, *pte)) {
+			ret = 1;
+			break;
+		}
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_unmap_unlock(orig_pte, ptl);
+
+	return ret;
+}
+
 static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -645,8 +709,12 @@ static int copy_pte_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	pte_t *src_pte, *dst_pte;
 	spinlock_t *src_ptl, *dst_ptl;
 	int progress = 0;
+	int lazy = vma_fork_lazy_ptes(vma);
 	int rss[2];
 
+	if (lazy && !pte_range_needs_copy(src_mm, src_pmd, vma, addr, end))
+		return 0;
+
 again:
 	rss[1] = rss[0] = 0;
 	dst_pte = pte_alloc_map_lock(dst_mm, dst_pmd, addr, &dst_ptl);
@@ -670,7 +738,8 @@ again:
 			    spin_needbreak(src_ptl) || spin_needbreak(dst_ptl))
 				break;
 		}
-		if (pte_none(*src_pte)) {
+		if (pte_none(*src_pte) ||
+		    (lazy && pte_fork_lazy(vma, addr, *src_pte))) {
 			progress++;
 			continue;
 		}
@@ -2972,6 +3041,121 @@ unwritable_page:
 	return ret;
 }
 
+/**
+ * do_set_pte - map a page cache page read-only at @address
+ * @vma: user vma the page is mapped into
+ * @address: user virtual address
+ * @page: uptodate page cache page, with a reference held for the mapping
+ * @pte: pte_none() slot for @address, with the page table lock held
+ *
+ * Used by ->map_pages() implementations to install pages around a read
+ * fault.
+ */
+void do_set_pte(struct vm_area_struct *vma, unsigned long address,
+		struct page *page, pte_t *pte)
+{
+	pte_t entry;
+
+	flush_icache_page(vma, page);
+	entry = mk_pte(page, vma->vm_page_prot);
+	inc_mm_counter(vma->vm_mm, file_rss);
+	page_add_file_rmap(page);
+	set_pte_at(vma->vm_mm, address, pte, entry);
+
+	/* no need to invalidate: a not-present page won't be cached */
+	update_mmu_cache(vma, address, entry);
+}
+
+/*
+ * Number of bytes around a read fault on a file mapping that are mapped
+ * in one go if the pages are already in the page cache.  Always a power
+ * of two pages, and never crossing a page table page.
+ */
+static unsigned long fault_around_bytes __read_mostly = 65536;
+
+static inline unsigned long fault_around_pages(void)
+{
+	return fault_around_bytes >> PAGE_SHIFT;
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t fault_around_bytes_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", fault_around_bytes);
+}
+
+static ssize_t fault_around_bytes_store(struct kobject *kobj,
+					struct kobj_attribute *attr,
+					const char *buf, size_t count)
+{
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+	if (val / PAGE_SIZE > PTRS_PER_PTE)
+		return -EINVAL;
+
+	if (val > PAGE_SIZE)
+		fault_around_bytes = rounddown_pow_of_two(val);
+	else
+		fault_around_bytes = PAGE_SIZE; /* disables fault-around */
+
+	return count;
+}
+
+static struct kobj_attribute fault_around_bytes_attr =
+	__ATTR(fault_around_bytes, 0644, fault_around_bytes_show,
+	       fault_around_bytes_store);
+
+static int __init fault_around_sysfs_init(void)
+{
+	return sysfs_create_file(mm_kobj, &fault_around_bytes_attr.attr);
+}
+late_initcall(fault_around_sysfs_init);
+#endif /* CONFIG_SYSFS */
+
+/*
+ * do_fault_around() maps the page cache pages around a read fault at
+ * @address that are already uptodate, without doing any I/O.  The window
+ * is fault_around_bytes, aligned down to its size and clipped to the vma
+ * and to the page table page containing @address.
+ *
+ * Returns 1 if the pte at @address got populated, either by us or by a
+ * racing fault, in which case there is nothing left to do.
+ */
+static int do_fault_around(struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, pgoff_t pgoff, unsigned int flags, pte_t orig_pte)
+{
+	unsigned long start_addr, end_addr;
+	unsigned long nr_pages = fault_around_pages();
+	struct vm_fault vmf;
+	spinlock_t *ptl;
+	pte_t *pte;
+	int off, done;
+
+	start_addr = max(address & ~(nr_pages * PAGE_SIZE - 1),
+			 vma->vm_start);
+	end_addr = min(start_addr + nr_pages * PAGE_SIZE,
+		       pmd_addr_end(address, vma->vm_end));
+	off = (address - start_addr) >> PAGE_SHIFT;
+
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, start_addr, &ptl);
+
+	vmf.virtual_address = (void __user *)start_addr;
+	vmf.pgoff = pgoff - off;
+	vmf.max_pgoff = vmf.pgoff + ((end_addr - start_addr) >> PAGE_SHIFT) - 1;
+	vmf.pte = pte;
+	vmf.flags = flags;
+	vmf.page = NULL;
+	vma->vm_ops->map_pages(vma, &vmf);
+
+	done = !pte_same(pte[off], orig_pte);
+	pte_unmap_unlock(pte, ptl);
+
+	return done;
+}
+
 static int do_linear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 		unsigned long address, pte_t *page_table, pmd_t *pmd,
 		unsigned int flags, pte_t orig_pte)
@@ -2983,6 +3167,19 @@ static int do_linear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	/* The VMA was not fully populated on mmap() or missing VM_DONTEXPAND */
 	if (!vma->vm_ops->fault)
 		return VM_FAULT_SIGBUS;
+
+	/*
+	 * Read faults on file mappings commonly come in runs over neighbouring
+	 * pages (library text, dex and resource files): map whatever of the
+	 * neighbourhood is already cached now, instead of taking one minor
+	 * fault per page later.
+	 */
+	if (!(flags & FAULT_FLAG_WRITE) && vma->vm_ops->map_pages &&
+	    fault_around_pages() > 1) {
+		if (do_fault_around(vma, address, pmd, pgoff, flags, orig_pte))
+			return 0;
+	}
+
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
@@ -45,6 +45,8 @@
 #include <linux/backing-dev.h>
 #include <linux/fault-inject.h>
 #include <linux/page-isolation.h>
+#include <linux/migrate.h>
+#include <linux/compaction.h>
 #include <linux/page_cgroup.h>
 #include <linux/debugobjects.h>
 #include <linux/kmemleak.h>
@@ -468,6 +470,19 @@ static inline void __free_one_page(struct page *page,
 	VM_BUG_ON(page_idx & ((1 << order) - 1));
 	VM_BUG_ON(bad_range(zone, page));
 
+	if (is_migrate_cma(migratetype)) {
+		/*
+		 * A CMA page that sat on a pcp list while its pageblock was
+		 * isolated goes to the isolated free list, where
+		 * alloc_contig_range() expects it.
+		 */
+		if (get_pageblock_migratetype(page) == MIGRATE_ISOLATE)
+			migratetype = MIGRATE_ISOLATE;
+		else
+			__mod_zone_page_state(zone, NR_FREE_CMA_PAGES,
+					      1 << order);
+	}
+
 	while (order < MAX_ORDER-1) {
 		unsigned long combined_idx;
 		struct page *buddy;
@@ -476,6 +491,23 @@ static inline void __free_one_page(struct page *page,
 		if (!page_is_buddy(page, buddy, order))
 			break;
 
+#ifdef CONFIG_CMA
+		/*
+		 * Free pages of CMA and isolated pageblocks stay within their
+		 * pageblock, so that they are always on the free list of its
+		 * type.
+		 */
+		if (order >= pageblock_order) {
+			int buddy_mt = get_pageblock_migratetype(buddy);
+
+			if (is_migrate_cma(migratetype) ||
+			    migratetype == MIGRATE_ISOLATE ||
+			    is_migrate_cma(buddy_mt) ||
+			    buddy_mt == MIGRATE_ISOLATE)
+				break;
+		}
+#endif
+
 		/* Our buddy is free, merge with it and move up one order. */
 		list_del(&buddy->lru);
 		zone->free_area[order].nr_free--;
@@ -754,7 +786,12 @@ struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
 static int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES-1] = {
 	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE,   MIGRATE_RESERVE },
 	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE,   MIGRATE_RESERVE },
+#ifdef CONFIG_CMA
+	[MIGRATE_MOVABLE]     = { MIGRATE_CMA,         MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+	[MIGRATE_CMA]         = { MIGRATE_RESERVE }, /* Never used */
+#else
 	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE, MIGRATE_RESERVE },
+#endif
 	[MIGRATE_RESERVE]     = { MIGRATE_RESERVE,     MIGRATE_RESERVE,   MIGRATE_RESERVE }, /* Never used */
 };
 
@@ -854,9 +891,12 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 		for (i = 0; i < MIGRATE_TYPES - 1; i++) {
 			migratetype = fallbacks[start_migratetype][i];
 
-			/* MIGRATE_RESERVE handled later if necessary */
+			/*
+			 * MIGRATE_RESERVE handled later if necessary, and
+			 * ends each list
+			 */
 			if (migratetype == MIGRATE_RESERVE)
-				continue;
+				break;
 
 			area = &(zone->free_area[current_order]);
 			if (list_empty(&area->free_list[migratetype]))
@@ -870,9 +910,14 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			 * If breaking a large block of pages, move all free
 			 * pages to the preferred allocation list. If falling
 			 * back for a reclaimable kernel allocation, be more
-			 * agressive about taking ownership of free pages
+			 * agressive about taking ownership of free pages.
+			 * CMA pageblocks are only borrowed from, never taken
+			 * over: the pages split off go back on the CMA lists.
 			 */
-			if (unlikely(current_order >= (pageblock_order >> 1)) ||
+			if (is_migrate_cma(migratetype)) {
+				__mod_zone_page_state(zone, NR_FREE_CMA_PAGES,
+						      -(1 << order));
+			} else if (unlikely(current_order >= (pageblock_order >> 1)) ||
 					start_migratetype == MIGRATE_RECLAIMABLE ||
 					page_group_by_mobility_disabled) {
 				unsigned long pages;
@@ -893,7 +938,8 @@ __rmqueue_fallback(struct zone *zone, int order, int start_migratetype)
 			rmv_page_order(page);
 
 			/* Take ownership for orders >= pageblock_order */
-			if (current_order >= pageblock_order)
+			if (current_order >= pageblock_order &&
+			    !is_migrate_cma(migratetype))
 				change_pageblock_range(page, current_order,
 							start_migratetype);
 
@@ -969,7 +1015,11 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
 			list_add(&page->lru, list);
 		else
 			list_add_tail(&page->lru, list);
-		set_page_private(page, migratetype);
+		/* freed from the pcp list back to the CMA lists */
+		if (is_migrate_cma(get_pageblock_migratetype(page)))
+			set_page_private(page, MIGRATE_CMA);
+		else
+			set_page_private(page, migratetype);
 		list = &page->lru;
 	}
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(i << order));
@@ -1177,6 +1227,56 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+/*
+ * Similar to split_page except the page is already free.  As this is only
+ * being used for migration, the migratetype of the block also changes.
+ * The caller holds zone->lock with interrupts disabled and is responsible
+ * for calling arch_alloc_page() and kernel_map_pages() after interrupts
+ * are enabled.  Returns the number of pages taken, 0 if the zone is too
+ * low on free pages to give them up.
+ *
+ * Note: this is probably too low level an operation for use in drivers.
+ * Please consult with lkml before using this in your driver.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	unsigned long watermark;
+	struct zone *zone;
+	int migratetype;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+	migratetype = get_pageblock_migratetype(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	watermark = low_wmark_pages(zone) + (1 << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+	if (is_migrate_cma(migratetype))
+		__mod_zone_page_state(zone, NR_FREE_CMA_PAGES, -(1UL << order));
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	if (order >= pageblock_order - 1 && !is_migrate_cma(migratetype)) {
+		struct page *endpage = page + (1 << order) - 1;
+		for (; page < endpage; page += pageblock_nr_pages)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+
+	return 1 << order;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1266,6 +1366,7 @@ failed:
 #define ALLOC_HARDER		0x10 /* try to alloc harder */
 #define ALLOC_HIGH		0x20 /* __GFP_HIGH set */
 #define ALLOC_CPUSET		0x40 /* check for correct cpuset */
+#define ALLOC_CMA		0x80 /* allow allocations from CMA areas */
 
 #ifdef CONFIG_FAIL_PAGE_ALLOC
 
@@ -1374,6 +1475,12 @@ int zone_watermark_ok(struct zone *z, int order, unsigned long mark,
 	long free_pages = zone_nr_free_pages(z) - (1 << order) + 1;
 	int o;
 
+#ifdef CONFIG_CMA
+	/* Only movable allocations can use the free pages of CMA areas */
+	if (!(alloc_flags & ALLOC_CMA))
+		free_pages -= zone_page_state(z, NR_FREE_CMA_PAGES);
+#endif
+
 	if (alloc_flags & ALLOC_HIGH)
 		min -= min / 2;
 	if (alloc_flags & ALLOC_HARDER)
@@ -1677,6 +1784,62 @@ out:
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype)
+{
+	struct page *page;
+	unsigned long status;
+
+	if (!order || compaction_deferred(preferred_zone))
+		return NULL;
+
+	current->flags |= PF_MEMALLOC;
+	status = try_to_compact_pages(zonelist, order, gfp_mask, nodemask);
+	current->flags &= ~PF_MEMALLOC;
+	if (status == COMPACT_SKIPPED)
+		return NULL;
+
+	/* Page migration frees to the PCP lists but we want merging */
+	drain_pages(get_cpu());
+	put_cpu();
+
+	page = get_page_from_freelist(gfp_mask, nodemask, order,
+			zonelist, high_zoneidx, alloc_flags,
+			preferred_zone, migratetype);
+	if (page) {
+		preferred_zone->compact_considered = 0;
+		preferred_zone->compact_defer_shift = 0;
+		count_vm_event(COMPACTSUCCESS);
+		return page;
+	}
+
+	/*
+	 * It's bad if compaction run occurs and fails.  The most likely
+	 * reason is that pages exist, but not enough to satisfy watermarks.
+	 */
+	count_vm_event(COMPACTFAIL);
+	defer_compaction(preferred_zone);
+
+	cond_resched();
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
 /* The really slow allocator path where we enter direct reclaim */
 static inline struct page *
 __alloc_pages_direct_reclaim(gfp_t gfp_mask, unsigned int order,
@@ -1797,6 +1960,10 @@ gfp_to_alloc_flags(gfp_t gfp_mask)
 		     unlikely(test_thread_flag(TIF_MEMDIE))))
 			alloc_flags |= ALLOC_NO_WATERMARKS;
 	}
+#ifdef CONFIG_CMA
+	if (allocflags_to_migratetype(gfp_mask) == MIGRATE_MOVABLE)
+		alloc_flags |= ALLOC_CMA;
+#endif
 
 	return alloc_flags;
 }
@@ -1875,6 +2042,19 @@ rebalance:
 	if (test_thread_flag(TIF_MEMDIE) && !(gfp_mask & __GFP_NOFAIL))
 		goto nopage;
 
+	/*
+	 * Try direct compaction.  Moving pages together is cheaper than
+	 * reclaiming whole blocks of them, which throws away page cache
+	 * that is still in use.
+	 */
+	page = __alloc_pages_direct_compact(gfp_mask, order,
+					zonelist, high_zoneidx,
+					nodemask,
+					alloc_flags, preferred_zone,
+					migratetype);
+	if (page)
+		goto got_pg;
+
 	/* Try direct reclaim and then allocating */
 	page = __alloc_pages_direct_reclaim(gfp_mask, order,
 					zonelist, high_zoneidx,
@@ -1948,6 +2128,7 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 	struct zone *preferred_zone;
 	struct page *page;
 	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int alloc_flags = ALLOC_WMARK_LOW|ALLOC_CPUSET;
 
 	gfp_mask &= gfp_allowed_mask;
 
@@ -1971,9 +2152,13 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 	if (!preferred_zone)
 		return NULL;
 
+#ifdef CONFIG_CMA
+	if (migratetype == MIGRATE_MOVABLE)
+		alloc_flags |= ALLOC_CMA;
+#endif
 	/* First allocation attempt */
 	page = get_page_from_freelist(gfp_mask|__GFP_HARDWALL, nodemask, order,
-			zonelist, high_zoneidx, ALLOC_WMARK_LOW|ALLOC_CPUSET,
+			zonelist, high_zoneidx, alloc_flags,
 			preferred_zone, migratetype);
 	if (unlikely(!page))
 		page = __alloc_pages_slowpath(gfp_mask, order,
@@ -3878,6 +4063,10 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+	pgdat->kcompactd_max_order = 0;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
@@ -5108,6 +5297,7 @@ int set_migratetype_isolate(struct page *page)
 	unsigned long flags;
 	int ret = -EBUSY;
 	int zone_idx;
+	int migratetype, pages;
 
 	zone = page_zone(page);
 	zone_idx = zone_idx(zone);
@@ -5115,11 +5305,14 @@ int set_migratetype_isolate(struct page *page)
 	/*
 	 * In future, more migrate types will be able to be isolation target.
 	 */
-	if (get_pageblock_migratetype(page) != MIGRATE_MOVABLE &&
+	migratetype = get_pageblock_migratetype(page);
+	if (migratetype != MIGRATE_MOVABLE && !is_migrate_cma(migratetype) &&
 	    zone_idx != ZONE_MOVABLE)
 		goto out;
 	set_pageblock_migratetype(page, MIGRATE_ISOLATE);
-	move_freepages_block(zone, page, MIGRATE_ISOLATE);
+	pages = move_freepages_block(zone, page, MIGRATE_ISOLATE);
+	if (is_migrate_cma(migratetype))
+		__mod_zone_page_state(zone, NR_FREE_CMA_PAGES, -pages);
 	ret = 0;
 out:
 	spin_unlock_irqrestore(&zone->lock, flags);
@@ -5128,20 +5321,223 @@ out:
 	return ret;
 }
 
-void unset_migratetype_isolate(struct page *page)
+void unset_migratetype_isolate(struct page *page, int migratetype)
 {
 	struct zone *zone;
 	unsigned long flags;
+	int pages;
 	zone = page_zone(page);
 	spin_lock_irqsave(&zone->lock, flags);
 	if (get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 		goto out;
-	set_pageblock_migratetype(page, MIGRATE_MOVABLE);
-	move_freepages_block(zone, page, MIGRATE_MOVABLE);
+	set_pageblock_migratetype(page, migratetype);
+	pages = move_freepages_block(zone, page, migratetype);
+	if (is_migrate_cma(migratetype))
+		__mod_zone_page_state(zone, NR_FREE_CMA_PAGES, pages);
 out:
 	spin_unlock_irqrestore(&zone->lock, flags);
 }
 
+#ifdef CONFIG_CMA
+/*
+ * Free a pageblock of a contiguous memory area, reserved at boot, to the
+ * page allocator as MIGRATE_CMA.
+ */
+void __init init_cma_reserved_pageblock(struct page *page)
+{
+	unsigned i = pageblock_nr_pages;
+	struct page *p = page;
+
+	do {
+		__ClearPageReserved(p);
+		set_page_count(p, 0);
+	} while (++p, --i);
+
+	set_pageblock_migratetype(page, MIGRATE_CMA);
+
+	if (pageblock_order >= MAX_ORDER) {
+		i = pageblock_nr_pages;
+		p = page;
+		do {
+			set_page_refcounted(p);
+			__free_pages(p, MAX_ORDER - 1);
+			p += MAX_ORDER_NR_PAGES;
+		} while (i -= MAX_ORDER_NR_PAGES);
+	} else {
+		set_page_refcounted(page);
+		__free_pages(page, pageblock_order);
+	}
+
+	totalram_pages += pageblock_nr_pages;
+}
+
+static struct page *
+contig_migrate_alloc(struct page *page, unsigned long private, int **resultp)
+{
+	return alloc_page(GFP_HIGHUSER_MOVABLE);
+}
+
+#define CONTIG_MIGRATE_BATCH	256
+#define CONTIG_RETRIES		5
+
+/*
+ * Migrate the pages on the LRU in [start, end) elsewhere.  Pages that
+ * cannot be isolated or moved are left for the caller to notice.
+ */
+static int contig_migrate_range(unsigned long start, unsigned long end)
+{
+	unsigned long pfn;
+	struct page *page;
+	int nr = 0, ret;
+	LIST_HEAD(pages);
+
+	for (pfn = start; pfn < end; pfn++) {
+		if (!pfn_valid_within(pfn))
+			continue;
+		page = pfn_to_page(pfn);
+		if (!page_count(page) || !PageLRU(page))
+			continue;
+		if (isolate_lru_page(page))
+			continue;
+		list_add_tail(&page->lru, &pages);
+
+		if (++nr == CONTIG_MIGRATE_BATCH) {
+			/* failed pages are put back on the LRU */
+			ret = migrate_pages(&pages, contig_migrate_alloc, 0);
+			if (ret < 0)
+				return ret;
+			nr = 0;
+			if (fatal_signal_pending(current))
+				return -EINTR;
+		}
+	}
+	if (nr) {
+		ret = migrate_pages(&pages, contig_migrate_alloc, 0);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Take the free pages covering [start, end) off the free lists of their
+ * isolated pageblocks.  Returns the pfn after the last page taken, which
+ * may be beyond end, with *startp moved back to the first, or 0 if some
+ * page in the range is not free.
+ */
+static unsigned long contig_take_free_range(struct zone *zone,
+		unsigned long *startp, unsigned long end)
+{
+	unsigned long pfn, start = *startp;
+	unsigned long flags;
+	struct page *page;
+	int order, i;
+
+	spin_lock_irqsave(&zone->lock, flags);
+
+	/*
+	 * The free page start is in may begin before it, but not before its
+	 * pageblock, see __free_one_page()
+	 */
+	for (order = 0; order < MAX_ORDER; order++) {
+		pfn = start & ~((1UL << order) - 1);
+		page = pfn_to_page(pfn);
+		if (PageBuddy(page) && page_order(page) >= order) {
+			start = pfn;
+			break;
+		}
+	}
+
+	for (pfn = start; pfn < end; pfn += 1UL << page_order(page)) {
+		page = pfn_to_page(pfn);
+		if (!PageBuddy(page)) {
+			spin_unlock_irqrestore(&zone->lock, flags);
+			return 0;
+		}
+	}
+
+	for (pfn = start; pfn < end; pfn += 1UL << order) {
+		page = pfn_to_page(pfn);
+		order = page_order(page);
+		list_del(&page->lru);
+		rmv_page_order(page);
+		zone->free_area[order].nr_free--;
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+		for (i = 0; i < (1 << order); i++)
+			set_page_refcounted(page + i);
+		arch_alloc_page(page, order);
+		kernel_map_pages(page, 1 << order, 1);
+	}
+
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	*startp = start;
+	return pfn;
+}
+
+/**
+ * alloc_contig_range() -- allocate a range of physically contiguous pages
+ * @start:	first pfn of the range
+ * @end:	pfn after the last of the range
+ * @migratetype:	MIGRATE_CMA, the type of the range's pageblocks
+ *
+ * The pageblocks covering the range are isolated, the pages in use in it
+ * are migrated out and its free pages taken.  All must be in one zone.
+ * On success every page in the range has a reference count of one and is
+ * freed with free_contig_range().  Returns -EBUSY if some page could not
+ * be moved, or -EINTR on a fatal signal.  May sleep.
+ */
+int alloc_contig_range(unsigned long start, unsigned long end,
+		       int migratetype)
+{
+	struct zone *zone = page_zone(pfn_to_page(start));
+	unsigned long block_start, block_end, outer_start, outer_end;
+	int tries, ret;
+
+	block_start = start & ~(pageblock_nr_pages - 1);
+	block_end = ALIGN(end, pageblock_nr_pages);
+
+	ret = start_isolate_page_range(block_start, block_end, migratetype);
+	if (ret)
+		return ret;
+
+	ret = -EBUSY;
+	for (tries = 0; tries < CONTIG_RETRIES; tries++) {
+		migrate_prep();
+		ret = contig_migrate_range(start, end);
+		if (ret)
+			break;
+
+		/* pages just freed may still be on the pcp lists */
+		drain_all_pages();
+		outer_start = start;
+		outer_end = contig_take_free_range(zone, &outer_start, end);
+		if (outer_end)
+			break;
+
+		ret = -EBUSY;
+		cond_resched();
+	}
+
+	undo_isolate_page_range(block_start, block_end, migratetype);
+	if (ret)
+		return ret;
+
+	/* Give back what was taken around the range */
+	free_contig_range(outer_start, start - outer_start);
+	free_contig_range(end, outer_end - end);
+
+	return 0;
+}
+
+void free_contig_range(unsigned long pfn, unsigned long nr_pages)
+{
+	for (; nr_pages--; pfn++)
+		__free_page(pfn_to_page(pfn));
+}
+#endif /* CONFIG_CMA */
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * All pages in the range must be isolated before calling this.
@@ -24,6 +24,7 @@ __first_valid_page(unsigned long pfn, unsigned long nr_pages)
  * to be MIGRATE_ISOLATE.
  * @start_pfn: The lower PFN of the range to be isolated.
  * @end_pfn: The upper PFN of the range to be isolated.
+ * @migratetype: The migratetype the range has, restored on failure.
  *
  * Making page-allocation-type to be MIGRATE_ISOLATE means free pages in
  * the range will never be allocated. Any free pages and pages freed in the
@@ -33,7 +34,8 @@ __first_valid_page(unsigned long pfn, unsigned long nr_pages)
  * Returns 0 on success and -EBUSY if any part of range cannot be isolated.
  */
 int
-start_isolate_page_range(unsigned long start_pfn, unsigned long end_pfn)
+start_isolate_page_range(unsigned long start_pfn, unsigned long end_pfn,
+			 int migratetype)
 {
 	unsigned long pfn;
 	unsigned long undo_pfn;
@@ -56,16 +58,17 @@ undo:
 	for (pfn = start_pfn;
 	     pfn < undo_pfn;
 	     pfn += pageblock_nr_pages)
-		unset_migratetype_isolate(pfn_to_page(pfn));
+		unset_migratetype_isolate(pfn_to_page(pfn), migratetype);
 
 	return -EBUSY;
 }
 
 /*
- * Make isolated pages available again.
+ * Make isolated pages available again, as migratetype.
  */
 int
-undo_isolate_page_range(unsigned long start_pfn, unsigned long end_pfn)
+undo_isolate_page_range(unsigned long start_pfn, unsigned long end_pfn,
+			int migratetype)
 {
 	unsigned long pfn;
 	struct page *page;
@@ -77,7 +80,7 @@ undo_isolate_page_range(unsigned long start_pfn, unsigned long end_pfn)
 		page = __first_valid_page(pfn, pageblock_nr_pages);
 		if (!page || get_pageblock_migratetype(page) != MIGRATE_ISOLATE)
 			continue;
-		unset_migratetype_isolate(page);
+		unset_migratetype_isolate(page, migratetype);
 	}
 	return 0;
 }
@@ -44,6 +44,7 @@ struct address_space swapper_space = {
 	.tree_lock	= __SPIN_LOCK_UNLOCKED(swapper_space.tree_lock),
 	.a_ops		= &swap_aops,
 	.i_mmap_nonlinear = LIST_HEAD_INIT(swapper_space.i_mmap_nonlinear),
+	.shadow_list	= LIST_HEAD_INIT(swapper_space.shadow_list),
 	.backing_dev_info = &swap_backing_dev_info,
 };
 
@@ -181,6 +181,49 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Drop the shadow entries that reclaim left in [start, end], so that the
+ * radix tree nodes holding them go along with the pages they stood for.
+ */
+void clear_shadow_entries(struct address_space *mapping,
+			  pgoff_t start, pgoff_t end)
+{
+	unsigned long indices[PAGEVEC_SIZE];
+	void **slots[PAGEVEC_SIZE];
+	pgoff_t next = start;
+	unsigned int i, nr;
+
+	while (next <= end && mapping->nrshadows) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, next, PAGEVEC_SIZE);
+		/*
+		 * Note the shadows first: a delete may free the node that
+		 * the following slots are in.
+		 */
+		for (i = 0; i < nr; i++) {
+			void *entry = radix_tree_deref_slot(slots[i]);
+
+			if (indices[i] > end ||
+			    !radix_tree_exceptional_entry(entry))
+				slots[i] = NULL;
+		}
+		for (i = 0; i < nr; i++) {
+			if (!slots[i])
+				continue;
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			workingset_shadow_dec(mapping);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+		if (!nr)
+			break;
+		next = indices[nr - 1] + 1;
+		if (!next)
+			break;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -214,8 +257,15 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t next;
 	int i;
 
-	if (mapping->nrpages == 0)
-		return;
+	/*
+	 * Reclaim counts a shadow entry before it drops the page it
+	 * replaces, so look at the two counters the other way round.
+	 */
+	if (mapping->nrpages == 0) {
+		smp_rmb();
+		if (mapping->nrshadows == 0)
+			return;
+	}
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
 	end = (lend >> PAGE_CACHE_SHIFT);
@@ -287,6 +337,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		}
 		pagevec_release(&pvec);
 	}
+	clear_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
@@ -383,7 +434,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 		goto failed;
 
 	BUG_ON(page_has_private(page));
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 	page_cache_release(page);	/* pagecache ref */
@@ -40,6 +40,7 @@
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
 #include <linux/sysctl.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -139,6 +140,21 @@ static DECLARE_RWSEM(shrinker_rwsem);
 #define scanning_global_lru(sc)	(1)
 #endif
 
+/*
+ * The order lumpy reclaim works at.  With compaction, reclaim for a
+ * high-order allocation frees single pages in LRU order like any other,
+ * and compaction moves what is left together.  Lumpy reclaim instead
+ * frees the neighbours of each page it takes, however recently used.
+ */
+static inline int lumpy_order(struct scan_control *sc)
+{
+#ifdef CONFIG_COMPACTION
+	return 0;
+#else
+	return sc->order;
+#endif
+}
+
 static struct zone_reclaim_stat *get_reclaim_stat(struct zone *zone,
 						  struct scan_control *sc)
 {
@@ -429,9 +445,11 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 
 /*
  * Same as remove_mapping, but if the page is removed from the mapping, it
- * gets returned with a refcount of 0.
+ * gets returned with a refcount of 0.  A page cache page that is being
+ * @reclaimed leaves a shadow entry behind for refault detection.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -476,7 +494,11 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		spin_unlock_irq(&mapping->tree_lock);
 		swapcache_free(swap, page);
 	} else {
-		__remove_from_page_cache(page);
+		void *shadow = NULL;
+
+		if (reclaimed && page_is_file_cache(page))
+			shadow = workingset_eviction(mapping, page);
+		__remove_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 	}
@@ -496,7 +518,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -649,7 +671,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * If page which have PG_mlocked lost isoltation race,
 		 * try_to_unmap moves it to unevictable list
 		 */
-		if (sc->order <= PAGE_ALLOC_COSTLY_ORDER &&
+		if (lumpy_order(sc) <= PAGE_ALLOC_COSTLY_ORDER &&
 					referenced && page_mapping_inuse(page)
 					&& !(vm_flags & VM_LOCKED))
 			goto activate_locked;
@@ -686,7 +708,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		}
 
 		if (PageDirty(page)) {
-			if (sc->order <= PAGE_ALLOC_COSTLY_ORDER && referenced)
+			if (lumpy_order(sc) <= PAGE_ALLOC_COSTLY_ORDER &&
+			    referenced)
 				goto keep_locked;
 			if (!may_enter_fs)
 				goto keep_locked;
@@ -758,7 +781,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -804,11 +827,6 @@ keep:
 	return nr_reclaimed;
 }
 
-/* LRU Isolation modes. */
-#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
-#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
-#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
-
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -1154,9 +1172,9 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 	 *
 	 * We use the same threshold as pageout congestion_wait below.
 	 */
-	if (sc->order > PAGE_ALLOC_COSTLY_ORDER)
+	if (lumpy_order(sc) > PAGE_ALLOC_COSTLY_ORDER)
 		lumpy_reclaim = 1;
-	else if (sc->order && priority < DEF_PRIORITY - 2)
+	else if (lumpy_order(sc) && priority < DEF_PRIORITY - 2)
 		lumpy_reclaim = 1;
 
 	pagevec_init(&pvec, 1);
@@ -1175,7 +1193,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		unsigned long nr_file;
 
 		nr_taken = sc->isolate_pages(sc->swap_cluster_max,
-			     &page_list, &nr_scan, sc->order, mode,
+			     &page_list, &nr_scan, lumpy_order(sc), mode,
 				zone, sc->mem_cgroup, 0, file);
 
 		if (scanning_global_lru(sc)) {
@@ -1360,7 +1378,8 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 
 	lru_add_drain();
 	spin_lock_irq(&zone->lru_lock);
-	nr_taken = sc->isolate_pages(nr_pages, &l_hold, &pgscanned, sc->order,
+	nr_taken = sc->isolate_pages(nr_pages, &l_hold, &pgscanned,
+					lumpy_order(sc),
 					ISOLATE_ACTIVE, zone,
 					sc->mem_cgroup, 1, file);
 	/*
@@ -1947,6 +1966,22 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem_cont,
 }
 #endif
 
+/*
+ * Is the zone above the watermark for an allocation of this order?  With
+ * compaction, a zone that has the free pages but not in a block of that
+ * order counts as balanced: kcompactd puts the block together afterwards,
+ * rather than kswapd reclaiming more and more pages hoping one turns up.
+ */
+static bool zone_balanced(struct zone *zone, int order, unsigned long mark,
+			  int classzone_idx)
+{
+	if (zone_watermark_ok(zone, order, mark, classzone_idx, 0))
+		return true;
+
+	return order && zone_watermark_ok(zone, 0, mark, classzone_idx, 0) &&
+		compaction_suitable(zone, order) != COMPACT_SKIPPED;
+}
+
 /*
  * For kswapd, balance_pgdat() will work across all this node's zones until
  * they are all at high_wmark_pages(zone).
@@ -2033,8 +2068,8 @@ loop_again:
 				shrink_active_list(SWAP_CLUSTER_MAX, zone,
 							&sc, priority, 0);
 
-			if (!zone_watermark_ok(zone, order,
-					high_wmark_pages(zone), 0, 0)) {
+			if (!zone_balanced(zone, order,
+					high_wmark_pages(zone), 0)) {
 				end_zone = i;
 				break;
 			}
@@ -2069,8 +2104,8 @@ loop_again:
 					priority != DEF_PRIORITY)
 				continue;
 
-			if (!zone_watermark_ok(zone, order,
-					high_wmark_pages(zone), end_zone, 0))
+			if (!zone_balanced(zone, order,
+					high_wmark_pages(zone), end_zone))
 				all_zones_ok = 0;
 			temp_priority[i] = priority;
 			sc.nr_scanned = 0;
@@ -2088,8 +2123,8 @@ loop_again:
 			 * We put equal pressure on every zone, unless one
 			 * zone has way too many pages free already.
 			 */
-			if (!zone_watermark_ok(zone, order,
-					8*high_wmark_pages(zone), end_zone, 0))
+			if (!zone_balanced(zone, order,
+					8*high_wmark_pages(zone), end_zone))
 				shrink_zone(priority, zone, &sc);
 			reclaim_state->reclaimed_slab = 0;
 			nr_slab = shrink_slab(sc.nr_scanned, GFP_KERNEL,
@@ -2239,6 +2274,9 @@ static int kswapd(void *p)
 			 * balance_pgdat after returning from the refrigerator
 			 */
 			balance_pgdat(pgdat, order);
+
+			/* have the high-order block put together */
+			wakeup_kcompactd(pgdat, order);
 		}
 	}
 
@@ -0,0 +1,257 @@
+/*
+ * linux/mm/workingset.c
+ *
+ * Workingset detection: tell a page that is being faulted back in soon
+ * after reclaim took it from a page that is only used once.
+ *
+ * New file pages start out on the inactive list and only get promoted
+ * to the active list when they are referenced again while they are on
+ * it.  When the workingset is larger than the inactive list, its pages
+ * are reclaimed before their second access and never get to be
+ * promoted: they keep being read back in from storage, which is known
+ * as thrashing, while the active list holds on to pages that may not
+ * be used any more.
+ *
+ * To see that, each zone counts the pages that leave its inactive list
+ * either way, by reclaim or by activation, in zone->inactive_age.  When
+ * a page is reclaimed, that count is stored in a shadow entry that takes
+ * the place of the page in the page cache radix tree.  If the page is
+ * faulted back in, the difference between the count then and the one in
+ * the shadow entry - the refault distance - is how many more slots the
+ * inactive list would have needed for the page to still be there when
+ * it was accessed again.
+ *
+ * The active list holds NR_ACTIVE_FILE pages that could be given to the
+ * inactive list instead, so a page with a refault distance up to that
+ * size would have been kept, and activated, in a workingset of the same
+ * size: such a page is put on the active list right away, where it has
+ * to compete with the other active pages.  Pages that are refaulted from
+ * further away would not have fit in memory anyway and go on the inactive
+ * list as usual.
+ *
+ * Shadow entries are left in the radix tree until the page is faulted
+ * back in or the file is truncated, so the radix tree nodes holding them
+ * could pile up in inodes that stay cached.  Only as many shadows as
+ * there are file pages on the LRU lists are worth keeping, since the
+ * refault distance of an older one is larger than the active list can
+ * make room for.  Beyond that, a shrinker drops the shadow entries of the
+ * mappings that have held them the longest.
+ *
+ * Based on the workingset detection patches by Johannes Weiner.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/pagemap.h>
+#include <linux/mm_inline.h>
+#include "internal.h"
+
+/*
+ * The shadow entry packs the eviction count of the zone along with the
+ * node and zone index, above the radix tree's exceptional entry bits.
+ * Whatever is left of the count wraps around; refault distances are
+ * taken modulo that width, which is still far more than any zone has
+ * pages.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction, refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	/*
+	 * The shrinker pins a mapping through its host inode, so a private
+	 * mapping without one would keep its shadows until it is truncated.
+	 */
+	if (!mapping->host)
+		return NULL;
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Mappings holding shadow entries, in the order they got their first,
+ * and the number of shadow entries in all of them.  A mapping is on the
+ * list whenever it holds shadows, except while the shrinker drops them.
+ */
+static LIST_HEAD(shadow_mappings);
+static DEFINE_SPINLOCK(shadow_mappings_lock);
+static atomic_long_t nr_shadows = ATOMIC_LONG_INIT(0);
+
+/**
+ * workingset_shadow_inc - account a shadow entry stored in a mapping
+ * @mapping: the address space, whose tree_lock is held
+ */
+void workingset_shadow_inc(struct address_space *mapping)
+{
+	mapping->nrshadows++;
+	atomic_long_inc(&nr_shadows);
+	if (list_empty(&mapping->shadow_list)) {
+		spin_lock(&shadow_mappings_lock);
+		list_add_tail(&mapping->shadow_list, &shadow_mappings);
+		spin_unlock(&shadow_mappings_lock);
+	}
+}
+
+/**
+ * workingset_shadow_dec - account a shadow entry removed from a mapping
+ * @mapping: the address space, whose tree_lock is held
+ */
+void workingset_shadow_dec(struct address_space *mapping)
+{
+	mapping->nrshadows--;
+	atomic_long_dec(&nr_shadows);
+	if (!mapping->nrshadows && !list_empty(&mapping->shadow_list)) {
+		spin_lock(&shadow_mappings_lock);
+		list_del_init(&mapping->shadow_list);
+		spin_unlock(&shadow_mappings_lock);
+	}
+}
+
+static long shadows_excess(void)
+{
+	return atomic_long_read(&nr_shadows) -
+		(long)(global_page_state(NR_ACTIVE_FILE) +
+		       global_page_state(NR_INACTIVE_FILE));
+}
+
+/*
+ * Take the mapping that has held shadows the longest off the list, with
+ * a reference on its host inode.  The list and tree locks keep it from
+ * going away meanwhile: it is only freed once truncation has dropped its
+ * shadows and taken it off the list under them.
+ */
+static struct inode *shadow_mapping_isolate(struct address_space **mappingp)
+{
+	struct address_space *mapping;
+	struct inode *inode = NULL;
+
+	spin_lock_irq(&shadow_mappings_lock);
+	list_for_each_entry(mapping, &shadow_mappings, shadow_list) {
+		if (!spin_trylock(&mapping->tree_lock))
+			continue;
+		inode = igrab(mapping->host);
+		if (inode) {
+			list_del_init(&mapping->shadow_list);
+			*mappingp = mapping;
+		}
+		spin_unlock(&mapping->tree_lock);
+		if (inode)
+			break;
+	}
+	spin_unlock_irq(&shadow_mappings_lock);
+
+	return inode;
+}
+
+static int shrink_shadows(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct address_space *mapping;
+	struct inode *inode;
+	long excess = shadows_excess();
+
+	if (nr_to_scan && excess > 0) {
+		/* iput() may have to evict the inode */
+		if (!(gfp_mask & __GFP_FS))
+			return -1;
+
+		while (nr_to_scan > 0 && excess > 0) {
+			inode = shadow_mapping_isolate(&mapping);
+			if (!inode)
+				break;
+			nr_to_scan -= mapping->nrshadows;
+			clear_shadow_entries(mapping, 0, ~0UL);
+			iput(inode);
+			excess = shadows_excess();
+		}
+	}
+
+	return excess > 0 ? min_t(long, excess, INT_MAX) : 0;
+}
+
+static struct shrinker shadow_shrinker = {
+	.shrink = shrink_shadows,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init);